@@ -0,0 +1,170 @@
+#!/usr/bin/env python3
+"""Convert an FSEMU_PERFORMANCE_LOG file to Chrome trace JSON.
+
+The output can be loaded in chrome://tracing or https://ui.perfetto.dev.
+
+    FSEMU_PERFORMANCE_LOG=perf.bin fs-uae ...
+    contrib/fsemu-performance-trace.py perf.bin perf.json
+
+See libfsemu/src/emu/performance.c for the binary format.
+"""
+
+import json
+import sys
+
+MAGIC = b"FSEMUPRF"
+VERSION = 1
+
+
+class LogError(Exception):
+    pass
+
+
+class Reader:
+    def __init__(self, data):
+        self.data = data
+        self.pos = 0
+
+    def eof(self):
+        return self.pos >= len(self.data)
+
+    def byte(self):
+        if self.pos >= len(self.data):
+            raise LogError("Truncated record")
+        value = self.data[self.pos]
+        self.pos += 1
+        return value
+
+    def bytes(self, n):
+        if self.pos + n > len(self.data):
+            raise LogError("Truncated record")
+        value = self.data[self.pos : self.pos + n]
+        self.pos += n
+        return value
+
+    def varint(self):
+        result = 0
+        shift = 0
+        while True:
+            b = self.byte()
+            result |= (b & 0x7F) << shift
+            if not b & 0x80:
+                return result
+            shift += 7
+
+    def zigzag(self):
+        v = self.varint()
+        return (v >> 1) ^ -(v & 1)
+
+
+def read_events(data):
+    """Yield (type, thread, series, time_us, value) tuples.
+
+    Thread name records are yielded with type "N", the name as series and
+    time and value set to None.
+    """
+    if data[: len(MAGIC)] != MAGIC:
+        raise LogError("Not an FSEMU performance log")
+    reader = Reader(data)
+    reader.pos = len(MAGIC)
+    version = reader.byte()
+    if version != VERSION:
+        raise LogError("Unsupported version {}".format(version))
+    time = 0
+    while not reader.eof():
+        start = reader.pos
+        try:
+            kind = chr(reader.byte())
+            thread = reader.varint()
+            if kind == "N":
+                length = reader.varint()
+                name = reader.bytes(length).decode("UTF-8", "replace")
+                yield kind, thread, name, None, None
+                continue
+            if kind not in "CBED":
+                raise LogError(
+                    "Unknown record type {!r} at {}".format(kind, start)
+                )
+            series = reader.bytes(4).decode("ASCII", "replace")
+            time += reader.zigzag()
+            value = reader.zigzag()
+        except LogError:
+            if reader.pos >= len(reader.data):
+                # Log was cut off in the middle of a record (still being
+                # written, or the process was killed).
+                return
+            raise
+        yield kind, thread, series, time, value
+
+
+def convert(data):
+    events = []
+    for kind, thread, series, time, value in read_events(data):
+        if kind == "N":
+            events.append(
+                {
+                    "name": "thread_name",
+                    "ph": "M",
+                    "pid": 1,
+                    "tid": thread,
+                    "args": {"name": series},
+                }
+            )
+        elif kind == "C":
+            events.append(
+                {
+                    "name": series,
+                    "ph": "C",
+                    "ts": time,
+                    "pid": 1,
+                    "tid": thread,
+                    "args": {series: value},
+                }
+            )
+        elif kind in "BE":
+            events.append(
+                {
+                    "name": series,
+                    "ph": kind,
+                    "ts": time,
+                    "pid": 1,
+                    "tid": thread,
+                }
+            )
+        else:
+            events.append(
+                {
+                    "name": "dropped {} events".format(value),
+                    "ph": "i",
+                    "s": "t",
+                    "ts": time,
+                    "pid": 1,
+                    "tid": thread,
+                }
+            )
+    # Records are grouped per thread when flushed, viewers want them sorted
+    events.sort(key=lambda event: event.get("ts", -1))
+    return {"traceEvents": events, "displayTimeUnit": "ms"}
+
+
+def main():
+    if len(sys.argv) not in (2, 3):
+        print("Usage: {} LOG [OUTPUT.json]".format(sys.argv[0]))
+        return 1
+    with open(sys.argv[1], "rb") as f:
+        data = f.read()
+    try:
+        trace = convert(data)
+    except LogError as e:
+        print("Error: {}".format(e), file=sys.stderr)
+        return 1
+    if len(sys.argv) == 3:
+        with open(sys.argv[2], "w") as f:
+            json.dump(trace, f)
+    else:
+        json.dump(trace, sys.stdout)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -9,6 +9,7 @@
 #include "fsemu-audiobuffer.h"
 #include "fsemu-axis.h"
 #include "fsemu-background.h"
+#include "fsemu-benchmark.h"
 #include "fsemu-button.h"
 #include "fsemu-color.h"
 #include "fsemu-common.h"
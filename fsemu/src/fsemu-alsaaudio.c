@@ -10,6 +10,7 @@
 #ifdef FSEMU_ALSA
 
 #include <alsa/asoundlib.h>
+#include <fsemu/performance.h>
 #include <errno.h>
 #include <poll.h>
 #include <stdio.h>
@@ -38,14 +39,17 @@ int playback_callback(snd_pcm_sframes_t nframes)
 }
 #endif
 
-static void fsemu_alsaaudio_handle_underrun(void)
+// Called when ALSA reports an xrun. missing_bytes is the data that could not
+// be delivered in time, or 0 when ALSA did not say how much.
+static void fsemu_alsaaudio_handle_underrun(int missing_bytes)
 {
     // fsemu_audio_log_inflight_estimate();
     fsemu_audio_log("----------\n");
+    fsemu_audiobuffer_register_underrun(missing_bytes);
     if (fsemu_audio_log_buffer_stats() <= 1) {
         // We ran out of data for realz (probably), so add some silence to
         // the buffer to aid in recovery.
-        fsemu_audiobuffer.add_silence = 1;
+        __atomic_store_n(&fsemu_audiobuffer.add_silence, 1, __ATOMIC_RELEASE);
 
         // FIXME: Get definitive information about underrun from ALSA ?
         fsemu_audio_register_underrun();
@@ -63,7 +67,7 @@ static int fsemu_alsaaudio_write(void *buffer, int bytes)
     if ((err = snd_pcm_writei(playback_handle, buffer, bytes / 4)) < 0) {
         fprintf(stderr, "write failed (%s)\n", snd_strerror(err));
 
-        fsemu_alsaaudio_handle_underrun();
+        fsemu_alsaaudio_handle_underrun(bytes);
 
         if (err = snd_pcm_recover(playback_handle, err, 0)) {
             fprintf(stderr, "snd_pcm_recover (%s)\n", snd_strerror(err));
@@ -107,17 +111,19 @@ static void fsemu_alsaaudio_callback(snd_pcm_sframes_t want_frames)
         // int want = fsemu_audio_frequency() * 50 / 1000 * 4;
         int want = 8192;
         // int want = 0;
-        fsemu_audiobuffer.read = fsemu_audiobuffer.write - want;
-        if (fsemu_audiobuffer.read < fsemu_audiobuffer.data) {
-            fsemu_audiobuffer.read += fsemu_audiobuffer.size;
+        uint8_t *reset = fsemu_audiobuffer_write_acquire() - want;
+        if (reset < fsemu_audiobuffer.data) {
+            reset += fsemu_audiobuffer.size;
         }
+        fsemu_audiobuffer_read_release(reset);
     }
     // -----------------------------------------------------------------------
 
     int err;
 
-    uint8_t volatile *read = fsemu_audiobuffer.read;
-    uint8_t volatile *write = fsemu_audiobuffer.write;
+    // The read pointer is ours, the write pointer belongs to the producer.
+    uint8_t *read = fsemu_audiobuffer.read;
+    uint8_t *write = fsemu_audiobuffer_write_acquire();
 
     int bytes = 0;
     int bytes_written = 0;
@@ -170,12 +176,13 @@ static void fsemu_alsaaudio_callback(snd_pcm_sframes_t want_frames)
         buffered_bytes, now, (void *) read, (void *) write);
 
     last_time = now;
-    fsemu_audiobuffer.read = read;
+    fsemu_audiobuffer_read_release(read);
 }
 
 static void *fsemu_alsaaudio_thread(void *data)
 {
     fsemu_thread_set_priority();
+    fsemu_performance_set_thread_name("audio");
 
     snd_pcm_sframes_t frames_to_deliver;
     int err;
@@ -187,7 +194,7 @@ static void *fsemu_alsaaudio_thread(void *data)
         if ((err = snd_pcm_wait(playback_handle, 1000)) < 0) {
             fprintf(stderr, "poll failed %d (%s)\n", err, strerror(err));
 
-            fsemu_alsaaudio_handle_underrun();
+            fsemu_alsaaudio_handle_underrun(0);
 
             if (err = snd_pcm_recover(playback_handle, err, 0)) {
                 fprintf(stderr, "snd_pcm_recover (%s)\n", snd_strerror(err));
@@ -209,7 +216,7 @@ static void *fsemu_alsaaudio_thread(void *data)
                         err);
             }
 
-            fsemu_alsaaudio_handle_underrun();
+            fsemu_alsaaudio_handle_underrun(0);
 
             if (err = snd_pcm_recover(playback_handle, err, 0)) {
                 fprintf(stderr, "snd_pcm_recover (%s)\n", snd_strerror(err));
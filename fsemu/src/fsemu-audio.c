@@ -189,8 +189,7 @@ static void fsemu_audio_update_stats(void)
     fsemu_audio.underruns = 0;
     fsemu_audio_unlock();
 
-    // uint8_t volatile *read = fsemu_audiobuffer.read;
-    uint8_t volatile *write = fsemu_audiobuffer.write;
+    uint8_t *write = fsemu_audiobuffer_write_acquire();
 
     intptr_t buffer_fill;
     if (sent_write >= sent_read) {
@@ -344,8 +343,7 @@ void fsemu_audio_register_underrun(void)
     fsemu_audio_unlock();
 }
 
-void fsemu_audio_update_min_fill(uint8_t volatile *read,
-                                 uint8_t volatile *write)
+void fsemu_audio_update_min_fill(uint8_t *read, uint8_t *write)
 {
     int bytes;
     if (write >= read) {
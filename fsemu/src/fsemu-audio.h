@@ -79,8 +79,7 @@ void fsemu_audio_register_underrun(void);
 
 void fsemu_audio_end_frame(void);
 
-void fsemu_audio_update_min_fill(uint8_t volatile *read,
-                                 uint8_t volatile *write);
+void fsemu_audio_update_min_fill(uint8_t *read, uint8_t *write);
 
 
 // ----------------------------------------------------------------------------
@@ -3,9 +3,20 @@
 
 #include "fsemu-audio.h"
 #include "fsemu-frame.h"
+#include "fsemu-option.h"
+#include "fsemu-options.h"
 #include "fsemu-time.h"
 #include "fsemu-util.h"
 
+#include <fsemu/performance.h>
+
+#include <math.h>
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 #ifdef FSEMU_SAMPLERATE
 #include <samplerate.h>
 #endif
@@ -18,32 +29,257 @@
 #define MAX(a, b) (((a) > (b)) ? (a) : (b))
 #endif
 
-/*
-int fsemu_audiobuffer.size;
-volatile uint8_t *fsemu_audiobuffer;
-volatile uint8_t *fsemu_audiobuffer.end;
-volatile uint8_t *volatile fsemu_audiobuffer.read;
-volatile uint8_t *volatile fsemu_audiobuffer.write;
-*/
+// Log a telemetry summary this often (in frames).
+#define FSEMU_AUDIOBUFFER_STATS_INTERVAL 500
+
 fsemu_audiobuffer_t fsemu_audiobuffer;
 
 static struct {
     int bytes_for_frame;
 #ifdef FSEMU_SAMPLERATE
     SRC_STATE *src_state;
+    int src_quality;
     double adjustment;
-    float src_in[8192];   // FIXME: suitable size?
-    float src_out[8192];  // FIXME: suitable size?
+    // Scratch buffers, grown on demand.
+    float *src_in;
+    int src_in_size;
+    float *src_out;
+    int src_out_size;
 #endif
+    // Telemetry. Underruns are counted by the consumer, the rest by the
+    // producer.
+    int underruns;
+    int underrun_bytes;
+    int overruns;
+    int min_fill;
+    int max_fill;
+    int64_t resample_us;
+    int stats_frames;
 } fsemu_audiobuffer_extra;
 
+// ----------------------------------------------------------------------------
+// Sample conversion
+// ----------------------------------------------------------------------------
+
+void fsemu_audiobuffer_s16_to_float(const int16_t *in, float *out, int n)
+{
+    int i = 0;
+#if defined(__SSE2__)
+    const __m128 scale = _mm_set1_ps(1.0f / 32768.0f);
+    for (; i + 8 <= n; i += 8) {
+        __m128i v = _mm_loadu_si128((const __m128i *) (in + i));
+        // Sign-extend by unpacking into the high half and shifting down.
+        __m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16);
+        __m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16);
+        _mm_storeu_ps(out + i, _mm_mul_ps(_mm_cvtepi32_ps(lo), scale));
+        _mm_storeu_ps(out + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(hi), scale));
+    }
+#endif
+    for (; i < n; i++) {
+        out[i] = in[i] * (1.0f / 32768.0f);
+    }
+}
+
+void fsemu_audiobuffer_float_to_s16(const float *in, int16_t *out, int n)
+{
+    int i = 0;
+#if defined(__SSE2__)
+    const __m128 scale = _mm_set1_ps(32768.0f);
+    const __m128 lo_limit = _mm_set1_ps(-32768.0f);
+    const __m128 hi_limit = _mm_set1_ps(32767.0f);
+    for (; i + 8 <= n; i += 8) {
+        __m128 a = _mm_mul_ps(_mm_loadu_ps(in + i), scale);
+        __m128 b = _mm_mul_ps(_mm_loadu_ps(in + i + 4), scale);
+        a = _mm_min_ps(_mm_max_ps(a, lo_limit), hi_limit);
+        b = _mm_min_ps(_mm_max_ps(b, lo_limit), hi_limit);
+        // Round to nearest and pack with signed saturation.
+        __m128i v = _mm_packs_epi32(_mm_cvtps_epi32(a), _mm_cvtps_epi32(b));
+        _mm_storeu_si128((__m128i *) (out + i), v);
+    }
+#endif
+    for (; i < n; i++) {
+        float v = in[i] * 32768.0f;
+        v = v < -32768.0f ? -32768.0f : (v > 32767.0f ? 32767.0f : v);
+        out[i] = (int16_t) lrintf(v);
+    }
+}
+
+// ----------------------------------------------------------------------------
+// Ring buffer
+// ----------------------------------------------------------------------------
+
+static inline int fsemu_audiobuffer_bytes_between(uint8_t *read,
+                                                  uint8_t *write)
+{
+    if (write >= read) {
+        return write - read;
+    }
+    return fsemu_audiobuffer.size - (read - write);
+}
+
+// Producer side: reserve room for up to size bytes at the write pointer.
+// The room is returned as up to two spans because of the wrap-around. The
+// returned byte count may be less than requested if the ring is full.
+static int fsemu_audiobuffer_reserve(int size,
+                                     uint8_t **span1,
+                                     int *span1_size,
+                                     uint8_t **span2,
+                                     int *span2_size)
+{
+    uint8_t *read = fsemu_audiobuffer_read_acquire();
+    uint8_t *write = fsemu_audiobuffer.write;
+    int space = fsemu_audiobuffer.size - 4 -
+                fsemu_audiobuffer_bytes_between(read, write);
+    if (size > space) {
+        fsemu_audiobuffer_extra.overruns += 1;
+        size = space & ~3;
+    }
+    int first = MIN(size, (int) (fsemu_audiobuffer.end - write));
+    *span1 = write;
+    *span1_size = first;
+    *span2 = fsemu_audiobuffer.data;
+    *span2_size = size - first;
+    return size;
+}
+
+// Producer side: publish size bytes previously reserved.
+static void fsemu_audiobuffer_commit(int size)
+{
+    uint8_t *write = fsemu_audiobuffer.write + size;
+    if (write >= fsemu_audiobuffer.end) {
+        write -= fsemu_audiobuffer.size;
+    }
+    fsemu_audiobuffer_write_release(write);
+}
+
+static void fsemu_audiobuffer_write_bytes(const uint8_t *data, int size)
+{
+    uint8_t *span1, *span2;
+    int size1, size2;
+    size = fsemu_audiobuffer_reserve(size, &span1, &size1, &span2, &size2);
+    memcpy(span1, data, size1);
+    if (size2) {
+        memcpy(span2, data + size1, size2);
+    }
+    fsemu_audiobuffer_commit(size);
+}
+
+#ifdef FSEMU_SAMPLERATE
+
+static void fsemu_audiobuffer_write_float(const float *data, int samples)
+{
+    uint8_t *span1, *span2;
+    int size1, size2;
+    int size = fsemu_audiobuffer_reserve(
+        samples * 2, &span1, &size1, &span2, &size2);
+    fsemu_audiobuffer_float_to_s16(data, (int16_t *) span1, size1 / 2);
+    if (size2) {
+        fsemu_audiobuffer_float_to_s16(
+            data + size1 / 2, (int16_t *) span2, size2 / 2);
+    }
+    fsemu_audiobuffer_commit(size);
+}
+
+static float *fsemu_audiobuffer_scratch(float *buffer, int *size, int want)
+{
+    if (want > *size) {
+        // Round up generously so we do not reallocate every frame.
+        *size = (want + 4095) & ~4095;
+        buffer = (float *) realloc(buffer, *size * sizeof(float));
+    }
+    return buffer;
+}
+
+static const struct {
+    const char *name;
+    int converter;
+} fsemu_audiobuffer_qualities[] = {
+    {"best", SRC_SINC_BEST_QUALITY},
+    {"medium", SRC_SINC_MEDIUM_QUALITY},
+    {"fastest", SRC_SINC_FASTEST},
+    {"linear", SRC_LINEAR},
+    {"zoh", SRC_ZERO_ORDER_HOLD},
+};
+
+// Returns the libsamplerate converter to use, or -1 when resampling has
+// been turned off with audio_resample_quality = none.
+static int fsemu_audiobuffer_read_quality(void)
+{
+    const char *quality = fsemu_option_const_string_default(
+        FSEMU_OPTION_AUDIO_RESAMPLE_QUALITY, "best");
+    if (strcmp(quality, "none") == 0) {
+        return -1;
+    }
+    for (int i = 0; i < (int) (sizeof(fsemu_audiobuffer_qualities) /
+                               sizeof(fsemu_audiobuffer_qualities[0]));
+         i++) {
+        if (strcmp(quality, fsemu_audiobuffer_qualities[i].name) == 0) {
+            return fsemu_audiobuffer_qualities[i].converter;
+        }
+    }
+    fsemu_audio_log_warning("Unknown resample quality '%s'\n", quality);
+    return SRC_SINC_BEST_QUALITY;
+}
+
+static void fsemu_audiobuffer_resample(const int16_t *data, int frames)
+{
+    int64_t t = fsemu_time_us();
+    int channels = 2;
+
+    fsemu_audiobuffer_extra.src_in =
+        fsemu_audiobuffer_scratch(fsemu_audiobuffer_extra.src_in,
+                                  &fsemu_audiobuffer_extra.src_in_size,
+                                  frames * channels);
+    // The ratio is kept within 0.5..1.5 by the PID controller, so twice the
+    // input plus some slack is always enough for one pass.
+    int out_frames = frames * 2 + 64;
+    fsemu_audiobuffer_extra.src_out =
+        fsemu_audiobuffer_scratch(fsemu_audiobuffer_extra.src_out,
+                                  &fsemu_audiobuffer_extra.src_out_size,
+                                  out_frames * channels);
+
+    fsemu_audiobuffer_s16_to_float(
+        data, fsemu_audiobuffer_extra.src_in, frames * channels);
+
+    SRC_DATA src_data;
+    src_data.data_in = fsemu_audiobuffer_extra.src_in;
+    src_data.input_frames = frames;
+    src_data.src_ratio = 1.0 + fsemu_audiobuffer_extra.adjustment;
+    src_data.end_of_input = 0;
+    while (src_data.input_frames > 0) {
+        src_data.data_out = fsemu_audiobuffer_extra.src_out;
+        src_data.output_frames = out_frames;
+        if (src_process(fsemu_audiobuffer_extra.src_state, &src_data) != 0) {
+            break;
+        }
+        fsemu_audiobuffer_write_float(fsemu_audiobuffer_extra.src_out,
+                                      src_data.output_frames_gen * channels);
+        if (src_data.input_frames_used == 0 &&
+            src_data.output_frames_gen == 0) {
+            break;
+        }
+        src_data.data_in += src_data.input_frames_used * channels;
+        src_data.input_frames -= src_data.input_frames_used;
+    }
+
+    fsemu_audiobuffer_extra.resample_us += fsemu_time_us() - t;
+}
+
+#endif  // FSEMU_SAMPLERATE
+
 void fsemu_audiobuffer_init(void)
 {
 #ifdef FSEMU_SAMPLERATE
     int channels = 2;
     int err;
-    fsemu_audiobuffer_extra.src_state =
-        src_new(SRC_SINC_BEST_QUALITY, channels, &err);
+    fsemu_audiobuffer_extra.src_quality = fsemu_audiobuffer_read_quality();
+    if (fsemu_audiobuffer_extra.src_quality >= 0) {
+        fsemu_audio_log_info(
+            "Resampler: %s\n",
+            src_get_name(fsemu_audiobuffer_extra.src_quality));
+        fsemu_audiobuffer_extra.src_state =
+            src_new(fsemu_audiobuffer_extra.src_quality, channels, &err);
+    }
 #endif
 
     // 1 second ring buffer (2 channels, 2 bytes per sample)
@@ -63,23 +299,13 @@ void fsemu_audiobuffer_init(void)
 
 void fsemu_audiobuffer_clear(void)
 {
-#if 1
-    for (int i = 0; i < fsemu_audiobuffer.size; i++) {
-        fsemu_audiobuffer.data[i] = 0;
-    }
-#else
-    memset((void *) fsemu_audiobuffer.data, 0, fsemu_audiobuffer.size);
-#endif
+    memset(fsemu_audiobuffer.data, 0, fsemu_audiobuffer.size);
 }
 
 int fsemu_audiobuffer_fill(void)
 {
-    uint8_t volatile *read = fsemu_audiobuffer.read;
-    uint8_t volatile *write = fsemu_audiobuffer.write;
-    if (write >= read) {
-        return write - read;
-    }
-    return (fsemu_audiobuffer.end - read) + (write - fsemu_audiobuffer.data);
+    return fsemu_audiobuffer_bytes_between(fsemu_audiobuffer_read_acquire(),
+                                           fsemu_audiobuffer_write_acquire());
 }
 
 int fsemu_audiobuffer_fill_ms(void)
@@ -94,148 +320,75 @@ int64_t fsemu_audiobuffer_fill_us(void)
     return frames * 1000000LL / fsemu_audio_frequency();
 }
 
-#if 0
-static void fsemu_audiobuffer_update_2(const void *data, int size)
-{
-    // int add_silence = fsemu_audiobuffer.add_silence;
-    // if (add_silence) {
-    //     fsemu_audiobuffer.add_silence = 0;
-    //     fsemu_audiobuffer_write_silence_ms(add_silence);
-    // }
-
-#if 0
-    int buffer_bytes = fsemu_audiobuffer_fill();
-    int buffer_frames = buffer_bytes / 4;
-    int buffer_ms = buffer_frames * 1000 / fsemu_audio_frequency();
-    // fsemu_audio_log("[FSE] %2d ms / %4d B + %4d B\n", buffer_ms,
-    // buffer_bytes, size);
-#endif
-
-    ptrdiff_t available = fsemu_audiobuffer.end - fsemu_audiobuffer.write;
-    if (available < size) {
-        memcpy((void *) fsemu_audiobuffer.write, data, available);
-        fsemu_audiobuffer.write = fsemu_audiobuffer.data;
-        data += available;
-        size -= available;
-    }
-    if (size) {
-        memcpy((void *) fsemu_audiobuffer.write, data, size);
-        fsemu_audiobuffer.write += size;
-    }
-}
-#endif
-
 void fsemu_audiobuffer_update(const void *void_data, int size)
 {
     // Casting to char pointer to be able to do byte pointer arithmetic.
     const uint8_t *data = (const uint8_t *) void_data;
 
     fsemu_audiobuffer_extra.bytes_for_frame += size;
+    fsemu_performance_log("APSH", size);
 
-    int add_silence = fsemu_audiobuffer.add_silence;
+    int add_silence = __atomic_exchange_n(
+        &fsemu_audiobuffer.add_silence, 0, __ATOMIC_ACQ_REL);
     if (add_silence) {
-        fsemu_audiobuffer.add_silence = 0;
         fsemu_audiobuffer_write_silence_ms(add_silence);
     }
 
 #ifdef FSEMU_SAMPLERATE
-    bool use_samplerate = true;
-    if (use_samplerate) {
-        // ptrdiff_t available = fsemu_audiobuffer.end -
-        // fsemu_audiobuffer.write;
-
-        int samples = size / 2;
-        int frames = samples / 2;
-        // int16_t *intdata = data;
-        // int16_t *intdata_p = intdata;
-        float *floatdata = fsemu_audiobuffer_extra.src_in;
-        // float *floatdata_p = floatdata;
-        /*
-        for (int i = 0; i < samples; i++) {
-            *floatdata_p = *intdata_p / 32
-        }
-        */
-        src_short_to_float_array((const short *) data, floatdata, samples);
-
-        SRC_DATA src_data;
-        // data_in       : A pointer to the input data samples.
-        // input_frames  : The number of frames of data pointed to by data_in.
-        // data_out      : A pointer to the output data samples.
-        // output_frames : Maximum number of frames pointer to by data_out.
-        // src_ratio     : Equal to output_sample_rate / input_sample_rate.
-        // end_of_input  : Equal to 0 if more input data is available and 1
-        //                 otherwise.
-        src_data.data_in = fsemu_audiobuffer_extra.src_in;
-        src_data.input_frames = frames;
-        src_data.data_out = fsemu_audiobuffer_extra.src_out;
-        src_data.output_frames = 8192 / 2;  // FIXME
-        src_data.src_ratio = 1.0 + fsemu_audiobuffer_extra.adjustment;
-        src_data.end_of_input = 0;
-
-        src_process(fsemu_audiobuffer_extra.src_state, &src_data);
-
-        int size_out = src_data.output_frames_gen * 4;
-        // float *floatdata_p = fsemu_audiobuffer_extra.src_out;
-        floatdata = fsemu_audiobuffer_extra.src_out;
-
-        ptrdiff_t available = fsemu_audiobuffer.end - fsemu_audiobuffer.write;
-        if (available < size_out) {
-#if 1
-            for (int i = 0; i < available / 2; i++) {
-                int16_t value = (int16_t)(floatdata[i] * 32767);
-                fsemu_audiobuffer.write[i * 2] = value & 0xff;
-                fsemu_audiobuffer.write[i * 2 + 1] = (value >> 8) & 0xff;
-            }
-#else
-            src_float_to_short_array(
-                floatdata, (short *) fsemu_audiobuffer.write, available / 2);
-#endif
-            fsemu_audiobuffer.write = fsemu_audiobuffer.data;
-            data += available;
-            size_out -= available;
-
-            floatdata += available / 2;
-        }
-        if (size_out) {
-#if 1
-            for (int i = 0; i < size_out / 2; i++) {
-                int16_t value = (int16_t)(floatdata[i] * 32767);
-                fsemu_audiobuffer.write[i * 2] = value & 0xff;
-                fsemu_audiobuffer.write[i * 2 + 1] = (value >> 8) & 0xff;
-            }
-#else
-            src_float_to_short_array(
-                floatdata, (short *) fsemu_audiobuffer.write, size_out / 2);
-#endif
-            fsemu_audiobuffer.write += size_out;
-        }
+    if (fsemu_audiobuffer_extra.src_state) {
+        fsemu_audiobuffer_resample((const int16_t *) data, size / 4);
         return;
     }
 #endif
 
-    ptrdiff_t available = fsemu_audiobuffer.end - fsemu_audiobuffer.write;
-    if (available < size) {
-#if 1
-        for (int i = 0; i < available; i++) {
-            fsemu_audiobuffer.write[i] = data[i];
-        }
-#else
-        memcpy((void *) fsemu_audiobuffer.write, data, available);
-#endif
-        fsemu_audiobuffer.write = fsemu_audiobuffer.data;
-        data += available;
-        size -= available;
+    fsemu_audiobuffer_write_bytes(data, size);
+}
+
+void fsemu_audiobuffer_register_underrun(int missing_bytes)
+{
+    fsemu_performance_log("AUND", missing_bytes);
+    __atomic_add_fetch(
+        &fsemu_audiobuffer_extra.underruns, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&fsemu_audiobuffer_extra.underrun_bytes,
+                       missing_bytes,
+                       __ATOMIC_RELAXED);
+}
+
+static void fsemu_audiobuffer_update_stats(void)
+{
+    int fill = fsemu_audiobuffer_fill();
+    if (fsemu_audiobuffer_extra.stats_frames == 0 ||
+        fill < fsemu_audiobuffer_extra.min_fill) {
+        fsemu_audiobuffer_extra.min_fill = fill;
     }
-    if (size) {
-#if 1
-        for (int i = 0; i < size; i++) {
-            fsemu_audiobuffer.write[i] = data[i];
-        }
-#else
-        memcpy((void *) fsemu_audiobuffer.write, data, size);
-#endif
-        fsemu_audiobuffer.write += size;
+    if (fill > fsemu_audiobuffer_extra.max_fill) {
+        fsemu_audiobuffer_extra.max_fill = fill;
     }
+    if (++fsemu_audiobuffer_extra.stats_frames <
+        FSEMU_AUDIOBUFFER_STATS_INTERVAL) {
+        return;
+    }
+
+    int underruns = __atomic_exchange_n(
+        &fsemu_audiobuffer_extra.underruns, 0, __ATOMIC_RELAXED);
+    int underrun_bytes = __atomic_exchange_n(
+        &fsemu_audiobuffer_extra.underrun_bytes, 0, __ATOMIC_RELAXED);
+
+    fsemu_audio_log_debug(
+        "Ring %0.1f..%0.1f ms, %d underruns (%0.1f ms missing), %d overruns, "
+        "resample %d us/frame\n",
+        fsemu_audio_bytes_to_us(fsemu_audiobuffer_extra.min_fill) / 1000.0,
+        fsemu_audio_bytes_to_us(fsemu_audiobuffer_extra.max_fill) / 1000.0,
+        underruns,
+        fsemu_audio_bytes_to_us(underrun_bytes) / 1000.0,
+        fsemu_audiobuffer_extra.overruns,
+        (int) (fsemu_audiobuffer_extra.resample_us /
+               fsemu_audiobuffer_extra.stats_frames));
+
+    fsemu_audiobuffer_extra.overruns = 0;
+    fsemu_audiobuffer_extra.max_fill = 0;
+    fsemu_audiobuffer_extra.resample_us = 0;
+    fsemu_audiobuffer_extra.stats_frames = 0;
 }
 
 void fsemu_audiobuffer_frame_done(void)
@@ -245,25 +398,21 @@ void fsemu_audiobuffer_frame_done(void)
     fsemu_frame_log_epoch(
         "Audio done for frame: %d samples / 2 = %d frames\n", samples, frames);
     fsemu_audiobuffer_extra.bytes_for_frame = 0;
+    fsemu_audiobuffer_update_stats();
 }
 
 void fsemu_audiobuffer_write_silence(int size)
 {
-    // FIXME: Use a static array instead and avoid malloc?
-    // Can write repeatedly from the same buffer;
-    /*
-    void *data = malloc(size);
-    memset(data, 0, sizeof(data));
-    fsemu_audiobuffer_update(data, size);
-    free(data);
-    */
-
-    static uint8_t data[512];  // silence
-    while (size) {
-        int chunk = MIN(size, 512);
-        fsemu_audiobuffer_update(data, size);
-        size = size - chunk;
+    // Silence goes straight into the ring; there is nothing to resample.
+    uint8_t *span1, *span2;
+    int size1, size2;
+    size = fsemu_audiobuffer_reserve(
+        size & ~3, &span1, &size1, &span2, &size2);
+    memset(span1, 0, size1);
+    if (size2) {
+        memset(span2, 0, size2);
     }
+    fsemu_audiobuffer_commit(size);
 }
 
 void fsemu_audiobuffer_write_silence_ms(int ms)
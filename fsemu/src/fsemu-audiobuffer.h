@@ -32,26 +32,66 @@ int fsemu_audiobuffer_calculate_target(void);
 
 double fsemu_audiobuffer_calculate_adjustment(void);
 
-/*
-extern int fsemu_audiobuffer.size;
-extern volatile uint8_t *fsemu_audiobuffer;
-extern volatile uint8_t *fsemu_audiobuffer.end;
-extern volatile uint8_t *volatile fsemu_audiobuffer.read;
-extern volatile uint8_t *volatile fsemu_audiobuffer.write;
-*/
+// The ring buffer is a single-producer (emulation thread), single-consumer
+// (audio driver thread) queue. Each side owns one of the pointers and only
+// reads the other one, with acquire/release ordering so that sample data is
+// visible before the pointer which publishes it. The two pointers live on
+// separate cache lines so the threads do not keep stealing the line from
+// each other. read == write means empty, so one frame is always kept free.
+
+#define FSEMU_AUDIOBUFFER_CACHE_LINE 64
+
+#if defined(__GNUC__) || defined(__clang__)
+#define FSEMU_AUDIOBUFFER_ALIGNED \
+    __attribute__((aligned(FSEMU_AUDIOBUFFER_CACHE_LINE)))
+#else
+#define FSEMU_AUDIOBUFFER_ALIGNED
+#endif
 
 typedef struct {
-    volatile uint8_t *data;
+    uint8_t *data;
     int size;
-    uint8_t volatile *end;
-    uint8_t volatile *volatile read;
-    uint8_t volatile *volatile write;
-    int volatile underrun;
-    int volatile add_silence;
+    uint8_t *end;
+    // Owned by the producer.
+    FSEMU_AUDIOBUFFER_ALIGNED uint8_t *write;
+    // Owned by the consumer.
+    FSEMU_AUDIOBUFFER_ALIGNED uint8_t *read;
+    int underrun;
+    // Set by the consumer, cleared by the producer.
+    int add_silence;
 } fsemu_audiobuffer_t;
 
 extern fsemu_audiobuffer_t fsemu_audiobuffer;
 
+static inline uint8_t *fsemu_audiobuffer_read_acquire(void)
+{
+    return __atomic_load_n(&fsemu_audiobuffer.read, __ATOMIC_ACQUIRE);
+}
+
+static inline void fsemu_audiobuffer_read_release(uint8_t *read)
+{
+    __atomic_store_n(&fsemu_audiobuffer.read, read, __ATOMIC_RELEASE);
+}
+
+static inline uint8_t *fsemu_audiobuffer_write_acquire(void)
+{
+    return __atomic_load_n(&fsemu_audiobuffer.write, __ATOMIC_ACQUIRE);
+}
+
+static inline void fsemu_audiobuffer_write_release(uint8_t *write)
+{
+    __atomic_store_n(&fsemu_audiobuffer.write, write, __ATOMIC_RELEASE);
+}
+
+// Called by the consumer when it could not get all the data it wanted. The
+// counts are logged together with the ring fill statistics.
+void fsemu_audiobuffer_register_underrun(int missing_bytes);
+
+// Sample conversion helpers, vectorized where the host allows it. Float
+// samples are in the range [-1.0, 1.0] and are clamped on the way back.
+void fsemu_audiobuffer_s16_to_float(const int16_t *in, float *out, int n);
+void fsemu_audiobuffer_float_to_s16(const float *in, int16_t *out, int n);
+
 #ifdef __cplusplus
 }
 #endif
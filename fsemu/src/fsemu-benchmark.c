@@ -0,0 +1,357 @@
+#define FSEMU_INTERNAL
+#include "fsemu-benchmark.h"
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "fsemu-frame.h"
+#include "fsemu-glib.h"
+#include "fsemu-log.h"
+#include "fsemu-module.h"
+#include "fsemu-mutex.h"
+#include "fsemu-option.h"
+#include "fsemu-quit.h"
+#include "fsemu-thread.h"
+#include "fsemu-time.h"
+#include "fsemu-util.h"
+
+int fsemu_benchmark_log_level = FSEMU_LOG_LEVEL_INFO;
+
+typedef struct {
+    int emu_us;
+    int render_us;
+    int wall_us;
+    uint32_t checksum;
+} fsemu_benchmark_frame_t;
+
+static struct {
+    bool initialized;
+    bool enabled;
+    bool done;
+    // Number of frames to measure, not counting the first frame.
+    int frames;
+    char *output;
+    // Measured frames so far; -1 until the first (unmeasured) frame ends.
+    int count;
+    int64_t start_us;
+    int64_t last_us;
+    int64_t cycles;
+    // Emulated time for the measured frames, from the frame rate.
+    double emulated_s;
+    uint32_t checksum;
+    fsemu_benchmark_frame_t *results;
+    // Pre-formatted "key": value pairs
+    GList *info;
+    fsemu_mutex_t *mutex;
+} fsemu_benchmark;
+
+bool fsemu_benchmark_enabled(void)
+{
+    return fsemu_benchmark.enabled;
+}
+
+static void fsemu_benchmark_add_info(char *pair)
+{
+    fsemu_mutex_lock(fsemu_benchmark.mutex);
+    fsemu_benchmark.info = g_list_append(fsemu_benchmark.info, pair);
+    fsemu_mutex_unlock(fsemu_benchmark.mutex);
+}
+
+void fsemu_benchmark_set_info(const char *key, const char *value)
+{
+    if (!fsemu_benchmark.enabled) {
+        return;
+    }
+    // Keys and values are plain identifiers / names; escape the characters
+    // that would break the JSON output anyway.
+    GString *s = g_string_new(NULL);
+    g_string_append_printf(s, "\"%s\": \"", key);
+    for (const char *c = value; *c; c++) {
+        if (*c == '"' || *c == '\\') {
+            g_string_append_c(s, '\\');
+            g_string_append_c(s, *c);
+        } else if ((unsigned char) *c < 0x20) {
+            g_string_append_printf(s, "\\u%04x", *c);
+        } else {
+            g_string_append_c(s, *c);
+        }
+    }
+    g_string_append_c(s, '"');
+    fsemu_benchmark_add_info(g_string_free(s, FALSE));
+}
+
+void fsemu_benchmark_set_info_int(const char *key, int64_t value)
+{
+    if (!fsemu_benchmark.enabled) {
+        return;
+    }
+    fsemu_benchmark_add_info(
+        g_strdup_printf("\"%s\": %lld", key, lld(value)));
+}
+
+void fsemu_benchmark_add_cycles(int64_t cycles)
+{
+    if (fsemu_benchmark.count < 0 || fsemu_benchmark.done) {
+        return;
+    }
+    fsemu_benchmark.cycles += cycles;
+}
+
+void fsemu_benchmark_checksum_frame(fsemu_video_frame_t *frame)
+{
+    if (!fsemu_benchmark.enabled || frame->dummy || !frame->buffer) {
+        return;
+    }
+    // FNV-1a on 32-bit words, good enough to detect differing output, and
+    // fast enough not to skew the render times much. Only the visible width
+    // is hashed, the padding up to stride is not written by the emulator.
+    uint32_t hash = 2166136261u;
+    int bytes = frame->width * frame->depth / 8;
+    if (bytes > frame->stride) {
+        bytes = frame->stride;
+    }
+    int words = bytes / 4;
+    for (int y = 0; y < frame->height; y++) {
+        const uint8_t *line = frame->buffer + y * frame->stride;
+        for (int x = 0; x < words; x++) {
+            uint32_t v;
+            memcpy(&v, line + x * 4, 4);
+            hash = (hash ^ v) * 16777619u;
+        }
+        for (int x = words * 4; x < bytes; x++) {
+            hash = (hash ^ line[x]) * 16777619u;
+        }
+    }
+    fsemu_benchmark.checksum = hash;
+}
+
+static int fsemu_benchmark_compare_int(const void *a, const void *b)
+{
+    return *(const int *) a - *(const int *) b;
+}
+
+static void fsemu_benchmark_write_stats(FILE *f,
+                                        const char *name,
+                                        size_t offset,
+                                        bool last)
+{
+    int n = fsemu_benchmark.count;
+    int *values = (int *) malloc(n * sizeof(int));
+    int64_t total = 0;
+    for (int i = 0; i < n; i++) {
+        values[i] = *(int *) ((char *) &fsemu_benchmark.results[i] + offset);
+        total += values[i];
+    }
+    qsort(values, n, sizeof(int), fsemu_benchmark_compare_int);
+    fprintf(f,
+            "    \"%s\": {\"total\": %lld, \"avg\": %0.1f, \"min\": %d, "
+            "\"p50\": %d, \"p95\": %d, \"p99\": %d, \"max\": %d}%s\n",
+            name,
+            lld(total),
+            (double) total / n,
+            values[0],
+            values[n / 2],
+            values[n * 95 / 100],
+            values[n * 99 / 100],
+            values[n - 1],
+            last ? "" : ",");
+    free(values);
+}
+
+static void fsemu_benchmark_write_frames(FILE *f,
+                                         const char *name,
+                                         size_t offset,
+                                         bool hex,
+                                         bool last)
+{
+    fprintf(f, "    \"%s\": [", name);
+    for (int i = 0; i < fsemu_benchmark.count; i++) {
+        int value =
+            *(int *) ((char *) &fsemu_benchmark.results[i] + offset);
+        fprintf(f, i % 16 == 0 ? "\n      " : " ");
+        if (hex) {
+            fprintf(f, "\"%08x\"", (uint32_t) value);
+        } else {
+            fprintf(f, "%d", value);
+        }
+        if (i < fsemu_benchmark.count - 1) {
+            fputc(',', f);
+        }
+    }
+    fprintf(f, "\n    ]%s\n", last ? "" : ",");
+}
+
+static void fsemu_benchmark_write_results(void)
+{
+    FILE *f = stdout;
+    if (fsemu_benchmark.output) {
+        f = g_fopen(fsemu_benchmark.output, "w");
+        if (f == NULL) {
+            fsemu_benchmark_log_error("Could not open %s for writing\n",
+                                      fsemu_benchmark.output);
+            return;
+        }
+    }
+
+    int64_t wall_us = fsemu_benchmark.last_us - fsemu_benchmark.start_us;
+    double wall_s = wall_us / 1000000.0;
+    uint32_t combined = 2166136261u;
+    for (int i = 0; i < fsemu_benchmark.count; i++) {
+        combined = (combined ^ fsemu_benchmark.results[i].checksum) *
+                   16777619u;
+    }
+
+    fprintf(f, "{\n");
+    fprintf(f, "  \"version\": 1,\n");
+    fprintf(f, "  \"info\": {");
+    fsemu_mutex_lock(fsemu_benchmark.mutex);
+    for (GList *item = fsemu_benchmark.info; item; item = item->next) {
+        fprintf(f,
+                "\n    %s%s",
+                (const char *) item->data,
+                item->next ? "," : "\n  ");
+    }
+    fsemu_mutex_unlock(fsemu_benchmark.mutex);
+    fprintf(f, "},\n");
+    fprintf(f, "  \"frames\": %d,\n", fsemu_benchmark.count);
+    fprintf(f, "  \"wall_us\": %lld,\n", lld(wall_us));
+    fprintf(f,
+            "  \"fps\": %0.2f,\n",
+            wall_s > 0 ? fsemu_benchmark.count / wall_s : 0.0);
+    fprintf(f,
+            "  \"realtime_factor\": %0.3f,\n",
+            wall_s > 0 ? fsemu_benchmark.emulated_s / wall_s : 0.0);
+    fprintf(f, "  \"cycles\": %lld,\n", lld(fsemu_benchmark.cycles));
+    fprintf(f,
+            "  \"cycles_per_second\": %0.0f,\n",
+            wall_s > 0 ? fsemu_benchmark.cycles / wall_s : 0.0);
+    fprintf(f,
+            "  \"final_frame_checksum\": \"%08x\",\n",
+            fsemu_benchmark.results[fsemu_benchmark.count - 1].checksum);
+    fprintf(f, "  \"checksum\": \"%08x\",\n", combined);
+    fprintf(f, "  \"summary\": {\n");
+    fsemu_benchmark_write_stats(
+        f, "emulation_us", offsetof(fsemu_benchmark_frame_t, emu_us), false);
+    fsemu_benchmark_write_stats(
+        f, "render_us", offsetof(fsemu_benchmark_frame_t, render_us), false);
+    fsemu_benchmark_write_stats(
+        f, "wall_us", offsetof(fsemu_benchmark_frame_t, wall_us), true);
+    fprintf(f, "  },\n");
+    fprintf(f, "  \"per_frame\": {\n");
+    fsemu_benchmark_write_frames(f,
+                                 "emulation_us",
+                                 offsetof(fsemu_benchmark_frame_t, emu_us),
+                                 false,
+                                 false);
+    fsemu_benchmark_write_frames(f,
+                                 "render_us",
+                                 offsetof(fsemu_benchmark_frame_t, render_us),
+                                 false,
+                                 false);
+    fsemu_benchmark_write_frames(f,
+                                 "wall_us",
+                                 offsetof(fsemu_benchmark_frame_t, wall_us),
+                                 false,
+                                 false);
+    fsemu_benchmark_write_frames(f,
+                                 "checksum",
+                                 offsetof(fsemu_benchmark_frame_t, checksum),
+                                 true,
+                                 true);
+    fprintf(f, "  }\n");
+    fprintf(f, "}\n");
+
+    if (f == stdout) {
+        fflush(f);
+    } else {
+        fclose(f);
+        fsemu_benchmark_log("Wrote results to %s\n", fsemu_benchmark.output);
+    }
+    fsemu_benchmark_log("%d frames in %0.3f s, %0.1f fps, %0.2fx realtime\n",
+                        fsemu_benchmark.count,
+                        wall_s,
+                        wall_s > 0 ? fsemu_benchmark.count / wall_s : 0.0,
+                        wall_s > 0 ? fsemu_benchmark.emulated_s / wall_s
+                                   : 0.0);
+}
+
+void fsemu_benchmark_frame_done(int64_t emu_us, int64_t render_us)
+{
+    if (!fsemu_benchmark.enabled || fsemu_benchmark.done) {
+        return;
+    }
+    fsemu_thread_assert_emu();
+    int64_t now = fsemu_time_us();
+    if (fsemu_benchmark.count < 0) {
+        // The first frame includes startup work; start measuring from here.
+        fsemu_benchmark.count = 0;
+        fsemu_benchmark.start_us = now;
+        fsemu_benchmark.last_us = now;
+        return;
+    }
+    fsemu_benchmark_frame_t *result =
+        &fsemu_benchmark.results[fsemu_benchmark.count];
+    result->emu_us = (int) emu_us;
+    result->render_us = (int) render_us;
+    result->wall_us = (int) (now - fsemu_benchmark.last_us);
+    result->checksum = fsemu_benchmark.checksum;
+    fsemu_benchmark.last_us = now;
+    double hz = fsemu_frame_rate_hz();
+    if (hz > 0) {
+        fsemu_benchmark.emulated_s += 1.0 / hz;
+    }
+    fsemu_benchmark.count += 1;
+
+    if (fsemu_benchmark.count == fsemu_benchmark.frames) {
+        fsemu_benchmark.done = true;
+        fsemu_benchmark_write_results();
+        fsemu_quit_maybe();
+    }
+}
+
+// ----------------------------------------------------------------------------
+
+static void fsemu_benchmark_quit(void)
+{
+    free(fsemu_benchmark.results);
+    fsemu_benchmark.results = NULL;
+    g_free(fsemu_benchmark.output);
+    fsemu_benchmark.output = NULL;
+    g_list_free_full(fsemu_benchmark.info, g_free);
+    fsemu_benchmark.info = NULL;
+}
+
+// ----------------------------------------------------------------------------
+
+void fsemu_benchmark_init(void)
+{
+    if (FSEMU_MODULE_INIT(benchmark)) {
+        return;
+    }
+    fsemu_option_init();
+
+    int frames = fsemu_option_int_default(FSEMU_OPTION_BENCHMARK_FRAMES, 0);
+    if (frames <= 0) {
+        return;
+    }
+    fsemu_benchmark_log("Running benchmark for %d frames\n", frames);
+    fsemu_benchmark.enabled = true;
+    fsemu_benchmark.frames = frames;
+    fsemu_benchmark.count = -1;
+    fsemu_benchmark.results = (fsemu_benchmark_frame_t *) calloc(
+        frames, sizeof(fsemu_benchmark_frame_t));
+    fsemu_benchmark.mutex = fsemu_mutex_create();
+
+    const char *output =
+        fsemu_option_const_string(FSEMU_OPTION_BENCHMARK_OUTPUT);
+    if (output) {
+        fsemu_benchmark.output = g_strdup(output);
+    }
+
+    // Run headless unless drivers are explicitly chosen; the null drivers
+    // still let the emulator produce (and checksum) frames and audio.
+    fsemu_option_set_string_if_unset(FSEMU_OPTION_VIDEO_DRIVER, "null");
+    fsemu_option_set_string_if_unset(FSEMU_OPTION_AUDIO_DRIVER, "null");
+}
@@ -0,0 +1,72 @@
+#ifndef FSEMU_BENCHMARK_H_
+#define FSEMU_BENCHMARK_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "fsemu-video.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Benchmark mode is enabled with benchmark_frames=N. The emulator then runs
+// without window and audio device, in warp mode, and quits after N frames,
+// writing results as JSON to benchmark_output (or stdout). The first frame
+// is not included in the measurements.
+
+void fsemu_benchmark_init(void);
+
+bool fsemu_benchmark_enabled(void);
+
+// Describe the benchmarked configuration (CPU core, chipset, ...). Call from
+// the emulation thread before the measured frames end, or from the main
+// thread before the emulation starts.
+void fsemu_benchmark_set_info(const char *key, const char *value);
+void fsemu_benchmark_set_info_int(const char *key, int64_t value);
+
+// Called by the emulator (emulation thread) with the number of emulated
+// cycles since the last call.
+void fsemu_benchmark_add_cycles(int64_t cycles);
+
+// Called from fsemu_video_post_frame.
+void fsemu_benchmark_checksum_frame(fsemu_video_frame_t *frame);
+
+// Called from fsemu_frame_end.
+void fsemu_benchmark_frame_done(int64_t emu_us, int64_t render_us);
+
+#ifdef FSEMU_INTERNAL
+
+// ----------------------------------------------------------------------------
+// Logging
+// ----------------------------------------------------------------------------
+
+extern int fsemu_benchmark_log_level;
+
+#define fsemu_benchmark_log(format, ...) \
+    FSEMU_LOG(benchmark, "[FSE] [BEN]", format, ##__VA_ARGS__)
+
+#define fsemu_benchmark_log_debug(format, ...) \
+    FSEMU_LOG_DEBUG(benchmark, "[FSE] [BEN]", format, ##__VA_ARGS__)
+
+#define fsemu_benchmark_log_error(format, ...) \
+    FSEMU_LOG_ERROR(benchmark, "[FSE] [BEN]", format, ##__VA_ARGS__)
+
+#define fsemu_benchmark_log_info(format, ...) \
+    FSEMU_LOG_INFO(benchmark, "[FSE] [BEN]", format, ##__VA_ARGS__)
+
+#define fsemu_benchmark_log_trace(format, ...) \
+    FSEMU_LOG_TRACE(benchmark, "[FSE] [BEN]", format, ##__VA_ARGS__)
+
+#define fsemu_benchmark_log_warning(format, ...) \
+    FSEMU_LOG_WARNING(benchmark, "[FSE] [BEN]", format, ##__VA_ARGS__)
+
+// ----------------------------------------------------------------------------
+
+#endif  // FSEMU_INTERNAL
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // FSEMU_BENCHMARK_H_
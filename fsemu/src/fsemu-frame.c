@@ -3,6 +3,7 @@
 
 #include "fsemu-action.h"
 #include "fsemu-audio.h"
+#include "fsemu-benchmark.h"
 #include "fsemu-control.h"
 #include "fsemu-frameinfo.h"
 #include "fsemu-hud.h"
@@ -16,6 +17,8 @@
 #include "fsemu-util.h"
 #include "fsemu-video.h"
 
+#include <fsemu/performance.h>
+
 // ----------------------------------------------------------------------------
 
 #pragma GCC diagnostic push
@@ -168,6 +171,7 @@ void fsemu_frame_end(void)
     fsemu_thread_assert_emu();
     fsemu_frame_log_epoch("Frame end\n");
     fsemu_assert(fsemu_frame.initialized);
+    fsemu_performance_end("FRAM");
 
     int64_t now = fsemu_time_us();
     if (now > fsemu_frame_end_at + 1000) {
@@ -179,7 +183,9 @@ void fsemu_frame_end(void)
             lld(fsemu_frame_end_at));
     } else if (now >= fsemu_frame_end_at) {
     } else {
+        fsemu_performance_begin("FWAI");
         fsemu_frame_wait_until_frame_end();
+        fsemu_performance_end("FWAI");
         now = fsemu_time_us();
         if (now > fsemu_frame_end_at + 1000) {
             printf("Overslept %d\n",
@@ -258,6 +264,9 @@ void fsemu_frame_end(void)
         emu_us_avg_max = emu_us_avg;
     }
 
+    fsemu_benchmark_frame_done(fsemu_frame_emu_duration,
+                               fsemu_frame_render_duration);
+
     // printf("Frame count %d\n", fsemu_frame.counter);
     if (fsemu_frame.counter == fsemu_frame.quit_after_n_frames) {
         printf(
@@ -1112,7 +1121,9 @@ static void fsemu_frame_start_2(double hz)
     }
 
     if (fsemu_video_vsync() && !fsemu_frame_warping()) {
+        fsemu_performance_begin("VWAI");
         fsemu_frame_wait_until_frame_start_vsync(frame_number);
+        fsemu_performance_end("VWAI");
         // while (!fsemu_frame_can_start_frame_vsync(frame_number)) {
 
         // }
@@ -1168,6 +1179,7 @@ static void fsemu_frame_start_2(double hz)
 
     fsemu_frame_add_overshoot_time(0);
     // fsemu_frame_reset_epoch() FIXME: Maybe reset epoch to same time here?
+    fsemu_performance_begin("FRAM");
 }
 
 // FIXME: Move hz to a separate function that can be called before start?
@@ -9,6 +9,7 @@
 #include "fsemu-layout.h"
 #include "fsemu-mutex.h"
 #include "fsemu-opengl.h"
+#include "fsemu-option.h"
 #include "fsemu-perfgui.h"
 #include "fsemu-sdl.h"
 #include "fsemu-sdlwindow.h"
@@ -27,6 +28,7 @@
 #define FSEMU_OPENGL_SHOW_TEXT_DEBUG_RECTANGLE 0
 
 #define FSEMU_GLVIDEO_N_TEXTURES 1
+#define FSEMU_GLVIDEO_TEXTURE_HEIGHT 1024
 
 // ----------------------------------------------------------------------------
 
@@ -48,6 +50,11 @@ static struct {
     // Number of frames rendered by the OpenGL video renderer.
     int frame_count;
 
+    // Rows (one bit per row) where each texture does not have the current
+    // frame contents, and the frame limits these rows are relative to.
+    uint32_t stale[FSEMU_GLVIDEO_N_TEXTURES][FSEMU_GLVIDEO_TEXTURE_HEIGHT / 32];
+    fsemu_rect_t stale_limits;
+
     bool fix_bleed;
 
     GLint iformat;
@@ -94,9 +101,441 @@ void fsemu_glvideo_set_size_2(int width, int height)
     fsemu_video_set_drawable_size(&fsemu_glvideo.drawable_size);
 }
 
+// ----------------------------------------------------------------------------
+// Pixel buffer objects
+// ----------------------------------------------------------------------------
+
+// Frames are copied (tightly packed) into a ring of pixel buffer objects and
+// uploaded to the texture from there. glTexSubImage2D then returns without
+// waiting for the driver to copy the pixels, and the transfer to the texture
+// overlaps with the handling of the next frame. With GL 4.4 /
+// ARB_buffer_storage the buffers are persistently mapped and guarded with
+// fences; otherwise each buffer is orphaned and mapped per frame.
+
+#define FSEMU_GLVIDEO_PBO_COUNT 3
+
+#ifndef GL_PIXEL_UNPACK_BUFFER
+#define GL_PIXEL_UNPACK_BUFFER 0x88EC
+#endif
+#ifndef GL_STREAM_DRAW
+#define GL_STREAM_DRAW 0x88E0
+#endif
+#ifndef GL_MAP_WRITE_BIT
+#define GL_MAP_WRITE_BIT 0x0002
+#endif
+#ifndef GL_MAP_INVALIDATE_RANGE_BIT
+#define GL_MAP_INVALIDATE_RANGE_BIT 0x0004
+#endif
+#ifndef GL_MAP_UNSYNCHRONIZED_BIT
+#define GL_MAP_UNSYNCHRONIZED_BIT 0x0020
+#endif
+#ifndef GL_MAP_PERSISTENT_BIT
+#define GL_MAP_PERSISTENT_BIT 0x0040
+#endif
+#ifndef GL_MAP_COHERENT_BIT
+#define GL_MAP_COHERENT_BIT 0x0080
+#endif
+#ifndef GL_SYNC_GPU_COMMANDS_COMPLETE
+#define GL_SYNC_GPU_COMMANDS_COMPLETE 0x9117
+#endif
+#ifndef GL_SYNC_FLUSH_COMMANDS_BIT
+#define GL_SYNC_FLUSH_COMMANDS_BIT 0x00000001
+#endif
+#ifndef GL_WAIT_FAILED
+#define GL_WAIT_FAILED 0x911D
+#endif
+
+// Own function pointer types, so we do not depend on which glext.h version
+// SDL ships with (and to not clash with GLAD's symbols).
+typedef void(APIENTRY *fsemu_glvideo_gen_buffers_f)(GLsizei, GLuint *);
+typedef void(APIENTRY *fsemu_glvideo_bind_buffer_f)(GLenum, GLuint);
+typedef void(APIENTRY *fsemu_glvideo_buffer_data_f)(GLenum,
+                                                    ptrdiff_t,
+                                                    const void *,
+                                                    GLenum);
+typedef void(APIENTRY *fsemu_glvideo_buffer_storage_f)(GLenum,
+                                                       ptrdiff_t,
+                                                       const void *,
+                                                       GLbitfield);
+typedef void *(APIENTRY *fsemu_glvideo_map_buffer_range_f)(GLenum,
+                                                           ptrdiff_t,
+                                                           ptrdiff_t,
+                                                           GLbitfield);
+typedef GLboolean(APIENTRY *fsemu_glvideo_unmap_buffer_f)(GLenum);
+typedef GLsync(APIENTRY *fsemu_glvideo_fence_sync_f)(GLenum, GLbitfield);
+typedef GLenum(APIENTRY *fsemu_glvideo_client_wait_sync_f)(GLsync,
+                                                           GLbitfield,
+                                                           uint64_t);
+typedef void(APIENTRY *fsemu_glvideo_delete_sync_f)(GLsync);
+
+static struct {
+    // Set from the video_pbo option (main thread)
+    bool allowed;
+    bool enabled;
+    bool persistent;
+    GLuint buffers[FSEMU_GLVIDEO_PBO_COUNT];
+    uint8_t *mapped[FSEMU_GLVIDEO_PBO_COUNT];
+    GLsync fences[FSEMU_GLVIDEO_PBO_COUNT];
+    int current;
+    int size;
+
+    fsemu_glvideo_gen_buffers_f gen_buffers;
+    fsemu_glvideo_bind_buffer_f bind_buffer;
+    fsemu_glvideo_buffer_data_f buffer_data;
+    fsemu_glvideo_buffer_storage_f buffer_storage;
+    fsemu_glvideo_map_buffer_range_f map_buffer_range;
+    fsemu_glvideo_unmap_buffer_f unmap_buffer;
+    fsemu_glvideo_fence_sync_f fence_sync;
+    fsemu_glvideo_client_wait_sync_f client_wait_sync;
+    fsemu_glvideo_delete_sync_f delete_sync;
+} fsemu_glvideo_pbo;
+
+static void fsemu_glvideo_pbo_init(int size)
+{
+    if (!fsemu_glvideo_pbo.allowed) {
+        fsemu_video_log_info("Pixel buffer objects disabled by option\n");
+        return;
+    }
+    int major = 0, minor = 0;
+    const char *version = (const char *) glGetString(GL_VERSION);
+    if (version == NULL || g_str_has_prefix(version, "OpenGL ES") ||
+        sscanf(version, "%d.%d", &major, &minor) != 2) {
+        fsemu_video_log_info("Pixel buffer objects not used (GL %s)\n",
+                             version ? version : "?");
+        return;
+    }
+    int gl = major * 10 + minor;
+    bool buffer_storage =
+        gl >= 44 || SDL_GL_ExtensionSupported("GL_ARB_buffer_storage");
+    bool map_buffer_range =
+        gl >= 30 || (SDL_GL_ExtensionSupported("GL_ARB_pixel_buffer_object") &&
+                     SDL_GL_ExtensionSupported("GL_ARB_map_buffer_range"));
+    bool sync = gl >= 32 || SDL_GL_ExtensionSupported("GL_ARB_sync");
+    if (!map_buffer_range) {
+        fsemu_video_log_info("Pixel buffer objects not supported\n");
+        return;
+    }
+
+#define FSEMU_GLVIDEO_PBO_LOAD(field, name) \
+    fsemu_glvideo_pbo.field =               \
+        (fsemu_glvideo_##field##_f) SDL_GL_GetProcAddress(name)
+    FSEMU_GLVIDEO_PBO_LOAD(gen_buffers, "glGenBuffers");
+    FSEMU_GLVIDEO_PBO_LOAD(bind_buffer, "glBindBuffer");
+    FSEMU_GLVIDEO_PBO_LOAD(buffer_data, "glBufferData");
+    FSEMU_GLVIDEO_PBO_LOAD(map_buffer_range, "glMapBufferRange");
+    FSEMU_GLVIDEO_PBO_LOAD(unmap_buffer, "glUnmapBuffer");
+    if (buffer_storage && sync) {
+        FSEMU_GLVIDEO_PBO_LOAD(buffer_storage, "glBufferStorage");
+        FSEMU_GLVIDEO_PBO_LOAD(fence_sync, "glFenceSync");
+        FSEMU_GLVIDEO_PBO_LOAD(client_wait_sync, "glClientWaitSync");
+        FSEMU_GLVIDEO_PBO_LOAD(delete_sync, "glDeleteSync");
+    }
+#undef FSEMU_GLVIDEO_PBO_LOAD
+    if (!fsemu_glvideo_pbo.gen_buffers || !fsemu_glvideo_pbo.bind_buffer ||
+        !fsemu_glvideo_pbo.buffer_data ||
+        !fsemu_glvideo_pbo.map_buffer_range ||
+        !fsemu_glvideo_pbo.unmap_buffer) {
+        fsemu_video_log_warning("Could not load buffer object functions\n");
+        return;
+    }
+    fsemu_glvideo_pbo.persistent =
+        fsemu_glvideo_pbo.buffer_storage && fsemu_glvideo_pbo.fence_sync &&
+        fsemu_glvideo_pbo.client_wait_sync && fsemu_glvideo_pbo.delete_sync;
+
+    fsemu_glvideo_pbo.size = size;
+    fsemu_glvideo_pbo.gen_buffers(FSEMU_GLVIDEO_PBO_COUNT,
+                                  fsemu_glvideo_pbo.buffers);
+    for (int i = 0; i < FSEMU_GLVIDEO_PBO_COUNT; i++) {
+        fsemu_glvideo_pbo.bind_buffer(GL_PIXEL_UNPACK_BUFFER,
+                                      fsemu_glvideo_pbo.buffers[i]);
+        if (fsemu_glvideo_pbo.persistent) {
+            GLbitfield flags =
+                GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+            fsemu_glvideo_pbo.buffer_storage(
+                GL_PIXEL_UNPACK_BUFFER, size, NULL, flags);
+            fsemu_glvideo_pbo.mapped[i] = (uint8_t *)
+                fsemu_glvideo_pbo.map_buffer_range(
+                    GL_PIXEL_UNPACK_BUFFER, 0, size, flags);
+            if (fsemu_glvideo_pbo.mapped[i] == NULL) {
+                fsemu_video_log_warning(
+                    "Could not map buffer persistently, orphaning instead\n");
+                // Buffers with immutable storage cannot be orphaned, so
+                // start over with new buffers.
+                fsemu_glvideo_pbo.bind_buffer(GL_PIXEL_UNPACK_BUFFER, 0);
+                fsemu_glvideo_pbo.persistent = false;
+                fsemu_glvideo_pbo.gen_buffers(FSEMU_GLVIDEO_PBO_COUNT,
+                                              fsemu_glvideo_pbo.buffers);
+                i = -1;
+            }
+        } else {
+            fsemu_glvideo_pbo.buffer_data(
+                GL_PIXEL_UNPACK_BUFFER, size, NULL, GL_STREAM_DRAW);
+        }
+        fsemu_opengl_log_error_maybe();
+    }
+    fsemu_glvideo_pbo.bind_buffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    fsemu_glvideo_pbo.enabled = true;
+    fsemu_video_log_info("Using %d %s pixel buffer objects\n",
+                         FSEMU_GLVIDEO_PBO_COUNT,
+                         fsemu_glvideo_pbo.persistent ? "persistently mapped"
+                                                      : "orphaned");
+}
+
+// Switches to the next buffer in the ring. Called before the first slice of
+// a new frame is uploaded.
+static void fsemu_glvideo_pbo_begin_frame(void)
+{
+    fsemu_glvideo_pbo.current =
+        (fsemu_glvideo_pbo.current + 1) % FSEMU_GLVIDEO_PBO_COUNT;
+    int n = fsemu_glvideo_pbo.current;
+    if (fsemu_glvideo_pbo.persistent) {
+        if (fsemu_glvideo_pbo.fences[n]) {
+            // Normally long signaled, since the buffer was last used
+            // FSEMU_GLVIDEO_PBO_COUNT frames ago.
+            GLenum result = fsemu_glvideo_pbo.client_wait_sync(
+                fsemu_glvideo_pbo.fences[n],
+                GL_SYNC_FLUSH_COMMANDS_BIT,
+                100 * 1000 * 1000);
+            if (result == GL_WAIT_FAILED) {
+                fsemu_opengl_log_error_maybe();
+            }
+            fsemu_glvideo_pbo.delete_sync(fsemu_glvideo_pbo.fences[n]);
+            fsemu_glvideo_pbo.fences[n] = NULL;
+        }
+    } else {
+        // Orphan the old storage; the driver can keep it until pending
+        // uploads from it are done.
+        fsemu_glvideo_pbo.bind_buffer(GL_PIXEL_UNPACK_BUFFER,
+                                      fsemu_glvideo_pbo.buffers[n]);
+        fsemu_glvideo_pbo.buffer_data(
+            GL_PIXEL_UNPACK_BUFFER, fsemu_glvideo_pbo.size, NULL, GL_STREAM_DRAW);
+        fsemu_glvideo_pbo.bind_buffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    }
+}
+
+// Copies the rows of rect (from pixels, with the given stride) into the
+// buffer for the current frame, which is left bound as the unpack buffer.
+// Stores the buffer offset to pass to glTexSubImage2D (as pointer) in
+// upload. Returns false if the rows could not be copied and must be
+// uploaded directly.
+static bool fsemu_glvideo_pbo_upload(const uint8_t *pixels,
+                                     int stride,
+                                     SDL_Rect *rect,
+                                     const uint8_t **upload)
+{
+    int bpp = fsemu_glvideo.bpp;
+    int row_bytes = rect->w * bpp;
+    // Rows are stored at their position in the frame, so later slices of
+    // the same frame do not overwrite earlier ones.
+    ptrdiff_t offset = (ptrdiff_t) rect->y * row_bytes;
+    ptrdiff_t length = (ptrdiff_t) rect->h * row_bytes;
+    if (offset + length > fsemu_glvideo_pbo.size) {
+        return false;
+    }
+
+    int n = fsemu_glvideo_pbo.current;
+    fsemu_glvideo_pbo.bind_buffer(GL_PIXEL_UNPACK_BUFFER,
+                                  fsemu_glvideo_pbo.buffers[n]);
+
+    uint8_t *dst;
+    if (fsemu_glvideo_pbo.persistent) {
+        dst = fsemu_glvideo_pbo.mapped[n] + offset;
+    } else {
+        dst = (uint8_t *) fsemu_glvideo_pbo.map_buffer_range(
+            GL_PIXEL_UNPACK_BUFFER,
+            offset,
+            length,
+            GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT |
+                GL_MAP_UNSYNCHRONIZED_BIT);
+        if (dst == NULL) {
+            fsemu_opengl_log_error_maybe();
+            fsemu_glvideo_pbo.bind_buffer(GL_PIXEL_UNPACK_BUFFER, 0);
+            return false;
+        }
+    }
+
+    if (stride == row_bytes) {
+        memcpy(dst, pixels, length);
+    } else {
+        for (int y = 0; y < rect->h; y++) {
+            memcpy(dst + y * row_bytes, pixels + y * stride, row_bytes);
+        }
+    }
+
+    if (!fsemu_glvideo_pbo.persistent) {
+        fsemu_glvideo_pbo.unmap_buffer(GL_PIXEL_UNPACK_BUFFER);
+    }
+    *upload = (const uint8_t *) (uintptr_t) offset;
+    return true;
+}
+
+// Called when the last upload from the current buffer has been issued.
+static void fsemu_glvideo_pbo_frame_done(void)
+{
+    int n = fsemu_glvideo_pbo.current;
+    if (fsemu_glvideo_pbo.persistent && !fsemu_glvideo_pbo.fences[n]) {
+        fsemu_glvideo_pbo.fences[n] =
+            fsemu_glvideo_pbo.fence_sync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    }
+}
+
+static void fsemu_glvideo_pbo_unbind(void)
+{
+    fsemu_glvideo_pbo.bind_buffer(GL_PIXEL_UNPACK_BUFFER, 0);
+}
+
+// ----------------------------------------------------------------------------
+// Texture upload
+// ----------------------------------------------------------------------------
+
+static bool fsemu_glvideo_row_stale(int texture, int y)
+{
+    if (y < 0 || y >= FSEMU_GLVIDEO_TEXTURE_HEIGHT) {
+        return true;
+    }
+    return (fsemu_glvideo.stale[texture][y / 32] >> (y % 32)) & 1;
+}
+
+static void fsemu_glvideo_set_row_stale(int texture, int y, bool stale)
+{
+    if (y < 0 || y >= FSEMU_GLVIDEO_TEXTURE_HEIGHT) {
+        return;
+    }
+    if (stale) {
+        fsemu_glvideo.stale[texture][y / 32] |= 1u << (y % 32);
+    } else {
+        fsemu_glvideo.stale[texture][y / 32] &= ~(1u << (y % 32));
+    }
+}
+
+// Marks the rows (from row from and down) changed by frame as stale in all
+// textures. Rows are relative to the frame limits (i.e. texture rows). Slices
+// carry all rows changed so far in the frame, but the rows above the slice
+// have already been handled by the previous slices. Everything is stale when
+// the frame does not say which rows have changed, or the limits change.
+static void fsemu_glvideo_mark_stale_rows(fsemu_video_frame_t *frame, int from)
+{
+    fsemu_rect_t *limits = &frame->limits;
+    fsemu_rect_t *last = &fsemu_glvideo.stale_limits;
+    if (frame->dummy || frame->dirty == NULL || limits->x != last->x ||
+        limits->y != last->y || limits->w != last->w || limits->h != last->h) {
+        memset(fsemu_glvideo.stale, 0xff, sizeof(fsemu_glvideo.stale));
+        if (!frame->dummy) {
+            *last = *limits;
+        }
+        return;
+    }
+    int h = MIN(limits->h, FSEMU_GLVIDEO_TEXTURE_HEIGHT);
+    for (int y = from; y < h; y++) {
+        if (fsemu_video_frame_row_dirty(frame, limits->y + y)) {
+            for (int i = 0; i < FSEMU_GLVIDEO_N_TEXTURES; i++) {
+                fsemu_glvideo.stale[i][y / 32] |= 1u << (y % 32);
+            }
+        }
+    }
+}
+
+// Uploads rect to the bound texture from pixels (first row of rect, with the
+// given stride), and duplicates the right edge (and the bottom edge, if
+// bottom_edge is set) into the unused part of the texture.
+static void fsemu_glvideo_upload_rows(const uint8_t *pixels,
+                                      int stride,
+                                      SDL_Rect *rect,
+                                      bool pbo,
+                                      bool bottom_edge)
+{
+    int row_length = stride / fsemu_glvideo.bpp;
+    // Pointer (or buffer offset when a pixel buffer object is bound) passed
+    // to glTexSubImage2D for the first row of rect.
+    const uint8_t *upload = pixels;
+    if (pbo) {
+        if (fsemu_glvideo_pbo_upload(pixels, stride, rect, &upload)) {
+            row_length = rect->w;
+        } else {
+            pbo = false;
+        }
+    }
+
+    // fsemu_opengl_unpack_row_length(frame->width == row_length ? 0 :
+    // row_length); fsemu_opengl_unpack_row_length(0);
+    fsemu_opengl_unpack_row_length(row_length);
+
+    // FIXME: Replace constants
+    int tw = 1024;
+    int th = FSEMU_GLVIDEO_TEXTURE_HEIGHT;
+
+    // FIXME: Internal format vs format vs type, make sure to use efficient
+    // combos!
+    // GLenum format = GL_BGRA;
+    // GLenum type = GL_UNSIGNED_BYTE;
+
+    glTexSubImage2D(GL_TEXTURE_2D,
+                    0,
+                    rect->x,
+                    rect->y,
+                    rect->w,
+                    rect->h,
+                    fsemu_glvideo.format,
+                    fsemu_glvideo.type,
+                    upload);
+    fsemu_opengl_log_error_maybe();
+
+    // Duplicate right and bottom edge to remove bleed effect from unused
+    // pixels in the texture when doing bilinear filtering.
+    if (fsemu_glvideo.fix_bleed && rect->w < tw) {
+        // FIXME: Wrapper call via fsemu-opengl ?
+        glTexSubImage2D(GL_TEXTURE_2D,
+                        0,
+                        rect->w,
+                        rect->y,
+                        1,
+                        rect->h,
+                        fsemu_glvideo.format,
+                        fsemu_glvideo.type,
+                        upload + (rect->w - 1) * fsemu_glvideo.bpp);
+        fsemu_opengl_log_error_maybe();
+    }
+
+    // Only draw bottom border duplicate line for the last rows of the frame,
+    // and only if there is space for it in the texture
+    if (bottom_edge && fsemu_glvideo.fix_bleed && rect->y + rect->h < th) {
+        glTexSubImage2D(GL_TEXTURE_2D,
+                        0,
+                        0,
+                        rect->y + rect->h,
+                        rect->w,
+                        1,
+                        fsemu_glvideo.format,
+                        fsemu_glvideo.type,
+                        upload +
+                            (rect->h - 1) * row_length * fsemu_glvideo.bpp);
+        fsemu_opengl_log_error_maybe();
+        // Draw corner pixel if room for it
+        if (rect->w < tw) {
+            glTexSubImage2D(
+                GL_TEXTURE_2D,
+                0,
+                rect->w,
+                rect->y + rect->h,
+                1,
+                1,
+                fsemu_glvideo.format,
+                fsemu_glvideo.type,
+                upload + ((rect->h - 1) * row_length + rect->w - 1) *
+                             fsemu_glvideo.bpp);
+            fsemu_opengl_log_error_maybe();
+        }
+    }
+
+    if (pbo) {
+        fsemu_glvideo_pbo_unbind();
+    }
+}
+
 static void fsemu_glvideo_handle_frame(fsemu_video_frame_t *frame)
 {
     if (frame->dummy) {
+        fsemu_glvideo_mark_stale_rows(frame, 0);
         // FIXME: Include in parameter to fsemu_video_set_ready?
         // FIXME: 
         fsemu_frame_number_posted = frame->number;
@@ -190,6 +629,7 @@ static void fsemu_glvideo_handle_frame(fsemu_video_frame_t *frame)
         return;
     }
 
+    fsemu_glvideo_mark_stale_rows(frame, rect.y);
     int n = frame->number % FSEMU_GLVIDEO_N_TEXTURES;
 
     // fsemu_opengl_texture_2d(true);
@@ -201,61 +641,36 @@ static void fsemu_glvideo_handle_frame(fsemu_video_frame_t *frame)
     //                   pixels,
     //                   frame->stride);
 
-    int row_length = frame->stride / fsemu_glvideo.bpp;
-
-    // fsemu_opengl_unpack_row_length(frame->width == row_length ? 0 :
-    // row_length); fsemu_opengl_unpack_row_length(0);
-    fsemu_opengl_unpack_row_length(row_length);
-
-    // for (int i = 0; i < rect.w * rect.h * 4; i++) {
-    //     pixels[i] = i % 256;
-    // }
-    // pixels = (void *) 0xffff0000;
-
-    // FIXME: Replace constants
-    int tw = 1024;
-    int th = 1024;
-    // fsemu_video_fix_right_edge(pixels, rect.y, rect.w, rect.h, 1024, 1024);
-
-    // FIXME: Internal format vs format vs type, make sure to use efficient
-    // combos!
-    // GLenum format = GL_BGRA;
-    // GLenum type = GL_UNSIGNED_BYTE;
-
-    // printf("b x=%d y=%d size=%dx%d\n", rect.x, rect.y, rect.w, rect.h);
-
-    glTexSubImage2D(GL_TEXTURE_2D,
-                    0,
-                    rect.x,
-                    rect.y,
-                    rect.w,
-                    rect.h,
-                    fsemu_glvideo.format,
-                    fsemu_glvideo.type,
-                    pixels);
-    // FIXME: fsemu_opengl_log_error_maybe();
-    fsemu_opengl_log_error_maybe();
+    bool last_slice = !(frame->partial > 0 && frame->partial != frame->height);
+    // The perfgui slice lines are uploaded from client memory, so the pixel
+    // buffer objects are not used in that (debug) mode.
+    bool pbo = fsemu_glvideo_pbo.enabled && fsemu_perfgui_mode() != 2;
+    if (pbo && rect.y == 0) {
+        fsemu_glvideo_pbo_begin_frame();
+    }
 
-    // Duplicate right (and later, bottom) edge to remove bleed effect from
-    // unused pixels in the texture when doing bilinear filtering.
-    if (fsemu_glvideo.fix_bleed && rect.w < tw) {
-        // FIXME: Wrapper call via fsemu-opengl ?
-        // fsemu_opengl_unpack_row_length(row_length);
-        // fsemu_opengl_log_error_maybe();
-        glTexSubImage2D(GL_TEXTURE_2D,
-                        0,
-                        rect.w,
-                        rect.y,
-                        1,
-                        rect.h,
-                        fsemu_glvideo.format,
-                        fsemu_glvideo.type,
-                        // pixels + (rect.w * 4 * rect.y) + (rect.w - 1) * 4);
-                        pixels + (rect.w - 1) * fsemu_glvideo.bpp);
-        fsemu_opengl_log_error_maybe();
-        // FIXME: Remove
-        // fsemu_opengl_unpack_row_length(0);
-        // fsemu_opengl_log_error_maybe();
+    // Upload runs of rows which have changed since the texture was updated.
+    int end = rect.y + rect.h;
+    for (int y = rect.y; y < end;) {
+        if (!fsemu_glvideo_row_stale(n, y)) {
+            y++;
+            continue;
+        }
+        SDL_Rect run = rect;
+        run.y = y;
+        while (y < end && fsemu_glvideo_row_stale(n, y)) {
+            fsemu_glvideo_set_row_stale(n, y, false);
+            y++;
+        }
+        run.h = y - run.y;
+        fsemu_glvideo_upload_rows(pixels + (run.y - rect.y) * frame->stride,
+                                  frame->stride,
+                                  &run,
+                                  pbo,
+                                  last_slice && y == frame->height);
+    }
+    if (pbo && last_slice) {
+        fsemu_glvideo_pbo_frame_done();
     }
 
     if (fsemu_perfgui_mode() == 2) {
@@ -272,44 +687,16 @@ static void fsemu_glvideo_handle_frame(fsemu_video_frame_t *frame)
                         fsemu_glvideo.type,
                         slice_line);
         fsemu_opengl_log_error_maybe();
+        fsemu_glvideo_set_row_stale(n, rect.y, true);
     }
 
-    if (frame->partial > 0 && frame->partial != frame->height) {
+    if (!last_slice) {
         // glFlush();
         return;
     }
 
     fsemu_glvideo.limits_rect = frame->limits;
 
-    // Only draw bottom border duplicate line for last slice, and only if
-    // there is space for it in the texture
-    if (fsemu_glvideo.fix_bleed && rect.y + rect.h < th) {
-        glTexSubImage2D(GL_TEXTURE_2D,
-                        0,
-                        0,
-                        rect.y + rect.h,
-                        rect.w,
-                        1,
-                        fsemu_glvideo.format,
-                        fsemu_glvideo.type,
-                        pixels + (rect.w * fsemu_glvideo.bpp * (rect.h - 1)));
-        fsemu_opengl_log_error_maybe();
-        // Draw corner pixel if room for it
-        if (rect.w < tw) {
-            glTexSubImage2D(
-                GL_TEXTURE_2D,
-                0,
-                rect.w,
-                rect.y + rect.h,
-                1,
-                1,
-                fsemu_glvideo.format,
-                fsemu_glvideo.type,
-                pixels + (rect.w * rect.h - 1) * fsemu_glvideo.bpp);
-            fsemu_opengl_log_error_maybe();
-        }
-    }
-
     fsemu_video_log_debug(" draw ___________ READY______________ \n");
 
     // FIXME: Locked access for main/video thread separation?
@@ -1421,6 +1808,10 @@ void fsemu_glvideo_init_gl_state(void)
         fsemu_opengl_log_error_maybe();
     }
 
+    fsemu_glvideo_pbo_init(1024 * 1024 * fsemu_glvideo.bpp);
+    // New textures, nothing has been uploaded yet
+    memset(fsemu_glvideo.stale, 0xff, sizeof(fsemu_glvideo.stale));
+
     glGenTextures(2, fsemu_glvideo.perfgui_textures);
 
     for (int i = 0; i < 2; i++) {
@@ -1528,6 +1919,9 @@ void fsemu_glvideo_init(void)
     fsemu_glvideo.fix_bleed = true;
 #endif
 
+    fsemu_option_read_bool_default(
+        FSEMU_OPTION_VIDEO_PBO, &fsemu_glvideo_pbo.allowed, true);
+
     if (!fsemu_video_is_threaded()) {
         fsemu_glvideo_init_gl_state();
     }
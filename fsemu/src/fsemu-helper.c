@@ -29,6 +29,8 @@
 #include "fsemu-videothread.h"
 #include "fsemu-window.h"
 
+#include <fsemu/performance.h>
+
 static struct {
     fsemu_gui_item_t *gui;
 } fsemu_helper;
@@ -58,6 +60,9 @@ void fsemu_helper_init_emulator(const char *emulator_name,
     fsemu_boot_log("before fsemu_log_setup");
     fsemu_log_setup();
 
+    fsemu_boot_log("before fsemu_performance_init");
+    fsemu_performance_init();
+
     fsemu_boot_log("before fsemu_option_init");
     fsemu_option_init();
 
@@ -105,6 +105,19 @@ const char *fsemu_option_const_string(const char *name)
     return value;
 }
 
+void fsemu_option_set_string_if_unset(const char *name, const char *value)
+{
+    fsemu_thread_assert_main();
+    fsemu_assert(fsemu_option.initialized);
+
+    if (fsemu_option_const_string(name)) {
+        return;
+    }
+    fsemu_option_log("%s = %s (default)\n", name, value);
+    g_hash_table_insert(
+        fsemu_option.hash_table, g_strdup(name), g_strdup(value));
+}
+
 const char *fsemu_option_const_string_default(const char *name,
                                               const char *default_value)
 {
@@ -49,6 +49,11 @@ int fsemu_option_int_clamped_default(const char *name,
 int fsemu_option_read_bool_default(const char *name,
                                    bool *result,
                                    bool default_value);
+
+// Lets a module provide defaults for options read by other modules. Must be
+// called before the other module reads the option.
+void fsemu_option_set_string_if_unset(const char *name, const char *value);
+
 int fsemu_option_read_int(const char *name, int *result);
 // int fsemu_option_read_string(const char *name, int *result, int max_len);
 int fsemu_option_read_const_string(const char *name, const char **result);
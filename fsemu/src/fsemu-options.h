@@ -5,8 +5,12 @@
 
 #define FSEMU_OPTION_AUDIO_DEVICE "audio_device"
 #define FSEMU_OPTION_AUDIO_DRIVER "audio_driver"
+#define FSEMU_OPTION_AUDIO_RESAMPLE_QUALITY "audio_resample_quality"
 #define FSEMU_OPTION_AUTOMATIC_INPUT_GRAB "automatic_input_grab"
 
+#define FSEMU_OPTION_BENCHMARK_FRAMES "benchmark_frames"
+#define FSEMU_OPTION_BENCHMARK_OUTPUT "benchmark_output"
+
 #define FSEMU_OPTION_BUSY_WAIT "busy_wait"
 
 #define FSEMU_OPTION_FULLSCREEN "fullscreen"
@@ -49,6 +53,7 @@
 #define FSEMU_OPTION_SYSTEM_TITLEBAR "system_titlebar"
 
 #define FSEMU_OPTION_VIDEO_DRIVER "video_driver"
+#define FSEMU_OPTION_VIDEO_PBO "video_pbo"
 #define FSEMU_OPTION_VIDEO_SYNC "video_sync"  // Legacy option?
 #define FSEMU_OPTION_VIDEO_THREAD "video_thread"
 
@@ -7,6 +7,8 @@
 #include "fsemu-option.h"
 #include "fsemu-time.h"
 
+#include <fsemu/performance.h>
+
 #ifdef FSEMU_SDL
 
 // FIXME: Emulation thread should call the audio system whenever *starting*?
@@ -167,6 +169,8 @@ void fsemu_sdlaudio_callback(void *data, Uint8 *stream, int want_bytes)
 {
     static int64_t last_time;
     int64_t now = fsemu_time_us();
+    fsemu_performance_set_thread_name("audio");
+    fsemu_performance_log("AFIL", fsemu_audiobuffer_fill_ms());
 #if 1
     fsemu_audio_log_trace(
         "Buffer: %3d ms (dt %0.1f ms) want %5d B (%4d frames)\n",
@@ -194,15 +198,17 @@ void fsemu_sdlaudio_callback(void *data, Uint8 *stream, int want_bytes)
         // int want = fsemu_audio_frequency() * 50 / 1000 * 4;
         int want = 8192;
         // int want = 0;
-        fsemu_audiobuffer.read = fsemu_audiobuffer.write - want;
-        if (fsemu_audiobuffer.read < fsemu_audiobuffer.data) {
-            fsemu_audiobuffer.read += fsemu_audiobuffer.size;
+        uint8_t *reset = fsemu_audiobuffer_write_acquire() - want;
+        if (reset < fsemu_audiobuffer.data) {
+            reset += fsemu_audiobuffer.size;
         }
+        fsemu_audiobuffer_read_release(reset);
     }
     // -----------------------------------------------------------------------
 
-    uint8_t volatile *read = fsemu_audiobuffer.read;
-    uint8_t volatile *write = fsemu_audiobuffer.write;
+    // The read pointer is ours, the write pointer belongs to the producer.
+    uint8_t *read = fsemu_audiobuffer.read;
+    uint8_t *write = fsemu_audiobuffer_write_acquire();
 
     int bytes = 0;
     int bytes_written = 0;
@@ -222,13 +228,7 @@ void fsemu_sdlaudio_callback(void *data, Uint8 *stream, int want_bytes)
 
     // int error = fsemu_audio_alsa_write((void *) read, bytes);
     // FIXME: Check for underrun
-#if 1
-    for (int i = 0; i < bytes; i++) {
-        stream[i] = read[i];
-    }
-#else
-    memcpy(stream, (void *) read, bytes);
-#endif
+    memcpy(stream, read, bytes);
     stream += bytes;
 
     want_bytes -= bytes;
@@ -245,13 +245,7 @@ void fsemu_sdlaudio_callback(void *data, Uint8 *stream, int want_bytes)
             }
             // error = fsemu_audio_alsa_write((void *) read, bytes);
             // FIXME: Check for underrun
-#if 1
-            for (int i = 0; i < bytes; i++) {
-                stream[i] = read[i];
-            }
-#else
-            memcpy(stream, (void *) read, bytes);
-#endif
+            memcpy(stream, read, bytes);
             stream += bytes;
 
             want_bytes -= bytes;
@@ -265,7 +259,8 @@ void fsemu_sdlaudio_callback(void *data, Uint8 *stream, int want_bytes)
         memset(stream, 0, want_bytes);
         // FIXME: Re-enable with log level
         // fsemu_audio_log("%d bytes short of refilling SDL :(\n", want_bytes);
-        fsemu_audiobuffer.add_silence = 1;
+        __atomic_store_n(&fsemu_audiobuffer.add_silence, 1, __ATOMIC_RELEASE);
+        fsemu_audiobuffer_register_underrun(want_bytes);
     }
 #endif
 
@@ -276,7 +271,7 @@ void fsemu_sdlaudio_callback(void *data, Uint8 *stream, int want_bytes)
         buffered_bytes, now, (uintptr_t) read, (uintptr_t) write);
 
     last_time = now;
-    fsemu_audiobuffer.read = read;
+    fsemu_audiobuffer_read_release(read);
 
     if (bytes_written != wanted_bytes) {
         // FIXME: Re-enable with log level
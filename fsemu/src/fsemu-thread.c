@@ -10,6 +10,8 @@
 #include "fsemu-time.h"
 #include "fsemu-util.h"
 
+#include <fsemu/performance.h>
+
 // #include <fs/base.h>
 // #include <fs/log.h>
 // #include <fs/thread.h>
@@ -110,6 +112,7 @@ void fsemu_thread_init(void)
 void fsemu_thread_set_emu(void)
 {
     fsemu_thread_emu_thread_id = fsemu_thread_id();
+    fsemu_performance_set_thread_name("emulation");
 }
 
 void fsemu_thread_set_main(void)
@@ -120,6 +123,7 @@ void fsemu_thread_set_main(void)
 void fsemu_thread_set_video(void)
 {
     fsemu_thread_video_thread_id = fsemu_thread_id();
+    fsemu_performance_set_thread_name("video");
 }
 
 fsemu_thread_id_t fsemu_thread_id(void)
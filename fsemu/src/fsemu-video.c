@@ -1,6 +1,7 @@
 #define FSEMU_INTERNAL
 #include "fsemu-video.h"
 
+#include "fsemu-benchmark.h"
 #include "fsemu-frame.h"
 #include "fsemu-frameinfo.h"
 #include "fsemu-glib.h"
@@ -22,6 +23,7 @@
 #include "fsemu-videothread.h"
 #include "fsemu-window.h"
 #include "fsemu.h"
+#include <fsemu/performance.h>
 
 int fsemu_video_log_level = FSEMU_LOG_LEVEL_INFO;
 
@@ -126,9 +128,40 @@ void fsemu_video_finalize_and_free_frame(fsemu_video_frame_t *frame)
     if (frame->finalize) {
         frame->finalize(frame);
     }
+    free(frame->dirty);
     free(frame);
 }
 
+void fsemu_video_frame_set_dirty_rows(fsemu_video_frame_t *frame,
+                                      const uint32_t *bits,
+                                      int rows)
+{
+    int words = (rows + 31) / 32;
+    free(frame->dirty);
+    frame->dirty = (uint32_t *) malloc(words * sizeof(uint32_t));
+    memcpy(frame->dirty, bits, words * sizeof(uint32_t));
+    frame->dirty_rows = rows;
+}
+
+// When a frame is thrown away, the rows it changed must be considered
+// changed by the frame replacing it.
+static void fsemu_video_merge_dirty_rows(fsemu_video_frame_t *frame,
+                                         fsemu_video_frame_t *dropped)
+{
+    if (frame->dirty == NULL || dropped->dummy) {
+        return;
+    }
+    if (dropped->dirty == NULL || dropped->dirty_rows > frame->dirty_rows) {
+        free(frame->dirty);
+        frame->dirty = NULL;
+        frame->dirty_rows = 0;
+        return;
+    }
+    for (int i = 0; i < (dropped->dirty_rows + 31) / 32; i++) {
+        frame->dirty[i] |= dropped->dirty[i];
+    }
+}
+
 // ----------------------------------------------------------------------------
 
 void fsemu_video_drawable_size(fsemu_size_t *size)
@@ -273,11 +306,13 @@ void fsemu_video_render(void)
         fsemu_video.did_render_frame = false;
     } else {
         fsemu_frame_log_epoch("Render\n");
+        fsemu_performance_begin("REND");
         if (fsemu_video.renderer == FSEMU_VIDEO_RENDERER_SDL) {
             fsemu_sdlvideo_render();
         } else if (fsemu_video.renderer == FSEMU_VIDEO_RENDERER_GL) {
             fsemu_glvideo_render();
         }
+        fsemu_performance_end("REND");
         fsemu_video.did_render_frame = true;
     }
     fsemu_video.ready = false;
@@ -319,11 +354,13 @@ void fsemu_video_display(void)
     }
 
     fsemu_frame_log_epoch("Display\n");
+    fsemu_performance_begin("SWAP");
     if (fsemu_video.renderer == FSEMU_VIDEO_RENDERER_SDL) {
         fsemu_sdlvideo_display();
     } else if (fsemu_video.renderer == FSEMU_VIDEO_RENDERER_GL) {
         fsemu_glvideo_display();
     }
+    fsemu_performance_end("SWAP");
 
     // fsemu_assert(fsemu_frame_number_displayed == fsemu_frame_number_posted -
     // 1);
@@ -352,6 +389,14 @@ void fsemu_video_post_frame(fsemu_video_frame_t *frame)
 
     frame->number = frame_number;
 
+    fsemu_benchmark_checksum_frame(frame);
+    if (fsemu_video.renderer == FSEMU_VIDEO_RENDERER_NULL) {
+        // Nothing will retrieve the frame (headless / benchmark mode)
+        fsemu_video.last_posted_frame = frame_number;
+        fsemu_video_finalize_and_free_frame(frame);
+        return;
+    }
+
     g_async_queue_lock(fsemu_video_frame_queue);
 
     // if (fsemu_video.last_posted_frame > fsemu_video.last_retrieved_frame) {
@@ -366,6 +411,7 @@ void fsemu_video_post_frame(fsemu_video_frame_t *frame)
         GList *keep = NULL;
         fsemu_video_frame_t *f;
         while ((f = g_async_queue_try_pop_unlocked(fsemu_video_frame_queue))) {
+            fsemu_video_merge_dirty_rows(frame, f);
             if (f->number == fsemu_video.last_retrieved_frame) {
                 // Need to keep this
                 keep = g_list_append(keep, f);
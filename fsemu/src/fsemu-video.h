@@ -37,6 +37,12 @@ typedef struct fsemu_video_frame_t {
     int number;
     // No actual frame data, used in pause mode
     bool dummy;
+    // Optional bitmap with one bit per row (dirty_rows rows, from the top of
+    // the buffer) for rows changed since the previous frame was posted. NULL
+    // means that any row may have changed. Set with
+    // fsemu_video_frame_set_dirty_rows, freed together with the frame.
+    uint32_t *dirty;
+    int dirty_rows;
 
     void (*finalize)(struct fsemu_video_frame_t *frame);
     void *finalize_data;
@@ -203,6 +209,21 @@ static inline fsemu_video_frame_t *fsemu_video_alloc_frame(void)
 
 void fsemu_video_finalize_and_free_frame(fsemu_video_frame_t *frame);
 
+// Copies the bitmap of changed rows into the frame (see dirty above).
+void fsemu_video_frame_set_dirty_rows(fsemu_video_frame_t *frame,
+                                      const uint32_t *bits,
+                                      int rows);
+
+// Returns true if row y may have changed since the previous frame.
+static inline bool fsemu_video_frame_row_dirty(fsemu_video_frame_t *frame,
+                                               int y)
+{
+    if (frame->dirty == NULL || y < 0 || y >= frame->dirty_rows) {
+        return true;
+    }
+    return (frame->dirty[y / 32] >> (y % 32)) & 1;
+}
+
 void fsemu_video_post_frame(fsemu_video_frame_t *frame);
 
 #ifdef FSEMU_INTERNAL
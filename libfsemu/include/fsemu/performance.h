@@ -7,9 +7,19 @@
 extern "C" {
 #endif
 
+// Does nothing unless FSEMU_PERFORMANCE_LOG is set to a file path. All the
+// logging functions are lock-free and can be called from any thread.
+
 void fsemu_performance_init(void);
-void fsemu_performance_log(char series[4], int64_t value);
-void fsemu_performance_log_with_time(char series[4], int64_t value, int64_t time);
+void fsemu_performance_quit(void);
+void fsemu_performance_log(const char series[4], int64_t value);
+void fsemu_performance_log_with_time(const char series[4],
+                                     int64_t value,
+                                     int64_t time);
+// Duration events; begin and end must be called on the same thread.
+void fsemu_performance_begin(const char series[4]);
+void fsemu_performance_end(const char series[4]);
+void fsemu_performance_set_thread_name(const char *name);
 void fsemu_performance_flush(void);
 
 #ifdef __cplusplus
@@ -12,97 +12,292 @@
 #include <fs/thread.h>
 
 #include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Each thread logs into its own ring buffer. The thread owning the ring is
+// the only writer and the flusher is the only reader, so logging an event is
+// a handful of stores and never waits for anything. If a ring is full, the
+// event is dropped and counted, and the count is written to the log as a
+// DROP event.
+//
+// A writer thread drains the rings every few milliseconds into the file
+// given by FSEMU_PERFORMANCE_LOG, using a compact binary format:
+//
+//   header:  "FSEMUPRF" followed by one version byte (1)
+//   record:  type byte, thread id (varint), then
+//            'N' (thread name): length (varint), name bytes
+//            'C' (counter), 'B' (begin), 'E' (end), 'D' (dropped):
+//            series (4 bytes), time delta in us (zigzag varint),
+//            value (zigzag varint)
+//
+// Time deltas are relative to the previous event record in the file, the
+// first one relative to the time the log was opened. Use
+// contrib/fsemu-performance-trace.py to convert the log to Chrome trace /
+// Perfetto JSON.
+
+#define RING_SIZE 4096
+#define FLUSH_INTERVAL_US 10000
 
 typedef struct fsemu_performance_entry
 {
   char series[4];
+  uint8_t type;
   int64_t time;
   int64_t value;
 } fsemu_performance_entry;
 
-const int BUFFER_SIZE = 1024;
+typedef struct fsemu_performance_thread
+{
+  struct fsemu_performance_thread *next;
+  int id;
+  // Set once by the owning thread, published with name_set
+  char name[32];
+  int name_set;
+  int name_written;
+  // write_pos is only written by the owning thread and read_pos only by
+  // the flusher
+  uint32_t write_pos;
+  uint32_t read_pos;
+  uint32_t dropped;
+  fsemu_performance_entry ring[RING_SIZE];
+} fsemu_performance_thread;
 
 static int64_t fsemu_performance_epoch;
-static volatile fsemu_performance_entry *buffer;
-static fsemu_performance_entry *buffer_end;
-static volatile fsemu_performance_entry * volatile write_p;
-static volatile fsemu_performance_entry * read_p;
+static int64_t fsemu_performance_last_time;
 static FILE *fsemu_performance_file;
-// Write mutex, to allow writing to the ring buffer from multiple threads
-static fs_mutex *fsemu_performance_mutex;
+static volatile int fsemu_performance_enabled;
+static fsemu_performance_thread *fsemu_performance_threads;
+static int fsemu_performance_thread_count;
+static GPrivate fsemu_performance_current = G_PRIVATE_INIT(NULL);
+// Only serializes flushers (writer thread and explicit flush calls), the
+// logging functions never take it.
+static fs_mutex *fsemu_performance_flush_mutex;
+static fs_thread *fsemu_performance_writer;
+static volatile int fsemu_performance_stop;
+
+static fsemu_performance_thread *fsemu_performance_thread_get(void)
+{
+  fsemu_performance_thread *t = g_private_get(&fsemu_performance_current);
+  if (t) {
+    return t;
+  }
+  t = g_malloc0(sizeof(fsemu_performance_thread));
+  t->id = __atomic_fetch_add(
+      &fsemu_performance_thread_count, 1, __ATOMIC_RELAXED);
+  // Threads are never unregistered; the flusher may still be draining the
+  // ring after the thread is gone.
+  t->next = __atomic_load_n(&fsemu_performance_threads, __ATOMIC_ACQUIRE);
+  while (!__atomic_compare_exchange_n(&fsemu_performance_threads,
+                                      &t->next,
+                                      t,
+                                      true,
+                                      __ATOMIC_RELEASE,
+                                      __ATOMIC_ACQUIRE)) {
+  }
+  g_private_set(&fsemu_performance_current, t);
+  return t;
+}
+
+static void fsemu_performance_add(
+    const char series[4], int type, int64_t value, int64_t time)
+{
+  fsemu_performance_thread *t = fsemu_performance_thread_get();
+  uint32_t w = t->write_pos;
+  uint32_t r = __atomic_load_n(&t->read_pos, __ATOMIC_ACQUIRE);
+  if (w - r >= RING_SIZE) {
+    __atomic_fetch_add(&t->dropped, 1, __ATOMIC_RELAXED);
+    return;
+  }
+  fsemu_performance_entry *e = &t->ring[w & (RING_SIZE - 1)];
+  memcpy(e->series, series, 4);
+  e->type = type;
+  e->time = time;
+  e->value = value;
+  __atomic_store_n(&t->write_pos, w + 1, __ATOMIC_RELEASE);
+}
+
+void fsemu_performance_log_with_time(
+    const char series[4], int64_t value, int64_t time)
+{
+  if (!fsemu_performance_enabled) {
+    return;
+  }
+  fsemu_performance_add(series, 'C', value, time);
+}
 
-void fsemu_performance_log_with_time(char series[4], int64_t value, int64_t time)
+void fsemu_performance_log(const char series[4], int64_t value)
 {
-  if (buffer == NULL) {
+  if (!fsemu_performance_enabled) {
+    return;
+  }
+  fsemu_performance_add(series, 'C', value, fs_get_monotonic_time());
+}
+
+void fsemu_performance_begin(const char series[4])
+{
+  if (!fsemu_performance_enabled) {
+    return;
+  }
+  fsemu_performance_add(series, 'B', 0, fs_get_monotonic_time());
+}
+
+void fsemu_performance_end(const char series[4])
+{
+  if (!fsemu_performance_enabled) {
+    return;
+  }
+  fsemu_performance_add(series, 'E', 0, fs_get_monotonic_time());
+}
+
+void fsemu_performance_set_thread_name(const char *name)
+{
+  if (!fsemu_performance_enabled) {
+    return;
+  }
+  fsemu_performance_thread *t = fsemu_performance_thread_get();
+  if (t->name_set) {
     return;
   }
-  fs_mutex_lock(fsemu_performance_mutex);
-  write_p->series[0] = series[0];
-  write_p->series[1] = series[1];
-  write_p->series[2] = series[2];
-  write_p->series[3] = series[3];
-  write_p->time = time;
-  write_p->value = value;
-  if (++write_p == buffer_end) {
-    write_p = buffer;
-  }
-  fs_mutex_unlock(fsemu_performance_mutex);
+  g_strlcpy(t->name, name, sizeof(t->name));
+  __atomic_store_n(&t->name_set, 1, __ATOMIC_RELEASE);
+}
+
+static uint8_t *fsemu_performance_put_varint(uint8_t *p, uint64_t v)
+{
+  while (v >= 0x80) {
+    *p++ = (v & 0x7f) | 0x80;
+    v >>= 7;
+  }
+  *p++ = v;
+  return p;
 }
 
-void fsemu_performance_log(char series[4], int64_t value)
+static uint8_t *fsemu_performance_put_zigzag(uint8_t *p, int64_t v)
 {
-  fsemu_performance_log_with_time(series, value, fs_get_monotonic_time());
+  return fsemu_performance_put_varint(
+      p, ((uint64_t) v << 1) ^ (uint64_t)(v >> 63));
+}
+
+static void fsemu_performance_write_event(int id,
+                                          int type,
+                                          const char series[4],
+                                          int64_t time,
+                                          int64_t value)
+{
+  // type + 3 varints of at most 10 bytes + series
+  uint8_t record[40];
+  uint8_t *p = record;
+  time -= fsemu_performance_epoch;
+  *p++ = type;
+  p = fsemu_performance_put_varint(p, id);
+  memcpy(p, series, 4);
+  p += 4;
+  p = fsemu_performance_put_zigzag(p, time - fsemu_performance_last_time);
+  p = fsemu_performance_put_zigzag(p, value);
+  fsemu_performance_last_time = time;
+  fwrite(record, p - record, 1, fsemu_performance_file);
+}
+
+static void fsemu_performance_write_name(fsemu_performance_thread *t)
+{
+  uint8_t record[16];
+  uint8_t *p = record;
+  int len = strlen(t->name);
+  *p++ = 'N';
+  p = fsemu_performance_put_varint(p, t->id);
+  p = fsemu_performance_put_varint(p, len);
+  fwrite(record, p - record, 1, fsemu_performance_file);
+  fwrite(t->name, len, 1, fsemu_performance_file);
 }
 
 void fsemu_performance_flush(void)
 {
-  char series[5] = { 0 };
-  volatile fsemu_performance_entry *p = read_p;
-  // const fsemu_performance_entry *write_p_copy = write_p;
-  if (read_p > write_p) {
-    // Read remaining ring buffer when writing has wrapped
-    while(p < buffer_end) {
-      series[0] = p->series[0];
-      series[1] = p->series[1];
-      series[2] = p->series[2];
-      series[3] = p->series[3];
-      int64_t time = p->time - fsemu_performance_epoch;
-      int64_t value = p->value;
-      fprintf(fsemu_performance_file, "%s,%" PRId64 ",%" PRId64 "\n", series, time, value);
-      ++p;
+  if (!fsemu_performance_enabled) {
+    return;
+  }
+  fs_mutex_lock(fsemu_performance_flush_mutex);
+  if (!fsemu_performance_file) {
+    // Closed by fsemu_performance_quit
+    fs_mutex_unlock(fsemu_performance_flush_mutex);
+    return;
+  }
+  fsemu_performance_thread *t =
+      __atomic_load_n(&fsemu_performance_threads, __ATOMIC_ACQUIRE);
+  for (; t; t = t->next) {
+    if (!t->name_written &&
+        __atomic_load_n(&t->name_set, __ATOMIC_ACQUIRE)) {
+      fsemu_performance_write_name(t);
+      t->name_written = 1;
+    }
+    uint32_t w = __atomic_load_n(&t->write_pos, __ATOMIC_ACQUIRE);
+    uint32_t r = t->read_pos;
+    for (; r != w; r++) {
+      fsemu_performance_entry *e = &t->ring[r & (RING_SIZE - 1)];
+      fsemu_performance_write_event(
+          t->id, e->type, e->series, e->time, e->value);
+    }
+    __atomic_store_n(&t->read_pos, r, __ATOMIC_RELEASE);
+    uint32_t dropped = __atomic_exchange_n(&t->dropped, 0, __ATOMIC_RELAXED);
+    if (dropped) {
+      fsemu_performance_write_event(
+          t->id, 'D', "DROP", fs_get_monotonic_time(), dropped);
     }
-    p = buffer;
-  }
-  while(p < write_p) {
-    series[0] = p->series[0];
-    series[1] = p->series[1];
-    series[2] = p->series[2];
-    series[3] = p->series[3];
-    int64_t time = p->time - fsemu_performance_epoch;
-    int64_t value = p->value;
-    fprintf(fsemu_performance_file, "%s,%" PRId64 ",%" PRId64 "\n", series, time, value);
-    ++p;
-  }
-  read_p = p;
+  }
+  fflush(fsemu_performance_file);
+  fs_mutex_unlock(fsemu_performance_flush_mutex);
+}
+
+static void *fsemu_performance_writer_thread(void *data)
+{
+  while (!fsemu_performance_stop) {
+    g_usleep(FLUSH_INTERVAL_US);
+    fsemu_performance_flush();
+  }
+  return NULL;
+}
+
+void fsemu_performance_quit(void)
+{
+  if (!fsemu_performance_enabled) {
+    return;
+  }
+  if (fsemu_performance_writer) {
+    fsemu_performance_stop = 1;
+    fs_thread_wait(fsemu_performance_writer);
+    fs_thread_free(fsemu_performance_writer);
+    fsemu_performance_writer = NULL;
+  }
+  fsemu_performance_flush();
+  fs_mutex_lock(fsemu_performance_flush_mutex);
+  fsemu_performance_enabled = 0;
+  // Threads may still be logging, so the rings are left alone
+  fclose(fsemu_performance_file);
+  fsemu_performance_file = NULL;
+  fs_mutex_unlock(fsemu_performance_flush_mutex);
 }
 
 void fsemu_performance_init(void)
 {
+  if (fsemu_performance_file) {
+    return;
+  }
   const gchar *log_file_path = g_getenv("FSEMU_PERFORMANCE_LOG");
-  if (log_file_path) {
-    fs_log("Performance: Log file is %s\n", log_file_path);
-    fsemu_performance_file = g_fopen(log_file_path, "wb");
+  if (!log_file_path) {
+    return;
   }
-  if (fsemu_performance_file) {
-    fsemu_performance_mutex = fs_mutex_create();
-    fsemu_performance_entry *allocated = malloc(sizeof(fsemu_performance_entry) * BUFFER_SIZE);
-    buffer = allocated;
-    buffer_end = allocated + BUFFER_SIZE;
-    read_p = buffer;
-    write_p = buffer;
-    fsemu_performance_epoch = fs_get_monotonic_time();
-    fs_log("Performance: Buffer initialized with %d entries\n", BUFFER_SIZE);
-  } else {
+  fs_log("Performance: Log file is %s\n", log_file_path);
+  fsemu_performance_file = g_fopen(log_file_path, "wb");
+  if (!fsemu_performance_file) {
     fs_log("Performance: Could not open log file for writing\n");
+    return;
   }
+  fwrite("FSEMUPRF\x01", 9, 1, fsemu_performance_file);
+  fsemu_performance_flush_mutex = fs_mutex_create();
+  fsemu_performance_epoch = fs_get_monotonic_time();
+  fsemu_performance_enabled = 1;
+  fsemu_performance_writer = fs_thread_create(
+      "performance", fsemu_performance_writer_thread, NULL);
+  atexit(fsemu_performance_quit);
+  fs_log("Performance: Logging with %d entries per thread\n", RING_SIZE);
 }
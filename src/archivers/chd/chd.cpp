@@ -40,6 +40,14 @@ static const UINT32 METADATA_HEADER_SIZE = 16;          // metadata header size
 static const UINT8 V34_MAP_ENTRY_FLAG_TYPE_MASK = 0x0f;     // what type of hunk
 static const UINT8 V34_MAP_ENTRY_FLAG_NO_CRC = 0x10;        // no CRC is present
 
+// hunk cache entry states
+enum
+{
+	HUNK_FREE = 0,                              // entry is unused
+	HUNK_PENDING,                               // being decoded ahead by a worker
+	HUNK_VALID                                  // holds decompressed data
+};
+
 
 
 // V3-V4 entry types
@@ -105,6 +113,34 @@ struct chd_file::metadata_hash
 };
 
 
+// ======================> hunk_cache_entry
+
+// a decompressed hunk in the hunk cache
+struct chd_file::hunk_cache_entry
+{
+	chd_file *              file;           // owning file, for the workers
+	UINT32                  hunknum;        // which hunk is cached here
+	UINT32                  lastused;       // LRU clock value of the last use
+	UINT8                   state;          // HUNK_FREE, HUNK_PENDING or HUNK_VALID
+	bool                    readahead;      // decoded ahead and not used yet
+	osd_work_item *         item;           // work item while pending
+	chd_error               err;            // result of the read-ahead decode
+	osd_ticks_t             ticks;          // time the read-ahead decode took
+	dynamic_buffer          data;           // decompressed data
+};
+
+
+// ======================> decoder_set
+
+// a set of decompressors for one read-ahead worker
+struct chd_file::decoder_set
+{
+	decoder_set *           next;           // next idle set
+	chd_decompressor *      decompressor[4];// decompression codecs
+	dynamic_buffer          compressed;     // buffer for compressed data
+};
+
+
 
 //**************************************************************************
 //  INLINE FUNCTIONS
@@ -175,9 +211,13 @@ inline void chd_file::file_read(UINT64 offset, void *dest, UINT32 length)
 	if (m_file == NULL)
 		throw CHDERR_NOT_OPEN;
 
-	// seek and read
+	// seek and read; the read-ahead workers share the file
+	if (m_file_lock != NULL)
+		osd_lock_acquire(m_file_lock);
 	core_fseek(m_file, offset, SEEK_SET);
 	UINT32 count = core_fread(m_file, dest, length);
+	if (m_file_lock != NULL)
+		osd_lock_release(m_file_lock);
 	if (count != length)
 		throw CHDERR_READ_ERROR;
 }
@@ -271,7 +311,13 @@ inline UINT8 chd_file::bits_for_value(UINT64 value)
 
 chd_file::chd_file()
 	: m_file(NULL),
-		m_owns_file(false)
+		m_owns_file(false),
+		m_hunkcache(NULL),
+		m_decode_queue(NULL),
+		m_decoders(NULL),
+		m_decoder_lock(NULL),
+		m_file_lock(NULL),
+		m_hunkcache_lock(NULL)
 {
 	// reset state
 	memset(m_decompressor, 0, sizeof(m_decompressor));
@@ -671,6 +717,9 @@ chd_error chd_file::open(core_file &file, bool writeable, chd_file *parent)
 
 void chd_file::close()
 {
+	// stop the read-ahead workers before the file goes away
+	hunk_cache_free();
+
 	// reset file characteristics
 	if (m_owns_file && m_file != NULL)
 		core_fclose(m_file);
@@ -722,6 +771,19 @@ void chd_file::close()
 //-------------------------------------------------
 
 chd_error chd_file::read_hunk(UINT32 hunknum, void *buffer)
+{
+	return read_hunk_common(hunknum, buffer, m_decompressor, m_compressed, true);
+}
+
+
+//-------------------------------------------------
+//  read_hunk_common - read a single hunk using
+//  the given decompressors and buffer for the
+//  compressed data; the read-ahead workers can't
+//  follow references to the parent
+//-------------------------------------------------
+
+chd_error chd_file::read_hunk_common(UINT32 hunknum, void *buffer, chd_decompressor **decompressor, UINT8 *compbuf, bool allow_parent)
 {
 	// wrap this for clean reporting
 	try
@@ -752,8 +814,8 @@ chd_error chd_file::read_hunk(UINT32 hunknum, void *buffer)
 				{
 					case V34_MAP_ENTRY_TYPE_COMPRESSED:
 						blocklen = be_read(&rawmap[12], 2) + (rawmap[14] << 16);
-						file_read(blockoffs, m_compressed, blocklen);
-						m_decompressor[0]->decompress(m_compressed, blocklen, dest, m_hunkbytes);
+						file_read(blockoffs, compbuf, blocklen);
+						decompressor[0]->decompress(compbuf, blocklen, dest, m_hunkbytes);
 						if (!(rawmap[15] & V34_MAP_ENTRY_FLAG_NO_CRC) && dest != NULL && crc32_creator::simple(dest, m_hunkbytes) != blockcrc)
 							throw CHDERR_DECOMPRESSION_ERROR;
 						return CHDERR_NONE;
@@ -773,10 +835,10 @@ chd_error chd_file::read_hunk(UINT32 hunknum, void *buffer)
 						return CHDERR_NONE;
 
 					case V34_MAP_ENTRY_TYPE_SELF_HUNK:
-						return read_hunk(blockoffs, dest);
+						return read_hunk_common(blockoffs, dest, decompressor, compbuf, allow_parent);
 
 					case V34_MAP_ENTRY_TYPE_PARENT_HUNK:
-						if (m_parent_missing)
+						if (m_parent_missing || !allow_parent)
 							throw CHDERR_REQUIRES_PARENT;
 						return m_parent->read_hunk(blockoffs, dest);
 				}
@@ -792,7 +854,7 @@ chd_error chd_file::read_hunk(UINT32 hunknum, void *buffer)
 					blockoffs = UINT64(be_read(rawmap, 4)) * UINT64(m_hunkbytes);
 					if (blockoffs != 0)
 						file_read(blockoffs, dest, m_hunkbytes);
-					else if (m_parent_missing)
+					else if (m_parent_missing || (m_parent != NULL && !allow_parent))
 						throw CHDERR_REQUIRES_PARENT;
 					else if (m_parent != NULL)
 						m_parent->read_hunk(hunknum, dest);
@@ -811,11 +873,11 @@ chd_error chd_file::read_hunk(UINT32 hunknum, void *buffer)
 					case COMPRESSION_TYPE_1:
 					case COMPRESSION_TYPE_2:
 					case COMPRESSION_TYPE_3:
-						file_read(blockoffs, m_compressed, blocklen);
-						m_decompressor[rawmap[0]]->decompress(m_compressed, blocklen, dest, m_hunkbytes);
-						if (!m_decompressor[rawmap[0]]->lossy() && dest != NULL && crc16_creator::simple(dest, m_hunkbytes) != blockcrc)
+						file_read(blockoffs, compbuf, blocklen);
+						decompressor[rawmap[0]]->decompress(compbuf, blocklen, dest, m_hunkbytes);
+						if (!decompressor[rawmap[0]]->lossy() && dest != NULL && crc16_creator::simple(dest, m_hunkbytes) != blockcrc)
 							throw CHDERR_DECOMPRESSION_ERROR;
-						if (m_decompressor[rawmap[0]]->lossy() && crc16_creator::simple(m_compressed, blocklen) != blockcrc)
+						if (decompressor[rawmap[0]]->lossy() && crc16_creator::simple(compbuf, blocklen) != blockcrc)
 							throw CHDERR_DECOMPRESSION_ERROR;
 						return CHDERR_NONE;
 
@@ -826,10 +888,10 @@ chd_error chd_file::read_hunk(UINT32 hunknum, void *buffer)
 						return CHDERR_NONE;
 
 					case COMPRESSION_SELF:
-						return read_hunk(blockoffs, dest);
+						return read_hunk_common(blockoffs, dest, decompressor, compbuf, allow_parent);
 
 					case COMPRESSION_PARENT:
-						if (m_parent_missing)
+						if (m_parent_missing || !allow_parent)
 							throw CHDERR_REQUIRES_PARENT;
 						return m_parent->read_bytes(UINT64(blockoffs) * UINT64(m_parent->unit_bytes()), dest, m_hunkbytes);
 				}
@@ -959,9 +1021,21 @@ chd_error chd_file::read_bytes(UINT64 offset, void *buffer, UINT32 bytes)
 		UINT32 startoffs = (curhunk == first_hunk) ? (offset % m_hunkbytes) : 0;
 		UINT32 endoffs = (curhunk == last_hunk) ? ((offset + bytes - 1) % m_hunkbytes) : (m_hunkbytes - 1);
 
-		// if it's a full block, just read directly from disk unless it's the cached hunk
+		// if the hunk cache is enabled, copy from there
 		chd_error err = CHDERR_NONE;
-		if (startoffs == 0 && endoffs == m_hunkbytes - 1 && curhunk != m_cachehunk)
+		if (m_hunkcache != NULL)
+		{
+			// CD audio and data may be read from different threads
+			const UINT8 *data;
+			osd_lock_acquire(m_hunkcache_lock);
+			err = hunk_cache_read(curhunk, data);
+			if (err == CHDERR_NONE)
+				memcpy(dest, &data[startoffs], endoffs + 1 - startoffs);
+			osd_lock_release(m_hunkcache_lock);
+		}
+
+		// if it's a full block, just read directly from disk unless it's the cached hunk
+		else if (startoffs == 0 && endoffs == m_hunkbytes - 1 && curhunk != m_cachehunk)
 			err = read_hunk(curhunk, dest);
 
 		// otherwise, read from the cache
@@ -1031,6 +1105,360 @@ chd_error chd_file::write_bytes(UINT64 offset, const void *buffer, UINT32 bytes)
 }
 
 
+//-------------------------------------------------
+//  set_hunk_cache - keep up to cachebytes of
+//  decompressed hunks in an LRU cache, and decode
+//  up to readahead hunks in the background when
+//  the hunks are read sequentially
+//-------------------------------------------------
+
+void chd_file::set_hunk_cache(UINT32 cachebytes, UINT32 readahead)
+{
+	hunk_cache_free();
+
+	// only worth it for compressed files; writable files use the single-hunk cache
+	if (m_file == NULL || !compressed() || m_allow_writes)
+		return;
+	UINT32 count = cachebytes / m_hunkbytes;
+	if (count > m_hunkcount)
+		count = m_hunkcount;
+	if (count < 2)
+		return;
+
+	// leave room for the hunk being read and the one before it
+	if (readahead > count - 2)
+		readahead = count - 2;
+	if (readahead > WORK_MAX_THREADS)
+		readahead = WORK_MAX_THREADS;
+
+	m_hunkcache = new hunk_cache_entry[count];
+	for (UINT32 entrynum = 0; entrynum < count; entrynum++)
+	{
+		hunk_cache_entry &entry = m_hunkcache[entrynum];
+		entry.file = this;
+		entry.hunknum = ~0;
+		entry.lastused = 0;
+		entry.state = HUNK_FREE;
+		entry.readahead = false;
+		entry.item = NULL;
+		entry.err = CHDERR_NONE;
+		entry.ticks = 0;
+		entry.data.resize(m_hunkbytes);
+	}
+	m_hunkcache_count = count;
+	m_hunkcache_lock = osd_lock_alloc();
+	m_readahead = readahead;
+	if (readahead > 0)
+	{
+		m_decoder_lock = osd_lock_alloc();
+		m_file_lock = osd_lock_alloc();
+		m_decode_queue = osd_work_queue_alloc(WORK_QUEUE_FLAG_MULTI);
+	}
+	write_log(_T("CHD: caching %u hunks of %u bytes, read-ahead %u hunks\n"), count, m_hunkbytes, readahead);
+}
+
+
+//-------------------------------------------------
+//  hunk_cache_free - wait for the read-ahead
+//  workers and free the hunk cache
+//-------------------------------------------------
+
+void chd_file::hunk_cache_free()
+{
+	if (m_decode_queue != NULL)
+		osd_work_queue_free(m_decode_queue);
+	if (m_hunkcache != NULL)
+	{
+		if (m_stat_reads > 0)
+		{
+			write_log(_T("CHD: %llu hunk reads, %llu%% cached (%llu%% decoded ahead), %llu hunks decoded (%llu ahead), %llu us per hunk\n"),
+				(unsigned long long)m_stat_reads,
+				(unsigned long long)(m_stat_hits * 100 / m_stat_reads),
+				(unsigned long long)(m_stat_readahead_hits * 100 / m_stat_reads),
+				(unsigned long long)m_stat_decoded,
+				(unsigned long long)m_stat_readahead,
+				(unsigned long long)(m_stat_decoded ? m_stat_decode_ticks * 1000000 / osd_ticks_per_second() / m_stat_decoded : 0));
+		}
+		for (UINT32 entrynum = 0; entrynum < m_hunkcache_count; entrynum++)
+			if (m_hunkcache[entrynum].item != NULL)
+				osd_work_item_release(m_hunkcache[entrynum].item);
+		delete[] m_hunkcache;
+	}
+	while (m_decoders != NULL)
+	{
+		decoder_set *set = m_decoders;
+		m_decoders = set->next;
+		for (int decompnum = 0; decompnum < ARRAY_LENGTH(set->decompressor); decompnum++)
+			delete set->decompressor[decompnum];
+		delete set;
+	}
+	if (m_decoder_lock != NULL)
+		osd_lock_free(m_decoder_lock);
+	if (m_file_lock != NULL)
+		osd_lock_free(m_file_lock);
+	if (m_hunkcache_lock != NULL)
+		osd_lock_free(m_hunkcache_lock);
+
+	m_hunkcache = NULL;
+	m_hunkcache_count = 0;
+	m_hunkcache_clock = 0;
+	m_hunkcache_last = NULL;
+	m_readahead = 0;
+	m_lasthunk = ~0;
+	m_decode_queue = NULL;
+	m_decoder_lock = NULL;
+	m_file_lock = NULL;
+	m_hunkcache_lock = NULL;
+	m_stat_reads = 0;
+	m_stat_hits = 0;
+	m_stat_readahead_hits = 0;
+	m_stat_decoded = 0;
+	m_stat_readahead = 0;
+	m_stat_decode_ticks = 0;
+}
+
+
+//-------------------------------------------------
+//  hunk_cache_find - find the cache entry for a
+//  hunk, or NULL if it is not cached
+//-------------------------------------------------
+
+chd_file::hunk_cache_entry *chd_file::hunk_cache_find(UINT32 hunknum)
+{
+	// partial reads usually hit the same hunk over and over
+	if (m_hunkcache_last != NULL && m_hunkcache_last->hunknum == hunknum && m_hunkcache_last->state != HUNK_FREE)
+		return m_hunkcache_last;
+	for (UINT32 entrynum = 0; entrynum < m_hunkcache_count; entrynum++)
+	{
+		hunk_cache_entry *entry = &m_hunkcache[entrynum];
+		if (entry->hunknum == hunknum && entry->state != HUNK_FREE)
+			return entry;
+	}
+	return NULL;
+}
+
+
+//-------------------------------------------------
+//  hunk_cache_victim - find the entry to reuse,
+//  never the one holding keephunk; pending
+//  entries are only reused if wait is set
+//-------------------------------------------------
+
+chd_file::hunk_cache_entry *chd_file::hunk_cache_victim(UINT32 keephunk, bool wait)
+{
+	hunk_cache_entry *victim = NULL;
+	hunk_cache_entry *pending = NULL;
+	for (UINT32 entrynum = 0; entrynum < m_hunkcache_count; entrynum++)
+	{
+		hunk_cache_entry *entry = &m_hunkcache[entrynum];
+		if (entry->state == HUNK_FREE)
+			return entry;
+		if (entry->hunknum == keephunk)
+			continue;
+		if (entry->state == HUNK_PENDING)
+		{
+			if (pending == NULL || entry->lastused < pending->lastused)
+				pending = entry;
+		}
+		else if (victim == NULL || entry->lastused < victim->lastused)
+			victim = entry;
+	}
+	if (victim == NULL && wait && pending != NULL)
+	{
+		hunk_cache_complete(pending);
+		victim = pending;
+	}
+	if (victim != NULL)
+	{
+		victim->state = HUNK_FREE;
+		victim->readahead = false;
+	}
+	return victim;
+}
+
+
+//-------------------------------------------------
+//  hunk_cache_complete - wait for a pending
+//  read-ahead decode to finish
+//-------------------------------------------------
+
+void chd_file::hunk_cache_complete(hunk_cache_entry *entry)
+{
+	osd_work_item_wait(entry->item, 100 * osd_ticks_per_second());
+	osd_work_item_release(entry->item);
+	entry->item = NULL;
+	m_stat_decode_ticks += entry->ticks;
+
+	// hunks that need the parent or failed are decoded again when read
+	if (entry->err == CHDERR_NONE)
+	{
+		entry->state = HUNK_VALID;
+		m_stat_decoded++;
+		m_stat_readahead++;
+	}
+	else
+	{
+		entry->state = HUNK_FREE;
+		entry->readahead = false;
+	}
+}
+
+
+//-------------------------------------------------
+//  hunk_cache_read - return the decompressed data
+//  of a hunk, decoding it if it is not cached;
+//  the data stays valid until the next call;
+//  called with m_hunkcache_lock held
+//-------------------------------------------------
+
+chd_error chd_file::hunk_cache_read(UINT32 hunknum, const UINT8 *&data)
+{
+	if (hunknum >= m_hunkcount)
+		return CHDERR_HUNK_OUT_OF_RANGE;
+
+	m_stat_reads++;
+	hunk_cache_entry *entry = hunk_cache_find(hunknum);
+	if (entry != NULL && entry->state == HUNK_PENDING)
+		hunk_cache_complete(entry);
+	if (entry != NULL && entry->state == HUNK_VALID)
+	{
+		m_stat_hits++;
+		if (entry->readahead)
+		{
+			m_stat_readahead_hits++;
+			entry->readahead = false;
+		}
+	}
+	else
+	{
+		entry = hunk_cache_victim(hunknum, true);
+		osd_ticks_t start = osd_ticks();
+		chd_error err = read_hunk(hunknum, entry->data);
+		m_stat_decode_ticks += osd_ticks() - start;
+		if (err != CHDERR_NONE)
+			return err;
+		m_stat_decoded++;
+		entry->hunknum = hunknum;
+		entry->state = HUNK_VALID;
+	}
+	entry->lastused = ++m_hunkcache_clock;
+	m_hunkcache_last = entry;
+	data = entry->data;
+
+	// start decoding the following hunks when reading sequentially
+	if (m_decode_queue != NULL && hunknum == m_lasthunk + 1)
+		hunk_cache_readahead(hunknum);
+	m_lasthunk = hunknum;
+	return CHDERR_NONE;
+}
+
+
+//-------------------------------------------------
+//  hunk_cache_readahead - queue the hunks after
+//  hunknum that are not cached yet for decoding
+//-------------------------------------------------
+
+void chd_file::hunk_cache_readahead(UINT32 hunknum)
+{
+	for (UINT32 ahead = 1; ahead <= m_readahead && hunknum + ahead < m_hunkcount; ahead++)
+	{
+		if (hunk_cache_find(hunknum + ahead) != NULL)
+			continue;
+		hunk_cache_entry *entry = hunk_cache_victim(hunknum, false);
+		if (entry == NULL)
+			break;
+		entry->hunknum = hunknum + ahead;
+		entry->state = HUNK_PENDING;
+		entry->readahead = true;
+		entry->lastused = ++m_hunkcache_clock;
+		entry->err = CHDERR_NONE;
+		entry->ticks = 0;
+		entry->item = osd_work_item_queue(m_decode_queue, hunk_decode_static, entry, 0);
+		if (entry->item == NULL)
+		{
+			entry->state = HUNK_FREE;
+			break;
+		}
+	}
+}
+
+
+//-------------------------------------------------
+//  hunk_decode_static - read-ahead worker, decodes
+//  a hunk into its cache entry
+//-------------------------------------------------
+
+void *chd_file::hunk_decode_static(void *param, int threadid)
+{
+	hunk_cache_entry *entry = reinterpret_cast<hunk_cache_entry *>(param);
+	chd_file *file = entry->file;
+	decoder_set *set = file->decoder_acquire();
+	if (set == NULL)
+	{
+		entry->err = CHDERR_OUT_OF_MEMORY;
+		return NULL;
+	}
+	osd_ticks_t start = osd_ticks();
+	entry->err = file->read_hunk_common(entry->hunknum, entry->data, set->decompressor, set->compressed, false);
+	entry->ticks = osd_ticks() - start;
+	file->decoder_release(set);
+	return NULL;
+}
+
+
+//-------------------------------------------------
+//  decoder_acquire - get an idle set of
+//  decompressors, or create a new one; the codecs
+//  keep state so each worker needs its own
+//-------------------------------------------------
+
+chd_file::decoder_set *chd_file::decoder_acquire()
+{
+	osd_lock_acquire(m_decoder_lock);
+	decoder_set *set = m_decoders;
+	if (set != NULL)
+		m_decoders = set->next;
+	osd_lock_release(m_decoder_lock);
+	if (set != NULL)
+		return set;
+
+	set = new decoder_set;
+	memset(set->decompressor, 0, sizeof(set->decompressor));
+	try
+	{
+		for (int decompnum = 0; decompnum < ARRAY_LENGTH(m_compression); decompnum++)
+		{
+			set->decompressor[decompnum] = chd_codec_list::new_decompressor(m_compression[decompnum], *this);
+			if (set->decompressor[decompnum] == NULL && m_compression[decompnum] != 0)
+				throw CHDERR_UNKNOWN_COMPRESSION;
+		}
+		set->compressed.resize(m_hunkbytes);
+	}
+	catch (chd_error &)
+	{
+		for (int decompnum = 0; decompnum < ARRAY_LENGTH(set->decompressor); decompnum++)
+			delete set->decompressor[decompnum];
+		delete set;
+		return NULL;
+	}
+	return set;
+}
+
+
+//-------------------------------------------------
+//  decoder_release - return a set of
+//  decompressors to the idle list
+//-------------------------------------------------
+
+void chd_file::decoder_release(decoder_set *set)
+{
+	osd_lock_acquire(m_decoder_lock);
+	set->next = m_decoders;
+	m_decoders = set;
+	osd_lock_release(m_decoder_lock);
+}
+
+
 //-------------------------------------------------
 //  read_metadata - read the indexed metadata
 //  of the given type
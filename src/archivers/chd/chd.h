@@ -346,6 +346,9 @@ public:
 	chd_error read_bytes(UINT64 offset, void *buffer, UINT32 bytes);
 	chd_error write_bytes(UINT64 offset, const void *buffer, UINT32 bytes);
 
+	// decompressed hunk cache
+	void set_hunk_cache(UINT32 cachebytes, UINT32 readahead);
+
 	// metadata management
 	chd_error read_metadata(chd_metadata_tag searchtag, UINT32 searchindex, astring &output);
 	chd_error read_metadata(chd_metadata_tag searchtag, UINT32 searchindex, dynamic_buffer &output);
@@ -369,6 +372,8 @@ public:
 private:
 	struct metadata_entry;
 	struct metadata_hash;
+	struct hunk_cache_entry;
+	struct decoder_set;
 
 	// inline helpers
 	UINT64 be_read(const UINT8 *base, int numbytes);
@@ -398,6 +403,16 @@ private:
 	void metadata_set_previous_next(UINT64 prevoffset, UINT64 nextoffset);
 	void metadata_update_hash();
 	static int CLIB_DECL metadata_hash_compare(const void *elem1, const void *elem2);
+	chd_error read_hunk_common(UINT32 hunknum, void *buffer, chd_decompressor **decompressor, UINT8 *compbuf, bool allow_parent);
+	chd_error hunk_cache_read(UINT32 hunknum, const UINT8 *&data);
+	hunk_cache_entry *hunk_cache_find(UINT32 hunknum);
+	hunk_cache_entry *hunk_cache_victim(UINT32 keephunk, bool wait);
+	void hunk_cache_complete(hunk_cache_entry *entry);
+	void hunk_cache_readahead(UINT32 hunknum);
+	void hunk_cache_free();
+	decoder_set *decoder_acquire();
+	void decoder_release(decoder_set *set);
+	static void *hunk_decode_static(void *param, int threadid);
 
 	// file characteristics
 	core_file *             m_file;             // handle to the open core file
@@ -436,6 +451,27 @@ private:
 	// caching
 	dynamic_buffer          m_cache;            // single-hunk cache for partial reads/writes
 	UINT32                  m_cachehunk;        // which hunk is in the cache?
+
+	// decompressed hunk cache
+	hunk_cache_entry *      m_hunkcache;        // LRU of decompressed hunks, or NULL if disabled
+	UINT32                  m_hunkcache_count;  // number of entries in the hunk cache
+	UINT32                  m_hunkcache_clock;  // LRU clock
+	hunk_cache_entry *      m_hunkcache_last;   // most recently used entry
+	UINT32                  m_readahead;        // number of hunks to decode ahead
+	UINT32                  m_lasthunk;         // last hunk read, to detect sequential access
+	osd_work_queue *        m_decode_queue;     // worker threads for read-ahead decoding
+	decoder_set *           m_decoders;         // idle decompressors for the workers
+	osd_lock *              m_decoder_lock;     // protects the list of idle decompressors
+	osd_lock *              m_file_lock;        // serializes file access with the workers
+	osd_lock *              m_hunkcache_lock;   // protects the LRU and entry states between readers
+
+	// hunk cache statistics
+	UINT64                  m_stat_reads;       // hunk lookups
+	UINT64                  m_stat_hits;        // hunk lookups found in the cache
+	UINT64                  m_stat_readahead_hits; // of which were decoded ahead
+	UINT64                  m_stat_decoded;     // hunks decoded
+	UINT64                  m_stat_readahead;   // of which were decoded ahead
+	osd_ticks_t             m_stat_decode_ticks;// time spent reading and decoding hunks
 };
 
 
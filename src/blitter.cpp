@@ -23,6 +23,7 @@
 #include "blit.h"
 #include "savestate.h"
 #include "debug.h"
+#include "uae/time.h"
 
 // 1 = logging
 // 2 = no wait detection
@@ -289,6 +290,671 @@ void build_blitfilltable (void)
 	}
 }
 
+/* Row based blitter engine for immediate and non cycle exact blits.
+
+A whole row of every enabled channel is fetched from chip RAM into host
+endian buffers, A and B are shifted as a row, the minterm runs on the
+complete row and the result is filled and stored as a row. The minterm
+is a template on the LF byte so each of the 256 functions reduces to a
+few logic operations, SSE2 does 8 words per round. Results are identical
+to the word by word loops in blitter_dofast() and blitter_dofast_desc(),
+which are still used when chip RAM is not directly accessible or when D
+overlaps a source in a way that makes the row order visible.  */
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define BLIT_SIMD 1
+typedef uae_u16 blitvec __attribute__ ((vector_size (16)));
+#endif
+
+enum { blitfast_scalar, blitfast_sse2 };
+// -2 = not checked yet, -1 = disabled
+static int blitfast_mode = -2;
+static const TCHAR *blitfast_names[] = { _T("scalar"), _T("SSE2") };
+
+static void blitfast_init (void);
+
+struct blitfast {
+	uae_u8 *mem;		/* host address of chip RAM */
+	uaecptr pt[4];		/* A, B, C, D, 0 = channel not used */
+	uae_u8 mt;
+	bool desc;
+	bool fill;
+	bool ife;
+	int fci;
+};
+
+typedef void blitfast_func (uae_u16 *, const uae_u16 *, const uae_u16 *, const uae_u16 *, int);
+
+static uae_u16 blitfast_xa[BLITTER_MAX_WORDS + 1], blitfast_xb[BLITTER_MAX_WORDS + 1];
+static uae_u16 blitfast_sa[BLITTER_MAX_WORDS], blitfast_sb[BLITTER_MAX_WORDS];
+static uae_u16 blitfast_c[BLITTER_MAX_WORDS], blitfast_d[BLITTER_MAX_WORDS];
+
+/* LF bits 3-0 (or 7-4) as a function of B and C */
+template <int F, typename T>
+STATIC_INLINE T blitfast_minterm2 (T b, T c)
+{
+	switch (F)
+	{
+	case 0x0: return b ^ b;
+	case 0x1: return ~(b | c);
+	case 0x2: return c & ~b;
+	case 0x3: return ~b;
+	case 0x4: return b & ~c;
+	case 0x5: return ~c;
+	case 0x6: return b ^ c;
+	case 0x7: return ~(b & c);
+	case 0x8: return b & c;
+	case 0x9: return ~(b ^ c);
+	case 0xa: return c;
+	case 0xb: return ~b | c;
+	case 0xc: return b;
+	case 0xd: return b | ~c;
+	case 0xe: return b | c;
+	default: return ~(b ^ b);
+	}
+}
+
+/* Split on A, the usual cookie cut and copy minterms end up as one or
+two operations.  */
+template <int MT, typename T>
+STATIC_INLINE T blitfast_minterm (T a, T b, T c)
+{
+	const int hi = MT >> 4, lo = MT & 15;
+
+	if (hi == lo)
+		return blitfast_minterm2<lo> (b, c);
+	if (hi == (lo ^ 15))
+		return a ^ blitfast_minterm2<lo> (b, c);
+	if (lo == 0)
+		return a & blitfast_minterm2<hi> (b, c);
+	if (hi == 0)
+		return ~a & blitfast_minterm2<lo> (b, c);
+	if (lo == 15)
+		return ~a | blitfast_minterm2<hi> (b, c);
+	if (hi == 15)
+		return a | blitfast_minterm2<lo> (b, c);
+	T l = blitfast_minterm2<lo> (b, c);
+	return l ^ (a & (blitfast_minterm2<hi> (b, c) ^ l));
+}
+
+template <int MT>
+static void blitfast_mt_scalar (uae_u16 *d, const uae_u16 *a, const uae_u16 *b, const uae_u16 *c, int n)
+{
+	for (int i = 0; i < n; i++)
+		d[i] = (uae_u16)blitfast_minterm<MT, uae_u32> (a[i], b[i], c[i]);
+}
+
+#ifdef BLIT_SIMD
+template <int MT>
+__attribute__((target("sse2")))
+static void blitfast_mt_sse2 (uae_u16 *d, const uae_u16 *a, const uae_u16 *b, const uae_u16 *c, int n)
+{
+	int i = 0;
+	for (; i + 8 <= n; i += 8) {
+		blitvec va, vb, vc, vd;
+		memcpy (&va, a + i, sizeof va);
+		memcpy (&vb, b + i, sizeof vb);
+		memcpy (&vc, c + i, sizeof vc);
+		vd = blitfast_minterm<MT, blitvec> (va, vb, vc);
+		memcpy (d + i, &vd, sizeof vd);
+	}
+	for (; i < n; i++)
+		d[i] = (uae_u16)blitfast_minterm<MT, uae_u32> (a[i], b[i], c[i]);
+}
+#endif
+
+#define BLITFAST_MT4(f, n) f<(n)>, f<(n) + 1>, f<(n) + 2>, f<(n) + 3>
+#define BLITFAST_MT16(f, n) BLITFAST_MT4 (f, n), BLITFAST_MT4 (f, (n) + 4), BLITFAST_MT4 (f, (n) + 8), BLITFAST_MT4 (f, (n) + 12)
+#define BLITFAST_MT64(f, n) BLITFAST_MT16 (f, n), BLITFAST_MT16 (f, (n) + 16), BLITFAST_MT16 (f, (n) + 32), BLITFAST_MT16 (f, (n) + 48)
+#define BLITFAST_MT256(f) BLITFAST_MT64 (f, 0), BLITFAST_MT64 (f, 64), BLITFAST_MT64 (f, 128), BLITFAST_MT64 (f, 192)
+
+static blitfast_func * const blitfast_funcs[][256] = {
+	{ BLITFAST_MT256 (blitfast_mt_scalar) },
+#ifdef BLIT_SIMD
+	{ BLITFAST_MT256 (blitfast_mt_sse2) },
+#endif
+};
+
+#ifdef BLIT_SIMD
+__attribute__((target("sse2")))
+static int blitfast_load_sse2 (uae_u16 *dst, const uae_u8 *src, int n)
+{
+	int i = 0;
+	for (; i + 8 <= n; i += 8) {
+		blitvec v;
+		memcpy (&v, src + i * 2, sizeof v);
+		v = (v << 8) | (v >> 8);
+		memcpy (dst + i, &v, sizeof v);
+	}
+	return i;
+}
+
+__attribute__((target("sse2")))
+static int blitfast_store_sse2 (uae_u8 *dst, const uae_u16 *src, int n)
+{
+	int i = 0;
+	for (; i + 8 <= n; i += 8) {
+		blitvec v;
+		memcpy (&v, src + i, sizeof v);
+		v = (v << 8) | (v >> 8);
+		memcpy (dst + i * 2, &v, sizeof v);
+	}
+	return i;
+}
+
+__attribute__((target("sse2")))
+static int blitfast_shift_sse2 (uae_u16 *dst, const uae_u16 *hi, const uae_u16 *lo, int n, int k)
+{
+	/* lane shifts by 16 are undefined, split them in two */
+	int r1 = k / 2, r2 = k - r1;
+	int l1 = (16 - k) / 2, l2 = (16 - k) - l1;
+	int i = 0;
+	for (; i + 8 <= n; i += 8) {
+		blitvec vh, vl;
+		memcpy (&vh, hi + i, sizeof vh);
+		memcpy (&vl, lo + i, sizeof vl);
+		vl = ((vl >> r1) >> r2) | ((vh << l1) << l2);
+		memcpy (dst + i, &vl, sizeof vl);
+	}
+	return i;
+}
+#endif
+
+/* Fetch n big endian words in blit order */
+static void blitfast_load (uae_u16 *dst, const uae_u8 *src, int n, bool desc, int mode)
+{
+	int i = 0;
+	if (desc) {
+		for (; i < n; i++, src -= 2)
+			dst[i] = (src[0] << 8) | src[1];
+		return;
+	}
+#ifdef BLIT_SIMD
+	if (mode == blitfast_sse2)
+		i = blitfast_load_sse2 (dst, src, n);
+#endif
+	for (; i < n; i++)
+		dst[i] = (src[i * 2] << 8) | src[i * 2 + 1];
+}
+
+static void blitfast_store (uae_u8 *dst, const uae_u16 *src, int n, bool desc, int mode)
+{
+	int i = 0;
+	if (desc) {
+		for (; i < n; i++, dst -= 2) {
+			dst[0] = src[i] >> 8;
+			dst[1] = (uae_u8)src[i];
+		}
+		return;
+	}
+#ifdef BLIT_SIMD
+	if (mode == blitfast_sse2)
+		i = blitfast_store_sse2 (dst, src, n);
+#endif
+	for (; i < n; i++) {
+		dst[i * 2] = src[i] >> 8;
+		dst[i * 2 + 1] = (uae_u8)src[i];
+	}
+}
+
+/* Barrel shift a row, src[-1] holds the previous word. Ascending blits
+use (prev:cur) >> k, descending ones (cur:prev) >> k, 0 <= k <= 16.  */
+static void blitfast_shift (uae_u16 *dst, const uae_u16 *src, int n, int k, bool desc, int mode)
+{
+	int i = 0;
+	const uae_u16 *hi = desc ? src : src - 1;
+	const uae_u16 *lo = desc ? src - 1 : src;
+
+#ifdef BLIT_SIMD
+	if (mode == blitfast_sse2)
+		i = blitfast_shift_sse2 (dst, hi, lo, n, k);
+#endif
+	for (; i < n; i++)
+		dst[i] = (uae_u16)((((uae_u32)hi[i] << 16) | lo[i]) >> k);
+}
+
+/* Area fill, same result as the blit_filltable lookups. Within a word
+the fill carry at bit n is the running xor of bits 0-n.  */
+static int blitfast_fill (uae_u16 *d, int n, int fc, bool ife)
+{
+	for (int i = 0; i < n; i++) {
+		uae_u32 x = d[i];
+		uae_u32 p = x ^ (x << 1);
+		p ^= p << 2;
+		p ^= p << 4;
+		p ^= p << 8;
+		p &= 0xffff;
+		if (fc)
+			p ^= 0xffff;
+		d[i] = ife ? (uae_u16)(x | (p ^ x)) : (uae_u16)p;
+		fc = p >> 15;
+	}
+	return fc;
+}
+
+/* Run a whole blit, returns the final fill carry */
+static int blitfast_run (const struct blitfast *bf, struct bltinfo *b, int mode)
+{
+	int h = b->hblitsize;
+	int step = bf->desc ? -2 : 2;
+	int ka = bf->desc ? b->blitdownashift : b->blitashift;
+	int kb = bf->desc ? b->blitdownbshift : b->blitbshift;
+	uaecptr pa = bf->pt[0], pb = bf->pt[1], pc = bf->pt[2], pd = bf->pt[3];
+	blitfast_func *func = blitfast_funcs[mode][bf->mt];
+	uae_u16 *xa = blitfast_xa + 1, *xb = blitfast_xb + 1;
+	uae_u16 *sb = blitfast_sb;
+	uae_u16 *d = blitfast_d;
+	uae_u32 total = 0;
+	int fc = bf->fci;
+
+	if (!pa) {
+		for (int i = 0; i < h; i++)
+			xa[i] = b->bltadat;
+	}
+	if (!pb) {
+		/* B hold stays as it is, no shift */
+		for (int i = 0; i < h; i++)
+			sb[i] = b->bltbhold;
+	}
+	if (!pc) {
+		for (int i = 0; i < h; i++)
+			blitfast_c[i] = b->bltcdat;
+	}
+
+	for (int j = 0; j < b->vblitsize; j++) {
+		if (pa) {
+			blitfast_load (xa, bf->mem + pa, h, bf->desc, mode);
+			b->bltadat = xa[h - 1];
+			pa += step * h + (bf->desc ? -b->bltamod : b->bltamod);
+		} else {
+			xa[0] = xa[h - 1] = b->bltadat;
+		}
+		xa[0] &= blit_masktable[0];
+		xa[h - 1] &= blit_masktable[h - 1];
+		xa[-1] = b->bltaold;
+		b->bltaold = xa[h - 1];
+		blitfast_shift (blitfast_sa, xa, h, ka, bf->desc, mode);
+
+		if (pb) {
+			blitfast_load (xb, bf->mem + pb, h, bf->desc, mode);
+			xb[-1] = b->bltbold;
+			b->bltbold = b->bltbdat = xb[h - 1];
+			blitfast_shift (sb, xb, h, kb, bf->desc, mode);
+			pb += step * h + (bf->desc ? -b->bltbmod : b->bltbmod);
+		}
+
+		if (pc) {
+			blitfast_load (blitfast_c, bf->mem + pc, h, bf->desc, mode);
+			b->bltcdat = blitfast_c[h - 1];
+			if (bf->desc)
+				b->bltbdat = b->bltcdat;
+			pc += step * h + (bf->desc ? -b->bltcmod : b->bltcmod);
+		}
+
+		func (d, blitfast_sa, sb, blitfast_c, h);
+		fc = bf->fci;
+		if (bf->fill)
+			fc = blitfast_fill (d, h, fc, bf->ife);
+		for (int i = 0; i < h; i++)
+			total |= d[i];
+
+		if (pd) {
+			blitfast_store (bf->mem + pd, d, h, bf->desc, mode);
+			pd += step * h + (bf->desc ? -b->bltdmod : b->bltdmod);
+		}
+	}
+
+	if (pb)
+		b->bltbhold = sb[h - 1];
+	b->bltddat = d[h - 1];
+	if (total)
+		b->blitzero = 0;
+	return fc;
+}
+
+/* Byte range touched by one channel, false if it leaves chip RAM */
+static bool blitfast_range (uaecptr pt, int mod, const struct bltinfo *b, bool desc, uae_u32 size, uae_s64 *lo, uae_s64 *hi)
+{
+	uae_s64 w = b->hblitsize * 2;
+	uae_s64 stride = (w + mod) * (desc ? -1 : 1);
+	uae_s64 first = pt, last = pt + stride * (b->vblitsize - 1);
+
+	if (desc) {
+		first -= w - 2;
+		last -= w - 2;
+	}
+	*lo = first < last ? first : last;
+	*hi = (first < last ? last : first) + w;
+	return *lo >= 0 && *hi <= size;
+}
+
+/* The row engine reads a complete row before writing it. That is only
+the same as the word by word order if D does not overlap a source, or
+follows it exactly with rows that do not overlap each other.  */
+static bool blitfast_safe (const struct blitfast *bf, const struct bltinfo *b, uae_u32 size)
+{
+	const int mods[4] = { b->bltamod, b->bltbmod, b->bltcmod, b->bltdmod };
+	uae_s64 lo[4], hi[4];
+	int w = b->hblitsize * 2;
+
+	for (int i = 0; i < 4; i++) {
+		if (bf->pt[i] && !blitfast_range (bf->pt[i], mods[i], b, bf->desc, size, &lo[i], &hi[i]))
+			return false;
+	}
+	if (!bf->pt[3])
+		return true;
+	for (int i = 0; i < 3; i++) {
+		if (!bf->pt[i] || hi[i] <= lo[3] || hi[3] <= lo[i])
+			continue;
+		if (bf->pt[i] == bf->pt[3] && mods[i] == mods[3] && (mods[3] >= 0 || mods[3] <= -2 * w))
+			continue;
+		return false;
+	}
+	return true;
+}
+
+static bool blitfast_direct (uaecptr pta, uaecptr ptb, uaecptr ptc, uaecptr ptd, bool desc)
+{
+	struct blitfast bf;
+	uae_u32 size;
+	int k1 = desc ? blt_info.blitdownashift : blt_info.blitashift;
+	int k2 = desc ? blt_info.blitdownbshift : blt_info.blitbshift;
+
+	if (blitfast_mode < -1)
+		blitfast_init ();
+	if (blitfast_mode < 0 || (log_blitter & 4))
+		return false;
+#ifdef DEBUGGER
+	if (memwatch_enabled)
+		return false;
+#endif
+	if (blt_info.hblitsize <= 0 || blt_info.hblitsize > BLITTER_MAX_WORDS || blt_info.vblitsize <= 0)
+		return false;
+	if (k1 < 0 || k1 > 16 || k2 < 0 || k2 > 16)
+		return false;
+	bf.mem = chipmem_agnus_direct (&size);
+	if (!bf.mem)
+		return false;
+	bf.pt[0] = pta;
+	bf.pt[1] = ptb;
+	bf.pt[2] = ptc;
+	bf.pt[3] = ptd;
+	if (!blitfast_safe (&bf, &blt_info, size))
+		return false;
+	bf.mt = bltcon0 & 0xff;
+	bf.desc = desc;
+	bf.fill = blitfill != 0;
+	bf.ife = blitife != 0;
+	bf.fci = !!(bltcon1 & 0x4);
+	blitfc = blitfast_run (&bf, &blt_info, blitfast_mode);
+	return true;
+}
+
+/* Word by word reference on host memory, same steps as blitter_dofast()
+and blitter_dofast_desc(). Used by the self-test and the benchmark.  */
+static int blitfast_reference (const struct blitfast *bf, struct bltinfo *b)
+{
+	uaecptr pa = bf->pt[0], pb = bf->pt[1], pc = bf->pt[2], pd = bf->pt[3];
+	int step = bf->desc ? -2 : 2;
+	int sign = bf->desc ? -1 : 1;
+	int ifemode = bf->ife ? 2 : 0;
+	uae_u32 blitbhold = b->bltbhold;
+	int fc = bf->fci;
+
+	for (int j = 0; j < b->vblitsize; j++) {
+		fc = bf->fci;
+		for (int i = 0; i < b->hblitsize; i++) {
+			uae_u32 bltadat, blitahold;
+			if (pa) {
+				b->bltadat = bltadat = do_get_mem_word ((uae_u16 *)(bf->mem + pa));
+				pa += step;
+			} else {
+				bltadat = b->bltadat;
+			}
+			bltadat &= blit_masktable[i];
+			if (bf->desc)
+				blitahold = (((uae_u32)bltadat << 16) | b->bltaold) >> b->blitdownashift;
+			else
+				blitahold = (((uae_u32)b->bltaold << 16) | bltadat) >> b->blitashift;
+			b->bltaold = bltadat;
+			if (pb) {
+				uae_u16 bltbdat = do_get_mem_word ((uae_u16 *)(bf->mem + pb));
+				pb += step;
+				if (bf->desc)
+					blitbhold = (((uae_u32)bltbdat << 16) | b->bltbold) >> b->blitdownbshift;
+				else
+					blitbhold = (((uae_u32)b->bltbold << 16) | bltbdat) >> b->blitbshift;
+				b->bltbold = bltbdat;
+				b->bltbdat = bltbdat;
+			}
+			if (pc) {
+				b->bltcdat = do_get_mem_word ((uae_u16 *)(bf->mem + pc));
+				if (bf->desc)
+					b->bltbdat = b->bltcdat;
+				pc += step;
+			}
+			b->bltddat = blit_func (blitahold, blitbhold, b->bltcdat, bf->mt) & 0xFFFF;
+			if (bf->fill) {
+				uae_u16 d = b->bltddat;
+				int fc1 = blit_filltable[d & 255][ifemode + fc][1];
+				b->bltddat = (blit_filltable[d & 255][ifemode + fc][0]
+					+ (blit_filltable[d >> 8][ifemode + fc1][0] << 8));
+				fc = blit_filltable[d >> 8][ifemode + fc1][1];
+			}
+			if (b->bltddat)
+				b->blitzero = 0;
+			if (pd) {
+				do_put_mem_word ((uae_u16 *)(bf->mem + pd), b->bltddat);
+				pd += step;
+			}
+		}
+		if (pa)
+			pa += sign * b->bltamod;
+		if (pb)
+			pb += sign * b->bltbmod;
+		if (pc)
+			pc += sign * b->bltcmod;
+		if (pd)
+			pd += sign * b->bltdmod;
+	}
+	b->bltbhold = blitbhold;
+	return fc;
+}
+
+#define BLITFAST_TESTMEM 65536
+/* the self-test areas end below 0x8200 */
+#define BLITFAST_CHECKMEM 0x8200
+
+static uae_u32 blitfast_savedmask[2];
+
+static uae_u8 *blitfast_testdata (void)
+{
+	uae_u8 *mem = xmalloc (uae_u8, BLITFAST_TESTMEM);
+	uae_u32 seed = 0x12345678;
+	for (int i = 0; i < BLITFAST_TESTMEM; i++) {
+		seed = seed * 1103515245 + 12345;
+		mem[i] = seed >> 16;
+	}
+	return mem;
+}
+
+static void blitfast_testsetup (struct blitfast *bf, struct bltinfo *b, int cfg, int h, int v)
+{
+	bool desc = (cfg & 1) != 0;
+	int w = h * 2;
+
+	memset (b, 0, sizeof (struct bltinfo));
+	b->hblitsize = h;
+	b->vblitsize = v;
+	b->blitashift = (cfg * 5) & 15;
+	b->blitbshift = (cfg * 3 + 1) & 15;
+	b->blitdownashift = 16 - b->blitashift;
+	b->blitdownbshift = 16 - b->blitbshift;
+	b->bltadat = 0x8421 ^ cfg;
+	b->bltbhold = 0x1248 ^ cfg;
+	b->bltcdat = 0x5aa5;
+	b->bltaold = 0x3c3c;
+	b->bltbold = 0xc3c3;
+	b->bltamod = (cfg & 2) ? 6 : 0;
+	b->bltbmod = (cfg & 4) ? -2 : 2;
+	b->bltcmod = b->bltdmod = 4;
+	b->blitzero = 1;
+	bf->desc = desc;
+	bf->fill = (cfg & 8) != 0;
+	bf->ife = (cfg & 16) != 0;
+	bf->fci = (cfg >> 5) & 1;
+	/* separate areas, C and D walk the same words */
+	bf->pt[0] = (cfg & 64) ? 0 : 0x1000;
+	bf->pt[1] = (cfg & 128) ? 0 : 0x4000;
+	bf->pt[2] = 0x8000;
+	bf->pt[3] = 0x8000;
+	if (desc) {
+		for (int i = 0; i < 4; i++) {
+			if (bf->pt[i])
+				bf->pt[i] += (w + 8) * v;
+		}
+	}
+	/* a blit may be in progress, blitfast_testdone() puts its masks back */
+	blitfast_savedmask[0] = blit_masktable[0];
+	blitfast_savedmask[1] = blit_masktable[h - 1];
+	blit_masktable[0] = 0xfff0 ^ cfg;
+	if (h > 1)
+		blit_masktable[h - 1] = 0xffff;
+	blit_masktable[h - 1] &= 0x0fff ^ (cfg << 4);
+}
+
+static void blitfast_testdone (int h)
+{
+	blit_masktable[h - 1] = blitfast_savedmask[1];
+	blit_masktable[0] = blitfast_savedmask[0];
+}
+
+/* compare against the reference for all minterms, the sizes and the
+direction/fill/channel configurations rotate with the minterm so that
+the test stays short enough to run on the first blit. */
+static bool blitfast_check (int mode)
+{
+	static const int sizes[][2] = { { 1, 3 }, { 2, 2 }, { 7, 3 }, { 8, 2 }, { 21, 4 } };
+	uae_u8 *src = blitfast_testdata ();
+	uae_u8 *mem1 = xmalloc (uae_u8, BLITFAST_CHECKMEM);
+	uae_u8 *mem2 = xmalloc (uae_u8, BLITFAST_CHECKMEM);
+	bool ok = true;
+
+	for (int mt = 0; mt < 256 && ok; mt++) {
+		for (int cfg = mt & 7; cfg < 256 && ok; cfg += 89) {
+			struct blitfast bf1, bf2;
+			struct bltinfo b1, b2;
+			int s = (mt + cfg) % 5;
+			int h = sizes[s][0], v = sizes[s][1];
+			int fc1, fc2;
+
+			memcpy (mem1, src, BLITFAST_CHECKMEM);
+			memcpy (mem2, src, BLITFAST_CHECKMEM);
+			blitfast_testsetup (&bf1, &b1, cfg, h, v);
+			bf1.mt = mt;
+			bf1.mem = mem1;
+			bf2 = bf1;
+			bf2.mem = mem2;
+			b2 = b1;
+			fc1 = blitfast_reference (&bf1, &b1);
+			fc2 = blitfast_run (&bf2, &b2, mode);
+			blitfast_testdone (h);
+			ok = fc1 == fc2 && !memcmp (mem1, mem2, BLITFAST_CHECKMEM)
+				&& b1.bltadat == b2.bltadat && b1.bltbdat == b2.bltbdat && b1.bltcdat == b2.bltcdat
+				&& b1.bltddat == b2.bltddat && b1.bltaold == b2.bltaold && b1.bltbold == b2.bltbold
+				&& b1.bltbhold == b2.bltbhold && b1.blitzero == b2.blitzero;
+			if (!ok)
+				write_log (_T("Blitter: %s mismatch, minterm %02x size %dx%d cfg %02x\n"),
+					blitfast_names[mode], mt, h, v, cfg);
+		}
+	}
+	xfree (mem2);
+	xfree (mem1);
+	xfree (src);
+	return ok;
+}
+
+static int blitfast_best (void)
+{
+	int best = blitfast_scalar;
+#ifdef BLIT_SIMD
+	__builtin_cpu_init ();
+	if (__builtin_cpu_supports ("sse2"))
+		best = blitfast_sse2;
+#endif
+	return best;
+}
+
+/* called on the first blit that could use the row engine */
+static void blitfast_init (void)
+{
+	int mode = blitfast_best ();
+
+	while (mode >= blitfast_scalar && !blitfast_check (mode)) {
+		write_log (_T("Blitter: %s self-test failed\n"), blitfast_names[mode]);
+		mode--;
+	}
+	blitfast_mode = mode;
+	if (mode >= 0)
+		write_log (_T("Blitter: %s row engine\n"), blitfast_names[mode]);
+}
+
+/* Debugger "B blit": time the word by word loop against the row engine
+on a 320x256 screen sized blit.  */
+void blitter_benchmark (void)
+{
+	static const struct {
+		const TCHAR *name;
+		uae_u8 mt;
+		int cfg;
+	} tests[] = {
+		{ _T("copy A->D"), 0xf0, 0x80 },
+		{ _T("cookie cut"), 0xca, 0x00 },
+		{ _T("clear"), 0x00, 0xc0 },
+		{ _T("xor"), 0x5a, 0x80 },
+		{ _T("fill desc"), 0x0a, 0xc9 },
+		{ NULL }
+	};
+	const int h = 20, v = 256, blits = 200;
+	uae_u8 *mem = xmalloc (uae_u8, 4 * BLITFAST_TESTMEM);
+	int best = blitfast_best ();
+
+	memset (mem, 0x55, 4 * BLITFAST_TESTMEM);
+	for (int t = 0; tests[t].name; t++) {
+		struct blitfast bf;
+		struct bltinfo b;
+		double base = 0;
+		for (int mode = -1; mode <= best; mode++) {
+			int64_t us = uae_time_us ();
+			for (int i = 0; i < blits; i++) {
+				blitfast_testsetup (&bf, &b, tests[t].cfg, h, v);
+				bf.mt = tests[t].mt;
+				bf.mem = mem;
+				/* screen sized areas, keep them apart */
+				for (int c = 0; c < 4; c++) {
+					if (bf.pt[c])
+						bf.pt[c] = c * BLITFAST_TESTMEM + (bf.desc ? BLITFAST_TESTMEM - 16 : 16);
+				}
+				bf.pt[3] = bf.pt[2] ? bf.pt[2] : 3 * BLITFAST_TESTMEM + (bf.desc ? BLITFAST_TESTMEM - 16 : 16);
+				b.bltamod = b.bltbmod = b.bltcmod = b.bltdmod = 0;
+				if (mode < 0)
+					blitfast_reference (&bf, &b);
+				else
+					blitfast_run (&bf, &b, mode);
+				blitfast_testdone (h);
+			}
+			us = uae_time_us () - us;
+			double ns = us * 1000.0 / blits;
+			if (mode < 0)
+				base = ns;
+			console_out_f (_T("%-10s %-6s %9.0f ns/blit %5.2fx%s\n"),
+				tests[t].name, mode < 0 ? _T("words") : blitfast_names[mode], ns, ns > 0 ? base / ns : 0.0,
+				mode >= 0 && !blitfast_check (mode) ? _T(" MISMATCH") : _T(""));
+		}
+	}
+	xfree (mem);
+}
+
 STATIC_INLINE void record_dma_blit (uae_u16 reg, uae_u16 dat, uae_u32 addr, int hpos)
 {
 #ifdef DEBUGGER
@@ -531,7 +1197,9 @@ static void blitter_dofast (void)
 	}
 
 #if SPEEDUP
-	if (blitfunc_dofast[mt] && !blitfill) {
+	if (blitfast_direct (bltadatptr, bltbdatptr, bltcdatptr, bltddatptr, false)) {
+		;
+	} else if (blitfunc_dofast[mt] && !blitfill) {
 		(*blitfunc_dofast[mt])(bltadatptr, bltbdatptr, bltcdatptr, bltddatptr, &blt_info);
 	} else
 #endif
@@ -629,7 +1297,9 @@ static void blitter_dofast_desc (void)
 		bltdpt -= (blt_info.hblitsize * 2 + blt_info.bltdmod) * blt_info.vblitsize;
 	}
 #if SPEEDUP
-	if (blitfunc_dofast_desc[mt] && !blitfill) {
+	if (blitfast_direct (bltadatptr, bltbdatptr, bltcdatptr, bltddatptr, true)) {
+		;
+	} else if (blitfunc_dofast_desc[mt] && !blitfill) {
 		(*blitfunc_dofast_desc[mt])(bltadatptr, bltbdatptr, bltcdatptr, bltddatptr, &blt_info);
 	} else
 #endif
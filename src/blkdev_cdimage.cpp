@@ -54,6 +54,10 @@
 #define scsi_log write_log
 
 #define CDDA_BUFFERS 12
+// compressed audio tracks are decoded in blocks of one second on demand
+#define CDDA_BLOCK_SIZE (75 * 2352)
+#define CDDA_CACHE_BLOCKS 8
+#define CDDA_READAHEAD 2
 
 enum audenc { AUDENC_NONE, AUDENC_PCM, AUDENC_MP3, AUDENC_FLAC, ENC_CHD };
 
@@ -78,13 +82,27 @@ struct cdtoc
 	int pregap; // sectors of silence
 	int postgap; // sectors of silence
 	audenc enctype;
-	int writeoffset;
+	FLAC__StreamDecoder *flac;
+	uae_s64 writeoffset; // decoder position
+	uae_u8 *flacdst;
+	uae_s64 flacstart, flacend;
+	// decoded samples past flacend, the start of the next block
+	uae_u8 *flactail;
+	int flactaillen, flactailsize;
 	int subcode;
 #ifdef WITH_CHD
 	const cdrom_track_info *chdtrack;
 #endif
 };
 
+struct cdaudio_block
+{
+	struct cdtoc *t;
+	int block;
+	uae_u32 used;
+	uae_u8 *data;
+};
+
 struct cdunit {
 	bool enabled;
 	bool open;
@@ -109,6 +127,11 @@ struct cdunit {
 	TCHAR imgname_in[MAX_DPATH];
 	TCHAR imgname_out[MAX_DPATH];
 	uae_sem_t sub_sem;
+	uae_sem_t audio_sem;
+	struct cdaudio_block audio_cache[CDDA_CACHE_BLOCKS];
+	uae_u32 audio_cache_used;
+	struct cdtoc *audio_readahead_t;
+	int audio_readahead_block;
 	struct device_info di;
 #ifdef WITH_CHD
 	chd_file *chd_f;
@@ -122,7 +145,7 @@ struct cdunit {
 static struct cdunit cdunits[MAX_TOTAL_SCSI_DEVICES];
 static int bus_open;
 
-static volatile int cdimage_unpack_thread, cdimage_unpack_active;
+static volatile int cdimage_unpack_thread;
 static smp_comm_pipe unpack_pipe;
 static uae_sem_t play_sem;
 
@@ -194,8 +217,13 @@ static int do_read (struct cdunit *cdu, struct cdtoc *t, uae_u8 *data, int secto
 #endif
 	} else if (t->handle) {
 		int ssize = t->size + t->skipsize;
+		int ok;
+		// the unpack thread also seeks this handle
+		uae_sem_wait (&cdu->audio_sem);
 		zfile_fseek (t->handle, t->offset + (uae_u64)sector * ssize + offset, SEEK_SET);
-		return zfile_fread (data, 1, size, t->handle) == size;
+		ok = zfile_fread (data, 1, size, t->handle) == size;
+		uae_sem_post (&cdu->audio_sem);
+		return ok;
 	}
 	return 0;
 }
@@ -204,7 +232,7 @@ static int do_read (struct cdunit *cdu, struct cdtoc *t, uae_u8 *data, int secto
 static void flac_metadata_callback (const FLAC__StreamDecoder *decoder, const FLAC__StreamMetadata *metadata, void *client_data)
 {
 	struct cdtoc *t = (struct cdtoc*)client_data;
-	if (t->data)
+	if (t->flac)
 		return;
 	if(metadata->type == FLAC__METADATA_TYPE_STREAMINFO) {
 		t->filesize = metadata->data.stream_info.total_samples * (metadata->data.stream_info.bits_per_sample / 8) * metadata->data.stream_info.channels;
@@ -217,9 +245,29 @@ static void flac_error_callback (const FLAC__StreamDecoder *decoder, FLAC__Strea
 static FLAC__StreamDecoderWriteStatus flac_write_callback (const FLAC__StreamDecoder *decoder, const FLAC__Frame *frame, const FLAC__int32 * const buffer[], void *client_data)
 {
 	struct cdtoc *t = (struct cdtoc*)client_data;
-	uae_u16 *p = (uae_u16*)(t->data + t->writeoffset);
 	int size = 4;
-	for (int i = 0; i < frame->header.blocksize && t->writeoffset < t->filesize - size; i++, t->writeoffset += size) {
+	if (!t->flacdst)
+		return FLAC__STREAM_DECODER_WRITE_STATUS_CONTINUE;
+	for (int i = 0; i < frame->header.blocksize; i++, t->writeoffset += size) {
+		if (t->writeoffset >= t->flacend) {
+			// keep the rest of the frame for the next block
+			int len = (frame->header.blocksize - i) * size;
+			if (len > t->flactailsize) {
+				t->flactail = xrealloc (uae_u8, t->flactail, len);
+				t->flactailsize = len;
+			}
+			uae_u16 *p = (uae_u16*)t->flactail;
+			for (; i < frame->header.blocksize; i++) {
+				*p++ = (FLAC__int16)buffer[0][i];
+				*p++ = (FLAC__int16)buffer[1][i];
+			}
+			t->flactaillen = len;
+			t->writeoffset += len;
+			break;
+		}
+		if (t->writeoffset < t->flacstart)
+			continue;
+		uae_u16 *p = (uae_u16*)(t->flacdst + (t->writeoffset - t->flacstart));
 		*p++ = (FLAC__int16)buffer[0][i];
 		*p++ = (FLAC__int16)buffer[1][i];
 	}
@@ -269,22 +317,129 @@ static void flac_get_size (struct cdtoc *t)
 		FLAC__stream_decoder_delete (decoder);
 	}
 }
-static uae_u8 *flac_get_data (struct cdtoc *t)
+static bool flac_decode_block (struct cdtoc *t, int block, uae_u8 *dst)
 {
-	write_log (_T("FLAC: unpacking '%s'..\n"), zfile_getname (t->handle));
-	t->writeoffset = 0;
-	FLAC__StreamDecoder *decoder = FLAC__stream_decoder_new ();
-	if (decoder) {
-		FLAC__stream_decoder_set_md5_checking (decoder, false);
-		int init_status = FLAC__stream_decoder_init_stream (decoder,
+	uae_s64 start = (uae_s64)block * CDDA_BLOCK_SIZE;
+	uae_s64 end = start + CDDA_BLOCK_SIZE;
+
+	if (end > t->filesize)
+		end = t->filesize;
+	if (!t->flac) {
+		t->flac = FLAC__stream_decoder_new ();
+		if (!t->flac)
+			return false;
+		FLAC__stream_decoder_set_md5_checking (t->flac, false);
+		if (FLAC__stream_decoder_init_stream (t->flac,
 			&file_read_callback, &file_seek_callback, &file_tell_callback,
 			&file_len_callback, &file_eof_callback,
-			&flac_write_callback, &flac_metadata_callback, &flac_error_callback, t);
-		FLAC__stream_decoder_process_until_end_of_stream (decoder);
-		FLAC__stream_decoder_delete (decoder);
-		write_log (_T("FLAC: %s unpacked\n"), zfile_getname (t->handle));
+			&flac_write_callback, &flac_metadata_callback, &flac_error_callback, t) != FLAC__STREAM_DECODER_INIT_STATUS_OK) {
+			FLAC__stream_decoder_delete (t->flac);
+			t->flac = NULL;
+			return false;
+		}
+		t->writeoffset = 0;
+	}
+	memset (dst, 0, CDDA_BLOCK_SIZE);
+	t->flacdst = dst;
+	t->flacstart = start;
+	t->flacend = end;
+	// sequential playback continues with the tail of the previous block's last frame
+	if (t->writeoffset - t->flactaillen == start && t->flactaillen <= end - start) {
+		memcpy (dst, t->flactail, t->flactaillen);
+		t->flactaillen = 0;
+	} else {
+		t->flactaillen = 0;
+		t->writeoffset = start;
+		if (!FLAC__stream_decoder_seek_absolute (t->flac, start / 4)) {
+			write_log (_T("FLAC: '%s' seek to %lld failed\n"), zfile_getname (t->handle), start);
+			// start again with a new decoder next time
+			FLAC__stream_decoder_delete (t->flac);
+			t->flac = NULL;
+			t->flacdst = NULL;
+			return false;
+		}
+	}
+	while (t->writeoffset < end) {
+		if (FLAC__stream_decoder_get_state (t->flac) == FLAC__STREAM_DECODER_END_OF_STREAM)
+			break;
+		if (!FLAC__stream_decoder_process_single (t->flac)) {
+			t->writeoffset = -1;
+			break;
+		}
 	}
-	return t->data;
+	t->flacdst = NULL;
+	return true;
+}
+
+// cdu->audio_sem must be held
+static struct cdaudio_block *cdda_findblock (struct cdunit *cdu, struct cdtoc *t, int block)
+{
+	for (int i = 0; i < CDDA_CACHE_BLOCKS; i++) {
+		struct cdaudio_block *b = &cdu->audio_cache[i];
+		if (b->t == t && b->block == block)
+			return b;
+	}
+	return NULL;
+}
+
+static struct cdaudio_block *cdda_getblock (struct cdunit *cdu, struct cdtoc *t, int block)
+{
+	struct cdaudio_block *b = cdda_findblock (cdu, t, block);
+
+	cdu->audio_cache_used++;
+	if (b) {
+		b->used = cdu->audio_cache_used;
+		return b;
+	}
+	for (int i = 0; i < CDDA_CACHE_BLOCKS; i++) {
+		struct cdaudio_block *cb = &cdu->audio_cache[i];
+		if (!b || cb->used < b->used)
+			b = cb;
+	}
+	if (!b->data)
+		b->data = xmalloc (uae_u8, CDDA_BLOCK_SIZE);
+	b->t = NULL;
+	b->used = 0;
+	if (!b->data || !flac_decode_block (t, block, b->data))
+		return NULL;
+	b->t = t;
+	b->block = block;
+	b->used = cdu->audio_cache_used;
+	return b;
+}
+
+static void cdda_freeblocks (struct cdunit *cdu)
+{
+	for (int i = 0; i < CDDA_CACHE_BLOCKS; i++) {
+		struct cdaudio_block *b = &cdu->audio_cache[i];
+		xfree (b->data);
+		b->data = NULL;
+		b->t = NULL;
+		b->used = 0;
+	}
+	cdu->audio_readahead_t = NULL;
+}
+
+static void cdda_read_audio (struct cdunit *cdu, struct cdtoc *t, uae_u8 *dst, uae_s64 pos, int size)
+{
+	if (pos < 0 || pos + size > t->filesize)
+		return;
+	uae_sem_wait (&cdu->audio_sem);
+	while (size > 0) {
+		int block = pos / CDDA_BLOCK_SIZE;
+		int offset = pos % CDDA_BLOCK_SIZE;
+		int len = CDDA_BLOCK_SIZE - offset;
+		if (len > size)
+			len = size;
+		struct cdaudio_block *b = cdda_getblock (cdu, t, block);
+		if (!b)
+			break;
+		memcpy (dst, b->data + offset, len);
+		dst += len;
+		pos += len;
+		size -= len;
+	}
+	uae_sem_post (&cdu->audio_sem);
 }
 
 void sub_to_interleaved (const uae_u8 *s, uae_u8 *d)
@@ -332,9 +487,12 @@ static int getsub_deinterleaved (uae_u8 *dst, struct cdunit *cdu, struct cdtoc *
 				totalsize += t->size;
 				offset = t->size;
 			}
+			// subhandle can be the same handle as t->handle
+			uae_sem_wait (&cdu->audio_sem);
 			zfile_fseek (t->subhandle, (uae_u64)sector * totalsize + t->suboffset + offset, SEEK_SET);
 			if (zfile_fread (dst, SUB_CHANNEL_SIZE, 1, t->subhandle) > 0)
 				ret = t->subcode;
+			uae_sem_post (&cdu->audio_sem);
 		} else {
 			memcpy (dst, t->subdata + sector * SUB_CHANNEL_SIZE + t->suboffset, SUB_CHANNEL_SIZE);
 			ret = t->subcode;
@@ -406,34 +564,61 @@ static void *cdda_unpack_func (void *v)
 		if (cdimage_unpack_thread == 0)
 			break;
 		uae_u32 tocidx = read_comm_pipe_u32_blocking (&unpack_pipe);
+		int block = read_comm_pipe_int_blocking (&unpack_pipe);
 		struct cdunit *cdu = &cdunits[cduidx];
 		struct cdtoc *t = &cdu->toc[tocidx];
-		if (t->handle) {
+		struct zfile *handle = NULL, *mp3handle = NULL;
+		bool mp3 = false;
+		// all t->handle access is serialized with the playback and emulation threads
+		uae_sem_wait (&cdu->audio_sem);
+		if (t->handle && block >= 0) {
+			// read-ahead
+			if (t->enctype == AUDENC_FLAC && (uae_s64)block * CDDA_BLOCK_SIZE < t->filesize && !cdda_findblock (cdu, t, block))
+				cdda_getblock (cdu, t, block);
+		} else if (t->handle) {
 			// force unpack if handle points to delayed zipped file
 			uae_s64 pos = zfile_ftell (t->handle);
 			zfile_fseek (t->handle, -1, SEEK_END);
 			uae_u8 b;
 			zfile_fread (&b, 1, 1, t->handle);
 			zfile_fseek (t->handle, pos, SEEK_SET);
-			if (!t->data && (t->enctype == AUDENC_MP3 || t->enctype == AUDENC_FLAC)) {
-				t->data = xcalloc (uae_u8, t->filesize + 2352);
-				cdimage_unpack_active = 1;
-				if (t->data) {
-					if (t->enctype == AUDENC_MP3) {
-						if (!mp3dec) {
-							try {
-								mp3dec = new mp3decoder();
-							} catch (exception) { };
-						}
-						if (mp3dec)
-							t->data = mp3dec->get (t->handle, t->data, t->filesize);
-					} else if (t->enctype == AUDENC_FLAC) {
-						flac_get_data (t);
-					}
+			// the mp3 decoder can only unpack complete files, it gets
+			// its own handle so that the semaphore is not held meanwhile
+			if (!t->data && t->enctype == AUDENC_MP3) {
+				mp3 = true;
+				handle = t->handle;
+				mp3handle = zfile_dup (t->handle);
+			}
+		}
+		// no separate handle: decode from t->handle with the semaphore held
+		if (!mp3 || mp3handle)
+			uae_sem_post (&cdu->audio_sem);
+		if (mp3) {
+			uae_u8 *data = xcalloc (uae_u8, t->filesize + 2352);
+			if (data) {
+				if (!mp3dec) {
+					try {
+						mp3dec = new mp3decoder();
+					} catch (exception) { };
+				}
+				struct zfile *zf = mp3handle ? mp3handle : handle;
+				zfile_fseek (zf, 0, SEEK_SET);
+				if (mp3dec)
+					data = mp3dec->get (zf, data, t->filesize);
+				if (mp3handle)
+					uae_sem_wait (&cdu->audio_sem);
+				// image may have been unloaded or changed meanwhile
+				if (t->handle == handle && !t->data) {
+					t->data = data;
+					data = NULL;
 				}
+				uae_sem_post (&cdu->audio_sem);
+				xfree (data);
+			} else if (!mp3handle) {
+				uae_sem_post (&cdu->audio_sem);
 			}
+			zfile_fclose (mp3handle);
 		}
-		cdimage_unpack_active = 2;
 	}
 	delete mp3dec;
 	cdimage_unpack_thread = -1;
@@ -444,13 +629,26 @@ static void audio_unpack (struct cdunit *cdu, struct cdtoc *t)
 {
 	// do this even if audio is not compressed, t->handle also could be
 	// compressed and we want to unpack it in background too
-	while (cdimage_unpack_active == 1)
-		sleep_millis(10);
-	cdimage_unpack_active = 0;
 	write_comm_pipe_u32 (&unpack_pipe, cdu - &cdunits[0], 0);
-	write_comm_pipe_u32 (&unpack_pipe, t - &cdu->toc[0], 1);
-	while (cdimage_unpack_active == 0)
-		sleep_millis(10);
+	write_comm_pipe_u32 (&unpack_pipe, t - &cdu->toc[0], 0);
+	write_comm_pipe_int (&unpack_pipe, -1, 1);
+}
+
+// decode the next blocks in background before playback reaches them
+static void audio_readahead (struct cdunit *cdu, struct cdtoc *t, uae_s64 pos)
+{
+	int block = pos / CDDA_BLOCK_SIZE;
+	if (cdu->audio_readahead_t != t || cdu->audio_readahead_block < block || cdu->audio_readahead_block > block + CDDA_READAHEAD)
+		cdu->audio_readahead_block = block;
+	cdu->audio_readahead_t = t;
+	while (cdu->audio_readahead_block < block + CDDA_READAHEAD) {
+		cdu->audio_readahead_block++;
+		if ((uae_s64)cdu->audio_readahead_block * CDDA_BLOCK_SIZE >= t->filesize)
+			break;
+		write_comm_pipe_u32 (&unpack_pipe, cdu - &cdunits[0], 0);
+		write_comm_pipe_u32 (&unpack_pipe, t - &cdu->toc[0], 0);
+		write_comm_pipe_int (&unpack_pipe, cdu->audio_readahead_block, 1);
+	}
 }
 
 static void next_cd_audio_buffer_callback(int bufnum, void *params)
@@ -656,13 +854,20 @@ static bool cdda_play_func2 (struct cdunit *cdu, int *outpos)
 							int totalsize = t->size + t->skipsize;
 							int offset = t->offset;
 							if (offset >= 0) {
-								if ((t->enctype == AUDENC_MP3 || t->enctype == AUDENC_FLAC) && t->data) {
+								if (t->enctype == AUDENC_FLAC) {
+									uae_s64 pos = (uae_s64)sector * totalsize + offset;
+									cdda_read_audio (cdu, t, dst, pos, t->size);
+									audio_readahead (cdu, t, pos);
+								} else if (t->enctype == AUDENC_MP3 && t->data) {
 									if (t->filesize >= sector * totalsize + offset + t->size)
 										memcpy (dst, t->data + sector * totalsize + offset, t->size);
 								} else if (t->enctype == AUDENC_PCM) {
 									if (sector * totalsize + offset + totalsize < t->filesize) {
+										// not while the unpack thread forces the handle unpacked
+										uae_sem_wait (&cdu->audio_sem);
 										zfile_fseek (t->handle, (uae_u64)sector * totalsize + offset, SEEK_SET);
 										zfile_fread (dst, t->size, 1, t->handle);
+										uae_sem_post (&cdu->audio_sem);
 									}
 								}
 							}
@@ -752,9 +957,6 @@ end:
 		cdu->cda->wait (1);
 	}
 
-	while (cdimage_unpack_active == 1)
-		sleep_millis(10);
-
 	delete cdu->cda;
 
 	write_log (_T("IMAGE CDDA: thread killed (%s)\n"), restart ? _T("restart") : _T("play end"));
@@ -1425,6 +1627,8 @@ static int parsechd (struct cdunit *cdu, struct zfile *zcue, const TCHAR *img)
 	}
 	cdu->chd_f = cf;
 	cdu->chd_cdf = cdf;
+	if (currprefs.chd_cache_size > 0)
+		cf->set_hunk_cache (currprefs.chd_cache_size * 1024 * 1024, currprefs.chd_readahead);
 	
 	const cdrom_toc *stoc = cdrom_get_toc (cdf);
 	cdu->tracks = stoc->numtrks;
@@ -2222,8 +2426,12 @@ static void unload_image (struct cdunit *cdu)
 {
 	int i;
 
+	uae_sem_wait (&cdu->audio_sem);
+	cdda_freeblocks (cdu);
 	for (i = 0; i < sizeof cdu->toc / sizeof (struct cdtoc); i++) {
 		struct cdtoc *t = &cdu->toc[i];
+		if (t->flac)
+			FLAC__stream_decoder_delete (t->flac);
 		zfile_fclose (t->handle);
 		if (t->handle != t->subhandle)
 			zfile_fclose (t->subhandle);
@@ -2231,6 +2439,7 @@ static void unload_image (struct cdunit *cdu)
 		xfree (t->data);
 		xfree (t->subdata);
 		xfree (t->extrainfo);
+		xfree (t->flactail);
 	}
 #ifdef WITH_CHD
 	cdrom_close (cdu->chd_cdf);
@@ -2242,6 +2451,7 @@ static void unload_image (struct cdunit *cdu)
 	memset (cdu->toc, 0, sizeof cdu->toc);
 	cdu->tracks = 0;
 	cdu->cdsize = 0;
+	uae_sem_post (&cdu->audio_sem);
 }
 
 
@@ -2252,6 +2462,7 @@ static int open_device (int unitnum, const TCHAR *ident, int flags)
 
 	if (!cdu->open) {
 		uae_sem_init (&cdu->sub_sem, 0, 1);
+		uae_sem_init (&cdu->audio_sem, 0, 1);
 		cdu->imgname_out[0] = 0;
 		cdu->imgname_in[0] = 0;
 		if (ident) {
@@ -2264,7 +2475,7 @@ static int open_device (int unitnum, const TCHAR *ident, int flags)
 		cdu->cdda_volume[0] = 0x7fff;
 		cdu->cdda_volume[1] = 0x7fff;
 		if (cdimage_unpack_thread == 0) {
-			init_comm_pipe (&unpack_pipe, 10, 1);
+			init_comm_pipe (&unpack_pipe, 3 * 16, 3);
 			uae_start_thread (_T("cdimage_unpack"), cdda_unpack_func, NULL, NULL);
 			while (cdimage_unpack_thread == 0)
 				Sleep (10);
@@ -2292,6 +2503,7 @@ static void close_device (int unitnum)
 		}
 		unload_image (cdu);
 		uae_sem_destroy (&cdu->sub_sem);
+		uae_sem_destroy (&cdu->audio_sem);
 	}
 	blkdev_cd_change (unitnum, cdu->imgname_out);
 }
@@ -1960,6 +1960,8 @@ void cfgfile_save_options (struct zfile *f, struct uae_prefs *p, int type)
 	cfgfile_write (f, _T("floppy_speed"), _T("%d"), p->floppy_speed);
 	cfgfile_dwrite (f, _T("floppy_channel_mask"), _T("0x%x"), p->dfxclickchannelmask);
 	cfgfile_write (f, _T("cd_speed"), _T("%d"), p->cd_speed);
+	cfgfile_dwrite (f, _T("chd_cache_size"), _T("%d"), p->chd_cache_size);
+	cfgfile_dwrite (f, _T("chd_readahead"), _T("%d"), p->chd_readahead);
 	cfgfile_write_bool (f, _T("parallel_on_demand"), p->parallel_demand);
 	cfgfile_write_bool (f, _T("serial_on_demand"), p->serial_demand);
 	cfgfile_write_bool (f, _T("serial_hardware_ctsrts"), p->serial_hwctsrts);
@@ -2010,6 +2012,7 @@ void cfgfile_save_options (struct zfile *f, struct uae_prefs *p, int type)
 #endif
 	cfgfile_write_bool(f, _T("comp_catchdetect"), p->comp_catchfault);
 	cfgfile_write (f, _T("cachesize"), _T("%d"), p->cachesize);
+	cfgfile_dwrite_str (f, _T("comp_trace_cache"), p->comp_trace_cache);
 
 	for (i = 0; i < MAX_JPORTS; i++) {
 		struct jport *jp = &p->jports[i];
@@ -2198,6 +2201,7 @@ void cfgfile_save_options (struct zfile *f, struct uae_prefs *p, int type)
 	cfgfile_write_str(f, _T("gfx_api_options"), filterapiopts[p->gfx_api_options]);
 	cfgfile_dwrite(f, _T("gfx_horizontal_tweak"), _T("%d"), p->gfx_extrawidth);
 	cfgfile_dwrite(f, _T("gfx_frame_slices"), _T("%d"), p->gfx_display_sections);
+	cfgfile_dwrite(f, _T("gfx_render_threads"), _T("%d"), p->gfx_render_threads);
 	cfgfile_dwrite_bool(f, _T("gfx_vrr_monitor"), p->gfx_variable_sync != 0);
 
 #ifdef GFXFILTER
@@ -2529,6 +2533,7 @@ void cfgfile_save_options (struct zfile *f, struct uae_prefs *p, int type)
 	cfgfile_write_bool(f, _T("gfxcard_hardware_vblank"), p->rtg_hardwareinterrupt);
 	cfgfile_write_bool(f, _T("gfxcard_hardware_sprite"), p->rtg_hardwaresprite);
 	cfgfile_write_bool(f, _T("gfxcard_multithread"), p->rtg_multithread);
+	cfgfile_dwrite(f, _T("gfxcard_convert_threads"), _T("%d"), p->rtg_convert_threads);
 	for (int i = 0; i < MAX_RTG_BOARDS; i++) {
 		TCHAR tmp2[100];
 		struct rtgboardconfig *rbc = &p->rtgboards[i];
@@ -2662,7 +2667,9 @@ void cfgfile_save_options (struct zfile *f, struct uae_prefs *p, int type)
 
 	cfgfile_dwrite (f, _T("state_replay_rate"), _T("%d"), p->statecapturerate);
 	cfgfile_dwrite (f, _T("state_replay_buffers"), _T("%d"), p->statecapturebuffersize);
+	cfgfile_dwrite (f, _T("state_replay_keyframes"), _T("%d"), p->statecapturekeyframes);
 	cfgfile_dwrite_bool (f, _T("state_replay_autoplay"), p->inprec_autoplay);
+	cfgfile_dwrite (f, _T("input_record_keyframe_interval"), _T("%d"), p->inprec_keyframe_interval);
 	cfgfile_dwrite_bool (f, _T("warp"), p->turbo_emulation);
 	cfgfile_dwrite (f, _T("warp_limit"), _T("%d"), p->turbo_emulation_limit);
 
@@ -3264,7 +3271,9 @@ static int cfgfile_parse_host (struct uae_prefs *p, TCHAR *option, TCHAR *value)
 		|| cfgfile_intval (option, value, _T("sound_max_buff"), &p->sound_maxbsiz, 1)
 		|| cfgfile_intval (option, value, _T("state_replay_rate"), &p->statecapturerate, 1)
 		|| cfgfile_intval (option, value, _T("state_replay_buffers"), &p->statecapturebuffersize, 1)
+		|| cfgfile_intval (option, value, _T("state_replay_keyframes"), &p->statecapturekeyframes, 1)
 		|| cfgfile_yesno (option, value, _T("state_replay_autoplay"), &p->inprec_autoplay)
+		|| cfgfile_intval (option, value, _T("input_record_keyframe_interval"), &p->inprec_keyframe_interval, 1)
 		|| cfgfile_intval (option, value, _T("sound_frequency"), &p->sound_freq, 1)
 		|| cfgfile_intval (option, value, _T("sound_volume"), &p->sound_volume_master, 1)
 		|| cfgfile_intval (option, value, _T("sound_volume_paula"), &p->sound_volume_paula, 1)
@@ -3280,6 +3289,7 @@ static int cfgfile_parse_host (struct uae_prefs *p, TCHAR *option, TCHAR *value)
 		|| cfgfile_intval(option, value, _T("power_led_dim"), &p->power_led_dim, 1)
 
 		|| cfgfile_intval(option, value, _T("gfx_frame_slices"), &p->gfx_display_sections, 1)
+		|| cfgfile_intval(option, value, _T("gfx_render_threads"), &p->gfx_render_threads, 1)
 		|| cfgfile_intval(option, value, _T("gfx_framerate"), &p->gfx_framerate, 1)
 		|| cfgfile_intval(option, value, _T("gfx_top_windowed"), &p->gfx_monitor[0].gfx_size_win.x, 1)
 		|| cfgfile_intval(option, value, _T("gfx_left_windowed"), &p->gfx_monitor[0].gfx_size_win.y, 1)
@@ -3889,6 +3899,9 @@ static int cfgfile_parse_host (struct uae_prefs *p, TCHAR *option, TCHAR *value)
 	if (cfgfile_path(option, value, _T("trainerfile"), p->trainerfile, sizeof p->trainerfile / sizeof(TCHAR)))
 		return 1;
 
+	if (cfgfile_path(option, value, _T("comp_trace_cache"), p->comp_trace_cache, sizeof p->comp_trace_cache / sizeof(TCHAR)))
+		return 1;
+
 #ifdef SAVESTATE
 
 	if (cfgfile_path (option, value, _T("statefile_quit"), p->quitstatefile, sizeof p->quitstatefile / sizeof (TCHAR)))
@@ -5498,8 +5511,11 @@ static int cfgfile_parse_hardware (struct uae_prefs *p, const TCHAR *option, TCH
 		|| cfgfile_intval(option, value, _T("debugmem_start"), &p->debugmem_start, 1)
 		|| cfgfile_intval(option, value, _T("bogomem_size"), &p->bogomem_size, 0x40000)
 		|| cfgfile_intval(option, value, _T("rtg_modes"), &p->picasso96_modeflags, 1)
+		|| cfgfile_intval(option, value, _T("gfxcard_convert_threads"), &p->rtg_convert_threads, 1)
 		|| cfgfile_intval(option, value, _T("floppy_speed"), &p->floppy_speed, 1)
 		|| cfgfile_intval(option, value, _T("cd_speed"), &p->cd_speed, 1)
+		|| cfgfile_intval(option, value, _T("chd_cache_size"), &p->chd_cache_size, 1)
+		|| cfgfile_intval(option, value, _T("chd_readahead"), &p->chd_readahead, 1)
 		|| cfgfile_intval(option, value, _T("floppy_write_length"), &p->floppy_write_length, 1)
 		|| cfgfile_intval(option, value, _T("floppy_random_bits_min"), &p->floppy_random_bits_min, 1)
 		|| cfgfile_intval(option, value, _T("floppy_random_bits_max"), &p->floppy_random_bits_max, 1)
@@ -7775,6 +7791,7 @@ void default_prefs (struct uae_prefs *p, bool reset, int type)
 #endif
 	p->comp_catchfault = true;
 	p->cachesize = 0;
+	p->comp_trace_cache[0] = 0;
 
 	p->gfx_framerate = 1;
 	p->gfx_autoframerate = 50;
@@ -7808,6 +7825,8 @@ void default_prefs (struct uae_prefs *p, bool reset, int type)
 	p->gfx_apmode[0].gfx_backbuffers = 2;
 	p->gfx_apmode[1].gfx_backbuffers = 1;
 	p->gfx_display_sections = 4;
+	p->gfx_render_threads = 0;
+	p->rtg_convert_threads = 0;
 	p->gfx_variable_sync = 0;
 	p->gfx_windowed_resize = true;
 
@@ -7975,10 +7994,14 @@ void default_prefs (struct uae_prefs *p, bool reset, int type)
 	p->dfxclickvolume_empty[3] = 33;
 	p->dfxclickchannelmask = 0xffff;
 	p->cd_speed = 100;
+	p->chd_cache_size = 8;
+	p->chd_readahead = 4;
 
 	p->statecapturebuffersize = 100;
 	p->statecapturerate = 5 * 50;
+	p->statecapturekeyframes = 0;
 	p->inprec_autoplay = true;
+	p->inprec_keyframe_interval = 30;
 
 #ifdef UAE_MINI
 	default_prefs_mini (p, 0);
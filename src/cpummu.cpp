@@ -68,14 +68,18 @@ uae_u32 mmu040_move16[4];
 #if MMU_ICACHE
 struct mmu_icache mmu_icache_data[MMU_ICACHE_SZ];
 #endif
+#if MMU_IPAGECACHE || MMU_DPAGECACHE
+uae_u32 mmu_fastcache_gen;
+#endif
 #if MMU_IPAGECACHE
-uae_u32 atc_last_ins_laddr, atc_last_ins_paddr;
-uae_u8 atc_last_ins_cache;
+struct mmufastcache atc_ins_cache[MMUFASTCACHE_ENTRIES];
 #endif
 #if MMU_DPAGECACHE
 struct mmufastcache atc_data_cache_read[MMUFASTCACHE_ENTRIES];
 struct mmufastcache atc_data_cache_write[MMUFASTCACHE_ENTRIES];
 #endif
+struct mmu_ttr_shortcut mmu_ttr_map[2][2][256];
+struct mmu_atc_stats mmu_atc_stats;
 
 #if CACHE_HIT_COUNT
 int mmu_ins_hit, mmu_ins_miss;
@@ -125,11 +129,33 @@ void mmu_make_transparent_region(uaecptr baseaddr, uae_u32 size, int datamode)
 #endif
 }
 
+static int mmu_do_match_ttr(uae_u32 ttr, uaecptr addr, bool super);
+
 void mmu_tt_modified (void)
 {
 	mmu_ttr_enabled_ins = ((regs.itt0 | regs.itt1) & MMU_TTR_BIT_ENABLED) != 0;
 	mmu_ttr_enabled_data = ((regs.dtt0 | regs.dtt1) & MMU_TTR_BIT_ENABLED) != 0;
 	mmu_ttr_enabled = mmu_ttr_enabled_ins || mmu_ttr_enabled_data;
+
+	// rebuild the 16M region shortcut map, mmu_do_match_ttr() sets mmu_cache_state
+	uae_u8 old_cache_state = mmu_cache_state;
+	for (int data = 0; data < 2; data++) {
+		uae_u32 ttr0 = data ? regs.dtt0 : regs.itt0;
+		uae_u32 ttr1 = data ? regs.dtt1 : regs.itt1;
+		for (int super = 0; super < 2; super++) {
+			for (int i = 0; i < 256; i++) {
+				struct mmu_ttr_shortcut *t = &mmu_ttr_map[data][super][i];
+				uaecptr addr = i << 24;
+				mmu_cache_state = 0;
+				int res = mmu_do_match_ttr(ttr0, addr, super != 0);
+				if (res == TTR_NO_MATCH)
+					res = mmu_do_match_ttr(ttr1, addr, super != 0);
+				t->match = res;
+				t->cache_state = res != TTR_NO_MATCH ? mmu_cache_state : 0;
+			}
+		}
+	}
+	mmu_cache_state = old_cache_state;
 }
 
 
@@ -324,7 +350,25 @@ static void mmu_dump_table(const char * label, uaecptr root_ptr)
 /* {{{ mmu_dump_atc */
 static void mmu_dump_atc(void)
 {
-
+	for (int type = 0; type < ATC_TYPE; type++) {
+		console_out_f(_T("%s ATC:\n"), type ? _T("Data") : _T("Instruction"));
+		for (int slot = 0; slot < ATC_SLOTS; slot++) {
+			for (int way = 0; way < ATC_WAYS; way++) {
+				struct mmu_atc_line *l = &mmu_atc_array[type][slot][way];
+				if (!l->valid)
+					continue;
+				console_out_f(_T("%2d.%d: %c %08x -> %08x %c%c%c%c CM=%d\n"),
+					slot, way, (l->tag & 0x80000000) ? 'S' : 'U',
+					(l->tag << 1) & mmu_pagemaski, l->phys,
+					(l->status & MMU_MMUSR_G) ? 'G' : '-',
+					(l->status & MMU_MMUSR_S) ? 'S' : '-',
+					(l->status & MMU_MMUSR_M) ? 'M' : '-',
+					(l->status & MMU_MMUSR_W) ? 'W' : '-',
+					(l->status & MMU_MMUSR_CM) >> 5);
+			}
+		}
+	}
+	mmu_dump_atc_stats();
 }
 /* }}} */
 
@@ -345,23 +389,65 @@ void mmu_dump_tables(void)
 }
 /* }}} */
 
+void mmu_atc_stats_reset(void)
+{
+	memset(&mmu_atc_stats, 0, sizeof mmu_atc_stats);
+#if CACHE_HIT_COUNT
+	mmu_ins_hit = mmu_ins_miss = 0;
+	mmu_data_read_hit = mmu_data_read_miss = 0;
+	mmu_data_write_hit = mmu_data_write_miss = 0;
+#endif
+}
+
+void mmu_dump_atc_stats(void)
+{
+	struct mmu_atc_stats *st = &mmu_atc_stats;
+#if CACHE_HIT_COUNT
+	console_out_f(_T("Fast path: ins %d/%d, read %d/%d, write %d/%d (hit/miss)\n"),
+		mmu_ins_hit, mmu_ins_miss, mmu_data_read_hit, mmu_data_read_miss,
+		mmu_data_write_hit, mmu_data_write_miss);
+#endif
+	console_out_f(_T("Translations: %llu, ATC hit %llu, ATC miss %llu\n"),
+		st->translate, st->atc_hit, st->atc_miss);
+	console_out_f(_T("Table walks: %llu (%llu failed)\n"), st->walk, st->walk_fail);
+	console_out_f(_T("Flushes: %llu page, %llu all\n"), st->flush, st->flush_all);
+}
+
+#if MMU_IPAGECACHE || MMU_DPAGECACHE
+static void flush_shortcut_entry(struct mmufastcache *c, uae_u32 idx1)
+{
+	uae_u32 idx2 = idx1 & (MMUFASTCACHE_ENTRIES - 1);
+	if (c[idx2].log == idx1)
+		c[idx2].log = 0xffffffff;
+}
+#endif
+
 static void flush_shortcut_cache(uaecptr addr, bool super)
 {
+#if MMU_IPAGECACHE || MMU_DPAGECACHE
+	if (addr == 0xffffffff) {
+		// start new generation, old tags can't match anymore.
+		// Last generation is never used so tag can't be 0xffffffff.
+		mmu_fastcache_gen += 1 << MMUFASTCACHE_GEN_SHIFT;
+		if (mmu_fastcache_gen == (0xffffffff << MMUFASTCACHE_GEN_SHIFT)) {
+			mmu_fastcache_gen = 0;
 #if MMU_IPAGECACHE
-	atc_last_ins_laddr = mmu_pagemask;
+			memset(&atc_ins_cache, 0xff, sizeof atc_ins_cache);
 #endif
 #if MMU_DPAGECACHE
-	if (addr == 0xffffffff) {
-		memset(&atc_data_cache_read, 0xff, sizeof atc_data_cache_read);
-		memset(&atc_data_cache_write, 0xff, sizeof atc_data_cache_write);
-	} else {
-		for (int i = 0; i < MMUFASTCACHE_ENTRIES; i++) {
-			uae_u32 idx = ((addr & mmu_pagemaski) >> mmu_pageshift1m) | (super ? 1 : 0);
-			if (atc_data_cache_read[i].log == idx)
-				atc_data_cache_read[i].log = 0xffffffff;
-			if (atc_data_cache_write[i].log == idx)
-				atc_data_cache_write[i].log = 0xffffffff;
+			memset(&atc_data_cache_read, 0xff, sizeof atc_data_cache_read);
+			memset(&atc_data_cache_write, 0xff, sizeof atc_data_cache_write);
+#endif
 		}
+	} else {
+		uae_u32 idx1 = mmu_fastcache_tag(addr, super ? 1 : 0);
+#if MMU_IPAGECACHE
+		flush_shortcut_entry(atc_ins_cache, idx1);
+#endif
+#if MMU_DPAGECACHE
+		flush_shortcut_entry(atc_data_cache_read, idx1);
+		flush_shortcut_entry(atc_data_cache_write, idx1);
+#endif
 	}
 #endif
 }
@@ -547,36 +633,6 @@ static int mmu_do_match_ttr(uae_u32 ttr, uaecptr addr, bool super)
 	return TTR_NO_MATCH;
 }
 
-int mmu_match_ttr_ins(uaecptr addr, bool super)
-{
-	int res;
-	
-	if (!mmu_ttr_enabled_ins)
-		return TTR_NO_MATCH;
-	res = mmu_do_match_ttr(regs.itt0, addr, super);
-	if (res == TTR_NO_MATCH)
-		res = mmu_do_match_ttr(regs.itt1, addr, super);
-	return res;
-}
-
-int mmu_match_ttr(uaecptr addr, bool super, bool data)
-{
-	int res;
-	
-	if (!mmu_ttr_enabled)
-		return TTR_NO_MATCH;
-	if (data) {
-		res = mmu_do_match_ttr(regs.dtt0, addr, super);
-		if (res == TTR_NO_MATCH)
-			res = mmu_do_match_ttr(regs.dtt1, addr, super);
-	} else {
-		res = mmu_do_match_ttr(regs.itt0, addr, super);
-		if (res == TTR_NO_MATCH)
-			res = mmu_do_match_ttr(regs.itt1, addr, super);
-	}
-	return res;
-}
-
 void mmu_bus_error_ttr_write_fault(uaecptr addr, bool super, bool data, uae_u32 val, int size)
  {
 	 uae_u32 status = 0;
@@ -637,6 +693,7 @@ static uae_u32 mmu_fill_atc(uaecptr addr, bool super, uae_u32 tag, bool write, s
     // Always use supervisor mode to access descriptors
     old_s = regs.s;
     regs.s = 1;
+    mmu_atc_stats.walk++;
 
     wp = 0;
     desc = super ? regs.srp : regs.urp;
@@ -767,6 +824,8 @@ fail:
 
     // Restore original supervisor state
     regs.s = old_s;
+    if (*status060 || (status & MMU_MMUSR_B))
+        mmu_atc_stats.walk_fail++;
 
 #if MMUDEBUG > 2
     write_log(_T("translate: %x,%u,%u -> %x\n"), addr, super, write, desc);
@@ -779,34 +838,25 @@ fail:
 
 static void mmu_add_cache(uaecptr addr, uaecptr phys, bool super, bool data, bool write)
 {
+#if MMU_IPAGECACHE || MMU_DPAGECACHE
+	struct mmufastcache *c = NULL;
+	uae_u32 idx1 = mmu_fastcache_tag(addr, super ? 1 : 0);
+	uae_u32 idx2 = idx1 & (MMUFASTCACHE_ENTRIES - 1);
 	if (!data) {
 #if MMU_IPAGECACHE
-		uae_u32 laddr = (addr & mmu_pagemaski) | (super ? 1 : 0);
-		atc_last_ins_laddr = laddr;
-		atc_last_ins_paddr = phys;
-		atc_last_ins_cache = mmu_cache_state;
-#else
-	;
+		c = &atc_ins_cache[idx2];
 #endif
-#if MMU_DPAGECACHE
 	} else {
-		uae_u32 idx1 = ((addr & mmu_pagemaski) >> mmu_pageshift1m) | (super ? 1 : 0);
-		uae_u32 idx2 = idx1 & (MMUFASTCACHE_ENTRIES - 1);
-		if (write) {
-			if (idx2 < MMUFASTCACHE_ENTRIES - 1) {
-				atc_data_cache_write[idx2].log = idx1;
-				atc_data_cache_write[idx2].phys = phys;
-				atc_data_cache_write[idx2].cache_state = mmu_cache_state;
-			}
-		} else {
-			if (idx2 < MMUFASTCACHE_ENTRIES - 1) {
-				atc_data_cache_read[idx2].log = idx1;
-				atc_data_cache_read[idx2].phys = phys;
-				atc_data_cache_read[idx2].cache_state = mmu_cache_state;
-			}
-		}
+#if MMU_DPAGECACHE
+		c = write ? &atc_data_cache_write[idx2] : &atc_data_cache_read[idx2];
 #endif
 	}
+	if (c) {
+		c->log = idx1;
+		c->phys = phys;
+		c->cache_state = mmu_cache_state;
+	}
+#endif
 }
 
 uaecptr mmu_translate(uaecptr addr, uae_u32 val, bool super, bool data, bool write, int size)
@@ -823,6 +873,7 @@ uaecptr mmu_translate(uaecptr addr, uae_u32 val, bool super, bool data, bool wri
 	way_invalid = ATC_WAYS;
 	way_random++;
 	way = mmu_atc_ways[data];
+	mmu_atc_stats.translate++;
 
 	for (i = 0; i < ATC_WAYS; i++) {
 		// if we have this
@@ -853,6 +904,7 @@ atc_retry:
 
 				// save way for next access (likely in same page)
 				mmu_atc_ways[data] = way;
+				mmu_atc_stats.atc_hit++;
 
 				if (l->status & MMU_MMUSR_CM_DISABLE) {
 					mmu_cache_state = CACHE_DISABLE_MMU;
@@ -880,6 +932,7 @@ atc_retry:
 	
 	// then initiate table search and create a new entry
 	l = &mmu_atc_array[data][index][way];
+	mmu_atc_stats.atc_miss++;
 	mmu_fill_atc(addr, super, tag, write, l, &status060);
 
 	if (status060 && currprefs.mmu_model == 68060) {
@@ -1409,6 +1462,7 @@ void REGPARAM2 mmu_flush_atc(uaecptr addr, bool super, bool global)
 			}
 		}
 	}	
+	mmu_atc_stats.flush++;
 	flush_shortcut_cache(addr, super);
 	mmu_flush_cache();
 }
@@ -1426,6 +1480,7 @@ void REGPARAM2 mmu_flush_atc_all(bool global)
 			}
 		}
 	}
+	mmu_atc_stats.flush_all++;
 	flush_shortcut_cache(0xffffffff, 0);
 	mmu_flush_cache();
 }
@@ -1,10 +1,26 @@
-
 #include "sysconfig.h"
 #include "sysdeps.h"
 
 #include "crc32.h"
+#include "uae/time.h"
+#include "debug.h"
+
+/* CRC32 uses slice-by-8 tables, or PCLMULQDQ folding for longer buffers
+* and SHA-1 uses the SHA extensions if the CPU has them. The method is
+* picked on first use and checked against the portable code first.  */
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define CRC32_SIMD 1
+#include <immintrin.h>
+#include <cpuid.h>
+#endif
 
-static unsigned long crc_table32[256];
+enum { crc32_slice8, crc32_pclmul };
+enum { sha1_scalar, sha1_shani };
+static int crc32_mode, sha1_mode;
+static const TCHAR *crc32_names[] = { _T("slice-by-8"), _T("PCLMULQDQ") };
+static const TCHAR *sha1_names[] = { _T("scalar"), _T("SHA-NI") };
+
+static uae_u32 crc_table32[8][256];
 static unsigned short crc_table16[256];
 static void make_crc_table (void)
 {
@@ -18,35 +34,159 @@ static void make_crc_table (void)
 			c = (c >> 1) ^ (c & 1 ? 0xedb88320 : 0);
 			w = (w << 1) ^ ((w & 0x8000) ? 0x1021 : 0);
 		}
-		crc_table32[n] = c;
+		crc_table32[0][n] = c;
 		crc_table16[n] = w;
 	}
+	for (n = 0; n < 256; n++) {
+		for (k = 1; k < 8; k++) {
+			c = crc_table32[k - 1][n];
+			crc_table32[k][n] = (c >> 8) ^ crc_table32[0][c & 0xff];
+		}
+	}
+}
+
+/* crc is the inverted running value in all of these */
+static uae_u32 crc32_bytes (uae_u32 crc, const uae_u8 *buf, int len)
+{
+	while (len-- > 0)
+		crc = crc_table32[0][(crc ^ (*buf++)) & 0xff] ^ (crc >> 8);
+	return crc;
+}
+
+static uae_u32 crc32_slice8_do (uae_u32 crc, const uae_u8 *buf, int len)
+{
+	while (len >= 8) {
+		uae_u32 one = (buf[0] | (buf[1] << 8) | (buf[2] << 16) | ((uae_u32)buf[3] << 24)) ^ crc;
+		uae_u32 two = buf[4] | (buf[5] << 8) | (buf[6] << 16) | ((uae_u32)buf[7] << 24);
+		crc = crc_table32[7][one & 0xff] ^
+			crc_table32[6][(one >> 8) & 0xff] ^
+			crc_table32[5][(one >> 16) & 0xff] ^
+			crc_table32[4][one >> 24] ^
+			crc_table32[3][two & 0xff] ^
+			crc_table32[2][(two >> 8) & 0xff] ^
+			crc_table32[1][(two >> 16) & 0xff] ^
+			crc_table32[0][two >> 24];
+		buf += 8;
+		len -= 8;
+	}
+	return crc32_bytes (crc, buf, len);
+}
+
+#ifdef CRC32_SIMD
+
+/* Folds 4x128 bits per round, then reduces to 32 bits (Barrett).
+* len must be at least 64 and a multiple of 16.  */
+__attribute__((target("sse4.1,pclmul")))
+static uae_u32 crc32_pclmul_do (uae_u32 crc, const uae_u8 *buf, int len)
+{
+	const __m128i k1k2 = _mm_set_epi64x (0x01c6e41596LL, 0x0154442bd4LL);
+	const __m128i k3k4 = _mm_set_epi64x (0x00ccaa009eLL, 0x01751997d0LL);
+	const __m128i k5k0 = _mm_set_epi64x (0, 0x0163cd6124LL);
+	const __m128i poly = _mm_set_epi64x (0x01f7011641LL, 0x01db710641LL);
+	const __m128i mask32 = _mm_setr_epi32 (~0, 0, ~0, 0);
+	__m128i x1, x2, x3, x4, x5, x6, x7, x8;
+
+	x1 = _mm_loadu_si128 ((const __m128i*)(buf + 0x00));
+	x2 = _mm_loadu_si128 ((const __m128i*)(buf + 0x10));
+	x3 = _mm_loadu_si128 ((const __m128i*)(buf + 0x20));
+	x4 = _mm_loadu_si128 ((const __m128i*)(buf + 0x30));
+	x1 = _mm_xor_si128 (x1, _mm_cvtsi32_si128 (crc));
+	buf += 64;
+	len -= 64;
+
+	while (len >= 64) {
+		x5 = _mm_clmulepi64_si128 (x1, k1k2, 0x00);
+		x6 = _mm_clmulepi64_si128 (x2, k1k2, 0x00);
+		x7 = _mm_clmulepi64_si128 (x3, k1k2, 0x00);
+		x8 = _mm_clmulepi64_si128 (x4, k1k2, 0x00);
+		x1 = _mm_clmulepi64_si128 (x1, k1k2, 0x11);
+		x2 = _mm_clmulepi64_si128 (x2, k1k2, 0x11);
+		x3 = _mm_clmulepi64_si128 (x3, k1k2, 0x11);
+		x4 = _mm_clmulepi64_si128 (x4, k1k2, 0x11);
+		x1 = _mm_xor_si128 (_mm_xor_si128 (x1, x5), _mm_loadu_si128 ((const __m128i*)(buf + 0x00)));
+		x2 = _mm_xor_si128 (_mm_xor_si128 (x2, x6), _mm_loadu_si128 ((const __m128i*)(buf + 0x10)));
+		x3 = _mm_xor_si128 (_mm_xor_si128 (x3, x7), _mm_loadu_si128 ((const __m128i*)(buf + 0x20)));
+		x4 = _mm_xor_si128 (_mm_xor_si128 (x4, x8), _mm_loadu_si128 ((const __m128i*)(buf + 0x30)));
+		buf += 64;
+		len -= 64;
+	}
+
+	/* fold into 128 bits */
+	x5 = _mm_clmulepi64_si128 (x1, k3k4, 0x00);
+	x1 = _mm_clmulepi64_si128 (x1, k3k4, 0x11);
+	x1 = _mm_xor_si128 (_mm_xor_si128 (x1, x2), x5);
+	x5 = _mm_clmulepi64_si128 (x1, k3k4, 0x00);
+	x1 = _mm_clmulepi64_si128 (x1, k3k4, 0x11);
+	x1 = _mm_xor_si128 (_mm_xor_si128 (x1, x3), x5);
+	x5 = _mm_clmulepi64_si128 (x1, k3k4, 0x00);
+	x1 = _mm_clmulepi64_si128 (x1, k3k4, 0x11);
+	x1 = _mm_xor_si128 (_mm_xor_si128 (x1, x4), x5);
+
+	while (len >= 16) {
+		x2 = _mm_loadu_si128 ((const __m128i*)buf);
+		x5 = _mm_clmulepi64_si128 (x1, k3k4, 0x00);
+		x1 = _mm_clmulepi64_si128 (x1, k3k4, 0x11);
+		x1 = _mm_xor_si128 (_mm_xor_si128 (x1, x2), x5);
+		buf += 16;
+		len -= 16;
+	}
+
+	/* 128 to 64 bits */
+	x2 = _mm_clmulepi64_si128 (x1, k3k4, 0x10);
+	x1 = _mm_xor_si128 (_mm_srli_si128 (x1, 8), x2);
+	x2 = _mm_srli_si128 (x1, 4);
+	x1 = _mm_and_si128 (x1, mask32);
+	x1 = _mm_clmulepi64_si128 (x1, k5k0, 0x00);
+	x1 = _mm_xor_si128 (x1, x2);
+
+	/* Barrett reduction to 32 bits */
+	x2 = _mm_and_si128 (x1, mask32);
+	x2 = _mm_clmulepi64_si128 (x2, poly, 0x10);
+	x2 = _mm_and_si128 (x2, mask32);
+	x2 = _mm_clmulepi64_si128 (x2, poly, 0x00);
+	x1 = _mm_xor_si128 (x1, x2);
+	return _mm_extract_epi32 (x1, 1);
+}
+
+#endif /* CRC32_SIMD */
+
+static uae_u32 crc32_do (uae_u32 crc, const uae_u8 *buf, int len)
+{
+#ifdef CRC32_SIMD
+	if (crc32_mode == crc32_pclmul && len >= 64) {
+		int blocks = len & ~15;
+		crc = crc32_pclmul_do (crc, buf, blocks);
+		buf += blocks;
+		len -= blocks;
+	}
+#endif
+	return crc32_slice8_do (crc, buf, len);
 }
+
+static void crc32_init (void);
+
 uae_u32 get_crc32_val (uae_u8 v, uae_u32 crc)
 {
-	if (!crc_table32[1])
-		make_crc_table();
+	crc32_init ();
 	crc ^= 0xffffffff;
-	crc = crc_table32[(crc ^ v) & 0xff] ^ (crc >> 8);
+	crc = crc_table32[0][(crc ^ v) & 0xff] ^ (crc >> 8);
 	return crc ^ 0xffffffff;
 }
 uae_u32 get_crc32 (void *vbuf, int len)
 {
-	uae_u8 *buf = (uae_u8*)vbuf;
-	uae_u32 crc;
-	if (!crc_table32[1])
-		make_crc_table();
-	crc = 0xffffffff;
-	while (len-- > 0)
-		crc = crc_table32[(crc ^ (*buf++)) & 0xff] ^ (crc >> 8);
-	return crc ^ 0xffffffff;
+	crc32_init ();
+	return crc32_do (0xffffffff, (uae_u8*)vbuf, len) ^ 0xffffffff;
+}
+uae_u32 get_crc32_more (uae_u32 crc, void *vbuf, int len)
+{
+	crc32_init ();
+	return crc32_do (crc ^ 0xffffffff, (uae_u8*)vbuf, len) ^ 0xffffffff;
 }
 uae_u16 get_crc16 (void *vbuf, int len)
 {
 	uae_u8 *buf = (uae_u8*)vbuf;
 	uae_u16 crc;
-	if (!crc_table32[1])
-		make_crc_table();
+	crc32_init ();
 	crc = 0xffff;
 	while (len-- > 0)
 		crc = (crc << 8) ^ crc_table16[((crc >> 8) ^ (*buf++)) & 0xff];
@@ -72,13 +212,6 @@ uae_u16 get_crc16 (void *vbuf, int len)
 }
 #endif
 
-typedef struct
-{
-	unsigned long total[2];     /*!< number of bytes processed  */
-	unsigned long state[5];     /*!< intermediate digest state  */
-	unsigned char buffer[64];   /*!< data block being processed */
-}
-sha1_context;
 
 static void sha1_starts( sha1_context *ctx )
 {
@@ -248,6 +381,107 @@ static void sha1_process( sha1_context *ctx, unsigned char data[64] )
 	ctx->state[4] += E;
 }
 
+#ifdef CRC32_SIMD
+
+#define SHA1_ROUND4(e, enext, m, f) \
+	e = _mm_sha1nexte_epu32 (e, m); \
+	enext = abcd; \
+	abcd = _mm_sha1rnds4_epu32 (abcd, e, f)
+
+/* 64 byte blocks with the SHA extensions. Rounds 4*g..4*g+3 use
+* W from msg[g % 4], which is computed three groups ahead with
+* msg1, xor and msg2.  */
+__attribute__((target("sha,sse4.1")))
+static void sha1_shani_do (sha1_context *ctx, const uae_u8 *data, int blocks)
+{
+	const __m128i bswap = _mm_set_epi64x (0x0001020304050607LL, 0x08090a0b0c0d0e0fLL);
+	__m128i abcd, abcd_save, e0, e0_save, e1;
+	__m128i m0, m1, m2, m3;
+
+	abcd = _mm_set_epi32 (ctx->state[0], ctx->state[1], ctx->state[2], ctx->state[3]);
+	e0 = _mm_set_epi32 (ctx->state[4], 0, 0, 0);
+
+	while (blocks-- > 0) {
+		abcd_save = abcd;
+		e0_save = e0;
+
+		m0 = _mm_shuffle_epi8 (_mm_loadu_si128 ((const __m128i*)(data + 0)), bswap);
+		m1 = _mm_shuffle_epi8 (_mm_loadu_si128 ((const __m128i*)(data + 16)), bswap);
+		m2 = _mm_shuffle_epi8 (_mm_loadu_si128 ((const __m128i*)(data + 32)), bswap);
+		m3 = _mm_shuffle_epi8 (_mm_loadu_si128 ((const __m128i*)(data + 48)), bswap);
+
+		/* 0-3 */
+		e0 = _mm_add_epi32 (e0, m0);
+		e1 = abcd;
+		abcd = _mm_sha1rnds4_epu32 (abcd, e0, 0);
+		/* 4-15 */
+		SHA1_ROUND4 (e1, e0, m1, 0);
+		m0 = _mm_sha1msg1_epu32 (m0, m1);
+		SHA1_ROUND4 (e0, e1, m2, 0);
+		m1 = _mm_sha1msg1_epu32 (m1, m2);
+		m0 = _mm_xor_si128 (m0, m2);
+		SHA1_ROUND4 (e1, e0, m3, 0);
+		m0 = _mm_sha1msg2_epu32 (m0, m3);
+		m2 = _mm_sha1msg1_epu32 (m2, m3);
+		m1 = _mm_xor_si128 (m1, m3);
+		/* 16-67, same pattern with the message registers rotating */
+#define SHA1_SCHEDULE(e, enext, a, b, c, d, f) \
+		SHA1_ROUND4 (e, enext, a, f); \
+		b = _mm_sha1msg2_epu32 (b, a); \
+		d = _mm_sha1msg1_epu32 (d, a); \
+		c = _mm_xor_si128 (c, a)
+		SHA1_SCHEDULE (e0, e1, m0, m1, m2, m3, 0);
+		SHA1_SCHEDULE (e1, e0, m1, m2, m3, m0, 1);
+		SHA1_SCHEDULE (e0, e1, m2, m3, m0, m1, 1);
+		SHA1_SCHEDULE (e1, e0, m3, m0, m1, m2, 1);
+		SHA1_SCHEDULE (e0, e1, m0, m1, m2, m3, 1);
+		SHA1_SCHEDULE (e1, e0, m1, m2, m3, m0, 1);
+		SHA1_SCHEDULE (e0, e1, m2, m3, m0, m1, 2);
+		SHA1_SCHEDULE (e1, e0, m3, m0, m1, m2, 2);
+		SHA1_SCHEDULE (e0, e1, m0, m1, m2, m3, 2);
+		SHA1_SCHEDULE (e1, e0, m1, m2, m3, m0, 2);
+		SHA1_SCHEDULE (e0, e1, m2, m3, m0, m1, 2);
+		SHA1_SCHEDULE (e1, e0, m3, m0, m1, m2, 3);
+		SHA1_SCHEDULE (e0, e1, m0, m1, m2, m3, 3);
+#undef SHA1_SCHEDULE
+		/* 68-79 */
+		SHA1_ROUND4 (e1, e0, m1, 3);
+		m2 = _mm_sha1msg2_epu32 (m2, m1);
+		m3 = _mm_xor_si128 (m3, m1);
+		SHA1_ROUND4 (e0, e1, m2, 3);
+		m3 = _mm_sha1msg2_epu32 (m3, m2);
+		SHA1_ROUND4 (e1, e0, m3, 3);
+
+		e0 = _mm_sha1nexte_epu32 (e0, e0_save);
+		abcd = _mm_add_epi32 (abcd, abcd_save);
+		data += 64;
+	}
+
+	ctx->state[0] = (uae_u32)_mm_extract_epi32 (abcd, 3);
+	ctx->state[1] = (uae_u32)_mm_extract_epi32 (abcd, 2);
+	ctx->state[2] = (uae_u32)_mm_extract_epi32 (abcd, 1);
+	ctx->state[3] = (uae_u32)_mm_extract_epi32 (abcd, 0);
+	ctx->state[4] = (uae_u32)_mm_extract_epi32 (e0, 3);
+}
+
+#undef SHA1_ROUND4
+
+#endif /* CRC32_SIMD */
+
+static void sha1_blocks( sha1_context *ctx, unsigned char *input, int blocks )
+{
+#ifdef CRC32_SIMD
+	if (sha1_mode == sha1_shani) {
+		sha1_shani_do (ctx, input, blocks);
+		return;
+	}
+#endif
+	while (blocks-- > 0) {
+		sha1_process (ctx, input);
+		input += 64;
+	}
+}
+
 /*
 * SHA-1 process buffer
 */
@@ -278,11 +512,11 @@ static void sha1_update( sha1_context *ctx, unsigned char *input, int ilen )
 		left = 0;
 	}
 
-	while( ilen >= 64 )
+	if( ilen >= 64 )
 	{
-		sha1_process( ctx, input );
-		input += 64;
-		ilen  -= 64;
+		sha1_blocks( ctx, input, ilen / 64 );
+		input += ilen & ~63;
+		ilen  &= 63;
 	}
 
 	if( ilen > 0 )
@@ -335,10 +569,24 @@ void get_sha1 (void *vinput, int len, void *vout)
 	uae_u8 *out = (uae_u8*)vout;
 	sha1_context ctx;
 
+	crc32_init ();
 	sha1_starts( &ctx );
 	sha1_update( &ctx, input, len );
 	sha1_finish( &ctx, out );
 }
+void get_sha1_start (sha1_context *ctx)
+{
+	crc32_init ();
+	sha1_starts (ctx);
+}
+void get_sha1_more (sha1_context *ctx, void *vinput, int len)
+{
+	sha1_update (ctx, (uae_u8*)vinput, len);
+}
+void get_sha1_finish (sha1_context *ctx, void *vout)
+{
+	sha1_finish (ctx, (uae_u8*)vout);
+}
 const TCHAR *get_sha1_txt (void *vinput, int len)
 {
 	uae_u8 *input = (uae_u8*)vinput;
@@ -356,3 +604,145 @@ const TCHAR *get_sha1_txt (void *vinput, int len)
 	*p = 0;
 	return outtxt;
 }
+
+static uae_u8 *crc32_testdata (int len)
+{
+	uae_u8 *buf = xmalloc (uae_u8, len);
+	uae_u32 seed = 0x12345678;
+	for (int i = 0; i < len; i++) {
+		seed = seed * 1103515245 + 12345;
+		buf[i] = seed >> 16;
+	}
+	return buf;
+}
+
+static const int crc32_test_lengths[] = { 0, 1, 15, 16, 63, 64, 65, 127, 128, 200, 1000, 4103, -1 };
+
+// compare against the byte loop and scalar SHA-1, odd lengths and alignments
+static bool crc32_check (int mode)
+{
+	uae_u8 *buf = crc32_testdata (4103 + 8);
+	int old = crc32_mode;
+	bool ok = true;
+
+	for (int i = 0; crc32_test_lengths[i] >= 0 && ok; i++) {
+		for (int align = 0; align < 8 && ok; align++) {
+			int len = crc32_test_lengths[i];
+			uae_u32 ref = crc32_bytes (0xffffffff, buf + align, len);
+			crc32_mode = mode;
+			ok = crc32_do (0xffffffff, buf + align, len) == ref;
+		}
+	}
+	crc32_mode = old;
+	xfree (buf);
+	return ok;
+}
+
+static void sha1_test (int mode, uae_u8 *buf, int len, uae_u8 *out)
+{
+	sha1_context ctx;
+	int old = sha1_mode;
+
+	sha1_mode = mode;
+	sha1_starts (&ctx);
+	sha1_update (&ctx, buf, len);
+	sha1_finish (&ctx, out);
+	sha1_mode = old;
+}
+
+static bool sha1_check (int mode)
+{
+	uae_u8 *buf = crc32_testdata (4103 + 8);
+	bool ok = true;
+
+	for (int i = 0; crc32_test_lengths[i] >= 0 && ok; i++) {
+		for (int align = 0; align < 8 && ok; align += 3) {
+			uae_u8 out1[SHA1_SIZE], out2[SHA1_SIZE];
+			int len = crc32_test_lengths[i];
+			sha1_test (sha1_scalar, buf + align, len, out1);
+			sha1_test (mode, buf + align, len, out2);
+			ok = !memcmp (out1, out2, SHA1_SIZE);
+		}
+	}
+	xfree (buf);
+	return ok;
+}
+
+static void crc32_best (int *crc, int *sha)
+{
+	*crc = crc32_slice8;
+	*sha = sha1_scalar;
+#ifdef CRC32_SIMD
+	__builtin_cpu_init ();
+	if (__builtin_cpu_supports ("sse4.1") && __builtin_cpu_supports ("pclmul"))
+		*crc = crc32_pclmul;
+	unsigned int eax, ebx, ecx, edx;
+	if (__builtin_cpu_supports ("sse4.1") && __get_cpuid_count (7, 0, &eax, &ebx, &ecx, &edx) && (ebx & bit_SHA))
+		*sha = sha1_shani;
+#endif
+}
+
+static bool crc32_setup (void)
+{
+	int crc, sha;
+
+	make_crc_table ();
+	crc32_best (&crc, &sha);
+	if (crc != crc32_slice8 && !crc32_check (crc)) {
+		write_log (_T("CRC32: %s self-test failed\n"), crc32_names[crc]);
+		crc = crc32_slice8;
+	}
+	if (sha != sha1_scalar && !sha1_check (sha)) {
+		write_log (_T("SHA-1: %s self-test failed\n"), sha1_names[sha]);
+		sha = sha1_scalar;
+	}
+	crc32_mode = crc;
+	sha1_mode = sha;
+	write_log (_T("CRC32: %s, SHA-1: %s\n"), crc32_names[crc32_mode], sha1_names[sha1_mode]);
+	return true;
+}
+
+// thread safe, ROMs are scanned on several threads
+static void crc32_init (void)
+{
+	static bool done = crc32_setup ();
+	(void)done;
+}
+
+/* Debugger "B crc": CRC32 and SHA-1 throughput of every usable method
+* on a 1MB buffer.  */
+void crc32_benchmark (void)
+{
+	const int len = 1024 * 1024;
+	const int rounds = 64;
+	uae_u8 *buf = crc32_testdata (len);
+	int oldcrc = crc32_mode, oldsha = sha1_mode;
+	int bestcrc, bestsha;
+	volatile uae_u32 sink = 0;
+
+	crc32_init ();
+	crc32_best (&bestcrc, &bestsha);
+	for (int mode = crc32_slice8; mode <= bestcrc; mode++) {
+		crc32_mode = mode;
+		int64_t t = uae_time_us ();
+		for (int i = 0; i < rounds; i++)
+			sink = crc32_do (0xffffffff, buf, len);
+		t = uae_time_us () - t;
+		console_out_f (_T("CRC32 %-10s %8.1f MB/s%s\n"), crc32_names[mode],
+			t > 0 ? rounds * 1000000.0 / t : 0.0,
+			mode != crc32_slice8 && !crc32_check (mode) ? _T(" MISMATCH") : _T(""));
+	}
+	crc32_mode = oldcrc;
+	for (int mode = sha1_scalar; mode <= bestsha; mode++) {
+		uae_u8 out[SHA1_SIZE];
+		int64_t t = uae_time_us ();
+		for (int i = 0; i < rounds; i++)
+			sha1_test (mode, buf, len, out);
+		t = uae_time_us () - t;
+		console_out_f (_T("SHA-1 %-10s %8.1f MB/s%s\n"), sha1_names[mode],
+			t > 0 ? rounds * 1000000.0 / t : 0.0,
+			mode != sha1_scalar && !sha1_check (mode) ? _T(" MISMATCH") : _T(""));
+	}
+	sha1_mode = oldsha;
+	xfree (buf);
+}
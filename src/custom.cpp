@@ -68,12 +68,54 @@ extern uae_u16 serper;
 #ifdef FSUAE // NL
 #include "uae/fs.h"
 
+#include "fsemu-benchmark.h"
 #include "fsemu-frame.h"
 #include "fsemu-quit.h"
 #include "fsemu-time.h"
 #include <fs/emu/hacks.h>
 int g_frame_debug_logging = 0;
 
+static void benchmark_describe(void)
+{
+	const TCHAR *core = _T("fast");
+	if (currprefs.cachesize) {
+		core = _T("jit");
+	} else if (currprefs.cpu_cycle_exact) {
+		core = _T("cycle-exact");
+	} else if (currprefs.cpu_compatible) {
+		core = _T("compatible");
+	}
+	const TCHAR *chipset = _T("OCS");
+	if (currprefs.chipset_mask & CSMASK_AGA) {
+		chipset = _T("AGA");
+	} else if (currprefs.chipset_mask & (CSMASK_ECS_AGNUS | CSMASK_ECS_DENISE)) {
+		chipset = _T("ECS");
+	}
+	fsemu_benchmark_set_info("cpu_core", core);
+	fsemu_benchmark_set_info_int("cpu_model", currprefs.cpu_model);
+	fsemu_benchmark_set_info_int("fpu_model", currprefs.fpu_model);
+	fsemu_benchmark_set_info_int("jit_cache_size", currprefs.cachesize);
+	fsemu_benchmark_set_info("chipset", chipset);
+	fsemu_benchmark_set_info("video", currprefs.ntscmode ? _T("NTSC") : _T("PAL"));
+	fsemu_benchmark_set_info_int("chip_memory", currprefs.chipmem_size);
+	fsemu_benchmark_set_info_int("cycle_unit", CYCLE_UNIT);
+}
+
+// Reports emulated time to the benchmark module, in color clocks.
+static void benchmark_frame_end(void)
+{
+	static bool described;
+	static unsigned long last_cycles;
+	unsigned long cycles = get_cycles();
+	if (!described) {
+		benchmark_describe();
+		described = true;
+	} else {
+		fsemu_benchmark_add_cycles((cycles - last_cycles) / CYCLE_UNIT);
+	}
+	last_cycles = cycles;
+}
+
 // static int64_t frame_begin_at;
 // static int64_t frame_end_at;
 
@@ -646,7 +688,7 @@ static void docols (struct color_entry *colentry)
 #endif
 }
 
-extern struct color_entry colors_for_drawing;
+extern thread_local struct color_entry colors_for_drawing;
 
 void notice_new_xcolors (void)
 {
@@ -8433,6 +8475,10 @@ static void vsync_handler_pre (void)
 		rtg_vsync ();
 #endif
 
+#ifdef FSUAE
+	int64_t render_started_at = fsemu_time_us();
+	int64_t render_us = 0;
+#endif
 	if (!vsync_rendered) {
 		frame_time_t start, end;
 		start = read_processor_time ();
@@ -8458,7 +8504,13 @@ static void vsync_handler_pre (void)
 		frameskiptime += end - start;
 	}
 
+#ifdef FSUAE
+	render_us += fsemu_time_us() - render_started_at;
+#endif
 	bool frameok = framewait ();
+#ifdef FSUAE
+	render_started_at = fsemu_time_us();
+#endif
 	
 	if (!ad->picasso_on) {
 		if (!frame_rendered && vblank_hz_state) {
@@ -8481,6 +8533,11 @@ static void vsync_handler_pre (void)
 
 #ifdef FSUAE // NL
 	if (fsemu) {
+		render_us += fsemu_time_us() - render_started_at;
+		fsemu_frame_render_duration += render_us;
+		if (fsemu_benchmark_enabled()) {
+			benchmark_frame_end();
+		}
 		amiga_flush_audio();
 		// fsemu_audio_end_frame(g_fs_uae_frame);
 		fsemu_frame_end();
@@ -8581,6 +8638,9 @@ static void vsync_handler_post (void)
 		write_log (_T("vblank interrupt not cleared\n"));
 #endif
 	DISK_vsync ();
+#ifdef FILESYS
+	hardfile_vsync ();
+#endif
 
 #ifdef WITH_LUA
 	uae_lua_run_handler ("on_uae_vsync");
@@ -10589,6 +10649,7 @@ void init_eventtab (void)
 	for (i = 0; i < ev2_max; i++) {
 		eventtab2[i].active = 0;
 	}
+	events_reset_queue ();
 
 	eventtab[ev_cia].handler = CIA_handler;
 	eventtab[ev_hsync].handler = hsync_handler;
@@ -51,6 +51,7 @@
 #include "drawing.h"
 #include "devices.h"
 #include "blitter.h"
+#include "picasso96.h"
 #include "ini.h"
 #include "readcpu.h"
 
@@ -228,6 +229,7 @@ static const TCHAR help[] = {
 	_T("  Td,Tl,Tr,Tp,Ts,TS,Ti,TO,TM,Tf Show devs, libs, resources, ports, semaphores,\n")
 	_T("                        residents, interrupts, doslist, memorylist, fsres.\n")
 	_T("  b                     Step to previous state capture position.\n")
+	_T("  bi <hsync>            Seek input recording playback to <hsync>.\n")
 	_T("  M<a/b/s> <val>        Enable or disable audio channels, bitplanes or sprites.\n")
 	_T("  sp <addr> [<addr2][<size>] Dump sprite information.\n")
 	_T("  di <mode> [<track>]   Break on disk access. R=DMA read,W=write,RW=both,P=PIO.\n")
@@ -236,6 +238,7 @@ static const TCHAR help[] = {
 	_T("  dj [<level bitmask>]  Enable joystick/mouse input debugging.\n")
 	_T("  smc [<0-1>]           Enable self-modifying code detector. 1 = enable break.\n")
 	_T("  dm                    Dump current address space map.\n")
+	_T("  mmus [r]              Show or reset 68040/060 ATC statistics.\n")
 	_T("  v <vpos> [<hpos>]     Show DMA data (accurate only in cycle-exact mode).\n")
 	_T("                        v [-1 to -4] = enable visual DMA debugger.\n")
 #ifdef WITH_SEGTRACKER
@@ -249,6 +252,12 @@ static const TCHAR help[] = {
 	_T("  Zc 'file' <line>      find source code line address.\n")
 #endif /* WITH_SEGTRACKER */
 	_T("  vh [<ratio> <lines>]  \"Heat map\"\n")
+	_T("  B p2c                 Benchmark planar to chunky conversion.\n")
+	_T("  B crc                 Benchmark CRC32 and SHA-1.\n")
+	_T("  B blit                Benchmark blitter row engine.\n")
+#ifdef PICASSO96
+	_T("  B p96                 Benchmark RTG blit primitives.\n")
+#endif
 	_T("  I <custom event>      Send custom event string\n")
 	_T("  ?<value>              Hex ($ and 0x)/Bin (%)/Dec (!) converter and calculator.\n")
 #ifdef _WIN32
@@ -3493,6 +3502,9 @@ static void memwatch_remap (uaecptr addr)
 		newbank->xlateaddr = debug_xlate;
 		newbank->wgeti = mode ? mmu_wgeti : debug_wgeti;
 		newbank->lgeti = mode ? mmu_lgeti : debug_lgeti;
+		/* accesses must go through the handlers above */
+		newbank->baseaddr_direct_r = NULL;
+		newbank->baseaddr_direct_w = NULL;
 		/* name will be freed by memwatch_reset */
 		newbank->name = my_strdup (tmp);
 		if (!newbank->mask)
@@ -5005,6 +5017,20 @@ static void searchmem (TCHAR **cc)
 
 static int staterecorder (TCHAR **cc)
 {
+	if (**cc == 'i') {
+		uae_u32 hsync;
+
+		next_char (cc);
+		if (!more_params (cc))
+			return 0;
+		hsync = readint (cc);
+		if (inprec_seek (hsync)) {
+			console_out_f (_T("Seeking input recording to %u\n"), hsync);
+			return 1;
+		}
+		console_out (_T("Input recording seek failed\n"));
+		return 0;
+	}
 #if 0
 	TCHAR nc;
 
@@ -6056,6 +6082,17 @@ static bool debug_line (TCHAR *input)
 					if (inptr[0] == 'd') {
 						if (currprefs.mmu_model >= 68040)
 							mmu_dump_tables();
+					} else if (inptr[0] == 's') {
+						if (currprefs.mmu_model >= 68040) {
+							next_char (&inptr);
+							ignore_ws (&inptr);
+							if (*inptr == 'r') {
+								mmu_atc_stats_reset();
+								console_out (_T("MMU statistics reset\n"));
+							} else {
+								mmu_dump_atc_stats();
+							}
+						}
 					} else {
 						if (currprefs.mmu_model) {
 							if (more_params (&inptr))
@@ -6197,6 +6234,21 @@ static bool debug_line (TCHAR *input)
 			if (staterecorder (&inptr))
 				return true;
 			break;
+		case 'B':
+			ignore_ws (&inptr);
+			if (!_tcsnicmp (inptr, _T("p2c"), 3))
+				drawing_p2c_benchmark ();
+			else if (!_tcsnicmp (inptr, _T("crc"), 3))
+				crc32_benchmark ();
+			else if (!_tcsnicmp (inptr, _T("blit"), 4))
+				blitter_benchmark ();
+#ifdef PICASSO96
+			else if (!_tcsnicmp (inptr, _T("p96"), 3))
+				picasso96_benchmark ();
+#endif
+			else
+				console_out (_T("Unknown benchmark.\n"));
+			break;
 		case 'u':
 			{
 				if (more_params(&inptr)) {
@@ -212,6 +212,9 @@ void devices_hsync(void)
 #ifdef A2091
 	scsi_hsync ();
 #endif
+#ifdef NCR
+	ncr_hsync();
+#endif
 }
 
 void devices_rethink_all(void func(void))
@@ -343,11 +346,15 @@ void do_leave_program (void)
 	picasso_free();
 	free_traps();
 	sampler_free ();
+	drawing_free ();
 	graphics_leave ();
 	inputdevice_close ();
 	DISK_free ();
 	close_sound ();
 	dump_counts ();
+#ifdef JIT
+	compemu_trace_save ();
+#endif
 #ifdef PARALLEL_PORT
 	parallel_exit();
 #endif
@@ -370,6 +377,7 @@ void do_leave_program (void)
 #ifdef NCR9X
 	ncr9x_free();
 #endif
+	scsi_async_free();
 #ifdef A2065
 	a2065_free();
 #endif
@@ -39,6 +39,7 @@ happening, all ports should restrict window widths to be multiples of 16 pixels.
 #include "threaddep/thread.h"
 #include "uae.h"
 #include "uae/memory.h"
+#include "uae/time.h"
 #include "custom.h"
 #include "newcpu.h"
 #include "xwin.h"
@@ -111,7 +112,7 @@ bool direct_rgb;
 coordinates.  Zero if the resolution is the same, positive if window coordinates
 have a higher resolution (i.e. we're stretching the image), negative if window
 coordinates have a lower resolution (i.e. we're shrinking the image).  */
-static int res_shift;
+static thread_local int res_shift;
 
 static int linedbl, linedbld;
 
@@ -156,9 +157,9 @@ struct spritepixelsbuf {
 	uae_u16 stfmdata;
 	uae_u16 data;
 };
-static struct spritepixelsbuf spritepixels_buffer[MAX_PIXELS_PER_LINE];
-static struct spritepixelsbuf *spritepixels;
-static int sprite_first_x, sprite_last_x;
+static thread_local struct spritepixelsbuf spritepixels_buffer[MAX_PIXELS_PER_LINE];
+static thread_local struct spritepixelsbuf *spritepixels;
+static thread_local int sprite_first_x, sprite_last_x;
 
 /* AGA mode color lookup tables */
 unsigned int xredcolors[256], xgreencolors[256], xbluecolors[256];
@@ -172,16 +173,16 @@ int xredcolor_s, xredcolor_b, xredcolor_m;
 int xgreencolor_s, xgreencolor_b, xgreencolor_m;
 int xbluecolor_s, xbluecolor_b, xbluecolor_m;
 
-struct color_entry colors_for_drawing;
+thread_local struct color_entry colors_for_drawing;
 static struct color_entry direct_colors_for_drawing;
 
-static xcolnr *p_acolors;
-static xcolnr *p_xcolors;
+static thread_local xcolnr *p_acolors;
+static thread_local xcolnr *p_xcolors;
 
 /* The size of these arrays is pretty arbitrary; it was chosen to be "more
 than enough".  The coordinates used for indexing into these arrays are
 almost, but not quite, Amiga coordinates (there's a constant offset).  */
-static union {
+static thread_local union {
 	uae_u64 apixels_q[MAX_PIXELS_PER_LINE * 2 / sizeof(uae_u64)];
 	uae_u32 apixels_l[MAX_PIXELS_PER_LINE * 2 / sizeof(uae_u32)];
 	uae_u8  apixels[MAX_PIXELS_PER_LINE * 2];
@@ -199,13 +200,13 @@ uae_u16 spixels[2 * MAX_SPR_PIXELS];
 
 struct sprite_stb spixstate;
 
-static uae_u32 ham_linebuf[MAX_PIXELS_PER_LINE * 2];
-static uae_u8 *real_bplpt[8];
+static thread_local uae_u32 ham_linebuf[MAX_PIXELS_PER_LINE * 2];
+static thread_local uae_u8 *real_bplpt[8];
 
 static uae_u8 all_ones[MAX_PIXELS_PER_LINE];
 static uae_u8 all_zeros[MAX_PIXELS_PER_LINE];
 
-uae_u8 *xlinebuffer, *xlinebuffer_genlock;
+thread_local uae_u8 *xlinebuffer, *xlinebuffer_genlock;
 
 static int *amiga2aspect_line_map, *native2amiga_line_map;
 static uae_u8 **row_map;
@@ -215,6 +216,33 @@ static int max_drawn_amiga_line;
 uae_u8 **row_map_genlock;
 uae_u8 *row_map_color_burst_buffer;
 
+/* Rows of the draw buffer written since the host video code last took them
+* with drawing_get_dirty_rows (one bit per row). Lines that are unchanged
+* since the previous frame are not drawn at all (LINE_DONE), so the host
+* can skip converting and uploading those rows as well.  */
+static uae_u32 *dirty_rows;
+static int dirty_rows_words;
+static bool dirty_rows_all = true;
+
+static void mark_row_dirty (int y)
+{
+	if (y >= 0 && y < dirty_rows_words * 32)
+		dirty_rows[y >> 5] |= 1u << (y & 31);
+}
+
+bool drawing_get_dirty_rows (uae_u32 *bits, int rows, bool clear)
+{
+	bool valid = !dirty_rows_all && dirty_rows && rows <= dirty_rows_words * 32;
+	if (valid)
+		memcpy (bits, dirty_rows, ((rows + 31) / 32) * sizeof (uae_u32));
+	if (clear) {
+		if (dirty_rows)
+			memset (dirty_rows, 0, dirty_rows_words * sizeof (uae_u32));
+		dirty_rows_all = false;
+	}
+	return valid;
+}
+
 /* line_draw_funcs: pfield_do_linetoscr, pfield_do_fill_line, decode_ham */
 typedef void (*line_draw_func)(int, int, int);
 
@@ -263,20 +291,20 @@ static int first_block_line, last_block_line;
 /* These are generated by the drawing code from the line_decisions array for
 each line that needs to be drawn.  These are basically extracted out of
 bit fields in the hardware registers.  */
-static int bplmode, bplehb, bplham, bpldualpf, bpldualpfpri;
-static int bpldualpf2of, bplplanecnt, ecsshres;
-static int bplbypass, bplcolorburst, bplcolorburst_field;
-static bool issprites;
-static int bplres;
-static int plf1pri, plf2pri, bplxor, bpland, bpldelay_sh;
-static uae_u32 plf_sprite_mask;
-static int sbasecol[2] = { 16, 16 };
-static int hposblank;
-static bool ecs_genlock_features_active;
-static uae_u8 ecs_genlock_features_mask;
-static bool ecs_genlock_features_colorkey;
-static int hsync_shift_hack;
-static bool sprite_smaller_than_64, sprite_smaller_than_64_inuse;
+static thread_local int bplmode, bplehb, bplham, bpldualpf, bpldualpfpri;
+static thread_local int bpldualpf2of, bplplanecnt, ecsshres;
+static thread_local int bplbypass, bplcolorburst, bplcolorburst_field;
+static thread_local bool issprites;
+static thread_local int bplres;
+static thread_local int plf1pri, plf2pri, bplxor, bpland, bpldelay_sh;
+static thread_local uae_u32 plf_sprite_mask;
+static thread_local int sbasecol[2] = { 16, 16 };
+static thread_local int hposblank;
+static thread_local bool ecs_genlock_features_active;
+static thread_local uae_u8 ecs_genlock_features_mask;
+static thread_local bool ecs_genlock_features_colorkey;
+static thread_local int hsync_shift_hack;
+static thread_local bool sprite_smaller_than_64, sprite_smaller_than_64_inuse;
 
 uae_sem_t gui_sem;
 
@@ -344,6 +372,7 @@ static void clearbuffer (struct vidbuffer *dst)
 		memset (p, 0, dst->width_allocated * dst->pixbytes);
 		p += dst->rowbytes;
 	}
+	dirty_rows_all = true;
 }
 
 static void reset_decision_table (void)
@@ -850,8 +879,8 @@ void get_custom_mouse_limits (int *pw, int *ph, int *pdx, int *pdy, int dbl)
 	*pdx = dx; *pdy = dy;
 }
 
-static struct decision *dp_for_drawing;
-static struct draw_info *dip_for_drawing;
+static thread_local struct decision *dp_for_drawing;
+static thread_local struct draw_info *dip_for_drawing;
 
 /* Record DIW of the current line for use by centering code.  */
 void record_diw_line (int plfstrt, int first, int last)
@@ -886,19 +915,19 @@ STATIC_INLINE int get_shdelay_add(void)
 where do we start drawing the playfield, where do we start drawing the right border.
 All of these are forced into the visible window (VISIBLE_LEFT_BORDER .. VISIBLE_RIGHT_BORDER).
 PLAYFIELD_START and PLAYFIELD_END are in window coordinates.  */
-static int playfield_start_pre, playfield_end_pre;
-static int playfield_start, playfield_end;
-static int real_playfield_start, real_playfield_end;
-static int playfield_diff;
-static int sprite_playfield_start;
-static int may_require_hard_way;
-static int linetoscr_diw_start, linetoscr_diw_end;
-static int native_ddf_left, native_ddf_right;
-
-static int pixels_offset;
-static int src_pixel;
+static thread_local int playfield_start_pre, playfield_end_pre;
+static thread_local int playfield_start, playfield_end;
+static thread_local int real_playfield_start, real_playfield_end;
+static thread_local int playfield_diff;
+static thread_local int sprite_playfield_start;
+static thread_local int may_require_hard_way;
+static thread_local int linetoscr_diw_start, linetoscr_diw_end;
+static thread_local int native_ddf_left, native_ddf_right;
+
+static thread_local int pixels_offset;
+static thread_local int src_pixel;
 /* How many pixels in window coordinates which are to the left of the left border.  */
-static int unpainted;
+static thread_local int unpainted;
 
 STATIC_INLINE xcolnr getbgc (int blank)
 {
@@ -1331,7 +1360,7 @@ static void fill_line_border (int lineno)
 	}
 }
 
-static int sprite_shdelay;
+static thread_local int sprite_shdelay;
 #define SPRITE_DEBUG 0
 static uae_u8 render_sprites (int pos, int dualpf, uae_u8 apixel, int aga)
 {
@@ -1788,9 +1817,9 @@ static int linetoscr_16_shrink2f_sh(int spix, int dpix, int stoppos)
 
 typedef int(*call_linetoscr)(int spix, int dpix, int dpix_end);
 
-static call_linetoscr pfield_do_linetoscr_normal;
-static call_linetoscr pfield_do_linetoscr_sprite;
-static call_linetoscr pfield_do_linetoscr_spriteonly;
+static thread_local call_linetoscr pfield_do_linetoscr_normal;
+static thread_local call_linetoscr pfield_do_linetoscr_sprite;
+static thread_local call_linetoscr pfield_do_linetoscr_spriteonly;
 
 static void pfield_do_linetoscr(int start, int stop, int blank)
 {
@@ -1806,8 +1835,8 @@ static int pfield_do_nothing(int a, int b, int c)
 }
 
 /* AGA subpixel delay hack */
-static call_linetoscr pfield_do_linetoscr_shdelay_normal;
-static call_linetoscr pfield_do_linetoscr_shdelay_sprite;
+static thread_local call_linetoscr pfield_do_linetoscr_shdelay_normal;
+static thread_local call_linetoscr pfield_do_linetoscr_shdelay_sprite;
 
 static int pfield_do_linetoscr_normal_shdelay(int spix, int dpix, int dpix_end)
 {
@@ -2113,8 +2142,8 @@ static void dummy_worker (int start, int stop, int blank)
 {
 }
 
-static int ham_decode_pixel;
-static unsigned int ham_lastcolor;
+static thread_local int ham_decode_pixel;
+static thread_local unsigned int ham_lastcolor;
 
 /* Decode HAM in the invisible portion of the display (left of VISIBLE_LEFT_BORDER),
  * but don't draw anything in.  This is done to prepare HAM_LASTCOLOR for later,
@@ -2459,8 +2488,210 @@ Don't touch this if you don't know what you are doing.  */
 #define GETLONG(P) (*(uae_u32 *)P)
 #define GETLONG64(P) (*(uae_u64 *)P)
 
+/* SIMD versions of the planar to chunky merge below. Every 32-bit lane
+* goes through exactly the same MERGE steps as the scalar code, SSE2 does
+* 16 bytes per plane per round and AVX2 32. The lanes are then byteswapped
+* and transposed so that the output is identical to the scalar code.  */
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define P2C_SIMD 1
+#include <immintrin.h>
+#endif
+
+enum { p2c_scalar, p2c_sse2, p2c_avx2 };
+static int p2c_mode;
+static const TCHAR *p2c_names[] = { _T("scalar"), _T("SSE2"), _T("AVX2") };
+
+#ifdef P2C_SIMD
+
+#define MERGE128(a,b,mask,shift) do {\
+	__m128i tmp = _mm_and_si128 (_mm_set1_epi32 (mask), _mm_xor_si128 (a, _mm_srli_epi32 (b, shift))); \
+	a = _mm_xor_si128 (a, tmp); \
+	b = _mm_xor_si128 (b, _mm_slli_epi32 (tmp, shift)); \
+} while (0)
+
+#define TRANSPOSE128(r0,r1,r2,r3) do {\
+	__m128i t0 = _mm_unpacklo_epi32 (r0, r1); \
+	__m128i t1 = _mm_unpacklo_epi32 (r2, r3); \
+	__m128i t2 = _mm_unpackhi_epi32 (r0, r1); \
+	__m128i t3 = _mm_unpackhi_epi32 (r2, r3); \
+	r0 = _mm_unpacklo_epi64 (t0, t1); \
+	r1 = _mm_unpackhi_epi64 (t0, t1); \
+	r2 = _mm_unpacklo_epi64 (t2, t3); \
+	r3 = _mm_unpackhi_epi64 (t2, t3); \
+} while (0)
+
+__attribute__((target("sse2")))
+static inline __m128i p2c_bswap128 (__m128i v)
+{
+	v = _mm_or_si128 (_mm_slli_epi16 (v, 8), _mm_srli_epi16 (v, 8));
+	v = _mm_shufflelo_epi16 (v, _MM_SHUFFLE (2, 3, 0, 1));
+	return _mm_shufflehi_epi16 (v, _MM_SHUFFLE (2, 3, 0, 1));
+}
+
+#define P2C_LOAD(n, type, load, size) \
+	(b##n = load ((type*)bplpt[7 - n]), bplpt[7 - n] += size)
+
+/* 'blocks' rounds of 16 bytes per plane, 128 bytes of output each.  */
+__attribute__((target("sse2")))
+static void NOINLINE pfield_doline_sse2 (uae_u32 *pixels, int blocks, int planes, uae_u8 **bplpt)
+{
+	while (blocks-- > 0) {
+		__m128i b0, b1, b2, b3, b4, b5, b6, b7;
+
+		b0 = b1 = b2 = b3 = b4 = b5 = b6 = b7 = _mm_setzero_si128 ();
+		switch (planes) {
+		case 8: P2C_LOAD (0, __m128i, _mm_loadu_si128, 16);
+		case 7: P2C_LOAD (1, __m128i, _mm_loadu_si128, 16);
+		case 6: P2C_LOAD (2, __m128i, _mm_loadu_si128, 16);
+		case 5: P2C_LOAD (3, __m128i, _mm_loadu_si128, 16);
+		case 4: P2C_LOAD (4, __m128i, _mm_loadu_si128, 16);
+		case 3: P2C_LOAD (5, __m128i, _mm_loadu_si128, 16);
+		case 2: P2C_LOAD (6, __m128i, _mm_loadu_si128, 16);
+		case 1: P2C_LOAD (7, __m128i, _mm_loadu_si128, 16);
+		}
+
+		MERGE128 (b0, b1, 0x55555555, 1);
+		MERGE128 (b2, b3, 0x55555555, 1);
+		MERGE128 (b4, b5, 0x55555555, 1);
+		MERGE128 (b6, b7, 0x55555555, 1);
+
+		MERGE128 (b0, b2, 0x33333333, 2);
+		MERGE128 (b1, b3, 0x33333333, 2);
+		MERGE128 (b4, b6, 0x33333333, 2);
+		MERGE128 (b5, b7, 0x33333333, 2);
+
+		MERGE128 (b0, b4, 0x0f0f0f0f, 4);
+		MERGE128 (b1, b5, 0x0f0f0f0f, 4);
+		MERGE128 (b2, b6, 0x0f0f0f0f, 4);
+		MERGE128 (b3, b7, 0x0f0f0f0f, 4);
+
+		MERGE128 (b0, b1, 0x00ff00ff, 8);
+		MERGE128 (b2, b3, 0x00ff00ff, 8);
+		MERGE128 (b4, b5, 0x00ff00ff, 8);
+		MERGE128 (b6, b7, 0x00ff00ff, 8);
+
+		MERGE128 (b0, b2, 0x0000ffff, 16);
+		MERGE128 (b1, b3, 0x0000ffff, 16);
+		MERGE128 (b4, b6, 0x0000ffff, 16);
+		MERGE128 (b5, b7, 0x0000ffff, 16);
+
+		// scalar stores b0, b4, b1, b5, b2, b6, b3, b7 for each long
+		TRANSPOSE128 (b0, b4, b1, b5);
+		TRANSPOSE128 (b2, b6, b3, b7);
+		_mm_storeu_si128 ((__m128i*)(pixels + 0), p2c_bswap128 (b0));
+		_mm_storeu_si128 ((__m128i*)(pixels + 4), p2c_bswap128 (b2));
+		_mm_storeu_si128 ((__m128i*)(pixels + 8), p2c_bswap128 (b4));
+		_mm_storeu_si128 ((__m128i*)(pixels + 12), p2c_bswap128 (b6));
+		_mm_storeu_si128 ((__m128i*)(pixels + 16), p2c_bswap128 (b1));
+		_mm_storeu_si128 ((__m128i*)(pixels + 20), p2c_bswap128 (b3));
+		_mm_storeu_si128 ((__m128i*)(pixels + 24), p2c_bswap128 (b5));
+		_mm_storeu_si128 ((__m128i*)(pixels + 28), p2c_bswap128 (b7));
+		pixels += 32;
+	}
+}
+
+#define MERGE256(a,b,mask,shift) do {\
+	__m256i tmp = _mm256_and_si256 (_mm256_set1_epi32 (mask), _mm256_xor_si256 (a, _mm256_srli_epi32 (b, shift))); \
+	a = _mm256_xor_si256 (a, tmp); \
+	b = _mm256_xor_si256 (b, _mm256_slli_epi32 (tmp, shift)); \
+} while (0)
+
+#define TRANSPOSE256(r0,r1,r2,r3) do {\
+	__m256i t0 = _mm256_unpacklo_epi32 (r0, r1); \
+	__m256i t1 = _mm256_unpacklo_epi32 (r2, r3); \
+	__m256i t2 = _mm256_unpackhi_epi32 (r0, r1); \
+	__m256i t3 = _mm256_unpackhi_epi32 (r2, r3); \
+	r0 = _mm256_unpacklo_epi64 (t0, t1); \
+	r1 = _mm256_unpackhi_epi64 (t0, t1); \
+	r2 = _mm256_unpacklo_epi64 (t2, t3); \
+	r3 = _mm256_unpackhi_epi64 (t2, t3); \
+} while (0)
+
+/* Transposes stay inside 128-bit halves: the low half holds longs 0-3 and
+* the high half longs 4-7 of the source.  */
+#define P2C_STORE256(n, a, b) do {\
+	a = _mm256_shuffle_epi8 (a, bswap); \
+	b = _mm256_shuffle_epi8 (b, bswap); \
+	_mm256_storeu_si256 ((__m256i*)(pixels + (n) * 8), _mm256_permute2x128_si256 (a, b, 0x20)); \
+	_mm256_storeu_si256 ((__m256i*)(pixels + ((n) + 4) * 8), _mm256_permute2x128_si256 (a, b, 0x31)); \
+} while (0)
+
+/* 'blocks' rounds of 32 bytes per plane, 256 bytes of output each.  */
+__attribute__((target("avx2")))
+static void NOINLINE pfield_doline_avx2 (uae_u32 *pixels, int blocks, int planes, uae_u8 **bplpt)
+{
+	const __m256i bswap = _mm256_setr_epi8 (
+		3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12,
+		3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+
+	while (blocks-- > 0) {
+		__m256i b0, b1, b2, b3, b4, b5, b6, b7;
+
+		b0 = b1 = b2 = b3 = b4 = b5 = b6 = b7 = _mm256_setzero_si256 ();
+		switch (planes) {
+		case 8: P2C_LOAD (0, __m256i, _mm256_loadu_si256, 32);
+		case 7: P2C_LOAD (1, __m256i, _mm256_loadu_si256, 32);
+		case 6: P2C_LOAD (2, __m256i, _mm256_loadu_si256, 32);
+		case 5: P2C_LOAD (3, __m256i, _mm256_loadu_si256, 32);
+		case 4: P2C_LOAD (4, __m256i, _mm256_loadu_si256, 32);
+		case 3: P2C_LOAD (5, __m256i, _mm256_loadu_si256, 32);
+		case 2: P2C_LOAD (6, __m256i, _mm256_loadu_si256, 32);
+		case 1: P2C_LOAD (7, __m256i, _mm256_loadu_si256, 32);
+		}
+
+		MERGE256 (b0, b1, 0x55555555, 1);
+		MERGE256 (b2, b3, 0x55555555, 1);
+		MERGE256 (b4, b5, 0x55555555, 1);
+		MERGE256 (b6, b7, 0x55555555, 1);
+
+		MERGE256 (b0, b2, 0x33333333, 2);
+		MERGE256 (b1, b3, 0x33333333, 2);
+		MERGE256 (b4, b6, 0x33333333, 2);
+		MERGE256 (b5, b7, 0x33333333, 2);
+
+		MERGE256 (b0, b4, 0x0f0f0f0f, 4);
+		MERGE256 (b1, b5, 0x0f0f0f0f, 4);
+		MERGE256 (b2, b6, 0x0f0f0f0f, 4);
+		MERGE256 (b3, b7, 0x0f0f0f0f, 4);
+
+		MERGE256 (b0, b1, 0x00ff00ff, 8);
+		MERGE256 (b2, b3, 0x00ff00ff, 8);
+		MERGE256 (b4, b5, 0x00ff00ff, 8);
+		MERGE256 (b6, b7, 0x00ff00ff, 8);
+
+		MERGE256 (b0, b2, 0x0000ffff, 16);
+		MERGE256 (b1, b3, 0x0000ffff, 16);
+		MERGE256 (b4, b6, 0x0000ffff, 16);
+		MERGE256 (b5, b7, 0x0000ffff, 16);
+
+		TRANSPOSE256 (b0, b4, b1, b5);
+		TRANSPOSE256 (b2, b6, b3, b7);
+		P2C_STORE256 (0, b0, b2);
+		P2C_STORE256 (1, b4, b6);
+		P2C_STORE256 (2, b1, b3);
+		P2C_STORE256 (3, b5, b7);
+		pixels += 64;
+	}
+}
+
+#endif /* P2C_SIMD */
+
 STATIC_INLINE void pfield_doline_1 (uae_u32 *pixels, int wordcount, int planes)
 {
+#ifdef P2C_SIMD
+	if (p2c_mode == p2c_avx2 && wordcount >= 8) {
+		int blocks = wordcount / 8;
+		pfield_doline_avx2 (pixels, blocks, planes, real_bplpt);
+		pixels += blocks * 64;
+		wordcount -= blocks * 8;
+	}
+	if (p2c_mode != p2c_scalar && wordcount >= 4) {
+		int blocks = wordcount / 4;
+		pfield_doline_sse2 (pixels, blocks, planes, real_bplpt);
+		pixels += blocks * 32;
+		wordcount -= blocks * 4;
+	}
+#endif
 	while (wordcount-- > 0) {
 		uae_u32 b0, b1, b2, b3, b4, b5, b6, b7;
 
@@ -2679,6 +2910,124 @@ static void pfield_doline (int lineno)
 
 }
 
+static void p2c_run (uae_u32 *pixels, uae_u8 *src, int wordcount, int planes)
+{
+	for (int i = 0; i < 8; i++)
+		real_bplpt[i] = src + i * MAX_WORDS_PER_LINE * 2;
+	switch (planes) {
+	case 1: pfield_doline_n1 (pixels, wordcount); break;
+	case 2: pfield_doline_n2 (pixels, wordcount); break;
+	case 3: pfield_doline_n3 (pixels, wordcount); break;
+	case 4: pfield_doline_n4 (pixels, wordcount); break;
+	case 5: pfield_doline_n5 (pixels, wordcount); break;
+	case 6: pfield_doline_n6 (pixels, wordcount); break;
+#ifdef AGA
+	case 7: pfield_doline_n7 (pixels, wordcount); break;
+	case 8: pfield_doline_n8 (pixels, wordcount); break;
+#endif
+	}
+}
+
+static uae_u8 *p2c_testdata (void)
+{
+	uae_u8 *src = xmalloc (uae_u8, 8 * MAX_WORDS_PER_LINE * 2);
+	uae_u32 seed = 0x12345678;
+	for (int i = 0; i < 8 * MAX_WORDS_PER_LINE * 2; i++) {
+		seed = seed * 1103515245 + 12345;
+		src[i] = seed >> 16;
+	}
+	return src;
+}
+
+// compare against the scalar code, all plane counts and odd lengths
+static bool p2c_check (int mode)
+{
+	static const int lengths[] = { 1, 3, 4, 7, 8, 13, 20, MAX_WORDS_PER_LINE / 2, -1 };
+	uae_u8 *src = p2c_testdata ();
+	uae_u32 *out1 = xmalloc (uae_u32, MAX_WORDS_PER_LINE * 4);
+	uae_u32 *out2 = xmalloc (uae_u32, MAX_WORDS_PER_LINE * 4);
+	int old = p2c_mode;
+	bool ok = true;
+
+	for (int planes = 1; planes <= MAX_PLANES && ok; planes++) {
+		for (int i = 0; lengths[i] >= 0 && ok; i++) {
+			int len = lengths[i];
+			p2c_mode = p2c_scalar;
+			p2c_run (out1, src, len, planes);
+			p2c_mode = mode;
+			p2c_run (out2, src, len, planes);
+			ok = !memcmp (out1, out2, len * 8 * sizeof (uae_u32));
+		}
+	}
+	p2c_mode = old;
+	xfree (out2);
+	xfree (out1);
+	xfree (src);
+	return ok;
+}
+
+static int p2c_best (void)
+{
+	int best = p2c_scalar;
+#ifdef P2C_SIMD
+	__builtin_cpu_init ();
+	if (__builtin_cpu_supports ("sse2"))
+		best = p2c_sse2;
+	if (__builtin_cpu_supports ("avx2"))
+		best = p2c_avx2;
+#endif
+	return best;
+}
+
+static void init_planar_to_chunky (void)
+{
+	static bool done;
+	int mode;
+
+	if (done)
+		return;
+	done = true;
+	mode = p2c_best ();
+	while (mode != p2c_scalar && !p2c_check (mode)) {
+		write_log (_T("Planar to chunky: %s self-test failed\n"), p2c_names[mode]);
+		mode--;
+	}
+	p2c_mode = mode;
+	write_log (_T("Planar to chunky: %s\n"), p2c_names[p2c_mode]);
+}
+
+/* Debugger "B p2c": time every usable planar to chunky method
+* on a 640 pixel hires line.  */
+void drawing_p2c_benchmark (void)
+{
+	const int lines = 100000;
+	const int wordcount = 20;
+	uae_u8 *src = p2c_testdata ();
+	uae_u32 *out = xmalloc (uae_u32, MAX_WORDS_PER_LINE * 4);
+	int old = p2c_mode;
+	int best = p2c_best ();
+
+	for (int planes = 4; planes <= MAX_PLANES; planes += 2) {
+		double base = 0;
+		for (int mode = p2c_scalar; mode <= best; mode++) {
+			p2c_mode = mode;
+			int64_t t = uae_time_us ();
+			for (int i = 0; i < lines; i++)
+				p2c_run (out, src, wordcount, planes);
+			t = uae_time_us () - t;
+			double ns = t * 1000.0 / lines;
+			if (mode == p2c_scalar)
+				base = ns;
+			console_out_f (_T("%d planes %-6s %7.1f ns/line %5.2fx%s\n"),
+				planes, p2c_names[mode], ns, ns > 0 ? base / ns : 0.0,
+				mode != p2c_scalar && !p2c_check (mode) ? _T(" MISMATCH") : _T(""));
+		}
+	}
+	p2c_mode = old;
+	xfree (out);
+	xfree (src);
+}
+
 void init_row_map(void)
 {
 #ifdef FSUAE
@@ -2699,6 +3048,8 @@ void init_row_map(void)
 	if (!row_map) {
 		row_map = xmalloc(uae_u8*, max_uae_height + 1);
 		row_map_genlock = xmalloc(uae_u8*, max_uae_height + 1);
+		dirty_rows_words = (max_uae_height + 1 + 31) / 32;
+		dirty_rows = xcalloc(uae_u32, dirty_rows_words);
 	}
 
 	if (oldbufmem && oldbufmem == vidinfo->drawbuffer.bufmem &&
@@ -2735,6 +3086,7 @@ void init_row_map(void)
 			row_map_genlock[i] = NULL;
 		}
 	}
+	dirty_rows_all = true;
 	oldbufmem = vidinfo->drawbuffer.bufmem;
 	oldheight = vidinfo->drawbuffer.height_allocated;
 	oldpitch = vidinfo->drawbuffer.rowbytes;
@@ -2972,8 +3324,8 @@ static void pfield_expand_dp_bplconx (int regno, int v)
 	set_res_shift();
 }
 
-static int drawing_color_matches;
-static enum { color_match_acolors, color_match_full } color_match_type;
+static thread_local int drawing_color_matches;
+static thread_local enum { color_match_acolors, color_match_full } color_match_type;
 
 /* Set up colors_for_drawing to the state at the beginning of the currently drawn
 line.  Try to avoid copying color tables around whenever possible.  */
@@ -3191,7 +3543,17 @@ enum double_how {
 	dh_emerg
 };
 
-static void pfield_draw_line (struct vidbuffer *vb, int lineno, int gfx_ypos, int follow_ypos)
+/* What pfield_decide_line() found out about a line; pfield_render_line()
+* needs nothing else, so lines can be rendered out of order.  */
+struct line_draw_job {
+	int lineno;
+	int dpline;
+	int border;
+	int do_double;
+	int gfx_ypos, follow_ypos;
+};
+
+static bool pfield_decide_line (struct line_draw_job *job, int lineno, int gfx_ypos, int follow_ypos)
 {
 #ifdef FSUAE
 #ifdef FSUAE_FRAME_DEBUG
@@ -3200,20 +3562,16 @@ static void pfield_draw_line (struct vidbuffer *vb, int lineno, int gfx_ypos, in
 	}
 #endif
 #endif
-	struct vidbuf_description *vidinfo = &adisplays[0].gfxvidinfo;
 	static int warned = 0;
 	int border = 0;
 	int do_double = 0;
-	bool have_color_changes;
-	enum double_how dh;
+	int dpline = lineno;
 	int ls = linestate[lineno];
+	struct decision *dp = line_decisions + lineno;
 
-	dp_for_drawing = line_decisions + lineno;
-	dip_for_drawing = curr_drawinfo + lineno;
-
-	if (dp_for_drawing->plfleft >= 0) {
+	if (dp->plfleft >= 0) {
 		lines_count++;
-		resolution_count[dp_for_drawing->bplres]++;
+		resolution_count[dp->bplres]++;
 	}
 
 	switch (ls)
@@ -3221,7 +3579,7 @@ static void pfield_draw_line (struct vidbuffer *vb, int lineno, int gfx_ypos, in
 	case LINE_REMEMBERED_AS_PREVIOUS:
 //		if (!warned) // happens when program messes up with VPOSW
 //			write_log (_T("Shouldn't get here... this is a bug.\n")), warned++;
-		return;
+		return false;
 
 	case LINE_BLACK:
 		linestate[lineno] = LINE_REMEMBERED_AS_BLACK;
@@ -3229,20 +3587,20 @@ static void pfield_draw_line (struct vidbuffer *vb, int lineno, int gfx_ypos, in
 		break;
 
 	case LINE_REMEMBERED_AS_BLACK:
-		return;
+		return false;
 
 	case LINE_AS_PREVIOUS:
-		dp_for_drawing--;
-		dip_for_drawing--;
+		dp--;
+		dpline--;
 		linestate[lineno] = LINE_DONE_AS_PREVIOUS;
-		if (dp_for_drawing->plfleft < 0)
+		if (dp->plfleft < 0)
 			border = 1;
 		break;
 
 	case LINE_DONE_AS_PREVIOUS:
 		/* fall through */
 	case LINE_DONE:
-		return;
+		return false;
 
 	case LINE_DECIDED_DOUBLE:
 		if (follow_ypos >= 0) {
@@ -3252,18 +3610,47 @@ static void pfield_draw_line (struct vidbuffer *vb, int lineno, int gfx_ypos, in
 
 		/* fall through */
 	default:
-		if (dp_for_drawing->plfleft < 0)
+		if (dp->plfleft < 0)
 			border = 1;
 		linestate[lineno] = LINE_DONE;
 		break;
 	}
 
+	job->lineno = lineno;
+	job->dpline = dpline;
+	job->border = border;
+	job->do_double = do_double;
+	job->gfx_ypos = gfx_ypos;
+	job->follow_ypos = follow_ypos;
+	mark_row_dirty (gfx_ypos);
+	if (do_double)
+		mark_row_dirty (follow_ypos);
+	return true;
+}
+
+/* Render a decided line. Only touches the thread's own drawing state, the
+* line's decision entry and the line's rows, so when 'threaded' is set this
+* runs on a render thread (no shared emergmem in that case).  */
+static void pfield_render_line (struct vidbuffer *vb, struct line_draw_job *job, bool threaded)
+{
+	struct vidbuf_description *vidinfo = &adisplays[0].gfxvidinfo;
+	int lineno = job->lineno;
+	int border = job->border;
+	int do_double = job->do_double;
+	int gfx_ypos = job->gfx_ypos;
+	int follow_ypos = job->follow_ypos;
+	bool have_color_changes;
+	enum double_how dh;
+
+	dp_for_drawing = line_decisions + job->dpline;
+	dip_for_drawing = curr_drawinfo + job->dpline;
+
 	have_color_changes = is_color_changes(dip_for_drawing);
 	sprite_smaller_than_64_inuse = false;
 
 	dh = dh_line;
 	xlinebuffer = vidinfo->drawbuffer.linemem;
-	if (xlinebuffer == 0 && do_double
+	if (xlinebuffer == 0 && do_double && !threaded
 		&& (border == 0 || have_color_changes))
 		xlinebuffer = vidinfo->drawbuffer.emergmem, dh = dh_emerg;
 	if (xlinebuffer == 0)
@@ -3449,6 +3836,14 @@ static void pfield_draw_line (struct vidbuffer *vb, int lineno, int gfx_ypos, in
 	}
 }
 
+static void pfield_draw_line (struct vidbuffer *vb, int lineno, int gfx_ypos, int follow_ypos)
+{
+	struct line_draw_job job;
+
+	if (pfield_decide_line (&job, lineno, gfx_ypos, follow_ypos))
+		pfield_render_line (vb, &job, false);
+}
+
 static void center_image (void)
 {
 #ifdef FSUAE
@@ -3808,6 +4203,7 @@ static uae_u8 *status_line_ptr(int monid, int line)
 	if (xlinebuffer == 0)
 		xlinebuffer = row_map[line];
 	xlinebuffer_genlock = row_map_genlock[line];
+	mark_row_dirty (line);
 	return xlinebuffer;
 }
 
@@ -3830,6 +4226,7 @@ static void draw_debug_status_line(int monid, int line)
 	if (xlinebuffer == 0)
 		xlinebuffer = row_map[line];
 	xlinebuffer_genlock = row_map_genlock[line];
+	mark_row_dirty (line);
 	debug_draw(xlinebuffer, vidinfo->drawbuffer.pixbytes, line, vidinfo->drawbuffer.outwidth, vidinfo->drawbuffer.outheight, xredcolors, xgreencolors, xbluecolors);
 }
 
@@ -3862,6 +4259,7 @@ static void draw_lightpen_cursor(int monid, int x, int y, int line, int onscreen
 	if (xlinebuffer == 0)
 		xlinebuffer = row_map[line];
 	xlinebuffer_genlock = row_map_genlock[line];
+	mark_row_dirty (line);
 
 	p = lightpen_cursor + y * LIGHTPEN_WIDTH;
 	for (int i = 0; i < LIGHTPEN_WIDTH; i++) {
@@ -3964,6 +4362,7 @@ static void refresh_indicator_update(struct vidbuffer *vb)
 			break;
 
 		xlinebuffer = row_map[whereline];
+		mark_row_dirty (whereline);
 		uae_u8 pixel = refresh_indicator_changed_prev[line];
 		if (wherenext >= 0) {
 			pixel = refresh_indicator_changed_prev[line & ~1];
@@ -4054,6 +4453,167 @@ static void draw_frame_extras(struct vidbuffer *vb, int y_start, int y_end)
 
 extern bool beamracer_debug;
 
+/* Optional render threads (gfx_render_threads). draw_lines() decides the
+* lines of a slice serially, then the lines are split into contiguous
+* chunks and rendered in parallel, the emulation thread doing the first
+* chunk itself. A line shown as previous shares its decision entry with
+* the line before it, so both always end up in the same chunk.
+*
+* The emulation thread still renders and waits for the slice: the screen
+* is unlocked at the end of each slice and the decision and color tables
+* are reused by the next one, so rendering can't run behind emulation
+* without double buffering both.  */
+#define MAX_RENDER_THREADS 8
+#define RENDER_THREAD_MIN_LINES 8
+
+struct render_thread {
+	uae_sem_t start;
+	struct vidbuffer *vb;
+	int first, last;
+	struct decision seed;
+	int seedline;
+	int colorburst_field;
+	volatile bool quit;
+};
+
+static struct render_thread render_threads[MAX_RENDER_THREADS];
+static int render_threads_num;
+static int render_threads_failed;
+static uae_sem_t render_threads_done;
+static struct line_draw_job line_jobs[LINESTATE_SIZE];
+
+static void *render_thread_func (void *v)
+{
+	struct render_thread *rt = (struct render_thread*)v;
+
+	for (;;) {
+		uae_sem_wait (&rt->start);
+		if (rt->quit)
+			break;
+		/* This thread's drawing state is stale: colour tables and
+		* linetoscr functions may have changed since the last slice. */
+		drawing_color_matches = -1;
+		bplcolorburst_field = 1;
+		pfield_set_linetoscr ();
+		/* Start from the registers of the line before the chunk,
+		* like the serial renderer would. */
+		dp_for_drawing = &rt->seed;
+		dip_for_drawing = curr_drawinfo + rt->seedline;
+		adjust_drawing_colors (dp_for_drawing->ctable, 1);
+		pfield_expand_dp_bplcon ();
+		set_res_shift ();
+		for (int i = rt->first; i < rt->last; i++) {
+			hposblank = 0;
+			pfield_render_line (rt->vb, &line_jobs[i], true);
+		}
+		rt->colorburst_field = bplcolorburst_field;
+		uae_sem_post (&render_threads_done);
+	}
+	uae_sem_post (&render_threads_done);
+	return NULL;
+}
+
+static void render_threads_free (void)
+{
+	for (int i = 0; i < render_threads_num; i++) {
+		struct render_thread *rt = &render_threads[i];
+		rt->quit = true;
+		uae_sem_post (&rt->start);
+		uae_sem_wait (&render_threads_done);
+		uae_sem_destroy (&rt->start);
+	}
+	if (render_threads_num)
+		uae_sem_destroy (&render_threads_done);
+	render_threads_num = 0;
+}
+
+static int render_threads_init (void)
+{
+	int num = currprefs.gfx_render_threads;
+
+	if (num < 0)
+		num = 0;
+	if (num > MAX_RENDER_THREADS)
+		num = MAX_RENDER_THREADS;
+	if (num == render_threads_num)
+		return num;
+	// don't retry every slice after a failure, only when the setting changes
+	if (num == render_threads_failed)
+		return render_threads_num;
+	render_threads_free ();
+	render_threads_failed = 0;
+	if (!num)
+		return 0;
+	uae_sem_init (&render_threads_done, 0, 0);
+	for (int i = 0; i < num; i++) {
+		struct render_thread *rt = &render_threads[i];
+		memset (rt, 0, sizeof (struct render_thread));
+		uae_sem_init (&rt->start, 0, 0);
+		if (!uae_start_thread (_T("render"), render_thread_func, rt, NULL)) {
+			write_log (_T("failed to start render thread %d, rendering single threaded\n"), i);
+			uae_sem_destroy (&rt->start);
+			if (!i)
+				uae_sem_destroy (&render_threads_done);
+			render_threads_num = i;
+			render_threads_free ();
+			render_threads_failed = num;
+			return 0;
+		}
+	}
+	render_threads_num = num;
+	write_log (_T("%d render threads started\n"), num);
+	return num;
+}
+
+static void render_lines_threaded (struct vidbuffer *vb, int jobs)
+{
+	int bounds[MAX_RENDER_THREADS + 2];
+	int chunks = render_threads_num + 1;
+	int n, i;
+
+	if (jobs < chunks * RENDER_THREAD_MIN_LINES)
+		chunks = jobs / RENDER_THREAD_MIN_LINES;
+
+	// split, keeping lines that share a decision entry together
+	n = 0;
+	bounds[n++] = 0;
+	for (i = 1; i < chunks; i++) {
+		int b = jobs * i / chunks;
+		if (b <= bounds[n - 1])
+			continue;
+		while (b < jobs && line_jobs[b].dpline == line_jobs[b - 1].dpline)
+			b++;
+		if (b >= jobs)
+			break;
+		bounds[n++] = b;
+	}
+	bounds[n] = jobs;
+
+	// seeds must be copied before anyone starts changing decision entries
+	for (i = 1; i < n; i++) {
+		struct render_thread *rt = &render_threads[i - 1];
+		rt->vb = vb;
+		rt->first = bounds[i];
+		rt->last = bounds[i + 1];
+		rt->seedline = line_jobs[bounds[i] - 1].dpline;
+		rt->seed = line_decisions[rt->seedline];
+	}
+	for (i = 1; i < n; i++)
+		uae_sem_post (&render_threads[i - 1].start);
+
+	for (i = 0; i < bounds[1]; i++) {
+		hposblank = 0;
+		pfield_render_line (vb, &line_jobs[i], false);
+	}
+
+	for (i = 1; i < n; i++)
+		uae_sem_wait (&render_threads_done);
+	for (i = 1; i < n; i++) {
+		if (!render_threads[i - 1].colorburst_field)
+			bplcolorburst_field = 0;
+	}
+}
+
 void draw_lines(int end, int section)
 {
 #ifdef FSUAE
@@ -4092,6 +4652,10 @@ void draw_lines(int end, int section)
 #endif
 
 	int section_color_cnt = 4;
+	int jobs = -1;
+
+	if (render_threads_init () && !beamracer_debug && !vidinfo->drawbuffer.linemem)
+		jobs = 0;
 
 	vidinfo->outbuffer = vb;
 	if (!lockscr(vb, false, vb->last_drawn_line ? false : true))
@@ -4121,8 +4685,13 @@ void draw_lines(int end, int section)
 		if (y_start < 0) {
 			y_start = whereline;
 		}
-		hposblank = 0;
-		pfield_draw_line(vb, line, whereline, wherenext);
+		if (jobs >= 0) {
+			if (pfield_decide_line(&line_jobs[jobs], line, whereline, wherenext))
+				jobs++;
+		} else {
+			hposblank = 0;
+			pfield_draw_line(vb, line, whereline, wherenext);
+		}
 
 #if 1
 		if (beamracer_debug) {
@@ -4134,6 +4703,7 @@ void draw_lines(int end, int section)
 				static const int section_colors[] = { 0x777, 0xf00, 0x0f0, 0x00f };
 				int color = section_toggle ? section_colors[section & 3] : 0;
 				xlinebuffer = row_map[whereline];
+				mark_row_dirty (whereline);
 				for (int x = 0; x < 4; x++) {
 					putpixel(xlinebuffer, NULL, vidinfo->drawbuffer.pixbytes, x, xcolors[color], 1);
 				}
@@ -4151,6 +4721,8 @@ void draw_lines(int end, int section)
 	printf("UAE vb->last_drawn_line = %d\n", vb->last_drawn_line);
 #endif
 #endif
+	if (jobs > 0)
+		render_lines_threaded(vb, jobs);
 	draw_frame_extras(vb, y_start, y_end + 1);
 	unlockscr(vb, y_start, y_end + 1);
 }
@@ -4760,6 +5332,7 @@ void drawing_init (void)
 	refresh_indicator_init();
 
 	gen_pfield_tables();
+	init_planar_to_chunky();
 
 	gen_direct_drawing_table();
 
@@ -4780,6 +5353,11 @@ void drawing_init (void)
 	reset_drawing ();
 }
 
+void drawing_free (void)
+{
+	render_threads_free ();
+}
+
 #ifdef FSUAE
 	// isvsync is always 0 for FS-UAE. Use static inline in header files.
 #else
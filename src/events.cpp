@@ -345,47 +345,114 @@ void do_cycles_slow (unsigned long cycles_to_add)
 	currcycle += cycles_to_add;
 }
 
+/* Pending eventtab2 slots, kept in a binary min-heap ordered by time
+* relative to the current cycle and then by slot number (the order the
+* old linear scan fired simultaneous events in). Slots that get
+* deactivated by clearing 'active' stay in the heap and are dropped
+* when they reach the top. ev2_heappos is index + 1, 0 = not queued.  */
+static int ev2_heap[ev2_max];
+static int ev2_heappos[ev2_max];
+static int ev2_heapsize;
+
+STATIC_INLINE bool ev2_before (int a, int b, evt ct)
+{
+	evt ta = eventtab2[a].evtime - ct;
+	evt tb = eventtab2[b].evtime - ct;
+	if (ta != tb)
+		return ta < tb;
+	return a < b;
+}
+
+STATIC_INLINE void ev2_heap_set (int i, int no)
+{
+	ev2_heap[i] = no;
+	ev2_heappos[no] = i + 1;
+}
+
+static void ev2_heap_up (int i, evt ct)
+{
+	int no = ev2_heap[i];
+	while (i > 0) {
+		int parent = (i - 1) / 2;
+		if (!ev2_before (no, ev2_heap[parent], ct))
+			break;
+		ev2_heap_set (i, ev2_heap[parent]);
+		i = parent;
+	}
+	ev2_heap_set (i, no);
+}
+
+static void ev2_heap_down (int i, evt ct)
+{
+	int no = ev2_heap[i];
+	for (;;) {
+		int child = i * 2 + 1;
+		if (child >= ev2_heapsize)
+			break;
+		if (child + 1 < ev2_heapsize && ev2_before (ev2_heap[child + 1], ev2_heap[child], ct))
+			child++;
+		if (!ev2_before (ev2_heap[child], no, ct))
+			break;
+		ev2_heap_set (i, ev2_heap[child]);
+		i = child;
+	}
+	ev2_heap_set (i, no);
+}
+
+static void ev2_heap_update (int no, evt ct)
+{
+	int i = ev2_heappos[no] - 1;
+	if (i < 0) {
+		i = ev2_heapsize++;
+		ev2_heap_set (i, no);
+	}
+	ev2_heap_up (i, ct);
+	ev2_heap_down (ev2_heappos[no] - 1, ct);
+}
+
+static void ev2_heap_pop (evt ct)
+{
+	ev2_heappos[ev2_heap[0]] = 0;
+	ev2_heapsize--;
+	if (ev2_heapsize > 0) {
+		ev2_heap_set (0, ev2_heap[ev2_heapsize]);
+		ev2_heap_down (0, ct);
+	}
+}
+
+void events_reset_queue (void)
+{
+	ev2_heapsize = 0;
+	memset (ev2_heappos, 0, sizeof ev2_heappos);
+}
+
 void MISC_handler (void)
 {
-	static bool dorecheck;
-	bool recheck;
-	int i;
-	evt mintime;
 	evt ct = get_cycles ();
 	static int recursive;
 
-	if (recursive) {
-		dorecheck = true;
+	// called from an event handler: the loop below picks up new events
+	if (recursive)
 		return;
-	}
 	recursive++;
 	eventtab[ev_misc].active = 0;
-	recheck = true;
-	while (recheck) {
-		recheck = false;
-		mintime = ~0L;
-		for (i = 0; i < ev2_max; i++) {
-			if (eventtab2[i].active) {
-				if (eventtab2[i].evtime == ct) {
-					eventtab2[i].active = false;
-					event2_count--;
-					eventtab2[i].handler (eventtab2[i].data);
-					if (dorecheck || eventtab2[i].active) {
-						recheck = true;
-						dorecheck = false;
-					}
-				} else {
-					evt eventtime = eventtab2[i].evtime - ct;
-					if (eventtime < mintime)
-						mintime = eventtime;
-				}
-			}
+	while (ev2_heapsize > 0) {
+		struct ev2 *e = &eventtab2[ev2_heap[0]];
+		if (!e->active) {
+			ev2_heap_pop (ct);
+			continue;
 		}
+		if (e->evtime != ct)
+			break;
+		ev2_heap_pop (ct);
+		e->active = false;
+		event2_count--;
+		e->handler (e->data);
 	}
-	if (mintime != ~0UL) {
+	if (ev2_heapsize > 0) {
 		eventtab[ev_misc].active = true;
 		eventtab[ev_misc].oldcycles = ct;
-		eventtab[ev_misc].evtime = ct + mintime;
+		eventtab[ev_misc].evtime = eventtab2[ev2_heap[0]].evtime;
 		events_schedule ();
 	}
 	recursive--;
@@ -395,9 +462,10 @@ void MISC_handler (void)
 void event2_newevent_xx (int no, evt t, uae_u32 data, evfunc2 func)
 {
 	evt et;
+	evt ct = get_cycles ();
 	static int next = ev2_misc;
 
-	et = t + get_cycles ();
+	et = t + ct;
 	if (no < 0) {
 		no = next;
 		for (;;) {
@@ -421,6 +489,7 @@ void event2_newevent_xx (int no, evt t, uae_u32 data, evfunc2 func)
 	eventtab2[no].evtime = et;
 	eventtab2[no].handler = func;
 	eventtab2[no].data = data;
+	ev2_heap_update (no, ct);
 	MISC_handler ();
 }
 
@@ -1377,9 +1377,20 @@ typedef struct exallkey {
 
 #define EXKEYS 128
 #define EXALLKEYS 100
-#define MAX_AINO_HASH 128
+#define AINO_TABLE_MIN 64
 #define NOTIFY_HASH_SIZE 127
 
+/* Open addressing a_inode table, size is a power of two. Slots hold
+ * a_inode pointers directly, removed entries leave a tombstone so that
+ * probe chains stay intact until the next resize. */
+struct aino_table {
+	a_inode **slots;
+	unsigned int size;
+	unsigned int used;
+	unsigned int deleted;
+	uae_u32 (*hash)(a_inode *);
+};
+
 /* handler state info */
 
 typedef struct _unit {
@@ -1419,7 +1430,8 @@ typedef struct _unit {
 
 	a_inode rootnode;
 	unsigned int aino_cache_size;
-	a_inode *aino_hash[MAX_AINO_HASH];
+	struct aino_table aino_uniq;	/* uniq -> a_inode */
+	struct aino_table aino_names;	/* parent + aname -> a_inode */
 	unsigned int nr_cache_hits;
 	unsigned int nr_cache_lookups;
 
@@ -2372,11 +2384,177 @@ static void de_recycle_aino (Unit *unit, a_inode *aino)
 	unit->aino_cache_size--;
 }
 
+static a_inode aino_table_deleted;
+#define AINO_DELETED (&aino_table_deleted)
+
+static uae_u32 aino_uniq_hash (uae_u32 uniq)
+{
+	uniq *= 0x9e3779b1;
+	return uniq ^ (uniq >> 15);
+}
+
+/* Only the last path component of an aname takes part in lookups */
+static const TCHAR *aino_name_key (const TCHAR *aname)
+{
+	const TCHAR *p = _tcsrchr (aname, '/');
+	return p ? p + 1 : aname;
+}
+
+/* Names compare with same_aname (), so fold ASCII case only and leave
+ * other characters out of the hash altogether: whatever the locale does
+ * to them, names that compare equal must land in the same chain. */
+static uae_u32 aino_name_hash (a_inode *parent, const TCHAR *name)
+{
+	uae_u32 h = 2166136261u ^ (uae_u32)((size_t)parent >> 4);
+	for (; *name; name++) {
+		unsigned int c = (unsigned int)*name;
+		if (c >= 0x80)
+			continue;
+		if (c >= 'A' && c <= 'Z')
+			c += 'a' - 'A';
+		h = (h ^ c) * 16777619u;
+	}
+	return h ^ (h >> 15);
+}
+
+static uae_u32 aino_hash_uniq (a_inode *a)
+{
+	return aino_uniq_hash (a->uniq);
+}
+
+static uae_u32 aino_hash_name (a_inode *a)
+{
+	return aino_name_hash (a->parent, aino_name_key (a->aname));
+}
+
+static void aino_table_init (struct aino_table *t, uae_u32 (*hash)(a_inode *))
+{
+	memset (t, 0, sizeof (struct aino_table));
+	t->hash = hash;
+}
+
+static void aino_table_free (struct aino_table *t)
+{
+	xfree (t->slots);
+	t->slots = NULL;
+	t->size = t->used = t->deleted = 0;
+}
+
+static void aino_table_put (struct aino_table *t, a_inode *a)
+{
+	unsigned int mask = t->size - 1;
+	unsigned int i = t->hash (a) & mask;
+
+	while (t->slots[i] && t->slots[i] != AINO_DELETED)
+		i = (i + 1) & mask;
+	if (t->slots[i] == AINO_DELETED)
+		t->deleted--;
+	t->slots[i] = a;
+	t->used++;
+}
+
+static void aino_table_resize (struct aino_table *t, unsigned int size)
+{
+	a_inode **old = t->slots;
+	unsigned int oldsize = t->size;
+
+	t->slots = xcalloc (a_inode*, size);
+	t->size = size;
+	t->used = 0;
+	t->deleted = 0;
+	for (unsigned int i = 0; i < oldsize; i++) {
+		if (old[i] && old[i] != AINO_DELETED)
+			aino_table_put (t, old[i]);
+	}
+	xfree (old);
+}
+
+static void aino_table_insert (struct aino_table *t, a_inode *a)
+{
+	if (t->size == 0) {
+		aino_table_resize (t, AINO_TABLE_MIN);
+	} else if ((t->used + t->deleted + 1) * 4 > t->size * 3) {
+		/* grow if live entries need it, otherwise just drop tombstones */
+		unsigned int size = t->size;
+		while ((t->used + 1) * 2 > size)
+			size *= 2;
+		aino_table_resize (t, size);
+	}
+	aino_table_put (t, a);
+}
+
+static void aino_table_remove (struct aino_table *t, a_inode *a)
+{
+	unsigned int mask, i;
+
+	if (t->size == 0)
+		return;
+	mask = t->size - 1;
+	i = t->hash (a) & mask;
+	while (t->slots[i]) {
+		if (t->slots[i] == a) {
+			t->slots[i] = AINO_DELETED;
+			t->used--;
+			t->deleted++;
+			if (t->size > AINO_TABLE_MIN && t->used * 8 < t->size)
+				aino_table_resize (t, t->size / 2);
+			return;
+		}
+		i = (i + 1) & mask;
+	}
+}
+
+static a_inode *aino_uniq_find (Unit *unit, uae_u32 uniq)
+{
+	struct aino_table *t = &unit->aino_uniq;
+	unsigned int mask, i;
+	a_inode *a;
+
+	if (t->size == 0)
+		return 0;
+	mask = t->size - 1;
+	i = aino_uniq_hash (uniq) & mask;
+	while ((a = t->slots[i])) {
+		if (a != AINO_DELETED && a->uniq == uniq)
+			return a;
+		i = (i + 1) & mask;
+	}
+	return 0;
+}
+
+static a_inode *aino_name_find (Unit *unit, a_inode *base, const TCHAR *rel)
+{
+	struct aino_table *t = &unit->aino_names;
+	int l0 = _tcslen (rel);
+	unsigned int mask, i;
+	a_inode *c;
+
+	if (t->size == 0)
+		return 0;
+	mask = t->size - 1;
+	i = aino_name_hash (base, aino_name_key (rel)) & mask;
+	while ((c = t->slots[i])) {
+		if (c != AINO_DELETED && c->parent == base) {
+			int l1 = _tcslen (c->aname);
+			if (l0 <= l1 && same_aname (rel, c->aname + l1 - l0)
+				&& (l0 == l1 || c->aname[l1-l0-1] == '/') && c->mountcount == unit->mountcount)
+				return c;
+		}
+		i = (i + 1) & mask;
+	}
+	return 0;
+}
+
+static void aino_tables_add (Unit *unit, a_inode *aino)
+{
+	aino_table_insert (&unit->aino_uniq, aino);
+	aino_table_insert (&unit->aino_names, aino);
+}
+
 static void dispose_aino (Unit *unit, a_inode **aip, a_inode *aino)
 {
-	int hash = aino->uniq % MAX_AINO_HASH;
-	if (unit->aino_hash[hash] == aino)
-		unit->aino_hash[hash] = 0;
+	aino_table_remove (&unit->aino_uniq, aino);
+	aino_table_remove (&unit->aino_names, aino);
 
 	if (aino->dirty && aino->parent)
 		fsdb_dir_writeback (aino->parent);
@@ -2529,11 +2707,18 @@ static void update_child_names (Unit *unit, a_inode *a, a_inode *parent)
 
 static void move_aino_children (Unit *unit, a_inode *from, a_inode *to)
 {
+	a_inode *a;
+
 	aino_test (from);
 	aino_test (to);
+	/* name table is keyed by parent, re-key the moved children */
+	for (a = from->child; a; a = a->sibling)
+		aino_table_remove (&unit->aino_names, a);
 	to->child = from->child;
 	from->child = 0;
 	update_child_names (unit, to->child, to);
+	for (a = to->child; a; a = a->sibling)
+		aino_table_insert (&unit->aino_names, a);
 }
 
 static void delete_aino (Unit *unit, a_inode *aino)
@@ -2612,17 +2797,18 @@ static a_inode *lookup_sub (a_inode *dir, uae_u32 uniq)
 static a_inode *lookup_aino (Unit *unit, uae_u32 uniq)
 {
 	a_inode *a;
-	int hash = uniq % MAX_AINO_HASH;
 
 	if (uniq == 0)
 		return &unit->rootnode;
-	a = unit->aino_hash[hash];
-	if (a == 0 || a->uniq != uniq)
+	a = aino_uniq_find (unit, uniq);
+	if (a == 0) {
 		a = lookup_sub (&unit->rootnode, uniq);
-	else
+		if (a)
+			aino_table_insert (&unit->aino_uniq, a);
+	} else {
 		unit->nr_cache_hits++;
+	}
 	unit->nr_cache_lookups++;
-	unit->aino_hash[hash] = a;
 	aino_test (a);
 	return a;
 }
@@ -2803,6 +2989,7 @@ static void init_child_aino_tree (Unit *unit, a_inode *base, a_inode *aino)
 	base->child = aino;
 	aino->next = aino->prev = 0;
 	aino->volflags = unit->volflags;
+	aino_tables_add (unit, aino);
 }
 
 static void init_child_aino (Unit *unit, a_inode *base, a_inode *aino)
@@ -2901,24 +3088,17 @@ static a_inode *create_child_aino (Unit *unit, a_inode *base, TCHAR *rel, int is
 
 static a_inode *lookup_child_aino (Unit *unit, a_inode *base, TCHAR *rel, int *err)
 {
-	a_inode *c = base->child;
-	int l0 = _tcslen (rel);
+	a_inode *c;
 
 	aino_test (base);
-	aino_test (c);
+	aino_test (base->child);
 
 	if (base->dir == 0) {
 		*err = ERROR_OBJECT_WRONG_TYPE;
 		return 0;
 	}
 
-	while (c != 0) {
-		int l1 = _tcslen (c->aname);
-		if (l0 <= l1 && same_aname (rel, c->aname + l1 - l0)
-			&& (l0 == l1 || c->aname[l1-l0-1] == '/') && c->mountcount == unit->mountcount)
-			break;
-		c = c->sibling;
-	}
+	c = aino_name_find (unit, base, rel);
 	if (c != 0)
 		return c;
 	c = new_child_aino (unit, base, rel);
@@ -3165,8 +3345,8 @@ static Unit *startup_create_unit(TrapContext *ctx, UnitInfo *uinfo, int num)
 	unit->rootnode.volflags = uinfo->volflags;
 	aino_test_init (&unit->rootnode);
 	unit->aino_cache_size = 0;
-	for (i = 0; i < MAX_AINO_HASH; i++)
-		unit->aino_hash[i] = 0;
+	aino_table_init (&unit->aino_uniq, aino_hash_uniq);
+	aino_table_init (&unit->aino_names, aino_hash_name);
 	return unit;
 }
 
@@ -6268,6 +6448,8 @@ static void	action_rename_object(TrapContext *ctx, Unit *unit, dpacket *packet)
 	a2->comment = a1->comment;
 	a1->comment = 0;
 	a2->amigaos_mode = a1->amigaos_mode;
+	/* a2 takes over a1's uniq, re-key it once a1 is gone */
+	aino_table_remove (&unit->aino_uniq, a2);
 	a2->uniq = a1->uniq;
 	a2->elock = a1->elock;
 	a2->shlock = a1->shlock;
@@ -6278,6 +6460,7 @@ static void	action_rename_object(TrapContext *ctx, Unit *unit, dpacket *packet)
 	move_exkeys (unit, a1, a2);
 	move_aino_children (unit, a1, a2);
 	delete_aino (unit, a1);
+	aino_table_insert (&unit->aino_uniq, a2);
 	a2->dirty = 1;
 	if (a2->parent)
 		fsdb_dir_writeback (a2->parent);
@@ -7338,6 +7521,8 @@ void filesys_free_handles (void)
 		free_all_ainos (u, &u->rootnode);
 		u->rootnode.next = u->rootnode.prev = &u->rootnode;
 		u->aino_cache_size = 0;
+		aino_table_free (&u->aino_uniq);
+		aino_table_free (&u->aino_names);
 		xfree (u->newrootdir);
 		xfree (u->newvolume);
 		u->newrootdir = NULL;
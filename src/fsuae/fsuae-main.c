@@ -27,6 +27,7 @@
 #include <fs/lazyness.h>
 #include <fs/main.h>
 #include <fs/thread.h>
+#include <fsemu/performance.h>
 #include <locale.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -729,31 +730,35 @@ void fs_uae_load_rom_files(const char *path)
     g_free(key_path);
 
     amiga_add_key_dir(path);
+    GPtrArray *paths = g_ptr_array_new_with_free_func(g_free);
     const char *name = g_dir_read_name(dir);
     while (name) {
         char *lname = g_utf8_strdown(name, -1);
         if (g_str_has_suffix(lname, ".rom") ||
-            g_str_has_suffix(lname, ".bin")) {
+            g_str_has_suffix(lname, ".bin") ||
+            g_str_has_suffix(lname, ".zip") ||
+            g_str_has_suffix(lname, ".7z") ||
+            g_str_has_suffix(lname, ".lha")) {
             fsuae_log("found file \"%s\"\n", name);
-            char *full_path = g_build_filename(path, name, NULL);
-            // GChecksum *checksum = g_checksum_new(G_CHECKSUM_MD5);
-            GChecksum *checksum = g_checksum_copy(rom_checksum);
-            g_checksum_update(
-                checksum, (guchar *) full_path, strlen(full_path));
-            const gchar *cache_name = g_checksum_get_string(checksum);
-            char *cache_path = g_build_filename(
-                fsuae_path_kickstartcache_dir(), cache_name, NULL);
-            amiga_add_rom_file(full_path, cache_path);
-            g_free(full_path);
-            if (cache_path != NULL) {
-                free(cache_path);
-            }
-            g_checksum_free(checksum);
+            g_ptr_array_add(paths, g_build_filename(path, name, NULL));
         }
         free(lname);
         name = g_dir_read_name(dir);
     }
     g_dir_close(dir);
+    g_ptr_array_add(paths, NULL);
+
+    // One cache file per directory, named after the directory and the
+    // rom key, so it is regenerated when the key changes.
+    g_checksum_update(rom_checksum, (guchar *) path, strlen(path));
+    char *cache_name =
+        g_strconcat(g_checksum_get_string(rom_checksum), ".roms", NULL);
+    char *cache_path =
+        g_build_filename(fsuae_path_kickstartcache_dir(), cache_name, NULL);
+    amiga_scan_rom_files((const char **) paths->pdata, cache_path);
+    g_free(cache_path);
+    g_free(cache_name);
+    g_ptr_array_free(paths, TRUE);
 
     if (rom_checksum != NULL) {
         g_checksum_free(rom_checksum);
@@ -1816,6 +1821,9 @@ int main(int argc, char *argv[])
 
 
     fsemu_log_setup();
+    fsemu_performance_init();
+    // Must be initialized before the video and audio drivers are chosen.
+    fsemu_benchmark_init();
     // fsemu_audio_init(0);
     // fsemu_window_init();
 
@@ -1884,6 +1892,10 @@ int main(int argc, char *argv[])
 
     fsemu_action_init();
 
+    if (fsemu_benchmark_enabled()) {
+        fsemu_control_set_warp(true);
+    }
+
     init_i18n();
     fsuae_init_leds();
 
@@ -2026,6 +2038,10 @@ int main(int argc, char *argv[])
         fs_config_get_boolean(OPTION_DETERMINISTIC) == 1) {
         deterministic_mode = 1;
     }
+    if (fsemu_benchmark_enabled()) {
+        // Frame checksums should be comparable between runs
+        deterministic_mode = 1;
+    }
     if (deterministic_mode) {
         amiga_set_deterministic_mode();
     }
@@ -1408,6 +1408,7 @@ static int freepcmcia (int reset)
 			xfree (pcmcia_sram);
 			pcmcia_sram = NULL;
 		} else {
+			hdf_flush (&pcmcia_sram->hfd);
 			pcmcia_sram->hfd.drive_empty = 1;
 		}
 	}
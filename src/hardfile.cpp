@@ -593,21 +593,407 @@ static uae_u32 vhd_checksum (uae_u8 *p, int offset)
 static int hdf_write2 (struct hardfiledata *hfd, void *buffer, uae_u64 offset, int len);
 static int hdf_read2 (struct hardfiledata *hfd, void *buffer, uae_u64 offset, int len);
 
+/* Block cache
+ *
+ * Set-associative cache of HDF_CACHE_BLOCK_SIZE sized blocks sitting on top
+ * of hdf_read2/hdf_write2 (before adide/byteswap decoding). Sequential reads
+ * trigger read-ahead, writes are kept in the cache until the block is evicted,
+ * the guest flushes (CMD_UPDATE, SYNCHRONIZE CACHE, ATA FLUSH CACHE), the
+ * dirty data gets older than HDF_CACHE_FLUSH_TIME or the hardfile is closed.
+ */
+
+#define HDF_CACHE_SETS (MAX_HDF_CACHE_BLOCKS / HDF_CACHE_WAYS)
+/* max number of blocks read with one host request, must be <= HDF_CACHE_SETS */
+#define HDF_CACHE_FILL_BLOCKS 16
+#define HDF_CACHE_READAHEAD 8
+/* larger requests go directly to the hardfile */
+#define HDF_CACHE_BYPASS (HDF_CACHE_FILL_BLOCKS * HDF_CACHE_BLOCK_SIZE)
+#define HDF_CACHE_FLUSH_TIME 5
+
+/* One lock for all caches, hardfile.device, IDE and SCSI threads use them
+ * and hardfile_vsync () writes back old dirty blocks of idle drives. Units
+ * with a cache are linked through bcache_next. */
+static uae_sem_t hdf_cache_sem;
+static struct hardfiledata *hdf_cache_units;
+
+static bool hdf_cache_writeback (struct hardfiledata *hfd, struct hdf_cache *hc)
+{
+	if (!hc->valid || !hc->dirty)
+		return true;
+	hc->dirty = false;
+	hc->writecount++;
+	hfd->bcache_writeback++;
+	if (hdf_write2 (hfd, hc->data, hc->block * HDF_CACHE_BLOCK_SIZE, HDF_CACHE_BLOCK_SIZE) != HDF_CACHE_BLOCK_SIZE) {
+		write_log (_T("HDF: cache write-back of block %llu failed\n"), hc->block);
+		return false;
+	}
+	return true;
+}
+
+static void hdf_flush_cache (struct hardfiledata *hfd)
+{
+	if (!hfd->bcache_data)
+		return;
+	for (int i = 0; i < MAX_HDF_CACHE_BLOCKS; i++)
+		hdf_cache_writeback (hfd, &hfd->bcache[i]);
+	hfd->bcache_dirtytime = 0;
+}
+
+static void hdf_invalidate_cache (struct hardfiledata *hfd)
+{
+	hdf_flush_cache (hfd);
+	for (int i = 0; i < MAX_HDF_CACHE_BLOCKS; i++)
+		hfd->bcache[i].valid = false;
+	hfd->bcache_virtual_size = hfd->virtual_size;
+	hfd->bcache_nextoffset = ~0ULL;
+}
+
+static void hdf_cache_unregister (struct hardfiledata *hfd)
+{
+	for (struct hardfiledata **pp = &hdf_cache_units; *pp; pp = &(*pp)->bcache_next) {
+		if (*pp == hfd) {
+			*pp = hfd->bcache_next;
+			break;
+		}
+	}
+	hfd->bcache_next = NULL;
+}
+
+static void hdf_free_cache (struct hardfiledata *hfd)
+{
+	if (!hfd->bcache_data)
+		return;
+	uae_sem_wait (&hdf_cache_sem);
+	hdf_cache_unregister (hfd);
+	hdf_flush_cache (hfd);
+	if (hfd->bcache_hits || hfd->bcache_misses) {
+		write_log (_T("HDF: cache %llu hits, %llu misses, %llu read-ahead, %llu write-backs\n"),
+			hfd->bcache_hits, hfd->bcache_misses, hfd->bcache_readahead, hfd->bcache_writeback);
+	}
+	xfree (hfd->bcache_data);
+	hfd->bcache_data = NULL;
+	memset (hfd->bcache, 0, sizeof hfd->bcache);
+	uae_sem_post (&hdf_cache_sem);
+}
+
 static void hdf_init_cache (struct hardfiledata *hfd)
 {
+	if (!hdf_cache_sem)
+		uae_sem_init (&hdf_cache_sem, 0, 1);
+	uae_sem_wait (&hdf_cache_sem);
+	hdf_cache_unregister (hfd);
+	/* previous image is already closed, nothing to write back */
+	xfree (hfd->bcache_data);
+	hfd->bcache_data = NULL;
+	memset (hfd->bcache, 0, sizeof hfd->bcache);
+	hfd->bcache_lru = 0;
+	hfd->bcache_dirtytime = 0;
+	hfd->bcache_hits = hfd->bcache_misses = 0;
+	hfd->bcache_readahead = hfd->bcache_writeback = 0;
+	if (hfd->ci.blocksize > 0 && (HDF_CACHE_BLOCK_SIZE % hfd->ci.blocksize) == 0) {
+		/* extra HDF_CACHE_FILL_BLOCKS at the end is the host read buffer */
+		hfd->bcache_data = xcalloc (uae_u8, (MAX_HDF_CACHE_BLOCKS + HDF_CACHE_FILL_BLOCKS) * HDF_CACHE_BLOCK_SIZE);
+		if (hfd->bcache_data) {
+			for (int j = 0; j < MAX_HDF_CACHE_BLOCKS; j++)
+				hfd->bcache[j].data = hfd->bcache_data + j * HDF_CACHE_BLOCK_SIZE;
+			hfd->bcache_virtual_size = hfd->virtual_size;
+			hfd->bcache_nextoffset = ~0ULL;
+			hfd->bcache_next = hdf_cache_units;
+			hdf_cache_units = hfd;
+		} else {
+			write_log (_T("HDF: no memory for block cache, cache disabled\n"));
+		}
+	}
+	uae_sem_post (&hdf_cache_sem);
+}
+
+void hdf_flush (struct hardfiledata *hfd)
+{
+	if (!hfd->bcache_data)
+		return;
+	uae_sem_wait (&hdf_cache_sem);
+	hdf_flush_cache (hfd);
+	uae_sem_post (&hdf_cache_sem);
+}
+
+void hardfile_vsync (void)
+{
+	static time_t lastcheck;
+	time_t now = time (NULL);
+
+	if (!hdf_cache_sem || now == lastcheck)
+		return;
+	lastcheck = now;
+	/* busy, the thread using the cache checks the flush time itself */
+	if (uae_sem_trywait (&hdf_cache_sem))
+		return;
+	for (struct hardfiledata *hfd = hdf_cache_units; hfd; hfd = hfd->bcache_next) {
+		if (hfd->bcache_dirtytime && now >= hfd->bcache_dirtytime + HDF_CACHE_FLUSH_TIME)
+			hdf_flush_cache (hfd);
+	}
+	uae_sem_post (&hdf_cache_sem);
+}
+
+/* number of complete blocks, partial last block is never cached */
+static uae_u64 hdf_cache_maxblock (struct hardfiledata *hfd)
+{
+	/* virtsize already includes the virtual RDB */
+	return hfd->virtsize / HDF_CACHE_BLOCK_SIZE;
 }
-static void hdf_flush_cache (struct hardfiledata *hdf)
+
+static struct hdf_cache *hdf_cache_find (struct hardfiledata *hfd, uae_u64 block)
 {
+	struct hdf_cache *set = &hfd->bcache[(block % HDF_CACHE_SETS) * HDF_CACHE_WAYS];
+	for (int i = 0; i < HDF_CACHE_WAYS; i++) {
+		if (set[i].valid && set[i].block == block)
+			return &set[i];
+	}
+	return NULL;
+}
+
+static struct hdf_cache *hdf_cache_alloc (struct hardfiledata *hfd, uae_u64 block)
+{
+	struct hdf_cache *set = &hfd->bcache[(block % HDF_CACHE_SETS) * HDF_CACHE_WAYS];
+	struct hdf_cache *hc = &set[0];
+	for (int i = 0; i < HDF_CACHE_WAYS; i++) {
+		if (!set[i].valid) {
+			hc = &set[i];
+			break;
+		}
+		if ((uae_s32)(set[i].lru - hc->lru) < 0)
+			hc = &set[i];
+	}
+	hdf_cache_writeback (hfd, hc);
+	hc->valid = false;
+	hc->block = block;
+	hc->lru = ++hfd->bcache_lru;
+	return hc;
+}
+
+/* Load 'block' and up to count - 1 following uncached blocks with a single read */
+static struct hdf_cache *hdf_cache_fill (struct hardfiledata *hfd, uae_u64 block, int count)
+{
+	struct hdf_cache *lines[HDF_CACHE_FILL_BLOCKS];
+	uae_u8 *tmp = hfd->bcache_data + MAX_HDF_CACHE_BLOCKS * HDF_CACHE_BLOCK_SIZE;
+	uae_u64 maxblock = hdf_cache_maxblock (hfd);
+	int num, got;
+
+	if (count > HDF_CACHE_FILL_BLOCKS)
+		count = HDF_CACHE_FILL_BLOCKS;
+	for (num = 1; num < count; num++) {
+		if (block + num >= maxblock || hdf_cache_find (hfd, block + num))
+			break;
+	}
+	for (int i = 0; i < num; i++)
+		lines[i] = hdf_cache_alloc (hfd, block + i);
+	got = hdf_read2 (hfd, tmp, block * HDF_CACHE_BLOCK_SIZE, num * HDF_CACHE_BLOCK_SIZE);
+	if (got < HDF_CACHE_BLOCK_SIZE)
+		return NULL;
+	got /= HDF_CACHE_BLOCK_SIZE;
+	for (int i = 0; i < got; i++) {
+		memcpy (lines[i]->data, tmp + i * HDF_CACHE_BLOCK_SIZE, HDF_CACHE_BLOCK_SIZE);
+		lines[i]->valid = true;
+		lines[i]->dirty = false;
+	}
+	return lines[0];
+}
+
+/* Copy cached (possibly dirty) data on top of an uncached read */
+static void hdf_cache_overlay (struct hardfiledata *hfd, uae_u8 *buffer, uae_u64 offset, int len)
+{
+	for (int i = 0; i < MAX_HDF_CACHE_BLOCKS; i++) {
+		struct hdf_cache *hc = &hfd->bcache[i];
+		if (!hc->valid || !hc->dirty)
+			continue;
+		uae_u64 start = hc->block * HDF_CACHE_BLOCK_SIZE;
+		uae_u64 end = start + HDF_CACHE_BLOCK_SIZE;
+		if (end <= offset || start >= offset + len)
+			continue;
+		if (start < offset)
+			start = offset;
+		if (end > offset + len)
+			end = offset + len;
+		memcpy (buffer + (start - offset), hc->data + (start - hc->block * HDF_CACHE_BLOCK_SIZE), end - start);
+	}
+}
+
+/* Update cached blocks after data was written directly to the hardfile */
+static void hdf_cache_update (struct hardfiledata *hfd, uae_u8 *buffer, uae_u64 offset, int len)
+{
+	for (int i = 0; i < MAX_HDF_CACHE_BLOCKS; i++) {
+		struct hdf_cache *hc = &hfd->bcache[i];
+		if (!hc->valid)
+			continue;
+		uae_u64 start = hc->block * HDF_CACHE_BLOCK_SIZE;
+		uae_u64 end = start + HDF_CACHE_BLOCK_SIZE;
+		if (end <= offset || start >= offset + len)
+			continue;
+		if (start < offset)
+			start = offset;
+		if (end > offset + len)
+			end = offset + len;
+		memcpy (hc->data + (start - hc->block * HDF_CACHE_BLOCK_SIZE), buffer + (start - offset), end - start);
+	}
+}
+
+static void hdf_cache_check (struct hardfiledata *hfd)
+{
+	/* virtual RDB shifts all offsets */
+	if (hfd->bcache_virtual_size != hfd->virtual_size)
+		hdf_invalidate_cache (hfd);
+}
+
+static int hdf_cache_read2 (struct hardfiledata *hfd, void *buffer, uae_u64 offset, int len)
+{
+	uae_u8 *p = (uae_u8*)buffer;
+	uae_u64 maxblock;
+	bool sequential;
+	int got = 0;
+
+	if (!hfd->bcache_data || hfd->drive_empty || len <= 0)
+		return hdf_read2 (hfd, buffer, offset, len);
+	hdf_cache_check (hfd);
+	sequential = offset == hfd->bcache_nextoffset;
+	hfd->bcache_nextoffset = offset + len;
+	if (len >= HDF_CACHE_BYPASS) {
+		int v = hdf_read2 (hfd, buffer, offset, len);
+		if (v > 0)
+			hdf_cache_overlay (hfd, p, offset, v);
+		return v;
+	}
+	maxblock = hdf_cache_maxblock (hfd);
+	while (len > 0) {
+		uae_u64 block = offset / HDF_CACHE_BLOCK_SIZE;
+		int boffset = offset % HDF_CACHE_BLOCK_SIZE;
+		int size = HDF_CACHE_BLOCK_SIZE - boffset;
+		struct hdf_cache *hc;
+
+		if (size > len)
+			size = len;
+		if (block >= maxblock) {
+			int v = hdf_read2 (hfd, p, offset, len);
+			if (v > 0)
+				got += v;
+			return got;
+		}
+		hc = hdf_cache_find (hfd, block);
+		if (hc) {
+			hfd->bcache_hits++;
+		} else {
+			int needed = (boffset + len + HDF_CACHE_BLOCK_SIZE - 1) / HDF_CACHE_BLOCK_SIZE;
+			int count = needed + (sequential ? HDF_CACHE_READAHEAD : 0);
+			hfd->bcache_misses++;
+			hc = hdf_cache_fill (hfd, block, count);
+			if (!hc) {
+				int v = hdf_read2 (hfd, p, offset, len);
+				if (v > 0)
+					got += v;
+				return got;
+			}
+			if (count > needed)
+				hfd->bcache_readahead += count - needed;
+		}
+		hc->lru = ++hfd->bcache_lru;
+		hc->readcount++;
+		memcpy (p, hc->data + boffset, size);
+		got += size;
+		p += size;
+		offset += size;
+		len -= size;
+	}
+	return got;
+}
+
+static int hdf_cache_write2 (struct hardfiledata *hfd, void *buffer, uae_u64 offset, int len)
+{
+	uae_u8 *p = (uae_u8*)buffer;
+	uae_u64 maxblock;
+	int got = 0;
+
+	if (!hfd->bcache_data || hfd->drive_empty || len <= 0)
+		return hdf_write2 (hfd, buffer, offset, len);
+	hdf_cache_check (hfd);
+	hfd->bcache_nextoffset = ~0ULL;
+	/* read only images must fail immediately, not at write-back time */
+	if (len >= HDF_CACHE_BYPASS || hfd->ci.readonly || hfd->dangerous) {
+		int v = hdf_write2 (hfd, buffer, offset, len);
+		if (v > 0)
+			hdf_cache_update (hfd, p, offset, v);
+		return v;
+	}
+	maxblock = hdf_cache_maxblock (hfd);
+	while (len > 0) {
+		uae_u64 block = offset / HDF_CACHE_BLOCK_SIZE;
+		int boffset = offset % HDF_CACHE_BLOCK_SIZE;
+		int size = HDF_CACHE_BLOCK_SIZE - boffset;
+		struct hdf_cache *hc;
+
+		if (size > len)
+			size = len;
+		if (block >= maxblock) {
+			int v = hdf_write2 (hfd, p, offset, len);
+			if (v > 0)
+				got += v;
+			return got;
+		}
+		hc = hdf_cache_find (hfd, block);
+		if (!hc) {
+			if (size == HDF_CACHE_BLOCK_SIZE) {
+				hc = hdf_cache_alloc (hfd, block);
+				hc->valid = true;
+			} else {
+				hc = hdf_cache_fill (hfd, block, 1);
+			}
+			if (!hc) {
+				int v = hdf_write2 (hfd, p, offset, size);
+				if (v > 0)
+					got += v;
+				if (v != size)
+					return got;
+				p += size;
+				offset += size;
+				len -= size;
+				continue;
+			}
+		}
+		hc->lru = ++hfd->bcache_lru;
+		memcpy (hc->data + boffset, p, size);
+		hc->dirty = true;
+		hc->lastaccess = time (NULL);
+		if (!hfd->bcache_dirtytime)
+			hfd->bcache_dirtytime = hc->lastaccess;
+		got += size;
+		p += size;
+		offset += size;
+		len -= size;
+	}
+	if (hfd->bcache_dirtytime && time (NULL) >= hfd->bcache_dirtytime + HDF_CACHE_FLUSH_TIME)
+		hdf_flush_cache (hfd);
+	return got;
 }
 
 static int hdf_cache_read (struct hardfiledata *hfd, void *buffer, uae_u64 offset, int len)
 {
-	return hdf_read2 (hfd, buffer, offset, len);
+	int v;
+
+	if (!hfd->bcache_data)
+		return hdf_read2 (hfd, buffer, offset, len);
+	uae_sem_wait (&hdf_cache_sem);
+	v = hdf_cache_read2 (hfd, buffer, offset, len);
+	uae_sem_post (&hdf_cache_sem);
+	return v;
 }
 
 static int hdf_cache_write (struct hardfiledata *hfd, void *buffer, uae_u64 offset, int len)
 {
-	return hdf_write2 (hfd, buffer, offset, len);
+	int v;
+
+	if (!hfd->bcache_data)
+		return hdf_write2 (hfd, buffer, offset, len);
+	uae_sem_wait (&hdf_cache_sem);
+	v = hdf_cache_write2 (hfd, buffer, offset, len);
+	uae_sem_post (&hdf_cache_sem);
+	return v;
 }
 
 int hdf_open (struct hardfiledata *hfd, const TCHAR *pname)
@@ -655,6 +1041,8 @@ int hdf_open (struct hardfiledata *hfd, const TCHAR *pname)
 				delete cf;
 				goto end;
 			}
+			if (currprefs.chd_cache_size > 0)
+				cf->set_hunk_cache (currprefs.chd_cache_size * 1024 * 1024, currprefs.chd_readahead);
 			chdf = hard_disk_open(cf);
 			if (!chdf) {
 				hfd->ci.readonly = true;
@@ -669,6 +1057,7 @@ int hdf_open (struct hardfiledata *hfd, const TCHAR *pname)
 			hfd->virtsize = cf->logical_bytes();
 			hfd->handle_valid = -1;
 			write_log(_T("CHD '%s' mounted as %s, %s.\n"), filepath, chdf ? _T("HD") : _T("OTHER"), hfd->ci.readonly ? _T("read only") : _T("read/write"));
+			hdf_init_cache (hfd);
 			return 1;
 		}
 	}
@@ -730,6 +1119,7 @@ int hdf_open (struct hardfiledata *hfd, const TCHAR *pname)
 	return 1;
 nonvhd:
 	hfd->hfd_type = 0;
+	hdf_init_cache (hfd);
 	return 1;
 end:
 	hdf_close_target (hfd);
@@ -747,7 +1137,7 @@ int hdf_open (struct hardfiledata *hfd)
 
 void hdf_close (struct hardfiledata *hfd)
 {
-	hdf_flush_cache (hfd);
+	hdf_free_cache (hfd);
 	hdf_close_target (hfd);
 #ifdef WITH_CHD
 	if (hfd->hfd_type == HFD_CHD_OTHER) {
@@ -2066,6 +2456,7 @@ int scsi_hd_emulate (struct hardfiledata *hfd, struct hd_hardfiledata *hdhfd, ua
 	case 0x35: /* SYNCRONIZE CACHE (10) */
 		if (nodisk (hfd))
 			goto nodisk;
+		hdf_flush (hfd);
 		scsi_len = 0;
 		break;
 	case 0xa8: /* READ (12) */
@@ -2329,6 +2720,11 @@ void hardfile_send_disk_change (struct hardfiledata *hfd, bool insert)
 	uae_sem_wait (&change_sem);
 	hardfpd[hfd->unitnum].changenum++;
 	write_log (_T("uaehf.device:%d media status=%d changenum=%d\n"), hfd->unitnum, insert, hardfpd[hfd->unitnum].changenum);
+	if (!insert && hfd->bcache_data) {
+		uae_sem_wait (&hdf_cache_sem);
+		hdf_invalidate_cache (hfd);
+		uae_sem_post (&hdf_cache_sem);
+	}
 	hfd->drive_empty = newstate;
 	int j = 0;
 	while (j < MAX_ASYNC_REQUESTS) {
@@ -2772,8 +3168,11 @@ static uae_u32 hardfile_do_io (TrapContext *ctx, struct hardfiledata *hfd, struc
 		actual = hfd->drive_empty ? 1 :0;
 		break;
 
-		/* Some commands that just do nothing and return zero */
 	case CMD_UPDATE:
+		hdf_flush (hfd);
+		break;
+
+		/* Some commands that just do nothing and return zero */
 	case CMD_CLEAR:
 	case CMD_MOTOR:
 	case CMD_SEEK:
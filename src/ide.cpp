@@ -1209,6 +1209,7 @@ static void ide_do_command (struct ide_hdf *ide, uae_u8 cmd)
 			if (ide->ata_level < 0) {
 				ide_fail(ide);
 			} else {
+				hdf_flush (&ide->hdhfd.hfd);
 				ide_interrupt(ide);
 			}
 		} else if (cmd == 0xe5) { /* check power mode */
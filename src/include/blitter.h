@@ -53,6 +53,7 @@ extern int blitter_channel_state (void);
 extern void blitter_check_start (void);
 extern void blitter_reset (void);
 extern void blitter_debugdump(void);
+extern void blitter_benchmark (void);
 
 typedef void blitter_func(uaecptr, uaecptr, uaecptr, uaecptr, struct bltinfo *);
 
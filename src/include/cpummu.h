@@ -173,9 +173,43 @@ extern uae_u32 mmu_is_super;
 extern uae_u32 mmu_tagmask, mmu_pagemask, mmu_pagemaski;
 extern struct mmu_atc_line mmu_atc_array[ATC_TYPE][ATC_SLOTS][ATC_WAYS];
 
+/*
+ * Transparent translation lookup. TTR matching only depends on the
+ * top 8 address bits, super and data/instruction so mmu_tt_modified()
+ * precalculates the result for every 16M region.
+ */
+struct mmu_ttr_shortcut {
+	uae_u8 match;
+	uae_u8 cache_state;
+};
+extern struct mmu_ttr_shortcut mmu_ttr_map[2][2][256];
+
 extern void mmu_tt_modified(void);
-extern int mmu_match_ttr_ins(uaecptr addr, bool super);
-extern int mmu_match_ttr(uaecptr addr, bool super, bool data);
+
+static ALWAYS_INLINE int mmu_match_ttr_ins(uaecptr addr, bool super)
+{
+	struct mmu_ttr_shortcut *t;
+
+	if (!mmu_ttr_enabled_ins)
+		return TTR_NO_MATCH;
+	t = &mmu_ttr_map[0][super ? 1 : 0][addr >> 24];
+	if (t->match != TTR_NO_MATCH)
+		mmu_cache_state = t->cache_state;
+	return t->match;
+}
+
+static ALWAYS_INLINE int mmu_match_ttr(uaecptr addr, bool super, bool data)
+{
+	struct mmu_ttr_shortcut *t;
+
+	if (!mmu_ttr_enabled)
+		return TTR_NO_MATCH;
+	t = &mmu_ttr_map[data ? 1 : 0][super ? 1 : 0][addr >> 24];
+	if (t->match != TTR_NO_MATCH)
+		mmu_cache_state = t->cache_state;
+	return t->match;
+}
+
 extern void mmu_bus_error_ttr_write_fault(uaecptr addr, bool super, bool data, uae_u32 val, int size);
 extern int mmu_match_ttr_write(uaecptr addr, bool super, bool data, uae_u32 val, int size);
 extern int mmu_match_ttr_maybe_write(uaecptr addr, bool super, bool data, int size, bool write);
@@ -241,23 +275,49 @@ static ALWAYS_INLINE uaecptr mmu_get_real_address(uaecptr addr, struct mmu_atc_l
 extern void mmu_get_move16(uaecptr addr, uae_u32 *v, bool data, int size);
 extern void mmu_put_move16(uaecptr addr, uae_u32 *val, bool data, int size);
 
-#if MMU_IPAGECACHE
-extern uae_u32 atc_last_ins_laddr, atc_last_ins_paddr;
-extern uae_u8 atc_last_ins_cache;
-#endif
-
-#if MMU_DPAGECACHE
-#define MMUFASTCACHE_ENTRIES 256
+/*
+ * Software TLB in front of the ATC, direct mapped and indexed by page and
+ * S bit, separate for instruction fetches, data reads and data writes.
+ * Entries are only created from valid ATC hits and they stay around after
+ * the ATC slot has been reused, so they cover much more than the 64 pages
+ * per type the real ATC has. PFLUSH invalidates single entries, PFLUSHA
+ * and TC changes bump mmu_fastcache_gen which is part of the tag.
+ */
+#if MMU_IPAGECACHE || MMU_DPAGECACHE
+#define MMUFASTCACHE_ENTRIES 4096
+#define MMUFASTCACHE_GEN_SHIFT 21
 struct mmufastcache
 {
 	uae_u32 log;
 	uae_u32 phys;
 	uae_u8 cache_state;
 };
+extern uae_u32 mmu_fastcache_gen;
+
+static ALWAYS_INLINE uae_u32 mmu_fastcache_tag(uaecptr addr, uae_u32 super)
+{
+	return (((addr & mmu_pagemaski) >> mmu_pageshift1m) | super) | mmu_fastcache_gen;
+}
+#endif
+#if MMU_IPAGECACHE
+extern struct mmufastcache atc_ins_cache[MMUFASTCACHE_ENTRIES];
+#endif
+#if MMU_DPAGECACHE
 extern struct mmufastcache atc_data_cache_read[MMUFASTCACHE_ENTRIES];
 extern struct mmufastcache atc_data_cache_write[MMUFASTCACHE_ENTRIES];
 #endif
 
+struct mmu_atc_stats
+{
+	uae_u64 translate;
+	uae_u64 atc_hit, atc_miss;
+	uae_u64 walk, walk_fail;
+	uae_u64 flush, flush_all;
+};
+extern struct mmu_atc_stats mmu_atc_stats;
+extern void mmu_atc_stats_reset(void);
+extern void mmu_dump_atc_stats(void);
+
 #if CACHE_HIT_COUNT
 extern int mmu_ins_hit, mmu_ins_miss;
 extern int mmu_data_read_hit, mmu_data_read_miss;
@@ -269,12 +329,14 @@ static ALWAYS_INLINE uae_u32 mmu_get_ilong(uaecptr addr, int size)
 	mmu_cache_state = cache_default_ins;
 	if ((!mmu_ttr_enabled_ins || mmu_match_ttr_ins(addr,regs.s!=0) == TTR_NO_MATCH) && regs.mmu_enabled) {
 #if MMU_IPAGECACHE
-		if (((addr & mmu_pagemaski) | regs.s) == atc_last_ins_laddr) {
+		uae_u32 idx1 = mmu_fastcache_tag(addr, regs.s);
+		uae_u32 idx2 = idx1 & (MMUFASTCACHE_ENTRIES - 1);
+		if (atc_ins_cache[idx2].log == idx1) {
 #if CACHE_HIT_COUNT
 			mmu_ins_hit++;
 #endif
-			addr = atc_last_ins_paddr | (addr & mmu_pagemask);
-			mmu_cache_state = atc_last_ins_cache;
+			addr = atc_ins_cache[idx2].phys | (addr & mmu_pagemask);
+			mmu_cache_state = atc_ins_cache[idx2].cache_state;
 		} else {
 #if CACHE_HIT_COUNT
 			mmu_ins_miss++;
@@ -293,12 +355,14 @@ static ALWAYS_INLINE uae_u16 mmu_get_iword(uaecptr addr, int size)
 	mmu_cache_state = cache_default_ins;
 	if ((!mmu_ttr_enabled_ins || mmu_match_ttr_ins(addr,regs.s!=0) == TTR_NO_MATCH) && regs.mmu_enabled) {
 #if MMU_IPAGECACHE
-		if (((addr & mmu_pagemaski) | regs.s) == atc_last_ins_laddr) {
+		uae_u32 idx1 = mmu_fastcache_tag(addr, regs.s);
+		uae_u32 idx2 = idx1 & (MMUFASTCACHE_ENTRIES - 1);
+		if (atc_ins_cache[idx2].log == idx1) {
 #if CACHE_HIT_COUNT
 			mmu_ins_hit++;
 #endif
-			addr = atc_last_ins_paddr | (addr & mmu_pagemask);
-			mmu_cache_state = atc_last_ins_cache;
+			addr = atc_ins_cache[idx2].phys | (addr & mmu_pagemask);
+			mmu_cache_state = atc_ins_cache[idx2].cache_state;
 		} else {
 #if CACHE_HIT_COUNT
 			mmu_ins_miss++;
@@ -318,7 +382,7 @@ static ALWAYS_INLINE uae_u32 mmu_get_long(uaecptr addr, bool data, int size)
 	mmu_cache_state = cache_default_data;
 	if ((!mmu_ttr_enabled || mmu_match_ttr(addr,regs.s!=0,data) == TTR_NO_MATCH) && regs.mmu_enabled) {
 #if MMU_DPAGECACHE
-		uae_u32 idx1 = ((addr & mmu_pagemaski) >> mmu_pageshift1m) | regs.s;
+		uae_u32 idx1 = mmu_fastcache_tag(addr, regs.s);
 		uae_u32 idx2 = idx1 & (MMUFASTCACHE_ENTRIES - 1);
 		if (atc_data_cache_read[idx2].log == idx1) {
 			addr = atc_data_cache_read[idx2].phys | (addr & mmu_pagemask);
@@ -344,7 +408,7 @@ static ALWAYS_INLINE uae_u16 mmu_get_word(uaecptr addr, bool data, int size)
 	mmu_cache_state = cache_default_data;
 	if ((!mmu_ttr_enabled || mmu_match_ttr(addr,regs.s!=0,data) == TTR_NO_MATCH) && regs.mmu_enabled) {
 #if MMU_DPAGECACHE
-		uae_u32 idx1 = ((addr & mmu_pagemaski) >> mmu_pageshift1m) | regs.s;
+		uae_u32 idx1 = mmu_fastcache_tag(addr, regs.s);
 		uae_u32 idx2 = idx1 & (MMUFASTCACHE_ENTRIES - 1);
 		if (atc_data_cache_read[idx2].log == idx1) {
 			addr = atc_data_cache_read[idx2].phys | (addr & mmu_pagemask);
@@ -370,7 +434,7 @@ static ALWAYS_INLINE uae_u8 mmu_get_byte(uaecptr addr, bool data, int size)
 	mmu_cache_state = cache_default_data;
 	if ((!mmu_ttr_enabled || mmu_match_ttr(addr,regs.s!=0,data) == TTR_NO_MATCH) && regs.mmu_enabled) {
 #if MMU_DPAGECACHE
-		uae_u32 idx1 = ((addr & mmu_pagemaski) >> mmu_pageshift1m) | regs.s;
+		uae_u32 idx1 = mmu_fastcache_tag(addr, regs.s);
 		uae_u32 idx2 = idx1 & (MMUFASTCACHE_ENTRIES - 1);
 		if (atc_data_cache_read[idx2].log == idx1) {
 			addr = atc_data_cache_read[idx2].phys | (addr & mmu_pagemask);
@@ -396,11 +460,11 @@ static ALWAYS_INLINE void mmu_put_long(uaecptr addr, uae_u32 val, bool data, int
 	mmu_cache_state = cache_default_data;
 	if ((!mmu_ttr_enabled || mmu_match_ttr_write(addr,regs.s!=0,data,val,size) == TTR_NO_MATCH) && regs.mmu_enabled) {
 #if MMU_DPAGECACHE
-		uae_u32 idx1 = ((addr & mmu_pagemaski) >> mmu_pageshift1m) | regs.s;
+		uae_u32 idx1 = mmu_fastcache_tag(addr, regs.s);
 		uae_u32 idx2 = idx1 & (MMUFASTCACHE_ENTRIES - 1);
 		if (atc_data_cache_write[idx2].log == idx1) {
 			addr = atc_data_cache_write[idx2].phys | (addr & mmu_pagemask);
-			mmu_cache_state = atc_data_cache_read[idx2].cache_state;
+			mmu_cache_state = atc_data_cache_write[idx2].cache_state;
 #if CACHE_HIT_COUNT
 			mmu_data_write_hit++;
 #endif
@@ -422,11 +486,11 @@ static ALWAYS_INLINE void mmu_put_word(uaecptr addr, uae_u16 val, bool data, int
 	mmu_cache_state = cache_default_data;
 	if ((!mmu_ttr_enabled || mmu_match_ttr_write(addr,regs.s!=0,data,val,size) == TTR_NO_MATCH) && regs.mmu_enabled) {
 #if MMU_DPAGECACHE
-		uae_u32 idx1 = ((addr & mmu_pagemaski) >> mmu_pageshift1m) | regs.s;
+		uae_u32 idx1 = mmu_fastcache_tag(addr, regs.s);
 		uae_u32 idx2 = idx1 & (MMUFASTCACHE_ENTRIES - 1);
 		if (atc_data_cache_write[idx2].log == idx1) {
 			addr = atc_data_cache_write[idx2].phys | (addr & mmu_pagemask);
-			mmu_cache_state = atc_data_cache_read[idx2].cache_state;
+			mmu_cache_state = atc_data_cache_write[idx2].cache_state;
 #if CACHE_HIT_COUNT
 			mmu_data_write_hit++;
 #endif
@@ -448,11 +512,11 @@ static ALWAYS_INLINE void mmu_put_byte(uaecptr addr, uae_u8 val, bool data, int
 	mmu_cache_state = cache_default_data;
 	if ((!mmu_ttr_enabled || mmu_match_ttr_write(addr,regs.s!=0,data,val,size) == TTR_NO_MATCH) && regs.mmu_enabled) {
 #if MMU_DPAGECACHE
-		uae_u32 idx1 = ((addr & mmu_pagemaski) >> mmu_pageshift1m) | regs.s;
+		uae_u32 idx1 = mmu_fastcache_tag(addr, regs.s);
 		uae_u32 idx2 = idx1 & (MMUFASTCACHE_ENTRIES - 1);
 		if (atc_data_cache_write[idx2].log == idx1) {
 			addr = atc_data_cache_write[idx2].phys | (addr & mmu_pagemask);
-			mmu_cache_state = atc_data_cache_read[idx2].cache_state;
+			mmu_cache_state = atc_data_cache_write[idx2].cache_state;
 #if CACHE_HIT_COUNT
 			mmu_data_write_hit++;
 #endif
@@ -474,7 +538,7 @@ static ALWAYS_INLINE uae_u32 mmu_get_user_long(uaecptr addr, bool super, bool wr
 	mmu_cache_state = cache_default_data;
 	if ((!mmu_ttr_enabled || mmu_match_ttr_maybe_write(addr,super,true,size,write) == TTR_NO_MATCH) && regs.mmu_enabled) {
 #if MMU_DPAGECACHE
-		uae_u32 idx1 = ((addr & mmu_pagemaski) >> mmu_pageshift1m) | (super ? 1 : 0);
+		uae_u32 idx1 = mmu_fastcache_tag(addr, super ? 1 : 0);
 		uae_u32 idx2 = idx1 & (MMUFASTCACHE_ENTRIES - 1);
 		if (atc_data_cache_read[idx2].log == idx1) {
 			addr = atc_data_cache_read[idx2].phys | (addr & mmu_pagemask);
@@ -502,7 +566,7 @@ static ALWAYS_INLINE uae_u16 mmu_get_user_word(uaecptr addr, bool super, bool wr
 	mmu_cache_state = cache_default_data;
 	if ((!mmu_ttr_enabled || mmu_match_ttr_maybe_write(addr,super,true,size,write) == TTR_NO_MATCH) && regs.mmu_enabled) {
 #if MMU_DPAGECACHE
-		uae_u32 idx1 = ((addr & mmu_pagemaski) >> mmu_pageshift1m) | (super ? 1 : 0);
+		uae_u32 idx1 = mmu_fastcache_tag(addr, super ? 1 : 0);
 		uae_u32 idx2 = idx1 & (MMUFASTCACHE_ENTRIES - 1);
 		if (atc_data_cache_read[idx2].log == idx1) {
 			addr = atc_data_cache_read[idx2].phys | (addr & mmu_pagemask);
@@ -530,7 +594,7 @@ static ALWAYS_INLINE uae_u8 mmu_get_user_byte(uaecptr addr, bool super, bool wri
 	mmu_cache_state = cache_default_data;
 	if ((!mmu_ttr_enabled || mmu_match_ttr_maybe_write(addr,super,true,size,write) == TTR_NO_MATCH) && regs.mmu_enabled) {
 #if MMU_DPAGECACHE
-		uae_u32 idx1 = ((addr & mmu_pagemaski) >> mmu_pageshift1m) | (super ? 1 : 0);
+		uae_u32 idx1 = mmu_fastcache_tag(addr, super ? 1 : 0);
 		uae_u32 idx2 = idx1 & (MMUFASTCACHE_ENTRIES - 1);
 		if (atc_data_cache_read[idx2].log == idx1) {
 			addr = atc_data_cache_read[idx2].phys | (addr & mmu_pagemask);
@@ -558,11 +622,11 @@ static ALWAYS_INLINE void mmu_put_user_long(uaecptr addr, uae_u32 val, bool supe
 	mmu_cache_state = cache_default_data;
 	if ((!mmu_ttr_enabled || mmu_match_ttr_write(addr,super,true,val,size) == TTR_NO_MATCH) && regs.mmu_enabled) {
 #if MMU_DPAGECACHE
-		uae_u32 idx1 = ((addr & mmu_pagemaski) >> mmu_pageshift1m) | (super ? 1 : 0);
+		uae_u32 idx1 = mmu_fastcache_tag(addr, super ? 1 : 0);
 		uae_u32 idx2 = idx1 & (MMUFASTCACHE_ENTRIES - 1);
 		if (atc_data_cache_write[idx2].log == idx1) {
 			addr = atc_data_cache_write[idx2].phys | (addr & mmu_pagemask);
-			mmu_cache_state = atc_data_cache_read[idx2].cache_state;
+			mmu_cache_state = atc_data_cache_write[idx2].cache_state;
 #if CACHE_HIT_COUNT
 			mmu_data_write_hit++;
 #endif
@@ -586,11 +650,11 @@ static ALWAYS_INLINE void mmu_put_user_word(uaecptr addr, uae_u16 val, bool supe
 	mmu_cache_state = cache_default_data;
 	if ((!mmu_ttr_enabled || mmu_match_ttr_write(addr,super,true,val,size) == TTR_NO_MATCH) && regs.mmu_enabled) {
 #if MMU_DPAGECACHE
-		uae_u32 idx1 = ((addr & mmu_pagemaski) >> mmu_pageshift1m) | (super ? 1 : 0);
+		uae_u32 idx1 = mmu_fastcache_tag(addr, super ? 1 : 0);
 		uae_u32 idx2 = idx1 & (MMUFASTCACHE_ENTRIES - 1);
 		if (atc_data_cache_write[idx2].log == idx1) {
 			addr = atc_data_cache_write[idx2].phys | (addr & mmu_pagemask);
-			mmu_cache_state = atc_data_cache_read[idx2].cache_state;
+			mmu_cache_state = atc_data_cache_write[idx2].cache_state;
 #if CACHE_HIT_COUNT
 			mmu_data_write_hit++;
 #endif
@@ -614,11 +678,11 @@ static ALWAYS_INLINE void mmu_put_user_byte(uaecptr addr, uae_u8 val, bool super
 	mmu_cache_state = cache_default_data;
 	if ((!mmu_ttr_enabled || mmu_match_ttr_write(addr,super,true,val,size) == TTR_NO_MATCH) && regs.mmu_enabled) {
 #if MMU_DPAGECACHE
-		uae_u32 idx1 = ((addr & mmu_pagemaski) >> mmu_pageshift1m) | (super ? 1 : 0);
+		uae_u32 idx1 = mmu_fastcache_tag(addr, super ? 1 : 0);
 		uae_u32 idx2 = idx1 & (MMUFASTCACHE_ENTRIES - 1);
 		if (atc_data_cache_write[idx2].log == idx1) {
 			addr = atc_data_cache_write[idx2].phys | (addr & mmu_pagemask);
-			mmu_cache_state = atc_data_cache_read[idx2].cache_state;
+			mmu_cache_state = atc_data_cache_write[idx2].cache_state;
 #if CACHE_HIT_COUNT
 			mmu_data_write_hit++;
 #endif
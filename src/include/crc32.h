@@ -3,11 +3,26 @@
 
 #include "uae/types.h"
 
+typedef struct
+{
+	unsigned long total[2];     /*!< number of bytes processed  */
+	unsigned long state[5];     /*!< intermediate digest state  */
+	unsigned char buffer[64];   /*!< data block being processed */
+}
+sha1_context;
+
 extern uae_u32 get_crc32 (void *p, int size);
+/* continue crc, get_crc32_more (0, ...) is the same as get_crc32 */
+extern uae_u32 get_crc32_more (uae_u32 crc, void *p, int size);
 extern uae_u16 get_crc16 (void *p, int size);
 extern uae_u32 get_crc32_val (uae_u8 v, uae_u32 crc);
 extern void get_sha1 (void *p, int size, void *out);
 extern const TCHAR *get_sha1_txt (void *p, int size);
+extern void get_sha1_start (sha1_context *ctx);
+extern void get_sha1_more (sha1_context *ctx, void *p, int size);
+extern void get_sha1_finish (sha1_context *ctx, void *out);
 #define SHA1_SIZE 20
 
+extern void crc32_benchmark (void);
+
 #endif /* UAE_CRC32_H */
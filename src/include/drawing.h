@@ -338,12 +338,14 @@ void draw_remaining_lines(void);
 extern void init_hardware_for_drawing_frame (void);
 extern void reset_drawing (void);
 extern void drawing_init (void);
+extern void drawing_free (void);
 extern bool notice_interlace_seen (bool);
 extern void notice_resolution_seen (int, bool);
 extern bool frame_drawn (int monid);
 extern void redraw_frame(void);
 extern void full_redraw_all(void);
 extern bool draw_frame (struct vidbuffer*);
+extern bool drawing_get_dirty_rows (uae_u32 *bits, int rows, bool clear);
 extern int get_custom_limits (int *pw, int *ph, int *pdx, int *pdy, int *prealh);
 extern void store_custom_limits (int w, int h, int dx, int dy);
 extern void set_custom_limits (int w, int h, int dx, int dy);
@@ -355,6 +357,7 @@ extern void putpixel (uae_u8 *buf, uae_u8 *genlockbuf, int bpp, int x, xcolnr c8
 extern void allocvidbuffer(int monid, struct vidbuffer *buf, int width, int height, int depth);
 extern void freevidbuffer(int monid, struct vidbuffer *buf);
 extern void check_prefs_picasso(void);
+extern void drawing_p2c_benchmark(void);
 
 /* Finally, stuff that shouldn't really be shared.  */
 
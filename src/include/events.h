@@ -41,6 +41,7 @@ extern void do_cycles_ce020 (unsigned long cycles);
 extern void events_schedule (void);
 extern void do_cycles_slow (unsigned long cycles_to_add);
 extern void events_reset_syncline(void);
+extern void events_reset_queue(void);
 
 extern int is_cycle_ce (void);
 
@@ -73,7 +74,7 @@ enum {
 
 enum {
     ev2_blitter, ev2_disk, ev2_misc,
-    ev2_max = 12
+    ev2_max = 64
 };
 
 extern int pissoff_value;
@@ -19,6 +19,8 @@
 struct hardfilehandle;
 
 #define MAX_HDF_CACHE_BLOCKS 128
+#define HDF_CACHE_BLOCK_SIZE 4096
+#define HDF_CACHE_WAYS 4
 #define MAX_SCSI_SENSE 36
 struct hdf_cache
 {
@@ -29,6 +31,7 @@ struct hdf_cache
 	int readcount;
 	int writecount;
 	time_t lastaccess;
+	uae_u32 lru;
 };
 
 struct hardfiledata {
@@ -72,6 +75,16 @@ struct hardfiledata {
     TCHAR *emptyname;
 
 	struct hdf_cache bcache[MAX_HDF_CACHE_BLOCKS];
+	uae_u8 *bcache_data;
+	struct hardfiledata *bcache_next;
+	uae_u32 bcache_lru;
+	uae_u64 bcache_virtual_size;
+	uae_u64 bcache_nextoffset;
+	time_t bcache_dirtytime;
+	uae_u64 bcache_hits;
+	uae_u64 bcache_misses;
+	uae_u64 bcache_readahead;
+	uae_u64 bcache_writeback;
 	uae_u8 scsi_sense[MAX_SCSI_SENSE];
 	uae_u8 sector_buffer[512];
 	uae_u8 identity[512];
@@ -138,6 +151,7 @@ extern void hdf_close (struct hardfiledata *hfd);
 extern int hdf_read_rdb (struct hardfiledata *hfd, void *buffer, uae_u64 offset, int len);
 extern int hdf_read(struct hardfiledata *hfd, void *buffer, uae_u64 offset, int len);
 extern int hdf_write(struct hardfiledata *hfd, void *buffer, uae_u64 offset, int len);
+extern void hdf_flush(struct hardfiledata *hfd);
 extern int hdf_getnumharddrives (void);
 extern TCHAR *hdf_getnameharddrive (int index, int flags, int *sectorsize, int *dangerousdrive, uae_u32 *outflags);
 extern int get_native_path(TrapContext *ctx, uae_u32 lock, TCHAR *out);
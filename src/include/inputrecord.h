@@ -35,12 +35,7 @@ extern int inputrecord_debug;
 #define INPREC_PLAY_NORMAL 1
 #define INPREC_PLAY_RERECORD 2
 
-#ifdef FSUAE
-const int input_record = 0;
-const int input_play = 0;
-#else
 extern int input_record, input_play;
-#endif
 extern void inprec_close (bool);
 extern void inprec_save (const TCHAR*, const TCHAR*);
 extern int inprec_open (const TCHAR*, const TCHAR*);
@@ -65,4 +60,10 @@ extern void inprec_setposition (int offset, int replaycounter);
 extern bool inprec_realtime (void);
 extern void inprec_getstatus (TCHAR*);
 
+extern void inprec_vsync (void);
+extern void inprec_restore_finish (void);
+extern bool inprec_seek (uae_u32 hsync);
+extern bool inprec_request_record (const TCHAR *fname);
+extern bool inprec_request_play (const TCHAR *fname);
+
 #endif /* UAE_INPUTRECORD_H */
@@ -21,6 +21,7 @@ extern void ncr_free(void);
 extern void ncr_reset(void);
 extern void ncr_rethink(void);
 extern void ncr_vsync(void);
+extern void ncr_hsync(void);
 
 extern bool ncr710_a4091_autoconfig_init(struct autoconfig_info *aci);
 extern bool ncr710_warpengine_autoconfig_init(struct autoconfig_info *aci);
@@ -531,6 +531,7 @@ struct uae_prefs {
 	bool comp_constjump;
 	bool comp_catchfault;
 	int cachesize;
+	TCHAR comp_trace_cache[MAX_DPATH];
 	bool fpu_strict;
 	int fpu_mode;
 
@@ -563,6 +564,7 @@ struct uae_prefs {
 	bool lightpen_crosshair;
 	int lightpen_offset[2];
 	int gfx_display_sections;
+	int gfx_render_threads;
 	int gfx_variable_sync;
 	bool gfx_windowed_resize;
 
@@ -615,6 +617,8 @@ struct uae_prefs {
 	int floppy_random_bits_max;
 	int floppy_auto_ext2;
 	int cd_speed;
+	int chd_cache_size;
+	int chd_readahead;
 	bool tod_hack;
 	uae_u32 maprom;
 	int boot_rom;
@@ -702,6 +706,7 @@ struct uae_prefs {
 	TCHAR inprecfile[MAX_DPATH];
 	TCHAR trainerfile[MAX_DPATH];
 	bool inprec_autoplay;
+	int inprec_keyframe_interval;
 	bool refresh_indicator;
 
 	struct multipath path_floppy;
@@ -753,6 +758,7 @@ struct uae_prefs {
 	bool rtg_hardwaresprite;
 	bool rtg_more_compatible;
 	bool rtg_multithread;
+	int rtg_convert_threads;
 	struct rtgboardconfig rtgboards[MAX_RTG_BOARDS];
 	uae_u32 custom_memory_addrs[MAX_CUSTOM_MEMORY_ADDRS];
 	uae_u32 custom_memory_sizes[MAX_CUSTOM_MEMORY_ADDRS];
@@ -854,6 +860,7 @@ struct uae_prefs {
 	struct slirp_redir slirp_redirs[MAX_SLIRP_REDIRS];
 #endif
 	int statecapturerate, statecapturebuffersize;
+	int statecapturekeyframes;
 	int aviout_width, aviout_height, aviout_xoffset, aviout_yoffset;
 	int screenshot_width, screenshot_height, screenshot_xoffset, screenshot_yoffset;
 	int screenshot_min_width, screenshot_min_height;
@@ -239,6 +239,7 @@ extern struct romdata *getromdatabypath (const TCHAR *path);
 extern struct romdata *getromdatabycrc (uae_u32 crc32);
 extern struct romdata *getromdatabycrc (uae_u32 crc32, bool);
 extern struct romdata *getromdatabydata (uae_u8 *rom, int size);
+extern struct romdata *getromdatabysha1 (const uae_u8 *sha1, int size);
 extern struct romdata *getromdatabyid (int id);
 extern struct romdata *getromdatabytype (int romtype);
 extern struct romdata *getromdatabyidgroup (int id, int group, int subitem);
@@ -236,6 +236,7 @@ extern int save_state (const TCHAR *filename, const TCHAR *description);
 extern void restore_state (const TCHAR *filename);
 extern void savestate_restore_finish (void);
 extern void savestate_memorysave (void);
+extern int savestate_memorysave (struct zfile *f, const TCHAR *description);
 
 
 extern void custom_save_state (void);
@@ -3,6 +3,8 @@
 
 #include "uae/types.h"
 #include "uae/memory.h"
+#include "threaddep/thread.h"
+#include <atomic>
 #ifdef FSUAE
 #include "uae/limits.h"
 #endif
@@ -59,6 +61,11 @@ struct scsi_data
 	bool atapi;
 	uae_u32 unit_attention;
 	int uae_unitnum;
+	/* cleared by the worker thread, async_pending and async_done
+	 * belong to the emulation thread */
+	std::atomic<bool> async_busy;
+	bool async_pending;
+	uae_sem_t async_done;
 };
 
 extern struct scsi_data *scsi_alloc_generic(struct hardfiledata *hfd, int type, int);
@@ -73,6 +80,10 @@ extern void scsi_start_transfer(struct scsi_data*);
 extern int scsi_send_data(struct scsi_data*, uae_u8);
 extern int scsi_receive_data(struct scsi_data*, uae_u8*, bool next);
 extern void scsi_emulate_cmd(struct scsi_data *sd);
+extern bool scsi_emulate_cmd_async(struct scsi_data *sd);
+extern bool scsi_emulate_cmd_busy(struct scsi_data *sd);
+extern void scsi_emulate_cmd_wait(struct scsi_data *sd);
+extern void scsi_async_free(void);
 extern void scsi_illegal_lun(struct scsi_data *sd);
 extern void scsi_clear_sense(struct scsi_data *sd);
 extern bool scsi_cmd_is_safe(uae_u8 cmd);
@@ -501,6 +501,16 @@ extern uae_u8 *baseaddr[MEMORY_BANKS];
 #define get_mem_bank(addr) (*mem_banks[bankindex(addr)])
 extern addrbank *get_mem_bank_real(uaecptr);
 
+/* Per 64k page host pointers for banks that can be accessed directly
+(baseaddr_direct_r/w set), biased so that adding the 68k address gives the
+host address. NULL means go through the bank handlers. Kept in sync with
+mem_banks by put_mem_bank and memory_update_direct.  */
+extern uae_u8 *mem_direct_r[MEMORY_BANKS];
+extern uae_u8 *mem_direct_w[MEMORY_BANKS];
+extern void memory_update_direct_page(int page);
+extern void memory_update_direct(void);
+extern void memory_clear_direct(addrbank *ab);
+
 #ifdef JIT
 #define put_mem_bank(addr, b, realstart) do { \
 	(mem_banks[bankindex(addr)] = (b)); \
@@ -508,10 +518,13 @@ extern addrbank *get_mem_bank_real(uaecptr);
 		baseaddr[bankindex(addr)] = (b)->baseaddr - (realstart); \
 	else \
 		baseaddr[bankindex(addr)] = (uae_u8*)(((uae_u8*)b)+1); \
+	memory_update_direct_page(bankindex(addr)); \
 } while (0)
 #else
-#define put_mem_bank(addr, b, realstart) \
-	(mem_banks[bankindex(addr)] = (b));
+#define put_mem_bank(addr, b, realstart) do { \
+	(mem_banks[bankindex(addr)] = (b)); \
+	memory_update_direct_page(bankindex(addr)); \
+} while (0)
 #endif
 
 extern void memory_init (void);
@@ -543,22 +556,37 @@ uae_u32 memory_get_wordi(uaecptr);
 
 STATIC_INLINE uae_u32 get_long(uaecptr addr)
 {
+	uae_u8 *m = mem_direct_r[bankindex(addr)];
+	if (m)
+		return do_get_mem_long((uae_u32*)(m + addr));
 	return memory_get_long(addr);
 }
 STATIC_INLINE uae_u32 get_word (uaecptr addr)
 {
+	uae_u8 *m = mem_direct_r[bankindex(addr)];
+	if (m)
+		return do_get_mem_word((uae_u16*)(m + addr));
 	return memory_get_word(addr);
 }
 STATIC_INLINE uae_u32 get_byte (uaecptr addr)
 {
+	uae_u8 *m = mem_direct_r[bankindex(addr)];
+	if (m)
+		return m[addr];
 	return memory_get_byte(addr);
 }
 STATIC_INLINE uae_u32 get_longi(uaecptr addr)
 {
+	uae_u8 *m = mem_direct_r[bankindex(addr)];
+	if (m)
+		return do_get_mem_long((uae_u32*)(m + addr));
 	return memory_get_longi(addr);
 }
 STATIC_INLINE uae_u32 get_wordi(uaecptr addr)
 {
+	uae_u8 *m = mem_direct_r[bankindex(addr)];
+	if (m)
+		return do_get_mem_word((uae_u16*)(m + addr));
 	return memory_get_wordi(addr);
 }
 
@@ -639,15 +667,27 @@ void memory_put_byte(uaecptr, uae_u32);
 
 STATIC_INLINE void put_long (uaecptr addr, uae_u32 l)
 {
-	memory_put_long(addr, l);
+	uae_u8 *m = mem_direct_w[bankindex(addr)];
+	if (m)
+		do_put_mem_long((uae_u32*)(m + addr), l);
+	else
+		memory_put_long(addr, l);
 }
 STATIC_INLINE void put_word (uaecptr addr, uae_u32 w)
 {
-	memory_put_word(addr, w);
+	uae_u8 *m = mem_direct_w[bankindex(addr)];
+	if (m)
+		do_put_mem_word((uae_u16*)(m + addr), w);
+	else
+		memory_put_word(addr, w);
 }
 STATIC_INLINE void put_byte (uaecptr addr, uae_u32 b)
 {
-	memory_put_byte(addr, b);
+	uae_u8 *m = mem_direct_w[bankindex(addr)];
+	if (m)
+		m[addr] = b;
+	else
+		memory_put_byte(addr, b);
 }
 
 STATIC_INLINE void put_long_jit(uaecptr addr, uae_u32 l)
@@ -763,6 +803,7 @@ extern void REGPARAM3 chipmem_bput (uaecptr, uae_u32) REGPARAM;
 
 extern uae_u32 REGPARAM3 chipmem_agnus_wget (uaecptr) REGPARAM;
 extern void REGPARAM3 chipmem_agnus_wput (uaecptr, uae_u32) REGPARAM;
+extern uae_u8 *chipmem_agnus_direct (uae_u32 *size);
 
 extern addrbank dummy_bank;
 
@@ -11,6 +11,8 @@
 typedef uae_s64 (*ZFILEREAD)(void*, uae_u64, uae_u64, struct zfile*);
 typedef uae_s64 (*ZFILEWRITE)(const void*, uae_u64, uae_u64, struct zfile*);
 typedef uae_s64 (*ZFILESEEK)(struct zfile*, uae_s64, int);
+typedef struct zfile *(*ZFILEDUP)(struct zfile*);
+typedef void (*ZFILECLOSE)(struct zfile*);
 
 struct zfile {
     TCHAR *name;
@@ -36,6 +38,8 @@ struct zfile {
     ZFILEREAD zfileread;
     ZFILEWRITE zfilewrite;
     ZFILESEEK zfileseek;
+    ZFILEDUP zfiledup;
+    ZFILECLOSE zfileclose; // releases userdata
     void *userdata;
     int useparent;
 };
@@ -150,6 +154,7 @@ extern void archive_access_close (void *handle, unsigned int id);
 
 extern struct zfile *archive_getzfile (struct znode *zn, unsigned int id, int flags);
 extern struct zfile *archive_unpackzfile (struct zfile *zf);
+extern struct zfile *zfile_fopen_virtual (struct zfile *prev, const TCHAR *name, uae_u64 size);
 
 extern struct zfile *decompress_zfd (struct zfile*);
 
@@ -12,6 +12,34 @@
 
 #define HEADERSIZE 12
 
+/* Recording file format version 3
+ *
+ * Header as in version 2 (version byte is 3) followed by the linked
+ * statefile name, then chunks (id, size of data, data):
+ *
+ * 'EVNT' first hsync, last hsync, event offset, uncompressed size,
+ *        zlib compressed records
+ * 'KEYF' hsync, vsync, event offset, statefile
+ * 'INDX' number of entries, uncompressed size of all records, entries
+ *        (chunk id, hsync, event offset, file offset)
+ *
+ * File ends with the file offset of 'INDX' and 'UAEI'. Event offsets
+ * are relative to the end of the header. Record blocks are split at
+ * keyframes, seeking restores the nearest keyframe and plays forward
+ * from its event offset.
+ *
+ * Chunks are appended while recording, the index is written when the
+ * recording stops. Re-recording leaves the chunks after the new end in
+ * the file, a later chunk replaces all chunks at or after its event
+ * offset. Files without index are read by walking the chunks.
+ */
+#define INPREC_VERSION 3
+#define INPREC_HEADER_MAX (64 + 4 * MAX_DPATH)
+/* seconds between record blocks written while recording */
+#define INPREC_STREAM_INTERVAL 5
+/* keyframes kept in memory when not recording to a file */
+#define INPREC_MEMORY_KEYFRAMES 16
+
 #include "sysconfig.h"
 #include "sysdeps.h"
 
@@ -26,6 +54,9 @@
 #include "disk.h"
 #include "fsdb.h"
 #include "xwin.h"
+#include "inputdevice.h"
+
+#include <atomic>
 
 #if INPUTRECORD_DEBUG > 0
 #include "memory.h"
@@ -57,6 +88,196 @@ static uae_u32 pcs2[16];
 extern void activate_debugger (void);
 static int warned;
 
+struct inprec_key
+{
+	uae_u32 hsync, vsync;
+	int offset;
+	int filepos;
+	struct zfile *state;
+};
+
+struct inprec_chunk
+{
+	uae_u32 id, hsync;
+	int offset, len;
+	int filepos;
+};
+
+static struct inprec_key *keyframes;
+static int keyframes_num, keyframes_alloc;
+static struct inprec_chunk *chunks;
+static int chunks_num, chunks_alloc;
+static struct zfile *inprec_container;
+static struct zfile *inprec_stream;
+static int stream_offset;
+static uae_u32 stream_vsync;
+static int seek_keyframe = -1;
+static bool seek_warp;
+static uae_u32 seek_hsync;
+
+/* Requests from other threads, handled by inprec_vsync (). The target is
+ * stored before the flag is set with release, the emulation thread reads
+ * the flag with acquire and clears it when it has copied the target. */
+#define INPREC_REQUEST_RECORD 1
+#define INPREC_REQUEST_PLAY 2
+static std::atomic<bool> seek_requested;
+static uae_u32 seek_request;
+static std::atomic<int> start_requested;
+static TCHAR start_request[MAX_DPATH];
+
+static void stream_open (const TCHAR *fname, const TCHAR *statefilename);
+static void stream_truncate (int offset);
+static void stream_close (void);
+
+static void putu32 (uae_u8 *p, uae_u32 v)
+{
+	p[0] = v >> 24;
+	p[1] = v >> 16;
+	p[2] = v >> 8;
+	p[3] = v >> 0;
+}
+static uae_u32 getu32 (const uae_u8 *p)
+{
+	return ((uae_u32)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | (p[3] << 0);
+}
+
+static void keyframes_free (void)
+{
+	for (int i = 0; i < keyframes_num; i++)
+		zfile_fclose (keyframes[i].state);
+	xfree (keyframes);
+	keyframes = NULL;
+	keyframes_num = keyframes_alloc = 0;
+	seek_keyframe = -1;
+	seek_warp = false;
+}
+
+static struct inprec_key *keyframe_add (void)
+{
+	if (keyframes_num >= keyframes_alloc) {
+		keyframes_alloc = keyframes_alloc ? keyframes_alloc * 2 : 64;
+		keyframes = xrealloc (struct inprec_key, keyframes, keyframes_alloc);
+	}
+	struct inprec_key *k = &keyframes[keyframes_num++];
+	memset (k, 0, sizeof (struct inprec_key));
+	k->filepos = -1;
+	return k;
+}
+
+// keyframes after offset belong to records that were thrown away
+static void keyframes_truncate (int offset)
+{
+	while (keyframes_num > 0 && keyframes[keyframes_num - 1].offset > offset) {
+		keyframes_num--;
+		zfile_fclose (keyframes[keyframes_num].state);
+	}
+}
+
+// drop every second keyframe held in memory, the rest still covers the recording
+static void keyframes_thin (void)
+{
+	int i, j, n;
+
+	for (i = 0, n = 0; i < keyframes_num; i++) {
+		if (keyframes[i].state)
+			n++;
+	}
+	if (n <= INPREC_MEMORY_KEYFRAMES)
+		return;
+	for (i = 0, j = 0, n = 0; i < keyframes_num; i++) {
+		struct inprec_key *k = &keyframes[i];
+		if (k->state && (n++ & 1)) {
+			zfile_fclose (k->state);
+			continue;
+		}
+		keyframes[j++] = *k;
+	}
+	keyframes_num = j;
+}
+
+static uae_u8 *keyframe_getstate (struct inprec_key *k, int *len)
+{
+	uae_u8 tmp[20];
+	struct zfile *zf = inprec_stream ? inprec_stream : inprec_container;
+
+	if (k->state) {
+		*len = zfile_size (k->state);
+		return zfile_getdata (k->state, 0, *len, NULL);
+	}
+	if (!zf || k->filepos < 0)
+		return NULL;
+	zfile_fseek (zf, k->filepos, SEEK_SET);
+	if (zfile_fread (tmp, sizeof tmp, 1, zf) != 1 || getu32 (tmp) != 'KEYF')
+		return NULL;
+	k->vsync = getu32 (tmp + 12);
+	*len = getu32 (tmp + 4) - 12;
+	return zfile_getdata (zf, k->filepos + sizeof tmp, *len, NULL);
+}
+
+static struct inprec_chunk *chunk_add (uae_u32 id, uae_u32 hsync, int offset, int len, int filepos)
+{
+	if (chunks_num >= chunks_alloc) {
+		chunks_alloc = chunks_alloc ? chunks_alloc * 2 : 64;
+		chunks = xrealloc (struct inprec_chunk, chunks, chunks_alloc);
+	}
+	struct inprec_chunk *c = &chunks[chunks_num++];
+	c->id = id;
+	c->hsync = hsync;
+	c->offset = offset;
+	c->len = len;
+	c->filepos = filepos;
+	return c;
+}
+
+// a chunk at offset replaces chunks left behind by re-recording
+static void chunks_replace (uae_u32 id, int offset)
+{
+	int j = 0;
+	for (int i = 0; i < chunks_num; i++) {
+		struct inprec_chunk *c = &chunks[i];
+		if (c->id == 'EVNT' && c->offset >= offset)
+			continue;
+		if (c->id == 'KEYF' && (c->offset > offset || (id == 'KEYF' && c->offset == offset)))
+			continue;
+		chunks[j++] = *c;
+	}
+	chunks_num = j;
+}
+
+static void chunks_free (void)
+{
+	xfree (chunks);
+	chunks = NULL;
+	chunks_num = chunks_alloc = 0;
+}
+
+static uae_u32 lastrecordhsync (uae_u8 *p, int len)
+{
+	uae_u8 *end = p + len;
+	uae_u32 hsync = 0;
+	while (p + HEADERSIZE <= end) {
+		int plen = (p[1] << 8) | (p[2] << 0);
+		if (plen < HEADERSIZE)
+			break;
+		hsync = getu32 (p + 3);
+		p += plen;
+	}
+	return hsync;
+}
+
+// clear played flags of all records starting from p
+static void clearplayed (uae_u8 *p)
+{
+	uae_u8 *end = inprec_buffer + inprec_size;
+	while (p < end) {
+		int len = (p[1] << 8) | (p[2] << 0);
+		if (len < HEADERSIZE)
+			break;
+		p[0] &= ~0x80;
+		p += len;
+	}
+}
+
 static void setlasthsync (void)
 {
 	if (lasthsync / current_maxvpos () != hsync_counter / current_maxvpos ()) {
@@ -146,6 +367,8 @@ static bool inprec_realtime (bool stopstart)
 	int offset = inprec_p - inprec_buffer;
 	zfile_fseek (inprec_zf, offset, SEEK_SET);
 	zfile_truncate (inprec_zf, offset);
+	keyframes_truncate (offset - header_end2);
+	stream_truncate (offset - header_end2);
 	xfree (inprec_buffer);
 	inprec_size = INPREC_BUFFER_SIZE;
 	inprec_buffer = inprec_p = xmalloc (uae_u8, inprec_size);
@@ -335,16 +558,126 @@ static void findlast (void)
 	endhsync = hsync;
 }
 
+static bool loadindex (int filesize)
+{
+	uae_u8 tmp[16];
+	uae_u8 *index;
+	int indexpos, num;
+
+	if (filesize < header_end2 + 8)
+		return false;
+	zfile_fseek (inprec_zf, filesize - 8, SEEK_SET);
+	if (zfile_fread (tmp, 8, 1, inprec_zf) != 1 || getu32 (tmp + 4) != 'UAEI')
+		return false;
+	indexpos = getu32 (tmp);
+	zfile_fseek (inprec_zf, indexpos, SEEK_SET);
+	if (zfile_fread (tmp, 16, 1, inprec_zf) != 1 || getu32 (tmp) != 'INDX')
+		return false;
+	num = getu32 (tmp + 8);
+	if (num < 0 || getu32 (tmp + 4) != 8 + num * 16)
+		return false;
+	index = zfile_getdata (inprec_zf, indexpos + 16, num * 16, NULL);
+	if (!index)
+		return false;
+	for (int i = 0; i < num; i++) {
+		uae_u8 *ix = index + i * 16;
+		chunk_add (getu32 (ix), getu32 (ix + 4), getu32 (ix + 8), 0, getu32 (ix + 12));
+	}
+	xfree (index);
+	return true;
+}
+
+// recording was not closed, walk the chunks up to the first incomplete one
+static void scanchunks (int filesize)
+{
+	uae_u8 tmp[24];
+	int pos = header_end2;
+
+	while (pos + 8 <= filesize) {
+		zfile_fseek (inprec_zf, pos, SEEK_SET);
+		if (zfile_fread (tmp, 8, 1, inprec_zf) != 1)
+			break;
+		uae_u32 id = getu32 (tmp);
+		int size = getu32 (tmp + 4);
+		if (size < 0 || pos + 8 + size > filesize)
+			break;
+		if (id == 'EVNT') {
+			if (size < 16 || zfile_fread (tmp + 8, 16, 1, inprec_zf) != 1)
+				break;
+			chunks_replace (id, getu32 (tmp + 16));
+			chunk_add (id, getu32 (tmp + 8), getu32 (tmp + 16), getu32 (tmp + 20), pos);
+		} else if (id == 'KEYF') {
+			if (size < 12 || zfile_fread (tmp + 8, 12, 1, inprec_zf) != 1)
+				break;
+			chunks_replace (id, getu32 (tmp + 16));
+			chunk_add (id, getu32 (tmp + 8), getu32 (tmp + 16), 0, pos);
+		} else if (id != 'INDX') {
+			break;
+		}
+		pos += 8 + size;
+	}
+}
+
+static bool loadcontainer (int filesize)
+{
+	uae_u8 tmp[24];
+	int size = 0;
+
+	if (!loadindex (filesize)) {
+		chunks_free ();
+		scanchunks (filesize);
+		write_log (_T("INPREC: no index, %d blocks recovered\n"), chunks_num);
+	}
+	// event blocks must cover the records without gaps
+	for (int i = 0; i < chunks_num; i++) {
+		struct inprec_chunk *c = &chunks[i];
+		if (c->id != 'EVNT')
+			continue;
+		zfile_fseek (inprec_zf, c->filepos, SEEK_SET);
+		if (zfile_fread (tmp, 24, 1, inprec_zf) != 1 || getu32 (tmp) != 'EVNT')
+			return false;
+		c->len = getu32 (tmp + 20);
+		if (c->offset != size || (int)getu32 (tmp + 16) != c->offset || c->len < 0)
+			return false;
+		size += c->len;
+	}
+	inprec_size = header_end2 + size;
+	inprec_buffer = xrealloc (uae_u8, inprec_buffer, inprec_size);
+	for (int i = 0; i < chunks_num; i++) {
+		struct inprec_chunk *c = &chunks[i];
+		if (c->id == 'EVNT') {
+			zfile_fseek (inprec_zf, c->filepos + 4, SEEK_SET);
+			if (zfile_fread (tmp, 4, 1, inprec_zf) != 1)
+				return false;
+			int complen = getu32 (tmp) - 16;
+			zfile_fseek (inprec_zf, c->filepos + 24, SEEK_SET);
+			zfile_zuncompress (inprec_buffer + header_end2 + c->offset, c->len, inprec_zf, complen);
+		} else if (c->id == 'KEYF' && c->offset <= size) {
+			struct inprec_key *k = keyframe_add ();
+			k->hsync = c->hsync;
+			k->offset = c->offset;
+			k->filepos = c->filepos;
+		}
+	}
+	chunks_free ();
+	// file stays open for keyframes, playback and re-recording use uncompressed records
+	inprec_container = inprec_zf;
+	inprec_zf = zfile_fopen_empty (NULL, _T("inp"));
+	zfile_fwrite (inprec_buffer, inprec_size, 1, inprec_zf);
+	write_log (_T("INPREC: %d bytes of records, %d keyframes\n"), size, keyframes_num);
+	return true;
+}
 
 int inprec_open (const TCHAR *fname, const TCHAR *statefilename)
 {
 	int i;
 
 	inprec_close (false);
-	if (fname == NULL)
+	// records are kept uncompressed in memory, recordings are also streamed to fname
+	if (fname == NULL || input_record)
 		inprec_zf = zfile_fopen_empty (NULL, _T("inp"));
 	else
-		inprec_zf = zfile_fopen (fname, input_record ? _T("wb") : _T("rb"), ZFD_NORMAL);
+		inprec_zf = zfile_fopen (fname, _T("rb"), ZFD_NORMAL);
 	if (inprec_zf == NULL)
 		return 0;
 
@@ -362,9 +695,12 @@ int inprec_open (const TCHAR *fname, const TCHAR *statefilename)
 	header_end2 = 0;
 	if (input_play) {
 		uae_u32 id;
+		int filesize;
 		zfile_fseek (inprec_zf, 0, SEEK_END);
-		inprec_size = zfile_ftell (inprec_zf);
+		filesize = zfile_ftell (inprec_zf);
 		zfile_fseek (inprec_zf, 0, SEEK_SET);
+		// only the header for now, keyframes make version 3 files large
+		inprec_size = filesize < INPREC_HEADER_MAX ? filesize : INPREC_HEADER_MAX;
 		inprec_buffer = inprec_p = xmalloc (uae_u8, inprec_size);
 		zfile_fread (inprec_buffer, inprec_size, 1, inprec_zf);
 		inprec_plastptr = inprec_buffer;
@@ -374,7 +710,7 @@ int inprec_open (const TCHAR *fname, const TCHAR *statefilename)
 			return 0;
 		}
 		int v = inprec_pu8 ();
-		if (v != 2) {
+		if (v != 2 && v != INPREC_VERSION) {
 			inprec_close (true);
 			return 0;
 		}
@@ -431,14 +767,30 @@ int inprec_open (const TCHAR *fname, const TCHAR *statefilename)
 				break;
 			}
 		}
-		inprec_p = inprec_plastptr;
 		header_end2 = inprec_plastptr - inprec_buffer;
+		if (header_end2 > inprec_size) {
+			inprec_close (true);
+			return 0;
+		}
+		if (v == INPREC_VERSION) {
+			if (!loadcontainer (filesize)) {
+				write_log (_T("INPREC: '%s' is corrupted\n"), fname);
+				inprec_close (true);
+				return 0;
+			}
+		} else {
+			inprec_size = filesize;
+			inprec_buffer = xrealloc (uae_u8, inprec_buffer, inprec_size);
+			zfile_fseek (inprec_zf, 0, SEEK_SET);
+			zfile_fread (inprec_buffer, inprec_size, 1, inprec_zf);
+		}
+		inprec_p = inprec_buffer + header_end2;
 		findlast ();
 	} else if (input_record) {
 		seed = uaesrand (seed);
 		inprec_buffer = inprec_p = xmalloc (uae_u8, inprec_size);
 		inprec_ru32 ('UAE\0');
-		inprec_ru8 (2);
+		inprec_ru8 (INPREC_VERSION);
 		inprec_ru8 (UAEMAJOR);
 		inprec_ru8 (UAEMINOR);
 		inprec_ru8 (UAESUBREV);
@@ -448,6 +800,8 @@ int inprec_open (const TCHAR *fname, const TCHAR *statefilename)
 		inprec_ru32 (0); // extra header size
 		flush ();
 		header_end2 = header_end = zfile_ftell (inprec_zf);
+		if (fname)
+			stream_open (fname, statefilename);
 	} else {
 		input_record = input_play = 0;
 		return 0;
@@ -494,7 +848,6 @@ bool inprec_prepare_record (const TCHAR *statefilename)
 	return true;
 }
 
-
 void inprec_close (bool clear)
 {
 	if (clear)
@@ -505,8 +858,14 @@ void inprec_close (bool clear)
 		if (inprec_rstart (INPREC_END))
 			inprec_rend ();
 	}
+	stream_close ();
 	zfile_fclose (inprec_zf);
 	inprec_zf = NULL;
+	zfile_fclose (inprec_container);
+	inprec_container = NULL;
+	keyframes_free ();
+	chunks_free ();
+	seek_requested.store (false, std::memory_order_relaxed);
 	xfree (inprec_buffer);
 	inprec_buffer = NULL;
 	input_play = input_record = 0;
@@ -759,13 +1118,7 @@ void inprec_playtorecord (void)
 	zfile_fclose (inprec_zf);
 	inprec_zf = zfile_fopen_empty (NULL, _T("inp"));
 	zfile_fwrite (inprec_buffer, header_end2, 1, inprec_zf);
-	uae_u8 *p = inprec_buffer + header_end2;
-	uae_u8 *end = inprec_buffer + inprec_size;
-	while (p < end) {
-		int len = (p[1] << 8) | (p[2] << 0);
-		p[0] &= ~0x80;
-		p += len;
-	}
+	clearplayed (inprec_buffer + header_end2);
 	zfile_fwrite (inprec_buffer + header_end2, inprec_size - header_end2, 1, inprec_zf);
 	inprec_realtime (false);
 	savestate_capture_request ();
@@ -865,6 +1218,249 @@ static int savedisk (const TCHAR *path, const TCHAR *file, uae_u8 *data, uae_u8
 	return len;
 }
 
+static void writechunkheader (struct zfile *zf, uae_u32 id, int size)
+{
+	uae_u8 tmp[8];
+	putu32 (tmp, id);
+	putu32 (tmp + 4, size);
+	zfile_fwrite (tmp, sizeof tmp, 1, zf);
+}
+
+static void writeindex (uae_u8 *ix, uae_u32 id, uae_u32 hsync, int offset, int filepos)
+{
+	putu32 (ix + 0, id);
+	putu32 (ix + 4, hsync);
+	putu32 (ix + 8, offset);
+	putu32 (ix + 12, filepos);
+}
+
+// returns file offset of the chunk
+static int writeevents (struct zfile *zf, uae_u8 *data, int size, uae_u32 firsthsync, uae_u32 lasthsync, int offset)
+{
+	uae_u8 tmp[16];
+	int filepos = zfile_ftell (zf);
+	struct zfile *comp = zfile_fopen_empty (NULL, _T("evnt"));
+	int complen = zfile_zcompress (comp, data, size);
+	uae_u8 *compdata = zfile_getdata (comp, 0, complen, NULL);
+	writechunkheader (zf, 'EVNT', 16 + complen);
+	putu32 (tmp + 0, firsthsync);
+	putu32 (tmp + 4, lasthsync);
+	putu32 (tmp + 8, offset);
+	putu32 (tmp + 12, size);
+	zfile_fwrite (tmp, sizeof tmp, 1, zf);
+	zfile_fwrite (compdata, complen, 1, zf);
+	xfree (compdata);
+	zfile_fclose (comp);
+	return filepos;
+}
+
+static int writekeyframe (struct zfile *zf, struct inprec_key *kf, int offset, uae_u8 *state, int slen)
+{
+	uae_u8 tmp[12];
+	int filepos = zfile_ftell (zf);
+	writechunkheader (zf, 'KEYF', 12 + slen);
+	putu32 (tmp + 0, kf->hsync);
+	putu32 (tmp + 4, kf->vsync);
+	putu32 (tmp + 8, offset);
+	zfile_fwrite (tmp, sizeof tmp, 1, zf);
+	zfile_fwrite (state, slen, 1, zf);
+	return filepos;
+}
+
+static void writeblock (struct zfile *zf, struct zfile *block, uae_u32 firsthsync, uae_u32 lasthsync, int offset, uae_u8 *index, int *indexnum)
+{
+	int size = zfile_size (block);
+	if (!size)
+		return;
+	uae_u8 *data = zfile_getdata (block, 0, size, NULL);
+	int filepos = writeevents (zf, data, size, firsthsync, lasthsync, offset);
+	writeindex (index + (*indexnum)++ * 16, 'EVNT', firsthsync, offset, filepos);
+	xfree (data);
+	zfile_fseek (block, 0, SEEK_SET);
+	zfile_truncate (block, 0);
+}
+
+static void writetrailer (struct zfile *zf, uae_u8 *index, int indexnum, int size)
+{
+	uae_u8 tmp[8];
+	int indexpos = zfile_ftell (zf);
+	writechunkheader (zf, 'INDX', 8 + indexnum * 16);
+	putu32 (tmp + 0, indexnum);
+	putu32 (tmp + 4, size);
+	zfile_fwrite (tmp, 8, 1, zf);
+	zfile_fwrite (index, indexnum * 16, 1, zf);
+	putu32 (tmp + 0, indexpos);
+	putu32 (tmp + 4, 'UAEI');
+	zfile_fwrite (tmp, 8, 1, zf);
+}
+
+static void writeheader (struct zfile *zf, const TCHAR *statefilename)
+{
+	TCHAR fn[MAX_DPATH];
+	uae_u8 *data = zfile_getdata (inprec_zf, 0, header_end, NULL);
+	data[4] = INPREC_VERSION;
+	zfile_fwrite (data, header_end, 1, zf);
+	xfree (data);
+	fn[0] = 0;
+	if (statefilename)
+		getfilepart (fn, MAX_DPATH, statefilename);
+	char *s = uutf8 (fn);
+	zfile_fwrite (s, strlen (s) + 1, 1, zf);
+	xfree (s);
+}
+
+// disk images are copied next to the recording if path is set
+static bool writefile (struct zfile *zf, const TCHAR *path, const TCHAR *file, const TCHAR *statefilename)
+{
+	uae_u8 *data, *index;
+	int indexnum = 0, offset = 0, blockoffset = 0, k = 0;
+	uae_u32 firsthsync = 0, lasthsync = 0;
+
+	writeheader (zf, statefilename);
+
+	struct zfile *block = zfile_fopen_empty (NULL, _T("evnt"));
+	if (!block)
+		return false;
+	// one block before and after each keyframe
+	index = xmalloc (uae_u8, (keyframes_num * 2 + 1) * 16);
+	int len = zfile_size (inprec_zf) - header_end2;
+	data = zfile_getdata (inprec_zf, header_end2, len, NULL);
+	uae_u8 *p = data;
+	uae_u8 *end = data + len;
+	for (;;) {
+		while (k < keyframes_num && keyframes[k].offset <= p - data) {
+			struct inprec_key *kf = &keyframes[k++];
+			int slen;
+			uae_u8 *state = keyframe_getstate (kf, &slen);
+			if (!state)
+				continue;
+			writeblock (zf, block, firsthsync, lasthsync, blockoffset, index, &indexnum);
+			blockoffset = offset;
+			writeindex (index + indexnum++ * 16, 'KEYF', kf->hsync, offset, writekeyframe (zf, kf, offset, state, slen));
+			xfree (state);
+		}
+		if (p >= end)
+			break;
+		uae_u8 rec[MAX_DPATH];
+		int plen = (p[1] << 8) | (p[2] << 0);
+		if (plen < HEADERSIZE)
+			break;
+		int wlen = plen - HEADERSIZE;
+		memcpy (rec, p + HEADERSIZE, wlen);
+		if (p[0] == INPREC_DISKINSERT && path) {
+			wlen = savedisk (path, file, p + HEADERSIZE, rec);
+		}
+		if (zfile_size (block) == 0)
+			firsthsync = getu32 (p + 3);
+		lasthsync = getu32 (p + 3);
+		if (wlen) {
+			wlen += HEADERSIZE;
+			p[1] = wlen >> 8;
+			p[2] = wlen;
+			zfile_fwrite (p, HEADERSIZE, 1, block);
+			zfile_fwrite (rec, wlen - HEADERSIZE, 1, block);
+			offset += wlen;
+		} else {
+			zfile_fwrite (p, plen, 1, block);
+			offset += plen;
+		}
+		p += plen;
+	}
+	writeblock (zf, block, firsthsync, lasthsync, blockoffset, index, &indexnum);
+	zfile_fclose (block);
+	xfree (data);
+	writetrailer (zf, index, indexnum, offset);
+	xfree (index);
+	return true;
+}
+
+// recordings are written while they are made, records since the last
+// block go out every few seconds and before each keyframe
+static void stream_open (const TCHAR *fname, const TCHAR *statefilename)
+{
+	inprec_stream = zfile_fopen (fname, _T("w+b"), 0);
+	if (!inprec_stream) {
+		write_log (_T("failed to open '%s'\n"), fname);
+		return;
+	}
+	writeheader (inprec_stream, statefilename);
+	zfile_fseek (inprec_stream, 0, SEEK_END);
+	stream_offset = 0;
+	stream_vsync = vsync_counter;
+}
+
+static void stream_events (void)
+{
+	if (!inprec_stream)
+		return;
+	flush ();
+	stream_vsync = vsync_counter;
+	int end = zfile_ftell (inprec_zf) - header_end2;
+	int len = end - stream_offset;
+	if (len <= 0)
+		return;
+	uae_u8 *data = zfile_getdata (inprec_zf, header_end2 + stream_offset, len, NULL);
+	zfile_fseek (inprec_stream, 0, SEEK_END);
+	int filepos = writeevents (inprec_stream, data, len, getu32 (data + 3), lastrecordhsync (data, len), stream_offset);
+	// seeking flushes the stdio buffer, the block survives a crash
+	zfile_fseek (inprec_stream, 0, SEEK_END);
+	chunk_add ('EVNT', getu32 (data + 3), stream_offset, len, filepos);
+	xfree (data);
+	stream_offset = end;
+}
+
+static bool stream_keyframe (struct inprec_key *k, struct zfile *state)
+{
+	if (!inprec_stream)
+		return false;
+	int slen = zfile_size (state);
+	uae_u8 *data = zfile_getdata (state, 0, slen, NULL);
+	zfile_fseek (inprec_stream, 0, SEEK_END);
+	k->filepos = writekeyframe (inprec_stream, k, k->offset, data, slen);
+	zfile_fseek (inprec_stream, 0, SEEK_END);
+	chunk_add ('KEYF', k->hsync, k->offset, 0, k->filepos);
+	xfree (data);
+	return true;
+}
+
+// re-recording from offset, blocks after it are left in the file but not indexed
+static void stream_truncate (int offset)
+{
+	int i;
+
+	if (!inprec_stream)
+		return;
+	stream_offset = 0;
+	for (i = 0; i < chunks_num; i++) {
+		struct inprec_chunk *c = &chunks[i];
+		if (c->id == 'EVNT' && c->offset + c->len > offset)
+			break;
+		if (c->id == 'KEYF' && c->offset > offset)
+			break;
+		if (c->id == 'EVNT')
+			stream_offset = c->offset + c->len;
+	}
+	chunks_num = i;
+}
+
+static void stream_close (void)
+{
+	if (!inprec_stream)
+		return;
+	stream_events ();
+	uae_u8 *index = xmalloc (uae_u8, chunks_num * 16 + 1);
+	for (int i = 0; i < chunks_num; i++) {
+		struct inprec_chunk *c = &chunks[i];
+		writeindex (index + i * 16, c->id, c->hsync, c->offset, c->filepos);
+	}
+	zfile_fseek (inprec_stream, 0, SEEK_END);
+	writetrailer (inprec_stream, index, chunks_num, stream_offset);
+	xfree (index);
+	zfile_fclose (inprec_stream);
+	inprec_stream = NULL;
+	write_log (_T("INPREC: %d blocks written\n"), chunks_num);
+}
+
 void inprec_save (const TCHAR *filename, const TCHAR *statefilename)
 {
 	TCHAR path[MAX_DPATH], file[MAX_DPATH];
@@ -874,38 +1470,7 @@ void inprec_save (const TCHAR *filename, const TCHAR *statefilename)
 	getfilepart (file, sizeof file / sizeof (TCHAR), filename);
 	struct zfile *zf = zfile_fopen (filename, _T("wb"), 0);
 	if (zf) {
-		TCHAR fn[MAX_DPATH];
-		uae_u8 *data;
-		data = zfile_getdata (inprec_zf, 0, header_end, NULL);
-		zfile_fwrite (data, header_end, 1, zf);
-		xfree (data);
-		getfilepart (fn, MAX_DPATH, statefilename);
-		char *s = uutf8 (fn);
-		zfile_fwrite (s, strlen (s) + 1, 1, zf);
-		int len = zfile_size (inprec_zf) -  header_end2;
-		data = zfile_getdata (inprec_zf, header_end2, len, NULL);
-		uae_u8 *p = data;
-		uae_u8 *end = data + len;
-		while (p < end) {
-			uae_u8 tmp[MAX_DPATH];
-			int plen = (p[1] << 8) | (p[2] << 0);
-			int wlen = plen - HEADERSIZE;
-			memcpy (tmp, p + HEADERSIZE, wlen);
-			if (p[0] == INPREC_DISKINSERT) {
-				wlen = savedisk (path, file, p + HEADERSIZE, tmp);
-			}
-			if (wlen) {
-				wlen += HEADERSIZE;
-				p[1] = wlen >> 8;
-				p[2] = wlen;
-				zfile_fwrite (p, HEADERSIZE, 1, zf);
-				zfile_fwrite (tmp, wlen - HEADERSIZE, 1, zf);
-			} else {
-				zfile_fwrite (p, plen, 1, zf);
-			}
-			p += plen;
-		}
-		xfree (data);
+		writefile (zf, path, file, statefilename);
 		zfile_fclose (zf);
 		savelog (path, file);
 		write_log (_T("inputfile '%s' saved\n"), filename);
@@ -914,6 +1479,185 @@ void inprec_save (const TCHAR *filename, const TCHAR *statefilename)
 	}
 }
 
+static void keyframe (void)
+{
+	if (keyframes_num > 0 && vsync_counter - keyframes[keyframes_num - 1].vsync < currprefs.inprec_keyframe_interval * vblank_hz)
+		return;
+	stream_events ();
+	flush ();
+	struct zfile *zf = zfile_fopen_empty (NULL, _T("keyframe.uss"));
+	if (!zf)
+		return;
+	if (!savestate_memorysave (zf, _T("input recording keyframe"))) {
+		zfile_fclose (zf);
+		return;
+	}
+	struct inprec_key *k = keyframe_add ();
+	k->hsync = hsync_counter;
+	k->vsync = vsync_counter;
+	k->offset = zfile_ftell (inprec_zf) - header_end2;
+	write_log (_T("INPREC: keyframe %d at %010d, %d bytes\n"), keyframes_num - 1, hsync_counter, (int)zfile_size (zf));
+	if (stream_keyframe (k, zf)) {
+		zfile_fclose (zf);
+	} else {
+		k->state = zf;
+		keyframes_thin ();
+	}
+}
+
+// restore nearest keyframe before hsync and play forward in warp mode
+static bool seek (uae_u32 hsync)
+{
+	TCHAR tmp[MAX_DPATH];
+	int i, lo, hi, len;
+
+	if (input_play != INPREC_PLAY_NORMAL || input_record || !inprec_buffer)
+		return false;
+	i = -1;
+	lo = 0;
+	hi = keyframes_num - 1;
+	while (lo <= hi) {
+		int mid = (lo + hi) / 2;
+		if (keyframes[mid].hsync <= hsync) {
+			i = mid;
+			lo = mid + 1;
+		} else {
+			hi = mid - 1;
+		}
+	}
+	if (i < 0) {
+		write_log (_T("INPREC: no keyframe before %010d\n"), hsync);
+		return false;
+	}
+	seek_hsync = hsync;
+	if (keyframes[i].hsync <= hsync_counter && hsync >= hsync_counter) {
+		// already past the keyframe
+		seek_warp = true;
+		warpmode (1);
+		return true;
+	}
+	uae_u8 *data = keyframe_getstate (&keyframes[i], &len);
+	if (!data)
+		return false;
+	fetch_statefilepath (tmp, sizeof tmp / sizeof (TCHAR));
+	_tcscat (tmp, _T("inprec_keyframe.uss"));
+	struct zfile *zf = zfile_fopen (tmp, _T("wb"), 0);
+	if (zf) {
+		zfile_fwrite (data, len, 1, zf);
+		zfile_fclose (zf);
+	}
+	xfree (data);
+	if (!zf)
+		return false;
+	write_log (_T("INPREC: seek to %010d, keyframe %d at %010d\n"), hsync, i, keyframes[i].hsync);
+	_tcscpy (savestate_fname, tmp);
+	savestate_state = STATE_DORESTORE;
+	seek_keyframe = i;
+	return true;
+}
+
+static void startrequest (void)
+{
+	TCHAR path[MAX_DPATH];
+	int mode = start_requested.load (std::memory_order_acquire);
+
+	if (!mode)
+		return;
+	_tcscpy (path, start_request);
+	start_requested.store (0, std::memory_order_release);
+	if (input_record || input_play) {
+		write_log (_T("INPREC: already active, '%s' ignored\n"), path);
+		return;
+	}
+	if (mode == INPREC_REQUEST_RECORD) {
+		_tcscpy (changed_prefs.inprecfile, path);
+		input_record = INPREC_RECORD_START;
+		uae_reset (1, 1);
+	} else {
+		_tcscpy (changed_prefs.inprecfile, path);
+		_tcscpy (currprefs.inprecfile, path);
+		input_play = INPREC_PLAY_NORMAL;
+		uae_reset (0, 1);
+	}
+}
+
+// called once per frame from the emulation thread
+void inprec_vsync (void)
+{
+	startrequest ();
+	if (seek_requested.load (std::memory_order_acquire)) {
+		uae_u32 hsync = seek_request;
+		seek_requested.store (false, std::memory_order_release);
+		if (!seek (hsync))
+			write_log (_T("INPREC: seek to %010d failed\n"), hsync);
+	}
+	if (seek_warp && hsync_counter >= seek_hsync) {
+		write_log (_T("INPREC: seek to %010d done\n"), seek_hsync);
+		seek_warp = false;
+		warpmode (0);
+	}
+	if (input_record != INPREC_RECORD_NORMAL && input_record != INPREC_RECORD_RERECORD)
+		return;
+	if (!inprec_zf)
+		return;
+	if (currprefs.inprec_keyframe_interval > 0)
+		keyframe ();
+	if (vsync_counter - stream_vsync >= INPREC_STREAM_INTERVAL * vblank_hz)
+		stream_events ();
+}
+
+// seeking is done at the next frame, may be called from the debugger or the gui
+bool inprec_seek (uae_u32 hsync)
+{
+	if (seek_requested.load (std::memory_order_acquire))
+		return false;
+	seek_request = hsync;
+	seek_requested.store (true, std::memory_order_release);
+	return true;
+}
+
+// recording or playback of fname starts with a reset at the next frame
+static bool requeststart (int mode, const TCHAR *fname)
+{
+	if (!fname || !fname[0] || _tcslen (fname) >= MAX_DPATH)
+		return false;
+	if (start_requested.load (std::memory_order_acquire))
+		return false;
+	_tcscpy (start_request, fname);
+	start_requested.store (mode, std::memory_order_release);
+	return true;
+}
+
+bool inprec_request_record (const TCHAR *fname)
+{
+	return requeststart (INPREC_REQUEST_RECORD, fname);
+}
+
+bool inprec_request_play (const TCHAR *fname)
+{
+	return requeststart (INPREC_REQUEST_PLAY, fname);
+}
+
+void inprec_restore_finish (void)
+{
+	if (seek_keyframe < 0)
+		return;
+	struct inprec_key *k = &keyframes[seek_keyframe];
+	seek_keyframe = -1;
+	hsync_counter = k->hsync;
+	vsync_counter = k->vsync;
+	inprec_p = inprec_buffer + header_end2 + k->offset;
+	inprec_plast = inprec_plastptr = NULL;
+	clearplayed (inprec_p);
+	cycleoffset = 0;
+	lasthsync = hsync_counter;
+	refreshtitle ();
+	if (seek_hsync > hsync_counter) {
+		seek_warp = true;
+		warpmode (1);
+	}
+}
+
 bool inprec_realtime (void)
 {
 	if (input_record != INPREC_RECORD_PLAYING || input_play != INPREC_PLAY_RERECORD)
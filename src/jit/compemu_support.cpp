@@ -3938,10 +3938,13 @@ static void prepare_block(blockinfo* bi)
 	//bi->env=empty_ss;
 }
 
+#include "compemu_trace.cpp"
+
 #ifdef UAE
 void compemu_reset(void)
 {
 	set_cache_state(0);
+	trace_cache_reset();
 }
 #endif
 
@@ -4879,6 +4882,10 @@ static void compile_block(cpu_history* pc_hist, int blocklen)
 #endif
 
 #if USE_CHECKSUM_INFO
+#ifdef UAE
+		if (optlev > 0 && !redo_current_block)
+			trace_record(pc_hist, blocklen, totcycles, bi);
+#endif
 		remove_from_list(bi);
 		if (trace_in_rom) {
 			// No need to checksum that block trace on cache invalidation
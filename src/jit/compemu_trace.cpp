@@ -0,0 +1,377 @@
+/********************************************************************
+ * Persistent translation trace cache.                              *
+ *                                                                  *
+ * Native code can't be carried over to another run: it is full of *
+ * absolute host addresses (regs, handlers, popall stubs and other  *
+ * blocks). What can be reused is the knowledge of which 68k traces *
+ * were hot enough to be translated. We remember those traces along *
+ * with a checksum of the 68k code they cover, save them on exit    *
+ * and replay them through compile_block() at full optimization the *
+ * first time the same, unmodified code is reached again.           *
+ ********************************************************************/
+
+#if defined(UAE) && defined(NATMEM_OFFSET)
+
+#include "zfile.h"
+
+#define TRACE_CACHE_MAGIC	0x4a544331 /* "JTC1" */
+#define TRACE_CACHE_VERSION	1
+#define TRACE_CACHE_HASH	4096
+#define TRACE_CACHE_MAX		65536
+
+struct trace_entry {
+	struct trace_entry *next;
+	uae_u32 pc;
+	uae_u32 c1, c2;
+	uae_u32 totcycles;
+	uae_u16 blocklen;
+	uae_u16 nranges;
+	/* nranges start/length pairs, followed by blocklen instruction addresses */
+	uae_u32 *data;
+	uae_u8 *specmem;
+};
+
+static struct trace_entry *trace_hash[TRACE_CACHE_HASH];
+static int trace_count;
+static uae_u32 trace_fp;
+static bool trace_dirty;
+static bool trace_replaying;
+static TCHAR trace_path[MAX_DPATH];
+static int trace_replayed, trace_stale;
+
+static inline uae_u32 trace_hashof(uae_u32 pc)
+{
+	return (pc >> 1) & (TRACE_CACHE_HASH - 1);
+}
+
+static inline uae_u8 *trace_host(uae_u32 addr)
+{
+	return (uae_u8 *)((uintptr)MEMBaseDiff + addr);
+}
+
+static inline uae_u32 trace_amiga(const void *p)
+{
+	return (uae_u32)((uintptr)p - MEMBaseDiff);
+}
+
+/* Everything that changes what compile_block() emits for a trace */
+static uae_u32 trace_fingerprint(void)
+{
+	uae_u32 v = TRACE_CACHE_VERSION;
+	v = v * 33 + currprefs.cpu_model;
+	v = v * 33 + currprefs.fpu_model;
+	v = v * 33 + currprefs.address_space_24;
+	v = v * 33 + currprefs.cpu_compatible;
+	v = v * 33 + currprefs.compnf;
+	v = v * 33 + currprefs.compfpu;
+	v = v * 33 + currprefs.fpu_strict;
+	v = v * 33 + currprefs.comp_constjump;
+	v = v * 33 + currprefs.comptrustbyte;
+	v = v * 33 + currprefs.comptrustword;
+	v = v * 33 + currprefs.comptrustlong;
+	v = v * 33 + currprefs.comptrustnaddr;
+	return v;
+}
+
+static void trace_free_entry(struct trace_entry *te)
+{
+	xfree(te->data);
+	xfree(te->specmem);
+	xfree(te);
+}
+
+static void trace_clear(void)
+{
+	for (int i = 0; i < TRACE_CACHE_HASH; i++) {
+		struct trace_entry *te = trace_hash[i];
+		while (te) {
+			struct trace_entry *next = te->next;
+			trace_free_entry(te);
+			te = next;
+		}
+		trace_hash[i] = NULL;
+	}
+	trace_count = 0;
+}
+
+static struct trace_entry *trace_find(uae_u32 pc)
+{
+	struct trace_entry *te = trace_hash[trace_hashof(pc)];
+	while (te && te->pc != pc)
+		te = te->next;
+	return te;
+}
+
+static void trace_insert(struct trace_entry *te)
+{
+	uae_u32 h = trace_hashof(te->pc);
+	te->next = trace_hash[h];
+	trace_hash[h] = te;
+	trace_count++;
+}
+
+/* Drop everything if the compiler settings changed under us */
+static void trace_sync_prefs(void)
+{
+	uae_u32 fp = trace_fingerprint();
+	if (fp == trace_fp)
+		return;
+	if (trace_count)
+		trace_dirty = true;
+	trace_clear();
+	trace_fp = fp;
+}
+
+/* Is this 68k range plain memory that is mapped 1:1 at NATMEM_OFFSET? */
+static bool trace_range_ok(uae_u32 start, uae_u32 len)
+{
+	addrbank *ab = &get_mem_bank(start);
+	if (!ab->baseaddr || len == 0 || len > MAX_CHECKSUM_LEN)
+		return false;
+	if (!valid_address(start & ~3, len + (start & 3) + 3))
+		return false;
+	return get_real_address(start) == trace_host(start);
+}
+
+/* Same sum as calc_checksum(), but over 68k addresses */
+static void trace_checksum(const uae_u32 *ranges, int nranges, uae_u32 *c1, uae_u32 *c2)
+{
+	uae_u32 k1 = 0;
+	uae_u32 k2 = 0;
+
+	for (int i = 0; i < nranges; i++) {
+		uintptr tmp = (uintptr)trace_host(ranges[i * 2]);
+		uae_s32 len = ranges[i * 2 + 1] + (tmp & 3);
+		uae_u32 *pos = (uae_u32 *)(tmp & ~((uintptr)3));
+		while (len > 0) {
+			k1 += *pos;
+			k2 ^= *pos;
+			pos++;
+			len -= 4;
+		}
+	}
+	*c1 = k1;
+	*c2 = k2;
+}
+
+/* Called by compile_block() once a trace has been translated */
+static void trace_record(cpu_history *pc_hist, int blocklen, int totcycles, blockinfo *bi)
+{
+	struct trace_entry *te;
+	checksum_info *csi;
+	uae_u32 pc;
+	int nranges, i;
+
+	if (trace_replaying || !trace_path[0] || !canbang)
+		return;
+	trace_sync_prefs();
+
+	nranges = 0;
+	for (csi = bi->csi; csi; csi = csi->next) {
+		if (!trace_range_ok(trace_amiga(csi->start_p), csi->length))
+			return;
+		nranges++;
+	}
+	if (!nranges || nranges > 0xffff)
+		return;
+
+	pc = trace_amiga(pc_hist[0].location);
+	te = trace_find(pc);
+	if (te) {
+		xfree(te->data);
+		xfree(te->specmem);
+	} else {
+		if (trace_count >= TRACE_CACHE_MAX)
+			return;
+		te = xcalloc(struct trace_entry, 1);
+		te->pc = pc;
+		trace_insert(te);
+	}
+	te->blocklen = blocklen;
+	te->nranges = nranges;
+	te->totcycles = totcycles;
+	te->data = xmalloc(uae_u32, nranges * 2 + blocklen);
+	te->specmem = xmalloc(uae_u8, blocklen);
+	i = 0;
+	for (csi = bi->csi; csi; csi = csi->next) {
+		te->data[i++] = trace_amiga(csi->start_p);
+		te->data[i++] = csi->length;
+	}
+	for (int j = 0; j < blocklen; j++) {
+		te->data[i++] = trace_amiga(pc_hist[j].location);
+		te->specmem[j] = pc_hist[j].specmem;
+	}
+	trace_checksum(te->data, nranges, &te->c1, &te->c2);
+	trace_dirty = true;
+}
+
+/* Called from execute_normal() before it starts interpreting a new block */
+bool compemu_trace_replay(void)
+{
+	cpu_history pc_hist[MAXRUN];
+	struct trace_entry *te;
+	blockinfo *bi;
+	uae_u32 c1, c2;
+
+	if (!trace_count || !canbang || !cache_enabled || !compiled_code || currprefs.cpu_model < 68020)
+		return false;
+	trace_sync_prefs();
+
+	te = trace_find(trace_amiga(regs.pc_p));
+	if (!te)
+		return false;
+	for (int i = 0; i < te->nranges; i++) {
+		if (!trace_range_ok(te->data[i * 2], te->data[i * 2 + 1]))
+			return false;
+	}
+	trace_checksum(te->data, te->nranges, &c1, &c2);
+	if (c1 != te->c1 || c2 != te->c2) {
+		trace_stale++;
+		return false;
+	}
+	for (int i = 0; i < te->blocklen; i++) {
+		pc_hist[i].location = (uae_u16 *)trace_host(te->data[te->nranges * 2 + i]);
+		pc_hist[i].specmem = te->specmem[i];
+	}
+
+	/* compile_block() would flush after we have primed the blockinfo */
+	if (current_compile_p >= MAX_COMPILE_PTR)
+		flush_icache_hard(7);
+	alloc_blockinfos();
+	bi = get_blockinfo_addr_new(regs.pc_p, 0);
+	if (bi->status != BI_INVALID && bi->status != BI_NEED_RECOMP)
+		return false;
+	/* Skip the countdown stages and go straight to full translation */
+	bi->count = -1;
+
+	trace_replaying = true;
+	compile_block(pc_hist, te->blocklen, te->totcycles);
+	trace_replaying = false;
+	trace_replayed++;
+	return true;
+}
+
+static void trace_cache_load(const TCHAR *name)
+{
+	struct zfile *f;
+	uae_u32 hdr[4];
+	int loaded = 0;
+
+	trace_clear();
+	trace_fp = trace_fingerprint();
+	trace_dirty = false;
+	trace_replayed = trace_stale = 0;
+
+	f = zfile_fopen(name, _T("rb"), 0);
+	if (!f)
+		return;
+	if (zfile_fread(hdr, sizeof hdr, 1, f) != 1 ||
+		hdr[0] != TRACE_CACHE_MAGIC || hdr[1] != TRACE_CACHE_VERSION) {
+		write_log(_T("JIT: '%s' is not a trace cache\n"), name);
+		zfile_fclose(f);
+		return;
+	}
+	if (hdr[2] != trace_fp) {
+		write_log(_T("JIT: trace cache '%s' was made with different settings, ignored\n"), name);
+		zfile_fclose(f);
+		return;
+	}
+	for (uae_u32 n = 0; n < hdr[3] && trace_count < TRACE_CACHE_MAX; n++) {
+		uae_u32 rec[6];
+		struct trace_entry *te;
+		size_t words;
+		if (zfile_fread(rec, sizeof rec, 1, f) != 1)
+			break;
+		if (rec[4] == 0 || rec[4] > MAXRUN || rec[5] == 0 || rec[5] > rec[4])
+			break;
+		te = xcalloc(struct trace_entry, 1);
+		te->pc = rec[0];
+		te->c1 = rec[1];
+		te->c2 = rec[2];
+		te->totcycles = rec[3];
+		te->blocklen = rec[4];
+		te->nranges = rec[5];
+		words = te->nranges * 2 + te->blocklen;
+		te->data = xmalloc(uae_u32, words);
+		te->specmem = xmalloc(uae_u8, te->blocklen);
+		if (zfile_fread(te->data, sizeof(uae_u32), words, f) != words ||
+			zfile_fread(te->specmem, 1, te->blocklen, f) != te->blocklen ||
+			te->data[te->nranges * 2] != te->pc || trace_find(te->pc)) {
+			trace_free_entry(te);
+			break;
+		}
+		trace_insert(te);
+		loaded++;
+	}
+	zfile_fclose(f);
+	write_log(_T("JIT: loaded %d translation traces from '%s'\n"), loaded, name);
+}
+
+static void trace_cache_save(const TCHAR *name)
+{
+	struct zfile *f;
+	uae_u32 hdr[4];
+
+	f = zfile_fopen(name, _T("wb"), 0);
+	if (!f) {
+		write_log(_T("JIT: can't write trace cache '%s'\n"), name);
+		return;
+	}
+	hdr[0] = TRACE_CACHE_MAGIC;
+	hdr[1] = TRACE_CACHE_VERSION;
+	hdr[2] = trace_fp;
+	hdr[3] = trace_count;
+	zfile_fwrite(hdr, sizeof hdr, 1, f);
+	for (int i = 0; i < TRACE_CACHE_HASH; i++) {
+		for (struct trace_entry *te = trace_hash[i]; te; te = te->next) {
+			uae_u32 rec[6] = { te->pc, te->c1, te->c2, te->totcycles, te->blocklen, te->nranges };
+			zfile_fwrite(rec, sizeof rec, 1, f);
+			zfile_fwrite(te->data, sizeof(uae_u32), te->nranges * 2 + te->blocklen, f);
+			zfile_fwrite(te->specmem, 1, te->blocklen, f);
+		}
+	}
+	zfile_fclose(f);
+	write_log(_T("JIT: saved %d translation traces to '%s' (%d replayed, %d stale)\n"),
+		trace_count, name, trace_replayed, trace_stale);
+	trace_dirty = false;
+}
+
+/* Called on reset: follow changes of the comp_trace_cache setting */
+static void trace_cache_reset(void)
+{
+	if (!_tcscmp(trace_path, currprefs.comp_trace_cache))
+		return;
+	if (trace_path[0] && trace_dirty)
+		trace_cache_save(trace_path);
+	trace_clear();
+	_tcscpy(trace_path, currprefs.comp_trace_cache);
+	if (trace_path[0])
+		trace_cache_load(trace_path);
+}
+
+void compemu_trace_save(void)
+{
+	if (trace_path[0] && trace_dirty)
+		trace_cache_save(trace_path);
+}
+
+#else
+
+static inline void trace_record(cpu_history *, int, int, blockinfo *)
+{
+}
+
+static inline void trace_cache_reset(void)
+{
+}
+
+bool compemu_trace_replay(void)
+{
+	return false;
+}
+
+void compemu_trace_save(void)
+{
+}
+
+#endif
@@ -120,6 +120,44 @@ case, bit 0 is set (the memory access routines will take care of it).  */
 
 uae_u8 *baseaddr[MEMORY_BANKS];
 
+uae_u8 *mem_direct_r[MEMORY_BANKS];
+uae_u8 *mem_direct_w[MEMORY_BANKS];
+
+/* Same address calculation as memory_get_long() and friends, done once per
+page. Only possible if the whole 64k page is linear in the bank.  */
+static uae_u8 *direct_page_pointer(addrbank *ab, uae_u8 *base, int page)
+{
+	uae_u32 addr = page << 16;
+	if (!base || (ab->mask & 0xffff) != 0xffff || (ab->startaccessmask & 0xffff))
+		return NULL;
+	return base + ((addr - ab->startaccessmask) & ab->mask) - addr;
+}
+
+void memory_update_direct_page(int page)
+{
+	addrbank *ab = mem_banks[page];
+	mem_direct_r[page] = direct_page_pointer(ab, ab->baseaddr_direct_r, page);
+	mem_direct_w[page] = direct_page_pointer(ab, ab->baseaddr_direct_w, page);
+}
+
+void memory_update_direct(void)
+{
+	for (unsigned int i = 0; i < MEMORY_BANKS; i++) {
+		if (mem_banks[i])
+			memory_update_direct_page(i);
+	}
+}
+
+/* Called before the bank memory goes away, banks may still be mapped.  */
+void memory_clear_direct(addrbank *ab)
+{
+	if (!ab->baseaddr_direct_r && !ab->baseaddr_direct_w)
+		return;
+	ab->baseaddr_direct_r = NULL;
+	ab->baseaddr_direct_w = NULL;
+	memory_update_direct();
+}
+
 #ifdef NO_INLINE_MEMORY_ACCESS
 __inline__ uae_u32 longget (uaecptr addr)
 {
@@ -969,6 +1007,16 @@ void chipmem_setindirect(void)
 	}
 }
 
+/* Host view of chip RAM for DMA that bypasses chipmem_agnus_wget/wput,
+ * NULL if accesses have to go through the indirect handlers.  */
+uae_u8 *chipmem_agnus_direct (uae_u32 *size)
+{
+	if (chipmem_wget_indirect != chipmem_agnus_wget || chipmem_wput_indirect != chipmem_agnus_wput)
+		return NULL;
+	*size = chipmem_full_size;
+	return chipmem_bank.baseaddr;
+}
+
 /* Slow memory */
 
 MEMORY_FUNCTIONS(bogomem);
@@ -2031,8 +2079,11 @@ static void set_direct_memory(addrbank *ab)
 	if (!(ab->flags & ABFLAG_DIRECTACCESS))
 		return;
 	ab->baseaddr_direct_r = ab->baseaddr;
-	if (!(ab->flags & ABFLAG_ROM))
+	/* RTG VRAM writes must go through the bank handlers, they feed the
+	* dirty page map used by RTG screen refresh. */
+	if (!(ab->flags & (ABFLAG_ROM | ABFLAG_RTG)))
 		ab->baseaddr_direct_w = ab->baseaddr;
+	memory_update_direct();
 }
 
 #ifndef NATMEM_OFFSET
@@ -2052,6 +2103,7 @@ bool mapped_malloc (addrbank *ab)
 
 void mapped_free (addrbank *ab)
 {
+	memory_clear_direct(ab);
 	xfree(ab->baseaddr);
 	ab->flags &= ~ABFLAG_MAPPED;
 	ab->allocated_size = 0;
@@ -59,6 +59,7 @@ struct ncr_state
 	bool newncr;
 	DeviceState devobject;
 	SCSIDevice *scsid[8];
+	SCSIRequest *asyncreq[8];
 	SCSIBus scsibus;
 	uae_u32 board_mask;
 	uae_u8 *rom;
@@ -190,6 +191,29 @@ void ncr_rethink(void)
 		cyberstorm_mk3_ppc_irq_setonly(0, 1);
 }
 
+/* Data in commands run on the SCSI worker thread. Enqueue returns 0 so
+ * the SCRIPTS processor stays connected in data in phase until ncr_hsync()
+ * sees the command finished and continues the request. */
+static bool ncr_async_start(SCSIRequest *req)
+{
+	struct scsi_data *sd = (struct scsi_data*)req->dev->handle;
+	struct ncr_state *ncr = (struct ncr_state*)sd->privdata;
+
+	if (!scsi_emulate_cmd_async(sd))
+		return false;
+	ncr->asyncreq[req->dev->id] = req;
+	return true;
+}
+
+static void ncr_async_clear(SCSIRequest *req)
+{
+	struct scsi_data *sd = (struct scsi_data*)req->dev->handle;
+	struct ncr_state *ncr = (struct ncr_state*)sd->privdata;
+
+	if (ncr->asyncreq[req->dev->id] == req)
+		ncr->asyncreq[req->dev->id] = NULL;
+}
+
 /* 720+ */
 
 void pci_set_irq(PCIDevice *pci_dev, int level)
@@ -233,11 +257,14 @@ int32_t scsi_req_enqueue(SCSIRequest *req)
 {
 	struct scsi_data *sd = (struct scsi_data*)req->dev->handle;
 
+	scsi_emulate_cmd_wait(sd);
 	sd->data_len = 0;
 	scsi_start_transfer(sd);
 	scsi_emulate_analyze(sd);
 	//write_log (_T("%02x.%02x.%02x.%02x.%02x.%02x\n"), sd->cmd[0], sd->cmd[1], sd->cmd[2], sd->cmd[3], sd->cmd[4], sd->cmd[5]);
 
+	if (ncr_async_start(req))
+		return 0;
 	if (sd->direction <= 0)
 		scsi_emulate_cmd(sd);
 	if (sd->direction == 0)
@@ -246,6 +273,7 @@ int32_t scsi_req_enqueue(SCSIRequest *req)
 }
 void scsi_req_unref(SCSIRequest *req)
 {
+	ncr_async_clear(req);
 	xfree(req);
 }
 uint8_t *scsi_req_get_buf(SCSIRequest *req)
@@ -326,11 +354,14 @@ int32_t scsi710_req_enqueue(SCSIRequest *req)
 {
 	struct scsi_data *sd = (struct scsi_data*)req->dev->handle;
 
+	scsi_emulate_cmd_wait(sd);
 	sd->data_len = 0;
 	scsi_start_transfer (sd);
 	scsi_emulate_analyze (sd);
 	//write_log (_T("%02x.%02x.%02x.%02x.%02x.%02x\n"), sd->cmd[0], sd->cmd[1], sd->cmd[2], sd->cmd[3], sd->cmd[4], sd->cmd[5]);
 	
+	if (ncr_async_start(req))
+		return 0;
 	if (sd->direction <= 0)
 		scsi_emulate_cmd(sd);
 	if (sd->direction == 0)
@@ -339,6 +370,7 @@ int32_t scsi710_req_enqueue(SCSIRequest *req)
 }
 void scsi710_req_unref(SCSIRequest *req)
 {
+	ncr_async_clear(req);
 	xfree (req);
 }
 uint8_t *scsi710_req_get_buf(SCSIRequest *req)
@@ -398,6 +430,23 @@ static void check_timer(struct ncr_state *ncr)
 	}
 }
 
+void ncr_hsync(void)
+{
+	for (int i = 0; ncr_units[i]; i++) {
+		struct ncr_state *ncr = ncr_units[i];
+		for (int ch = 0; ch < 8; ch++) {
+			SCSIRequest *req = ncr->asyncreq[ch];
+			if (!req || scsi_emulate_cmd_busy((struct scsi_data*)req->dev->handle))
+				continue;
+			ncr->asyncreq[ch] = NULL;
+			if (ncr->newncr)
+				scsi_req_continue(req);
+			else
+				scsi710_req_continue(req);
+		}
+	}
+}
+
 void ncr_vsync(void)
 {
 	for (int i = 0; ncr_units[i]; i++) {
@@ -853,6 +902,12 @@ static void ncr_reset_board (struct ncr_state *ncr)
 {
 	if (!ncr)
 		return;
+	for (int ch = 0; ch < 8; ch++) {
+		if (ncr->asyncreq[ch]) {
+			scsi_emulate_cmd_wait((struct scsi_data*)ncr->scsid[ch]->handle);
+			ncr->asyncreq[ch] = NULL;
+		}
+	}
 	ncr->irq = false;
 }
 
@@ -5656,6 +5656,9 @@ void execute_normal (void)
 	blocklen = 0;
 	start_pc_p = r->pc_oldp;
 	start_pc = r->pc;
+	/* Translated in an earlier run and still unmodified? */
+	if (compemu_trace_replay ())
+		return;
 	for (;;) {
 		/* Take note: This is the do-it-normal loop */
 		regs.instruction_pc = m68k_getpc ();
@@ -6693,15 +6696,10 @@ void m68k_go (int may_quit)
 
 			if (!restored || hsync_counter == 0)
 				savestate_check ();
-#ifdef FSUAE
-#else
 			if (input_record == INPREC_RECORD_START)
 				input_record = INPREC_RECORD_NORMAL;
-#endif
 			statusline_clear();
 		} else {
-#ifdef FSUAE
-#else
 			if (input_record == INPREC_RECORD_START) {
 				input_record = INPREC_RECORD_NORMAL;
 				savestate_init ();
@@ -6709,7 +6707,6 @@ void m68k_go (int may_quit)
 				vsync_counter = 0;
 				savestate_check ();
 			}
-#endif
 		}
 
 		if (changed_prefs.inprecfile[0] && input_record)
@@ -39,6 +39,20 @@ FLAC_API FLAC__bool FLAC__stream_decoder_process_until_end_of_stream(FLAC__Strea
 FLAC_API void FLAC__stream_decoder_delete(FLAC__StreamDecoder *decoder) {
 }
 
+FLAC_API FLAC__bool FLAC__stream_decoder_process_single(FLAC__StreamDecoder *decoder) {
+    return 0;
+}
+
+FLAC_API FLAC__bool FLAC__stream_decoder_seek_absolute(
+        FLAC__StreamDecoder *decoder, FLAC__uint64 sample) {
+    return 0;
+}
+
+FLAC_API FLAC__StreamDecoderState FLAC__stream_decoder_get_state(
+        const FLAC__StreamDecoder *decoder) {
+    return FLAC__STREAM_DECODER_UNINITIALIZED;
+}
+
 mp3decoder::~mp3decoder() {
 }
 
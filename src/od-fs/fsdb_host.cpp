@@ -130,8 +130,14 @@ static uae_u32 filesys_parse_mask(uae_u32 mask)
     return mask ^ 0xf;
 }
 
+static int dir_index_exists(const char *nname);
+
 int fsdb_exists(const TCHAR *nname)
 {
+    int result = dir_index_exists(nname);
+    if (result >= 0) {
+        return result;
+    }
     return fs_path_exists(nname);
 }
 
@@ -933,60 +939,194 @@ int fsdb_set_file_attrs(a_inode *aino)
     return fsdb_set_file_info(aino->nname, &info);
 }
 
-static void find_nname_case(const char *dir_path, char **name)
+/* Directory name index
+ *
+ * Case-insensitive lookups used to scan the whole host directory each time.
+ * Instead, each directory gets an index from the lowercased Latin-1 name to
+ * the host name, plus the set of exact host names. An index is rebuilt when
+ * the directory modification time changes. If the directory was modified
+ * in the same second as the scan, later changes in that second would not
+ * show in the mtime. Such an index can only be trusted for positive results,
+ * so misses rescan the directory.
+ */
+
+#define DIR_INDEX_MAX_DIRS 256
+
+typedef struct {
+    GHashTable *folded;
+    GHashTable *exact;
+    time_t mtime;
+    int mtime_nsec;
+    bool complete;
+} dir_index;
+
+static GHashTable *g_dir_indexes;
+static GMutex g_dir_index_mutex;
+
+static void dir_index_free(void *data)
 {
-    // FIXME: should cache these results...!!
-    if (g_fsdb_debug) {
-        write_log("find case for %s in dir %s\n", *name, dir_path);
+    dir_index *index = (dir_index *) data;
+    g_hash_table_destroy(index->folded);
+    g_hash_table_destroy(index->exact);
+    g_free(index);
+}
+
+static char *dir_index_fold(const char *name)
+{
+    char *folded = fs_utf8_to_latin1(name, -1);
+    if (folded) {
+        lower_latin1(folded);
     }
+    return folded;
+}
+
+static dir_index *dir_index_scan(const char *dir_path, struct fs_stat *st)
+{
     GDir *dir = g_dir_open(dir_path, 0, NULL);
     if (dir == NULL) {
-        write_log("open dir %s failed\n", *name);
-        return;
-    }
-
-    //gsize read, written;
-    //gchar *cmp_name = g_convert(*name, -1, "ISO-8859-1", "UTF-8", &read,
-    //        &written, NULL);
-    char *cmp_name = fs_utf8_to_latin1(*name, -1);
-    if (cmp_name == NULL) {
-        write_log("WARNING: could not convert to latin1: %s", *name);
-        g_dir_close(dir);
-        return;
+        write_log("open dir %s failed\n", dir_path);
+        return NULL;
     }
-    lower_latin1(cmp_name);
+    dir_index *index = g_new0(dir_index, 1);
+    index->folded = g_hash_table_new_full(g_str_hash, g_str_equal,
+            g_free, NULL);
+    index->exact = g_hash_table_new_full(g_str_hash, g_str_equal,
+            g_free, NULL);
+    index->mtime = st->mtime;
+    index->mtime_nsec = st->mtime_nsec;
+    index->complete = st->mtime < time(NULL);
 
     const char *result;
-    while (1) {
-        result = g_dir_read_name(dir);
-        if (!result) {
-            break;
-        }
-
-        //char *cmp_result = g_convert(result, -1, "ISO-8859-1", "UTF-8", &read,
-        //        &written, NULL);
-        char *cmp_result = fs_utf8_to_latin1(result, -1);
-        //printf("%s %s\n", result, cmp_result);
-        if (cmp_result == NULL) {
+    while ((result = g_dir_read_name(dir)) != NULL) {
+        char *name = g_strdup(result);
+        g_hash_table_add(index->exact, name);
+        char *folded = dir_index_fold(result);
+        if (folded == NULL) {
             // file name could not be represented as ISO-8859-1, so it
             // will be ignored
             write_log("cannot convert name \"%s\" to ISO-8859-1 - ignoring\n",
                     result);
             continue;
         }
-        lower_latin1(cmp_result);
+        // first match in directory order wins, as before
+        if (g_hash_table_contains(index->folded, folded)) {
+            g_free(folded);
+        } else {
+            g_hash_table_insert(index->folded, folded, name);
+        }
+    }
+    g_dir_close(dir);
+    if (g_fsdb_debug) {
+        write_log("indexed %d entries in dir %s\n",
+                g_hash_table_size(index->exact), dir_path);
+    }
+    return index;
+}
 
-        if (strcmp(cmp_name, cmp_result) == 0) {
-            // FIXME: memory leak, free name first?
-            *name = g_strdup(result);
-            if (g_fsdb_debug) {
-                write_log("              %s\n", *name);
+/* Returns the current index for dir_path, must be called with
+ * g_dir_index_mutex held. */
+static dir_index *dir_index_get(const char *dir_path, bool rescan)
+{
+    struct fs_stat st;
+    if (fs_stat(dir_path, &st) != 0) {
+        return NULL;
+    }
+    if (g_dir_indexes == NULL) {
+        g_dir_indexes = g_hash_table_new_full(g_str_hash, g_str_equal,
+                g_free, dir_index_free);
+    }
+    dir_index *index = (dir_index *) g_hash_table_lookup(
+            g_dir_indexes, dir_path);
+    if (index && !rescan && index->mtime == st.mtime &&
+            index->mtime_nsec == st.mtime_nsec) {
+        return index;
+    }
+    index = dir_index_scan(dir_path, &st);
+    if (index == NULL) {
+        g_hash_table_remove(g_dir_indexes, dir_path);
+        return NULL;
+    }
+    if (g_hash_table_size(g_dir_indexes) >= DIR_INDEX_MAX_DIRS) {
+        g_hash_table_remove_all(g_dir_indexes);
+    }
+    g_hash_table_replace(g_dir_indexes, g_strdup(dir_path), index);
+    return index;
+}
+
+static void dir_index_lock(void)
+{
+    // filesys units run on their own threads
+    g_mutex_lock(&g_dir_index_mutex);
+}
+
+static void dir_index_unlock(void)
+{
+    g_mutex_unlock(&g_dir_index_mutex);
+}
+
+/* Returns 1 if nname exists, 0 if it does not, -1 if the index can't tell */
+static int dir_index_exists(const char *nname)
+{
+    size_t len = strlen(nname);
+    if (len == 0 || G_IS_DIR_SEPARATOR(nname[len - 1])) {
+        return -1;
+    }
+    char *dir_path = g_path_get_dirname(nname);
+    char *base = g_path_get_basename(nname);
+    int result = -1;
+    if (strcmp(base, ".") == 0 || strcmp(base, "..") == 0) {
+        g_free(dir_path);
+        g_free(base);
+        return -1;
+    }
+
+    dir_index_lock();
+    dir_index *index = dir_index_get(dir_path, false);
+    if (index) {
+        if (g_hash_table_contains(index->exact, base)) {
+            result = 1;
+        } else if (index->complete) {
+            result = 0;
+        }
+    }
+    dir_index_unlock();
+    g_free(dir_path);
+    g_free(base);
+    return result;
+}
+
+static void find_nname_case(const char *dir_path, char **name)
+{
+    if (g_fsdb_debug) {
+        write_log("find case for %s in dir %s\n", *name, dir_path);
+    }
+    char *cmp_name = dir_index_fold(*name);
+    if (cmp_name == NULL) {
+        write_log("WARNING: could not convert to latin1: %s", *name);
+        return;
+    }
+
+    dir_index_lock();
+    dir_index *index = dir_index_get(dir_path, false);
+    const char *result = NULL;
+    if (index) {
+        result = (const char *) g_hash_table_lookup(index->folded, cmp_name);
+        if (result == NULL && !index->complete) {
+            index = dir_index_get(dir_path, true);
+            if (index) {
+                result = (const char *) g_hash_table_lookup(
+                        index->folded, cmp_name);
             }
-            break;
         }
-        g_free(cmp_result);
     }
-    g_dir_close(dir);
+    if (result) {
+        // FIXME: memory leak, free name first?
+        *name = g_strdup(result);
+        if (g_fsdb_debug) {
+            write_log("              %s\n", *name);
+        }
+    }
+    dir_index_unlock();
     g_free(cmp_name);
 }
 
@@ -2288,6 +2288,13 @@ bool uae_fsvideo_renderframe(int monid, int mode, bool immediate)
 				uae_fsvideo_log("WARNING: Expected mode to be 1 or 2\n");
 			}
 
+			// Slices carry the rows changed so far in this frame; the
+			// bitmap is reset when the complete frame has been sent.
+			uae_u32 dirty[(AMIGA_HEIGHT + 31) / 32];
+			if (drawing_get_dirty_rows(dirty, AMIGA_HEIGHT, mode == 1)) {
+				fsemu_video_frame_set_dirty_rows(frame, dirty, AMIGA_HEIGHT);
+			}
+
 			// { "692x540", NULL, 48, 22, 692, 540 },
 
 			// frame->buffer = uae_fsvideo.chipset_framebuffer; + 22 * frame->stride + 48 * g_amiga_video_bpp;
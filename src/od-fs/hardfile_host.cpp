@@ -17,6 +17,7 @@
 #include "uae/fs.h"
 #include "uae/io.h"
 #include "uae/log.h"
+#include "threaddep/thread.h"
 
 #ifdef MACOSX
 #include <sys/stat.h>
@@ -41,11 +42,49 @@ static int g_debug = 0;
 #define DEBUG_LOG(...) do ; while(0)
 #endif
 
+#define CACHE_SIZE 16384
+#define CACHE_FLUSH_TIME 5
+
+/* Asynchronous read-ahead. When the guest reads sequentially, the data
+ * following the current cache window is read by a worker thread using its
+ * own file handle. Cache misses are then normally satisfied from memory and
+ * the emulation (or device) thread does not wait for host storage. */
+#define PREFETCH_SLOTS 2
+#define PREFETCH_SIZE (8 * CACHE_SIZE)
+#define PREFETCH_QUIT 0xffffffff
+
+struct hdf_prefetch_slot
+{
+    uae_u8 *buffer;
+    uae_u64 offset;
+    /* busy, valid and stale are only changed by the reading thread, the
+     * worker only sets result and posts done */
+    bool busy;
+    bool valid;
+    bool stale;
+    volatile int result;
+    uae_sem_t done;
+};
+
+struct hdf_prefetch
+{
+    FILE *h;
+    uae_u64 physoffset;
+    uae_thread_id thread;
+    smp_comm_pipe requests;
+    struct hdf_prefetch_slot slot[PREFETCH_SLOTS];
+    uae_u64 lastend;
+    uae_u64 ahead;
+    bool unflushed;
+    uae_u64 hits, misses, waits;
+};
+
 struct hardfilehandle
 {
     int zfile;
     struct zfile *zf;
     FILE *h;
+    struct hdf_prefetch *prefetch;
 };
 
 struct uae_driveinfo {
@@ -70,9 +109,6 @@ struct uae_driveinfo {
 #undef INVALID_HANDLE_VALUE
 #define INVALID_HANDLE_VALUE NULL
 
-#define CACHE_SIZE 16384
-#define CACHE_FLUSH_TIME 5
-
 /* safety check: only accept drives that:
 * - contain RDSK in block 0
 * - block 0 is zeroed
@@ -207,12 +243,190 @@ static int isharddrive (const TCHAR *name)
 
 static const char *hdz[] = { "hdz", "zip", "rar", "7z", NULL };
 
+static void *hdf_prefetch_thread (void *data)
+{
+    struct hdf_prefetch *pf = (struct hdf_prefetch *) data;
+
+    for (;;) {
+        uae_u32 n = read_comm_pipe_u32_blocking (&pf->requests);
+        if (n == PREFETCH_QUIT)
+            break;
+        struct hdf_prefetch_slot *ps = &pf->slot[n];
+        int got = 0;
+        if (uae_fseeko64 (pf->h, pf->physoffset + ps->offset, SEEK_SET) == 0)
+            got = fread (ps->buffer, 1, PREFETCH_SIZE, pf->h);
+        ps->result = got;
+        uae_sem_post (&ps->done);
+    }
+    return NULL;
+}
+
+static void hdf_prefetch_wait (struct hdf_prefetch *pf, struct hdf_prefetch_slot *ps)
+{
+    if (!ps->busy)
+        return;
+    uae_sem_wait (&ps->done);
+    ps->busy = false;
+    ps->valid = ps->result == PREFETCH_SIZE && !ps->stale;
+    ps->stale = false;
+}
+
+static void hdf_prefetch_init (struct hardfiledata *hfd, const char *path)
+{
+    struct hdf_prefetch *pf;
+
+    if (hfd->physsize - hfd->virtual_size < 2 * PREFETCH_SIZE)
+        return;
+    pf = xcalloc (struct hdf_prefetch, 1);
+    /* unbuffered, the main handle is flushed before new slots are queued
+     * so the worker always sees the current data */
+    pf->h = uae_tfopen (path, "rb");
+    if (!pf->h) {
+        xfree (pf);
+        return;
+    }
+    setvbuf (pf->h, NULL, _IONBF, 0);
+    pf->physoffset = hfd->offset;
+    for (int i = 0; i < PREFETCH_SLOTS; i++) {
+        pf->slot[i].buffer = xmalloc (uae_u8, PREFETCH_SIZE);
+        uae_sem_init (&pf->slot[i].done, 0, 0);
+    }
+    init_comm_pipe (&pf->requests, 2 * PREFETCH_SLOTS + 2, 1);
+    if (!uae_start_thread (_T("hdf prefetch"), hdf_prefetch_thread, pf, &pf->thread)) {
+        write_log (_T("HDF: failed to start prefetch thread\n"));
+        destroy_comm_pipe (&pf->requests);
+        for (int i = 0; i < PREFETCH_SLOTS; i++) {
+            uae_sem_destroy (&pf->slot[i].done);
+            xfree (pf->slot[i].buffer);
+        }
+        fclose (pf->h);
+        xfree (pf);
+        return;
+    }
+    pf->lastend = ~0ULL;
+    hfd->handle->prefetch = pf;
+}
+
+static void hdf_prefetch_free (struct hardfiledata *hfd)
+{
+    struct hdf_prefetch *pf = hfd->handle ? hfd->handle->prefetch : NULL;
+
+    if (!pf)
+        return;
+    for (int i = 0; i < PREFETCH_SLOTS; i++)
+        hdf_prefetch_wait (pf, &pf->slot[i]);
+    write_comm_pipe_u32 (&pf->requests, PREFETCH_QUIT, 1);
+    uae_wait_thread (pf->thread);
+    uae_end_thread (&pf->thread);
+    destroy_comm_pipe (&pf->requests);
+    if (pf->hits || pf->misses) {
+        write_log (_T("HDF: prefetch %llu hits, %llu misses, %llu waits\n"),
+                   pf->hits, pf->misses, pf->waits);
+    }
+    for (int i = 0; i < PREFETCH_SLOTS; i++) {
+        uae_sem_destroy (&pf->slot[i].done);
+        xfree (pf->slot[i].buffer);
+    }
+    fclose (pf->h);
+    xfree (pf);
+    hfd->handle->prefetch = NULL;
+}
+
+/* Drops the slots overlapping a write of len bytes at offset. Slots that
+ * are still being read are not waited for, their result is discarded when
+ * they complete. */
+static void hdf_prefetch_invalidate (struct hardfiledata *hfd, uae_u64 offset, int len)
+{
+    struct hdf_prefetch *pf = hfd->handle->prefetch;
+
+    if (!pf)
+        return;
+    for (int i = 0; i < PREFETCH_SLOTS; i++) {
+        struct hdf_prefetch_slot *ps = &pf->slot[i];
+        if (offset >= ps->offset + PREFETCH_SIZE || offset + len <= ps->offset)
+            continue;
+        if (ps->busy)
+            ps->stale = true;
+        ps->valid = false;
+    }
+    pf->unflushed = true;
+}
+
+/* Copy len bytes at offset from a prefetched slot, waits if the slot is
+ * still being read. */
+static bool hdf_prefetch_get (struct hardfiledata *hfd, uae_u8 *buffer, uae_u64 offset, int len)
+{
+    struct hdf_prefetch *pf = hfd->handle->prefetch;
+
+    if (!pf)
+        return false;
+    for (int i = 0; i < PREFETCH_SLOTS; i++) {
+        struct hdf_prefetch_slot *ps = &pf->slot[i];
+        if ((!ps->busy && !ps->valid) || ps->stale || offset < ps->offset
+            || offset + len > ps->offset + PREFETCH_SIZE)
+            continue;
+        if (ps->busy) {
+            pf->waits++;
+            hdf_prefetch_wait (pf, ps);
+            if (!ps->valid)
+                break;
+        }
+        memcpy (buffer, ps->buffer + (offset - ps->offset), len);
+        pf->hits++;
+        return true;
+    }
+    pf->misses++;
+    return false;
+}
+
+/* Called after the cache window has moved to offset. Sequential access
+ * keeps up to PREFETCH_SLOTS windows queued ahead of it. */
+static void hdf_prefetch_update (struct hardfiledata *hfd, uae_u64 offset)
+{
+    struct hdf_prefetch *pf = hfd->handle->prefetch;
+    uae_u64 end = hfd->physsize - hfd->virtual_size;
+    bool sequential;
+
+    if (!pf)
+        return;
+    sequential = offset == pf->lastend;
+    pf->lastend = offset + CACHE_SIZE;
+    if (!sequential)
+        return;
+    if (pf->unflushed) {
+        fflush (hfd->handle->h);
+        pf->unflushed = false;
+    }
+    if (pf->ahead < offset + CACHE_SIZE || pf->ahead > offset + PREFETCH_SLOTS * PREFETCH_SIZE)
+        pf->ahead = offset + CACHE_SIZE;
+    for (int i = 0; i < PREFETCH_SLOTS; i++) {
+        struct hdf_prefetch_slot *ps = &pf->slot[i];
+        if (pf->ahead + PREFETCH_SIZE > end)
+            break;
+        /* reclaim a slot that was overwritten while being read */
+        if (ps->stale && uae_sem_trywait (&ps->done) == 0) {
+            ps->busy = false;
+            ps->stale = false;
+        }
+        /* keep slots that are still ahead of the stream */
+        if (ps->busy || (ps->valid && ps->offset + PREFETCH_SIZE > offset
+            && ps->offset < pf->ahead))
+            continue;
+        ps->offset = pf->ahead;
+        ps->valid = false;
+        ps->busy = true;
+        pf->ahead += PREFETCH_SIZE;
+        write_comm_pipe_u32 (&pf->requests, i, 1);
+    }
+}
+
 int hdf_open_target (struct hardfiledata *hfd, const char *pname)
 {
     FILE *h = INVALID_HANDLE_VALUE;
     int i;
     struct uae_driveinfo *udi;
     char *name = strdup (pname);
+    const char *path = name;
 
     if (getenv("FS_DEBUG_HDF")) {
         g_debug = 1;
@@ -245,6 +459,7 @@ int hdf_open_target (struct hardfiledata *hfd, const char *pname)
                 hfd->drive_empty = -1;
             if (udi->readonly)
                 hfd->ci.readonly = 1;
+            path = udi->device_path;
             h = uae_tfopen (udi->device_path, hfd->ci.readonly ? "rb" : "r+b");
             hfd->handle->h = h;
             if (h == INVALID_HANDLE_VALUE)
@@ -389,6 +604,8 @@ int hdf_open_target (struct hardfiledata *hfd, const char *pname)
             write_log ("HDF '%s' failed to open. error = %d\n", name, errno);
         }
     }
+    if (hfd->handle_valid == HDF_HANDLE_LINUX && !hfd->drive_empty)
+        hdf_prefetch_init (hfd, path);
     if (hfd->handle_valid || hfd->drive_empty) {
         hfd_log ("HDF '%s' opened, size=%dK mode=%d empty=%d\n",
             name, (int) (hfd->physsize / 1024), hfd->handle_valid, hfd->drive_empty);
@@ -417,6 +634,7 @@ static void freehandle (struct hardfilehandle *h)
 
 void hdf_close_target (struct hardfiledata *hfd) {
     write_log("hdf_close_target\n");
+    hdf_prefetch_free (hfd);
     if (hfd->handle && hfd->handle->h) {
         write_log("closing file handle %p\n", hfd->handle->h);
         fclose(hfd->handle->h);
@@ -549,12 +767,17 @@ static int hdf_read_2 (struct hardfiledata *hfd, void *buffer, uae_u64 offset, i
     hfd->cache_offset = offset;
     if (offset + CACHE_SIZE > hfd->offset + (hfd->physsize - hfd->virtual_size))
         hfd->cache_offset = hfd->offset + (hfd->physsize - hfd->virtual_size) - CACHE_SIZE;
-    hdf_seek (hfd, hfd->cache_offset);
-    poscheck (hfd, CACHE_SIZE);
-    if (hfd->handle_valid == HDF_HANDLE_LINUX)
-        outlen = fread (hfd->cache, 1, CACHE_SIZE, hfd->handle->h);
-    else if (hfd->handle_valid == HDF_HANDLE_ZFILE)
-        outlen = zfile_fread (hfd->cache, 1, CACHE_SIZE, hfd->handle->zf);
+    if (hdf_prefetch_get (hfd, hfd->cache, hfd->cache_offset, CACHE_SIZE)) {
+        outlen = CACHE_SIZE;
+    } else {
+        hdf_seek (hfd, hfd->cache_offset);
+        poscheck (hfd, CACHE_SIZE);
+        if (hfd->handle_valid == HDF_HANDLE_LINUX)
+            outlen = fread (hfd->cache, 1, CACHE_SIZE, hfd->handle->h);
+        else if (hfd->handle_valid == HDF_HANDLE_ZFILE)
+            outlen = zfile_fread (hfd->cache, 1, CACHE_SIZE, hfd->handle->zf);
+    }
+    hdf_prefetch_update (hfd, hfd->cache_offset);
     hfd->cache_valid = 0;
     if (outlen != CACHE_SIZE)
         return 0;
@@ -621,6 +844,7 @@ static int hdf_write_2 (struct hardfiledata *hfd, void *buffer, uae_u64 offset,
         return 0;
     }
     hfd->cache_valid = 0;
+    hdf_prefetch_invalidate (hfd, offset, len);
     hdf_seek (hfd, offset);
     poscheck (hfd, len);
     memcpy (hfd->cache, buffer, len);
@@ -142,6 +142,10 @@ int amiga_state_save(int slot);
 
 int amiga_state_load(int slot);
 
+int amiga_input_record(const char *path);
+int amiga_input_play(const char *path);
+int amiga_input_seek(unsigned int hsync);
+
 int amiga_quit();
 
 void amiga_set_render_buffer(void *data, int size, int need_redraw,
@@ -267,6 +271,7 @@ void amiga_write_config(const char *path);
 
 void amiga_add_key_dir(const char *path);
 int amiga_add_rom_file(const char *path, const char *cache_path);
+int amiga_scan_rom_files(const char **paths, const char *cache_path);
 
 void amiga_set_paths(const char **rom_paths, const char **floppy_paths,
         const char **cd_paths, const char **hd_paths);
@@ -11,6 +11,7 @@
 // #include "fsemu-mutex.h"
 #include "gui.h"
 #include "inputdevice.h"
+#include "inputrecord.h"
 #include "keyboard.h"
 #include "luascript.h"
 #include "options.h"
@@ -431,6 +432,25 @@ int amiga_reset(int hard)
     return hard;
 }
 
+// the emulation thread starts recording, playback or seeking at the next frame
+
+int amiga_input_record(const char *path)
+{
+    write_log("amiga_input_record %s\n", path);
+    return inprec_request_record(path);
+}
+
+int amiga_input_play(const char *path)
+{
+    write_log("amiga_input_play %s\n", path);
+    return inprec_request_play(path);
+}
+
+int amiga_input_seek(unsigned int hsync)
+{
+    return inprec_seek(hsync);
+}
+
 int amiga_state_save(int slot)
 {
     if (slot < 0) {
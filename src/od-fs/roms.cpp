@@ -6,6 +6,7 @@
 #include "uae/fs.h"
 #include "rommgr.h"
 #include "zfile.h"
+#include "threaddep/thread.h"
 
 #include <fs/filesys.h>
 #include <fs/glib.h>
@@ -38,16 +39,21 @@ void romlist_init (void)
 	"\xc3\xc4\x81\x16\x08\x66\xe6\x0d\x08\x5e" \
 	"\x43\x6a\x24\xdb\x36\x17\xff\x60\xb5\xf9"
 
+static void sha1_to_txt (const uae_u8 *sha1, TCHAR *out)
+{
+	for (int i = 0; i < SHA1_SIZE; i++) {
+		_stprintf (out + i * 2, _T ("%02x"), sha1[i]);
+	}
+}
+
+/* Called from the ROM scanner threads, log complete lines only */
 void romlist_patch_rom (uae_u8 *buf, size_t size)
 {
-	write_log ("romlist_patch_rom\n");
+	TCHAR txt[SHA1_SIZE * 2 + 1];
 	uae_u8 sha1[SHA1_SIZE];
 	get_sha1 (buf, size, sha1);
-	write_log ("ROM: SHA1=");
-	for (int i = 0; i < SHA1_SIZE; i++) {
-		write_log ("%02x", sha1[i]);
-	}
-	write_log ("\n");
+	sha1_to_txt (sha1, txt);
+	write_log ("romlist_patch_rom: SHA1=%s\n", txt);
 	int converted = 0;
 	if (memcmp (sha1, AMIGA_OS_130_SHA1, SHA1_SIZE) == 0) {
 		write_log ("convering amiga-os-130 ROM (in-memory) "
@@ -69,11 +75,8 @@ void romlist_patch_rom (uae_u8 *buf, size_t size)
 	}
 	if (converted) {
 		get_sha1 (buf, size, sha1);
-		write_log ("ROM: SHA1=");
-		for (int i = 0; i < SHA1_SIZE; i++) {
-			write_log ("%02x", sha1[i]);
-		}
-		write_log ("\n");
+		sha1_to_txt (sha1, txt);
+		write_log ("ROM: SHA1=%s\n", txt);
 	}
 #if 0
 	struct romdata *rd = getromdatabydata (buf, size);
@@ -85,63 +88,81 @@ void romlist_patch_rom (uae_u8 *buf, size_t size)
 #endif
 }
 
-static struct romdata *scan_single_rom_2 (struct zfile *f, uae_u32 *crc32)
+#define ROMSCAN_MAX_SIZE (524288 * 2) /* don't skip KICK disks or 1M ROMs */
+
+/* Identify ROM file contents in buf, which is modified (headers skipped,
+ * decoded, byteswapped). crc32 and sha1 are returned for the ROM data
+ * actually checked. Safe to call from the ROM scanner threads. */
+static struct romdata *romscan_identify (uae_u8 *buf, int size, uae_u32 *crc32, uae_u8 *sha1)
 {
-	uae_u8 buffer[20] = { 0 };
-	uae_u8 *rombuf;
-	int cl = 0, size;
-	struct romdata *rd = 0;
+	struct romdata *rd;
+	uae_u8 *rombuf = buf;
 
-	zfile_fseek (f, 0, SEEK_END);
-	size = zfile_ftell (f);
-	zfile_fseek (f, 0, SEEK_SET);
-	if (size > 524288 * 2) { /* don't skip KICK disks or 1M ROMs */
-		write_log (_T ("'%s': too big %d, ignored\n"), zfile_getname (f), size);
-		return 0;
-	}
-	zfile_fread (buffer, 1, 11, f);
-	if (!memcmp (buffer, "KICK", 4)) {
-		zfile_fseek (f, 512, SEEK_SET);
+	if (size > 11 && !memcmp (buf, "KICK", 4)) {
+		if (size <= 512)
+			return NULL;
+		rombuf += 512;
+		size -= 512;
 		if (size > 262144)
 			size = 262144;
-	} else if (!memcmp (buffer, "AMIROMTYPE1", 11)) {
-		cl = 1;
+	} else if (size > 11 && !memcmp (buf, "AMIROMTYPE1", 11)) {
+		rombuf += 11;
 		size -= 11;
-	} else {
-		zfile_fseek (f, 0, SEEK_SET);
-	}
-	rombuf = xcalloc (uae_u8, size);
-	if (!rombuf)
-		return 0;
-	zfile_fread (rombuf, 1, size, f);
-	if (cl > 0) {
 		decode_cloanto_rom_do (rombuf, size, size);
-		cl = 0;
 	}
 	romlist_patch_rom (rombuf, size);
-	if (!cl) {
-		rd = getromdatabydata (rombuf, size);
-		if (!rd && (size & 65535) == 0) {
-			/* check byteswap */
-			int i;
-			for (i = 0; i < size; i+=2) {
-				uae_u8 b = rombuf[i];
-				rombuf[i] = rombuf[i + 1];
-				rombuf[i + 1] = b;
-			}
-			rd = getromdatabydata (rombuf, size);
+	rd = getromdatabydata (rombuf, size);
+	if (!rd && (size & 65535) == 0) {
+		/* check byteswap */
+		int i;
+		for (i = 0; i < size; i+=2) {
+			uae_u8 b = rombuf[i];
+			rombuf[i] = rombuf[i + 1];
+			rombuf[i + 1] = b;
 		}
+		rd = getromdatabydata (rombuf, size);
 	}
 	*crc32 = get_crc32 (rombuf, size);
+	get_sha1 (rombuf, size, sha1);
+	return rd;
+}
+
+static void romscan_log (const TCHAR *name, int size, struct romdata *rd, uae_u32 crc32, const uae_u8 *sha1)
+{
+	TCHAR txt[SHA1_SIZE * 2 + 1];
+
+	sha1_to_txt (sha1, txt);
 	if (!rd) {
-		write_log (_T ("!: Name='%s':%d\nCRC32=%08X SHA1=%s\n"),
-			   zfile_getname (f), size, *crc32, get_sha1_txt (rombuf, size));
+		write_log (_T ("!: Name='%s':%d CRC32=%08X SHA1=%s\n"),
+			   name, size, crc32, txt);
 	} else {
 		TCHAR tmp[MAX_DPATH];
 		getromname (rd, tmp);
-		write_log (_T ("*: %s:%d = %s\nCRC32=%08X SHA1=%s\n"),
-			   zfile_getname (f), size, tmp, *crc32, get_sha1_txt (rombuf, size));
+		write_log (_T ("*: %s:%d = %s CRC32=%08X SHA1=%s\n"),
+			   name, size, tmp, crc32, txt);
+	}
+}
+
+/* Reads the whole zfile, also used for archive members by the scanner */
+static struct romdata *scan_single_rom_2 (struct zfile *f, uae_u32 *crc32, uae_u8 *sha1)
+{
+	uae_u8 *rombuf;
+	int size;
+	struct romdata *rd;
+
+	zfile_fseek (f, 0, SEEK_END);
+	size = zfile_ftell (f);
+	zfile_fseek (f, 0, SEEK_SET);
+	if (size > ROMSCAN_MAX_SIZE) {
+		write_log (_T ("'%s': too big %d, ignored\n"), zfile_getname (f), size);
+		return 0;
 	}
+	rombuf = xcalloc (uae_u8, size);
+	if (!rombuf)
+		return 0;
+	size = zfile_fread (rombuf, 1, size, f);
+	rd = romscan_identify (rombuf, size, crc32, sha1);
+	romscan_log (zfile_getname (f), size, rd, *crc32, sha1);
 	xfree (rombuf);
 	return rd;
 }
@@ -164,11 +185,321 @@ static struct romdata *scan_single_rom (const TCHAR *path, uae_u32 *crc32)
 	z = zfile_fopen (path, _T ("rb"), ZFD_NORMAL);
 	if (!z)
 		return 0;
-	return scan_single_rom_2 (z, crc32);
+	uae_u8 sha1[SHA1_SIZE];
+	rd = scan_single_rom_2 (z, crc32, sha1);
+	zfile_fclose (z);
+	return rd;
+}
+
+/* ROM scanner
+ *
+ * Candidate files are hashed on worker threads. Plain files are read with
+ * stdio and hashed while reading, so most ROMs are identified by SHA-1
+ * without another pass over the data. Archives go through zfile, which is
+ * not thread safe, so only one thread at a time scans an archive.
+ *
+ * Results are cached in a text file, one line per ROM (or per file without
+ * known ROMs): path, size, mtime, ROM id, ROM group, CRC32, SHA-1 and the
+ * name to add to the ROM list (archive member path for archives). Files
+ * with unchanged size and mtime are not read again.
+ */
+
+#define ROMSCAN_MAX_THREADS 8
+#define ROMSCAN_CACHE_HEADER "# FS-UAE ROM cache 1"
+
+struct romscan_rom
+{
+	TCHAR *name;
+	int id, group;
+	uae_u32 crc32;
+	uae_u8 sha1[SHA1_SIZE];
+};
+
+struct romscan_file
+{
+	const char *path;
+	int64_t size;
+	int64_t mtime;
+	bool archive;
+	bool scan;
+	int num;
+	struct romscan_rom *roms;
+};
+
+static struct romscan_file *romscan_files;
+static int romscan_count, romscan_next;
+static uae_sem_t romscan_sem, romscan_zfile_sem;
+
+static void romscan_add (struct romscan_file *rf, const TCHAR *name, struct romdata *rd, uae_u32 crc32, const uae_u8 *sha1)
+{
+	rf->roms = xrealloc (struct romscan_rom, rf->roms, rf->num + 1);
+	struct romscan_rom *r = &rf->roms[rf->num++];
+	r->name = my_strdup (name);
+	r->id = rd ? rd->id : 0;
+	r->group = rd ? rd->group : 0;
+	r->crc32 = crc32;
+	if (sha1)
+		memcpy (r->sha1, sha1, SHA1_SIZE);
+	else
+		memset (r->sha1, 0, SHA1_SIZE);
+}
+
+static void romscan_plain (struct romscan_file *rf)
+{
+	uae_u8 sha1[SHA1_SIZE];
+	sha1_context ctx;
+	uae_u32 crc32 = 0;
+	struct romdata *rd = NULL;
+	int size = 0;
+
+	if (rf->size > ROMSCAN_MAX_SIZE || rf->size < 16) {
+		write_log (_T ("'%s': size %lld, ignored\n"), rf->path, (long long) rf->size);
+		romscan_add (rf, rf->path, NULL, 0, NULL);
+		return;
+	}
+	FILE *f = g_fopen (rf->path, "rb");
+	if (!f)
+		return;
+	uae_u8 *buf = xmalloc (uae_u8, rf->size + 1);
+	get_sha1_start (&ctx);
+	while (size < rf->size) {
+		int len = rf->size - size;
+		if (len > 65536)
+			len = 65536;
+		len = fread (buf + size, 1, len, f);
+		if (len <= 0)
+			break;
+		get_sha1_more (&ctx, buf + size, len);
+		crc32 = get_crc32_more (crc32, buf + size, len);
+		size += len;
+	}
+	get_sha1_finish (&ctx, sha1);
+	fclose (f);
+	if (size <= 11 || (memcmp (buf, "KICK", 4) && memcmp (buf, "AMIROMTYPE1", 11)))
+		rd = getromdatabysha1 (sha1, size);
+	if (!rd) {
+		/* headers, byteswapped, patched or partial matches */
+		rd = romscan_identify (buf, size, &crc32, sha1);
+	}
+	romscan_log (rf->path, size, rd, crc32, sha1);
+	romscan_add (rf, rf->path, rd, crc32, sha1);
+	xfree (buf);
+}
+
+static int romscan_archive_cb (struct zfile *f, void *user)
+{
+	struct romscan_file *rf = (struct romscan_file *) user;
+	uae_u8 sha1[SHA1_SIZE];
+	uae_u32 crc32 = 0;
+
+	if (zfile_size (f) > ROMSCAN_MAX_SIZE)
+		return 0;
+	struct romdata *rd = scan_single_rom_2 (f, &crc32, sha1);
+	if (rd)
+		romscan_add (rf, zfile_getname (f), rd, crc32, sha1);
+	return 0;
+}
+
+static void *romscan_thread (void *data)
+{
+	for (;;) {
+		uae_sem_wait (&romscan_sem);
+		int i = romscan_next;
+		while (i < romscan_count && !romscan_files[i].scan)
+			i++;
+		romscan_next = i + 1;
+		uae_sem_post (&romscan_sem);
+		if (i >= romscan_count)
+			break;
+		struct romscan_file *rf = &romscan_files[i];
+		if (rf->archive) {
+			uae_sem_wait (&romscan_zfile_sem);
+			zfile_zopen (rf->path, romscan_archive_cb, rf);
+			uae_sem_post (&romscan_zfile_sem);
+			if (!rf->num)
+				romscan_add (rf, _T (""), NULL, 0, NULL);
+		} else {
+			romscan_plain (rf);
+		}
+	}
+	return NULL;
+}
+
+static bool romscan_is_archive (const char *path)
+{
+	static const char *exts[] = { ".zip", ".7z", ".lha", ".lzh", ".rar", NULL };
+	char *lpath = g_utf8_strdown (path, -1);
+	bool archive = false;
+	for (int i = 0; exts[i]; i++) {
+		if (g_str_has_suffix (lpath, exts[i])) {
+			archive = true;
+			break;
+		}
+	}
+	g_free (lpath);
+	return archive;
+}
+
+static void romscan_read_cache (const char *cache_path, GHashTable *files)
+{
+	char *data;
+	if (!g_file_get_contents (cache_path, &data, NULL, NULL))
+		return;
+	char **lines = g_strsplit (data, "\n", -1);
+	g_free (data);
+	if (!lines[0] || strcmp (lines[0], ROMSCAN_CACHE_HEADER) != 0) {
+		write_log (_T ("ROM cache '%s' ignored\n"), cache_path);
+		g_strfreev (lines);
+		return;
+	}
+	for (int i = 1; lines[i]; i++) {
+		char **f = g_strsplit (lines[i], "\t", 8);
+		if (g_strv_length (f) != 8) {
+			g_strfreev (f);
+			continue;
+		}
+		struct romscan_file *rf = (struct romscan_file *) g_hash_table_lookup (files, f[0]);
+		if (rf && rf->scan) {
+			if (g_ascii_strtoll (f[1], NULL, 10) == rf->size &&
+			    g_ascii_strtoll (f[2], NULL, 10) == rf->mtime) {
+				struct romscan_rom r;
+				r.name = f[7];
+				r.id = atoi (f[3]);
+				r.group = atoi (f[4]);
+				r.crc32 = g_ascii_strtoull (f[5], NULL, 16);
+				memset (r.sha1, 0, SHA1_SIZE);
+				for (int j = 0; j < SHA1_SIZE && f[6][j * 2] && f[6][j * 2 + 1]; j++) {
+					char hex[3] = { f[6][j * 2], f[6][j * 2 + 1], 0 };
+					r.sha1[j] = g_ascii_strtoull (hex, NULL, 16);
+				}
+				rf->roms = xrealloc (struct romscan_rom, rf->roms, rf->num + 1);
+				rf->roms[rf->num] = r;
+				rf->roms[rf->num].name = my_strdup (r.name);
+				rf->num++;
+			}
+		}
+		g_strfreev (f);
+	}
+	g_strfreev (lines);
+	/* all lines of a file must be read before it is known to be cached */
+	for (int i = 0; i < romscan_count; i++) {
+		if (romscan_files[i].num)
+			romscan_files[i].scan = false;
+	}
+}
+
+static void romscan_write_cache (const char *cache_path)
+{
+	GString *out = g_string_new (ROMSCAN_CACHE_HEADER "\n");
+	for (int i = 0; i < romscan_count; i++) {
+		struct romscan_file *rf = &romscan_files[i];
+		/* not representable, scanned again next time */
+		if (strpbrk (rf->path, "\t\n"))
+			continue;
+		for (int j = 0; j < rf->num; j++) {
+			struct romscan_rom *r = &rf->roms[j];
+			TCHAR txt[SHA1_SIZE * 2 + 1];
+			sha1_to_txt (r->sha1, txt);
+			g_string_append_printf (out, "%s\t%lld\t%lld\t%d\t%d\t%08x\t%s\t%s\n",
+						rf->path, (long long) rf->size, (long long) rf->mtime,
+						r->id, r->group, r->crc32, txt, r->name);
+		}
+	}
+	if (!g_file_set_contents (cache_path, out->str, out->len, NULL))
+		write_log (_T ("Could not write ROM cache '%s'\n"), cache_path);
+	g_string_free (out, TRUE);
+}
+
+static int romscan_threads (int jobs)
+{
+	int num = g_get_num_processors ();
+	if (num > ROMSCAN_MAX_THREADS)
+		num = ROMSCAN_MAX_THREADS;
+	if (num > jobs)
+		num = jobs;
+	return num < 1 ? 1 : num;
 }
 
 extern "C" {
 
+/* Scan the NULL-terminated list of files, which may include archives, and
+ * add all known ROMs to the ROM list. Returns the number of ROMs added. */
+int amiga_scan_rom_files (const char **paths, const char *cache_path)
+{
+	GHashTable *files = g_hash_table_new (g_str_hash, g_str_equal);
+	uae_thread_id threads[ROMSCAN_MAX_THREADS];
+	int jobs = 0, added = 0;
+
+	for (romscan_count = 0; paths[romscan_count]; romscan_count++);
+	romscan_files = xcalloc (struct romscan_file, romscan_count);
+	for (int i = 0; i < romscan_count; i++) {
+		struct romscan_file *rf = &romscan_files[i];
+		struct fs_stat st;
+		rf->path = paths[i];
+		if (fs_stat (rf->path, &st) != 0)
+			continue;
+		rf->size = st.size;
+		rf->mtime = st.mtime;
+		rf->archive = romscan_is_archive (rf->path);
+		rf->scan = true;
+		g_hash_table_insert (files, (gpointer) rf->path, rf);
+	}
+	if (cache_path)
+		romscan_read_cache (cache_path, files);
+	g_hash_table_destroy (files);
+	for (int i = 0; i < romscan_count; i++) {
+		if (romscan_files[i].scan)
+			jobs++;
+	}
+	write_log (_T ("ROM scan: %d files, %d not cached\n"), romscan_count, jobs);
+
+	if (jobs) {
+		int num = romscan_threads (jobs);
+		/* initialize the CRC table before the threads use it */
+		get_crc32 (NULL, 0);
+		romscan_next = 0;
+		uae_sem_init (&romscan_sem, 0, 1);
+		uae_sem_init (&romscan_zfile_sem, 0, 1);
+		for (int i = 0; i < num; i++) {
+			if (!uae_start_thread (_T ("romscan"), romscan_thread, NULL, &threads[i])) {
+				num = i;
+				break;
+			}
+		}
+		if (!num)
+			romscan_thread (NULL);
+		for (int i = 0; i < num; i++) {
+			uae_wait_thread (threads[i]);
+			uae_end_thread (&threads[i]);
+		}
+		uae_sem_destroy (&romscan_sem);
+		uae_sem_destroy (&romscan_zfile_sem);
+		if (cache_path)
+			romscan_write_cache (cache_path);
+	}
+
+	for (int i = 0; i < romscan_count; i++) {
+		struct romscan_file *rf = &romscan_files[i];
+		for (int j = 0; j < rf->num; j++) {
+			struct romscan_rom *r = &rf->roms[j];
+			struct romdata *rd = NULL;
+			if (r->id)
+				rd = getromdatabyidgroup (r->id, r->group >> 16, r->group & 0xffff);
+			if (rd) {
+				romlist_add (r->name, rd);
+				added++;
+			}
+			xfree (r->name);
+		}
+		xfree (rf->roms);
+	}
+	xfree (romscan_files);
+	romscan_files = NULL;
+	romscan_count = 0;
+	write_log (_T ("ROM scan: %d ROMs added\n"), added);
+	return added;
+}
+
 void amiga_add_key_dir (const char *path)
 {
 	char *p = g_build_filename (path, "rom.key", NULL);
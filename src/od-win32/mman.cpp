@@ -724,6 +724,7 @@ void mapped_free (addrbank *ab)
 	shmpiece *x = shm_start;
 	bool rtgmem = (ab->flags & ABFLAG_RTG) != 0;
 
+	memory_clear_direct(ab);
 	ab->flags &= ~ABFLAG_MAPPED;
 	if (ab->baseaddr == NULL)
 		return;
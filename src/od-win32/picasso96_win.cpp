@@ -52,6 +52,7 @@
 #include "options.h"
 #include "threaddep/thread.h"
 #include "uae/memory.h"
+#include "uae/time.h"
 #include "custom.h"
 #include "events.h"
 #include "newcpu.h"
@@ -447,6 +448,117 @@ static void **gwwbuf[MAX_RTG_BOARDS];
 static int gwwbufsize[MAX_RTG_BOARDS], gwwpagesize[MAX_RTG_BOARDS], gwwpagemask[MAX_RTG_BOARDS];
 extern uae_u8 *natmem_offset;
 
+#ifdef FSUAE
+/* Software write watch for the uaegfx VRAM banks, one byte per page.
+* CPU writes go through the gfxmem put handlers (RTG banks never get
+* direct write access) and the P96 functions mark the rectangles they
+* render to. A VRAM pointer handed to anything else sets rtg_dirty_all
+* and the next refresh converts the whole screen.  */
+#define RTG_DIRTY_PAGE_SHIFT 12
+#define RTG_DIRTY_PAGE_SIZE (1 << RTG_DIRTY_PAGE_SHIFT)
+static uae_u8 *rtg_dirty_map[MAX_RTG_BOARDS];
+static int rtg_dirty_pages[MAX_RTG_BOARDS];
+static volatile bool rtg_dirty_all[MAX_RTG_BOARDS];
+static thread_local bool p96_xlate_tracked;
+
+static void rtg_dirty_alloc(int index, int size)
+{
+	addrbank *ab = gfxmem_banks[index];
+
+	if (ab && ab->mask + 1 > size)
+		size = ab->mask + 1;
+	xfree(rtg_dirty_map[index]);
+	// one extra page for accesses crossing the end of the bank
+	rtg_dirty_pages[index] = (size >> RTG_DIRTY_PAGE_SHIFT) + 1;
+	rtg_dirty_map[index] = xcalloc(uae_u8, rtg_dirty_pages[index]);
+	rtg_dirty_all[index] = true;
+}
+
+STATIC_INLINE void rtg_dirty_put(int index, uaecptr offset, int size)
+{
+	uae_u8 *map = rtg_dirty_map[index];
+	if (map) {
+		map[offset >> RTG_DIRTY_PAGE_SHIFT] = 1;
+		map[(offset + size - 1) >> RTG_DIRTY_PAGE_SHIFT] = 1;
+	}
+}
+
+static void rtg_dirty_xlate(int index)
+{
+	if (!p96_xlate_tracked)
+		rtg_dirty_all[index] = true;
+}
+
+/* Collect and clear the dirty pages of src_start..src_end, like
+* GetWriteWatch() with WRITE_WATCH_FLAG_RESET.  */
+static uintptr_t rtg_getwritewatch(int index, uae_u8 *src, uae_u8 *src_start, uae_u8 *src_end, void **buf, uintptr_t max)
+{
+	uae_u8 *map = rtg_dirty_map[index];
+	int first = (src_start - src) >> RTG_DIRTY_PAGE_SHIFT;
+	int last = (src_end - src + RTG_DIRTY_PAGE_SIZE - 1) >> RTG_DIRTY_PAGE_SHIFT;
+	uintptr_t cnt = 0;
+
+	if (map && last > rtg_dirty_pages[index])
+		last = rtg_dirty_pages[index];
+	/* JIT direct memory access bypasses the bank handlers, and without
+	* fsemu the RTG buffer is not kept between frames.  */
+	if (!map || rtg_dirty_all[index] || (currprefs.cachesize && canbang) || !fsemu) {
+		rtg_dirty_all[index] = false;
+		if (map)
+			memset(map + first, 0, last - first);
+		for (int i = first; i < last && cnt < max; i++)
+			buf[cnt++] = src + ((uae_u32)i << RTG_DIRTY_PAGE_SHIFT);
+		return cnt;
+	}
+	for (int i = first; i < last && cnt < max; i++) {
+		if (map[i]) {
+			map[i] = 0;
+			buf[cnt++] = src + ((uae_u32)i << RTG_DIRTY_PAGE_SHIFT);
+		}
+	}
+	return cnt;
+}
+#endif
+
+/* VRAM pointer for a P96 function, which marks what it renders with
+* p96_mark_dirty().  */
+static uae_u8 *p96_get_real_address(uaecptr addr)
+{
+#ifdef FSUAE
+	p96_xlate_tracked = true;
+	uae_u8 *p = get_real_address(addr);
+	p96_xlate_tracked = false;
+	return p;
+#else
+	return get_real_address(addr);
+#endif
+}
+
+static void p96_mark_dirty(struct RenderInfo *ri, uae_u32 X, uae_u32 Y, uae_u32 Width, uae_u32 Height, int Bpp)
+{
+#ifdef FSUAE
+	uae_u32 len = Width * Bpp;
+
+	if (!len || !Height)
+		return;
+	for (int i = 0; i < MAX_RTG_BOARDS; i++) {
+		addrbank *ab = gfxmem_banks[i];
+		uae_u8 *map = rtg_dirty_map[i];
+		if (!ab || !map || ri->AMemory - ab->start >= ab->allocated_size)
+			continue;
+		uae_u32 start = ri->AMemory - ab->start + Y * ri->BytesPerRow + X * Bpp;
+		for (uae_u32 y = 0; y < Height; y++, start += ri->BytesPerRow) {
+			uae_u32 end = start + len - 1;
+			if (end >= ab->allocated_size)
+				break;
+			for (uae_u32 p = start >> RTG_DIRTY_PAGE_SHIFT; p <= end >> RTG_DIRTY_PAGE_SHIFT; p++)
+				map[p] = 1;
+		}
+		return;
+	}
+#endif
+}
+
 static uae_u8 GetBytesPerPixel (uae_u32 RGBfmt)
 {
 	switch (RGBfmt)
@@ -524,7 +636,7 @@ static int CopyRenderInfoStructureA2U(TrapContext *ctx, uaecptr amigamemptr, str
 		trap_multi(ctx, md, sizeof md / sizeof(struct trapmd));
 		uaecptr memp = md[0].params[0];
 		ri->AMemory = memp;
-		ri->Memory = get_real_address (memp);
+		ri->Memory = p96_get_real_address(memp);
 		ri->BytesPerRow = md[1].params[0];
 		ri->RGBFormat = (RGBFTYPE)md[2].params[0];
 		// Can't really validate this better at this point, no height.
@@ -553,7 +665,7 @@ static int CopyPatternStructureA2U(TrapContext *ctx, uaecptr amigamemptr, struct
 		if (trap_is_indirect())
 			pattern->Memory = NULL;
 		else
-			pattern->Memory = get_real_address(memp);
+			pattern->Memory = p96_get_real_address(memp);
 		pattern->AMemory = memp;
 		pattern->XOffset = md[1].params[0];
 		pattern->YOffset = md[2].params[0];
@@ -609,7 +721,7 @@ static int CopyBitMapStructureA2U(TrapContext *ctx, uaecptr amigamemptr, struct
 			break;
 		default:
 			if (!trap_is_indirect() && trap_valid_address(ctx, plane, bm->BytesPerRow * bm->Rows))
-				bm->Planes[i] = get_real_address(plane);
+				bm->Planes[i] = p96_get_real_address(plane);
 			else
 				bm->Planes[i] = &all_zeros_bitmap;
 			break;
@@ -636,7 +748,7 @@ static int CopyTemplateStructureA2U(TrapContext *ctx, uaecptr amigamemptr, struc
 		if (trap_is_indirect())
 			tmpl->Memory = NULL;
 		else
-			tmpl->Memory = get_real_address(memp);
+			tmpl->Memory = p96_get_real_address(memp);
 		tmpl->AMemory = memp;
 		tmpl->BytesPerRow = md[1].params[0];
 		tmpl->XOffset = md[2].params[0];
@@ -684,6 +796,244 @@ static void AmigaListAddTail(TrapContext *ctx, uaecptr l, uaecptr n)
 	trap_put_long(ctx, l + 8, n); // l->lh_TailPred = n;
 }
 
+/* SIMD versions of the blit primitives. The raster operations of the
+* p96_blit.cpp templates are bitwise, at every depth they work on the
+* Width * Bpp bytes of each row, so one set of byte kernels covers
+* 8/16/24/32-bit. Fills repeat a 48 byte pen pattern, BlitTemplate and
+* BlitPattern expand 16 mask bits to byte masks. p96_blit_select()
+* checks them against the scalar code before they are used.  */
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define P96_BLIT_SIMD 1
+#include <immintrin.h>
+#endif
+
+// -1 = not selected yet, 0 = scalar, 1 = SSE2
+static int p96b_simd = -1;
+static void p96_blit_select (void);
+
+STATIC_INLINE bool p96_blit_simd (void)
+{
+	if (p96b_simd < 0)
+		p96_blit_select ();
+	return p96b_simd > 0;
+}
+
+struct p96_expand {
+	// 16 pixels of each pen
+	uae_u8 fg[64], bg[64];
+	int Bpp, mode;
+	uae_u8 mask, comp;
+};
+
+#ifdef P96_BLIT_SIMD
+
+typedef void (*p96_rop_func)(uae_u8 *src, uae_u8 *dst, int bytes, int h, int srcpitch, int dstpitch);
+
+#define P96_ROP_SSE2(name, vop, op) \
+__attribute__((target("sse2"))) \
+static void name (uae_u8 *src, uae_u8 *dst, int bytes, int h, int srcpitch, int dstpitch) \
+{ \
+	__m128i ones = _mm_set1_epi32 (-1); \
+	(void)ones; \
+	for (int y = 0; y < h; y++, src += srcpitch, dst += dstpitch) { \
+		int x; \
+		for (x = 0; x + 16 <= bytes; x += 16) { \
+			__m128i s = _mm_loadu_si128 ((__m128i*)(src + x)); \
+			__m128i d = _mm_loadu_si128 ((__m128i*)(dst + x)); \
+			(void)s; (void)d; \
+			_mm_storeu_si128 ((__m128i*)(dst + x), vop); \
+		} \
+		for (; x < bytes; x++) { \
+			uae_u8 s = src[x], d = dst[x]; \
+			(void)s; (void)d; \
+			dst[x] = op; \
+		} \
+	} \
+}
+
+P96_ROP_SSE2(p96_rop_false_sse2, _mm_setzero_si128 (), 0)
+P96_ROP_SSE2(p96_rop_nor_sse2, _mm_xor_si128 (_mm_or_si128 (s, d), ones), ~(s | d))
+P96_ROP_SSE2(p96_rop_onlydst_sse2, _mm_andnot_si128 (s, d), d & ~s)
+P96_ROP_SSE2(p96_rop_notsrc_sse2, _mm_xor_si128 (s, ones), ~s)
+P96_ROP_SSE2(p96_rop_onlysrc_sse2, _mm_andnot_si128 (d, s), s & ~d)
+P96_ROP_SSE2(p96_rop_notdst_sse2, _mm_xor_si128 (d, ones), ~d)
+P96_ROP_SSE2(p96_rop_eor_sse2, _mm_xor_si128 (s, d), s ^ d)
+P96_ROP_SSE2(p96_rop_nand_sse2, _mm_xor_si128 (_mm_and_si128 (s, d), ones), ~(s & d))
+P96_ROP_SSE2(p96_rop_and_sse2, _mm_and_si128 (s, d), s & d)
+P96_ROP_SSE2(p96_rop_neor_sse2, _mm_xor_si128 (_mm_xor_si128 (s, d), ones), ~(s ^ d))
+P96_ROP_SSE2(p96_rop_notonlysrc_sse2, _mm_or_si128 (_mm_xor_si128 (s, ones), d), ~s | d)
+P96_ROP_SSE2(p96_rop_notonlydst_sse2, _mm_or_si128 (_mm_xor_si128 (d, ones), s), ~d | s)
+P96_ROP_SSE2(p96_rop_or_sse2, _mm_or_si128 (s, d), s | d)
+P96_ROP_SSE2(p96_rop_true_sse2, ones, 0xff)
+
+__attribute__((target("sse2")))
+static void p96_rop_swap_sse2 (uae_u8 *src, uae_u8 *dst, int bytes, int h, int srcpitch, int dstpitch)
+{
+	for (int y = 0; y < h; y++, src += srcpitch, dst += dstpitch) {
+		int x;
+		for (x = 0; x + 16 <= bytes; x += 16) {
+			__m128i s = _mm_loadu_si128 ((__m128i*)(src + x));
+			__m128i d = _mm_loadu_si128 ((__m128i*)(dst + x));
+			_mm_storeu_si128 ((__m128i*)(dst + x), s);
+			_mm_storeu_si128 ((__m128i*)(src + x), d);
+		}
+		for (; x < bytes; x++) {
+			uae_u8 tmp = dst[x];
+			dst[x] = src[x];
+			src[x] = tmp;
+		}
+	}
+}
+
+static p96_rop_func p96_rop_sse2 (int opcode)
+{
+	switch (opcode)
+	{
+	case BLIT_FALSE: return p96_rop_false_sse2;
+	case BLIT_NOR: return p96_rop_nor_sse2;
+	case BLIT_ONLYDST: return p96_rop_onlydst_sse2;
+	case BLIT_NOTSRC: return p96_rop_notsrc_sse2;
+	case BLIT_ONLYSRC: return p96_rop_onlysrc_sse2;
+	case BLIT_NOTDST: return p96_rop_notdst_sse2;
+	case BLIT_EOR: return p96_rop_eor_sse2;
+	case BLIT_NAND: return p96_rop_nand_sse2;
+	case BLIT_AND: return p96_rop_and_sse2;
+	case BLIT_NEOR: return p96_rop_neor_sse2;
+	case BLIT_NOTONLYSRC: return p96_rop_notonlysrc_sse2;
+	case BLIT_NOTONLYDST: return p96_rop_notonlydst_sse2;
+	case BLIT_OR: return p96_rop_or_sse2;
+	case BLIT_TRUE: return p96_rop_true_sse2;
+	case BLIT_SWAP: return p96_rop_swap_sse2;
+	}
+	return NULL;
+}
+
+/* The templates go forwards 4 bytes at a time, the kernels load 16
+* bytes before storing them. That only makes a difference if the
+* destination starts less than 16 bytes after the source (or before
+* it, for SWAP which writes both), or if areas with different pitches
+* overlap.  */
+static bool p96_rop_simd_safe (uae_u8 *src, uae_u8 *dst, int bytes, int h, int srcpitch, int dstpitch, int opcode)
+{
+	if (opcode == BLIT_FALSE || opcode == BLIT_NOTDST || opcode == BLIT_TRUE)
+		return true;
+	if (srcpitch == dstpitch) {
+		ptrdiff_t diff = dst - src;
+		if (opcode == BLIT_SWAP)
+			return diff == 0 || diff >= 16 || diff <= -16;
+		return diff <= 0 || diff >= 16;
+	}
+	uae_u8 *s0 = src, *s1 = src + (ptrdiff_t)(h - 1) * srcpitch;
+	uae_u8 *d0 = dst, *d1 = dst + (ptrdiff_t)(h - 1) * dstpitch;
+	if (srcpitch < 0) {
+		s0 = s1;
+		s1 = src;
+	}
+	if (dstpitch < 0) {
+		d0 = d1;
+		d1 = dst;
+	}
+	return s1 + bytes <= d0 || d1 + bytes <= s0;
+}
+
+// pat repeats every 48 bytes, enough for all pixel sizes
+__attribute__((target("sse2")))
+static void p96_fill_sse2 (uae_u8 *dst, int bytes, int h, int pitch, const uae_u8 *pat)
+{
+	__m128i p0 = _mm_loadu_si128 ((const __m128i*)(pat + 0));
+	__m128i p1 = _mm_loadu_si128 ((const __m128i*)(pat + 16));
+	__m128i p2 = _mm_loadu_si128 ((const __m128i*)(pat + 32));
+
+	for (int y = 0; y < h; y++, dst += pitch) {
+		int x;
+		for (x = 0; x + 48 <= bytes; x += 48) {
+			_mm_storeu_si128 ((__m128i*)(dst + x + 0), p0);
+			_mm_storeu_si128 ((__m128i*)(dst + x + 16), p1);
+			_mm_storeu_si128 ((__m128i*)(dst + x + 32), p2);
+		}
+		for (; x + 16 <= bytes; x += 16)
+			_mm_storeu_si128 ((__m128i*)(dst + x), _mm_loadu_si128 ((const __m128i*)(pat + x % 48)));
+		for (; x < bytes; x++)
+			dst[x] = pat[x % 48];
+	}
+}
+
+__attribute__((target("sse2")))
+static void p96_xor_sse2 (uae_u8 *p, int bytes, int h, int pitch, uae_u8 v)
+{
+	__m128i vv = _mm_set1_epi8 ((char)v);
+
+	for (int y = 0; y < h; y++, p += pitch) {
+		int x;
+		for (x = 0; x + 16 <= bytes; x += 16) {
+			__m128i d = _mm_loadu_si128 ((__m128i*)(p + x));
+			_mm_storeu_si128 ((__m128i*)(p + x), _mm_xor_si128 (d, vv));
+		}
+		for (; x < bytes; x++)
+			p[x] ^= v;
+	}
+}
+
+/* Mask bits of the bytes of 16 pixels: [Bpp - 1][vector][0-15] for
+* the high byte of the mask word, [16-31] for the low byte.  */
+static uae_u8 p96x_bits[4][4][32];
+
+/* Draw 16 pixels of BlitTemplate() or BlitPattern(), bit 15 of bits is
+* the first pixel. Same as the scalar loops with PixelWrite().  */
+__attribute__((target("sse2")))
+static void p96_expand16_sse2 (uae_u8 *dst, unsigned int bits, const struct p96_expand *e)
+{
+	__m128i zero = _mm_setzero_si128 ();
+	__m128i ones = _mm_cmpeq_epi8 (zero, zero);
+	__m128i hi = _mm_set1_epi8 ((char)(bits >> 8));
+	__m128i lo = _mm_set1_epi8 ((char)bits);
+	__m128i mask = _mm_set1_epi8 ((char)e->mask);
+	__m128i comp = _mm_set1_epi8 ((char)e->comp);
+	const uae_u8 *t = p96x_bits[e->Bpp - 1][0];
+
+	for (int i = 0; i < e->Bpp; i++, t += 32, dst += 16) {
+		__m128i sel = _mm_or_si128 (_mm_and_si128 (hi, _mm_loadu_si128 ((const __m128i*)t)),
+			_mm_and_si128 (lo, _mm_loadu_si128 ((const __m128i*)(t + 16))));
+		__m128i m = _mm_xor_si128 (_mm_cmpeq_epi8 (sel, zero), ones);
+		__m128i d = _mm_loadu_si128 ((__m128i*)dst);
+		if (e->mode == COMP) {
+			d = _mm_xor_si128 (d, _mm_and_si128 (m, comp));
+		} else {
+			__m128i other = e->mode == JAM2 ? _mm_loadu_si128 ((const __m128i*)(e->bg + i * 16)) : d;
+			__m128i p = _mm_or_si128 (_mm_and_si128 (m, _mm_loadu_si128 ((const __m128i*)(e->fg + i * 16))),
+				_mm_andnot_si128 (m, other));
+			d = _mm_or_si128 (_mm_and_si128 (p, mask), _mm_andnot_si128 (mask, d));
+		}
+		_mm_storeu_si128 ((__m128i*)dst, d);
+	}
+}
+
+#endif /* P96_BLIT_SIMD */
+
+/* Set up 16 pixel expansion for DrawMode mode, false if it has to
+* use the scalar loops. Pens are in host byte order. COMP at 24-bit
+* stays scalar, it inverts the 3 bytes after each pixel's first.  */
+static bool p96_expand_init (struct p96_expand *e, int Bpp, int mode, uae_u32 fgpen, uae_u32 bgpen, uae_u8 mask, uae_u8 comp)
+{
+	if (Bpp < 1 || Bpp > 4 || mode > COMP)
+		return false;
+	if (Bpp > 1)
+		mask = comp = 0xff;
+	for (int i = 0; i < 16 * Bpp; i++) {
+		e->fg[i] = fgpen >> ((i % Bpp) * 8);
+		e->bg[i] = bgpen >> ((i % Bpp) * 8);
+	}
+	e->Bpp = Bpp;
+	e->mode = mode;
+	e->mask = mask;
+	e->comp = comp;
+#ifdef P96_BLIT_SIMD
+	return !(mode == COMP && Bpp == 3) && p96_blit_simd ();
+#else
+	return false;
+#endif
+}
+
 /*
 * Fill a rectangle in the screen.
 */
@@ -695,6 +1045,15 @@ static void do_fillrect_frame_buffer(struct RenderInfo *ri, int X, int Y, int Wi
 
 	dst = ri->Memory + X * Bpp + Y * bpr;
 	endianswap (&Pen, Bpp);
+#ifdef P96_BLIT_SIMD
+	if (Bpp > 1 && p96_blit_simd ()) {
+		uae_u8 pat[48];
+		for (int i = 0; i < 48; i++)
+			pat[i] = Pen >> ((i % Bpp) * 8);
+		p96_fill_sse2 (dst, Width * Bpp, Height, bpr, pat);
+		return;
+	}
+#endif
 	switch (Bpp)
 	{
 	case 1:
@@ -1686,6 +2045,15 @@ static int do_blitrect_frame_buffer (struct RenderInfo *ri, struct
 
 		} else {
 
+#ifdef P96_BLIT_SIMD
+			// 8/16-bit SWAP templates keep a uae_u8/uae_u16 temp of 32-bit words, leave them as they are
+			if ((opcode != BLIT_SWAP || Bpp > 2) && p96_blit_simd () && p96_rop_simd_safe (src, dst, total_width, height, ri->BytesPerRow, dstri->BytesPerRow, opcode)) {
+				p96_rop_func rop = p96_rop_sse2 (opcode);
+				if (rop)
+					rop (src, dst, total_width, height, ri->BytesPerRow, dstri->BytesPerRow);
+				return 1;
+			}
+#endif
 			if (Bpp == 4) {
 
 				/* 32-bit optimized */
@@ -1943,7 +2311,7 @@ int createwindowscursor(int monid, uaecptr src, int w, int h, int hiressprite, i
 		ct = cursorrgbn;
 	}
 	datasize = h * ((w + 15) / 16) * 4;
-	realsrc = get_real_address (src);
+	realsrc = p96_get_real_address(src);
 
 	if (w > 64 || h > 64)
 		goto exit;
@@ -2440,7 +2808,12 @@ static void CopyLibResolutionStructureU2A(TrapContext *ctx, struct LibResolution
 void picasso_allocatewritewatch (int index, int gfxmemsize)
 {
 #ifdef FSUAE
-	/* FS-UAE does not support write watch. */
+	/* Pages of the software write watch, see rtg_getwritewatch(). */
+	xfree (gwwbuf[index]);
+	gwwpagesize[index] = RTG_DIRTY_PAGE_SIZE;
+	gwwbufsize[index] = gfxmemsize / gwwpagesize[index] + 1;
+	gwwpagemask[index] = gwwpagesize[index] - 1;
+	gwwbuf[index] = xmalloc (void*, gwwbufsize[index]);
 #else
 	SYSTEM_INFO si;
 
@@ -2517,12 +2890,7 @@ static void init_alloc (TrapContext *ctx, int size)
 	write_log (_T("P96 RESINFO: %08X-%08X (%d,%d)\n"), picasso96_amem, picasso96_amemend, size / PSSO_ModeInfo_sizeof, size);
 	picasso_allocatewritewatch (0, gfxmem_bank.allocated_size);
 #ifdef FSUAE
-	printf("setting gwwpagesize to something...\n");
-	gwwpagesize[0] = 1024*1024*4; // FIXME:...
-
-	gwwbufsize[0] = gfxmem_bank.allocated_size / gwwpagesize[0] + 1;
-	gwwpagemask[0] = gwwpagesize[0] - 1;
-	gwwbuf[0] = xmalloc (void*, gwwbufsize[0]);
+	rtg_dirty_alloc(0, gfxmem_bank.allocated_size);
 #endif
 }
 
@@ -3416,6 +3784,19 @@ static void do_xor8 (uae_u8 *p, int w, uae_u32 v)
 	}
 }
 #endif
+
+static void do_invertrect_frame_buffer (uae_u8 *mem, int bytes, int h, int pitch, uae_u32 xorval)
+{
+#ifdef P96_BLIT_SIMD
+	if (p96_blit_simd ()) {
+		p96_xor_sse2 (mem, bytes, h, pitch, (uae_u8)xorval);
+		return;
+	}
+#endif
+	for (int lines = 0; lines < h; lines++, mem += pitch)
+		do_xor8 (mem, bytes, xorval);
+}
+
 /*
 * InvertRect:
 *
@@ -3442,7 +3823,6 @@ static uae_u32 REGPARAM2 picasso_InvertRect (TrapContext *ctx)
 	uae_u8 mask = (uae_u8)trap_get_dreg(ctx, 4);
 	int Bpp = GetBytesPerPixel (trap_get_dreg(ctx, 7));
 	uae_u32 xorval;
-	unsigned int lines;
 	struct RenderInfo ri;
 	uae_u8 *uae_mem, *rectstart;
 	unsigned long width_in_bytes;
@@ -3464,8 +3844,8 @@ static uae_u32 REGPARAM2 picasso_InvertRect (TrapContext *ctx)
 		width_in_bytes = Bpp * Width;
 		rectstart = uae_mem = ri.Memory + Y * ri.BytesPerRow + X * Bpp;
 
-		for (lines = 0; lines < Height; lines++, uae_mem += ri.BytesPerRow)
-			do_xor8 (uae_mem, width_in_bytes, xorval);
+		do_invertrect_frame_buffer (uae_mem, width_in_bytes, Height, ri.BytesPerRow, xorval);
+		p96_mark_dirty(&ri, X, Y, Width, Height, Bpp);
 		result = 1;
 	}
 
@@ -3544,6 +3924,8 @@ static uae_u32 REGPARAM2 picasso_FillRect(TrapContext *ctx)
 				result = 1;
 			}
 		}
+		if (result)
+			p96_mark_dirty(&ri, X, Y, Width, Height, Bpp);
 	}
 	return result;
 }
@@ -3625,7 +4007,9 @@ STATIC_INLINE int BlitRectHelper(TrapContext *ctx)
 		dstri = ri;
 	}
 	/* Do our virtual frame-buffer memory first */
-	return do_blitrect_frame_buffer(ri, dstri, srcx, srcy, dstx, dsty, width, height, mask, opcode);
+	int result = do_blitrect_frame_buffer(ri, dstri, srcx, srcy, dstx, dsty, width, height, mask, opcode);
+	p96_mark_dirty(dstri, dstx, dsty, width, height, Bpp);
+	return result;
 }
 
 static int BlitRect(TrapContext *ctx, uaecptr ri, uaecptr dstri,
@@ -3751,6 +4135,219 @@ STATIC_INLINE void PixelWrite(uae_u8 *mem, int bits, uae_u32 fgpen, int Bpp, uae
 	}
 }
 
+/* The scalar BlitTemplate() and BlitPattern() loops for 16 pixels,
+* to check and time p96_expand16_sse2() against.  */
+static void p96_expand16_scalar (uae_u8 *mem, unsigned int data, const struct p96_expand *e)
+{
+	uae_u32 fgpen = 0, bgpen = 0;
+
+	for (int i = 0; i < e->Bpp; i++) {
+		fgpen |= (uae_u32)e->fg[i] << (i * 8);
+		bgpen |= (uae_u32)e->bg[i] << (i * 8);
+	}
+	for (int bits = 0; bits < 16; bits++) {
+		int bit_set = data & 0x8000;
+		data <<= 1;
+		switch (e->mode)
+		{
+		case JAM1:
+			if (bit_set)
+				PixelWrite (mem, bits, fgpen, e->Bpp, e->mask);
+			break;
+		case JAM2:
+			PixelWrite (mem, bits, bit_set ? fgpen : bgpen, e->Bpp, e->mask);
+			break;
+		case COMP:
+			if (!bit_set)
+				break;
+			if (e->Bpp == 1)
+				mem[bits] ^= e->comp;
+			else if (e->Bpp == 2)
+				((uae_u16 *)mem)[bits] ^= 0xffff;
+			else if (e->Bpp == 4)
+				((uae_u32 *)mem)[bits] ^= 0xffffffff;
+			break;
+		}
+	}
+}
+
+static void p96_testdata (uae_u8 *p, int size, uae_u32 seed)
+{
+	for (int i = 0; i < size; i++) {
+		seed = seed * 1103515245 + 12345;
+		p[i] = seed >> 16;
+	}
+}
+
+static const RGBFTYPE p96_test_formats[] = { RGBFB_CLUT, RGBFB_R5G6B5PC, RGBFB_B8G8R8, RGBFB_A8R8G8B8 };
+
+#ifdef P96_BLIT_SIMD
+
+/* Run the scalar and SSE2 versions of every primitive on the same
+* random data, at all depths and at widths and offsets that hit the
+* 16 byte blocks and the byte tails. The raster operations are also
+* run on overlapping areas of one buffer.  */
+static bool p96_blit_check (void)
+{
+	const int pitch = 256, size = pitch * 4;
+	uae_u8 *buf = xmalloc (uae_u8, size * 4);
+	uae_u8 *a = buf, *b = buf + size * 2;
+	struct RenderInfo ri, dstri;
+	uae_u32 seed = 1;
+	bool ok = true;
+
+	for (int f = 0; f < 4 && ok; f++) {
+		int Bpp = f + 1;
+		memset (&ri, 0, sizeof ri);
+		ri.BytesPerRow = pitch;
+		ri.RGBFormat = p96_test_formats[f];
+		dstri = ri;
+		for (int w = 1; w <= 40 && ok; w++) {
+			int x = w % 5;
+			uae_u32 pen = 0x89abcdef * w;
+
+			p96_testdata (a, size * 2, seed++);
+			memcpy (b, a, size * 2);
+			p96b_simd = 0;
+			dstri.Memory = a;
+			do_fillrect_frame_buffer (&dstri, x, 1, w, 2, pen, Bpp);
+			do_invertrect_frame_buffer (a + size + x * Bpp, w * Bpp, 3, pitch, 0x01010101 * (pen & 0xff));
+			p96b_simd = 1;
+			dstri.Memory = b;
+			do_fillrect_frame_buffer (&dstri, x, 1, w, 2, pen, Bpp);
+			do_invertrect_frame_buffer (b + size + x * Bpp, w * Bpp, 3, pitch, 0x01010101 * (pen & 0xff));
+			ok = !memcmp (a, b, size * 2);
+
+			for (int op = BLIT_FALSE; op <= BLIT_SWAP && ok; op++) {
+				if ((op > BLIT_TRUE && op != BLIT_SWAP) || op == BLIT_SRC || op == BLIT_DST)
+					continue;
+				for (int overlap = 0; overlap < 2 && ok; overlap++) {
+					int dstx = overlap ? x + w % 7 + 1 : 3;
+					int dsty = overlap ? 0 : 1;
+					p96_testdata (a, size * 2, seed++);
+					memcpy (b, a, size * 2);
+					for (int simd = 0; simd < 2; simd++) {
+						uae_u8 *p = simd ? b : a;
+						p96b_simd = simd;
+						ri.Memory = p;
+						dstri.Memory = overlap ? p : p + size;
+						do_blitrect_frame_buffer (&ri, &dstri, x, 0, dstx, dsty, w, 3, 0xff, (BLIT_OPCODE)op);
+					}
+					ok = !memcmp (a, b, size * 2);
+				}
+			}
+
+			for (int mode = JAM1; mode <= COMP && ok; mode++) {
+				struct p96_expand e;
+				uae_u8 mask = Bpp == 1 && (w & 1) ? 0x3c : 0xff;
+				unsigned int bits = w == 1 ? 0 : (w == 2 ? 0xffff : (w * 0x9e3779b9) >> 16);
+				if (!p96_expand_init (&e, Bpp, mode, pen, ~pen, mask, mask))
+					continue;
+				p96_testdata (a, size, seed++);
+				memcpy (b, a, size);
+				p96_expand16_scalar (a + x * Bpp, bits, &e);
+				p96_expand16_sse2 (b + x * Bpp, bits, &e);
+				ok = !memcmp (a, b, size);
+			}
+		}
+	}
+	xfree (buf);
+	return ok;
+}
+
+#endif /* P96_BLIT_SIMD */
+
+static void p96_blit_select (void)
+{
+	p96b_simd = 0;
+#ifdef P96_BLIT_SIMD
+	__builtin_cpu_init ();
+	if (!__builtin_cpu_supports ("sse2")) {
+		write_log (_T("P96: scalar blits\n"));
+		return;
+	}
+	for (int Bpp = 1; Bpp <= 4; Bpp++) {
+		for (int i = 0; i < Bpp * 16; i++) {
+			int pixel = i / Bpp;
+			p96x_bits[Bpp - 1][i / 16][i % 16] = pixel < 8 ? 0x80 >> pixel : 0;
+			p96x_bits[Bpp - 1][i / 16][16 + i % 16] = pixel >= 8 ? 0x80 >> (pixel - 8) : 0;
+		}
+	}
+	bool ok = p96_blit_check ();
+	p96b_simd = ok ? 1 : 0;
+	write_log (_T("P96: %s blits\n"), ok ? _T("SSE2") : _T("scalar (SSE2 self-test failed)"));
+#endif
+}
+
+/* Debugger "B p96": time the scalar and SIMD blit primitives on a
+* 640x480 screen at every depth.  */
+void picasso96_benchmark (void)
+{
+	const int width = 640, height = 480, loops = 20;
+	const int pitch = width * 4, size = pitch * height;
+	static const TCHAR *names[] = { _T("fill"), _T("invert"), _T("eor"), _T("template") };
+	uae_u8 *a = xmalloc (uae_u8, size * 2);
+	uae_u8 *b = a + size;
+	int best = p96_blit_simd () ? 1 : 0;
+	struct RenderInfo ri, dstri;
+
+	p96_testdata (a, size * 2, 1);
+	for (int f = 0; f < 4; f++) {
+		int Bpp = f + 1;
+		struct p96_expand e;
+		memset (&ri, 0, sizeof ri);
+		ri.Memory = a;
+		ri.BytesPerRow = pitch;
+		ri.RGBFormat = p96_test_formats[f];
+		dstri = ri;
+		dstri.Memory = b;
+		p96_expand_init (&e, Bpp, JAM2, 0x00ffffff, 0, 0xff, 0xff);
+		for (int test = 0; test < 4; test++) {
+			double base = 0;
+			for (int mode = 0; mode <= best; mode++) {
+				p96b_simd = mode;
+				int64_t t = uae_time_us ();
+				for (int i = 0; i < loops; i++) {
+					switch (test)
+					{
+					case 0:
+						do_fillrect_frame_buffer (&dstri, 0, 0, width, height, 0x12345678 + i, Bpp);
+						break;
+					case 1:
+						do_invertrect_frame_buffer (b, width * Bpp, height, pitch, 0xffffffff);
+						break;
+					case 2:
+						do_blitrect_frame_buffer (&ri, &dstri, 0, 0, 0, 0, width, height, 0xff, BLIT_EOR);
+						break;
+					case 3:
+						for (int y = 0; y < height; y++) {
+							uae_u8 *p = b + y * pitch;
+							unsigned int bits = 0x3c66 ^ (y * 0x0101);
+							for (int x = 0; x < width; x += 16, p += 16 * Bpp) {
+#ifdef P96_BLIT_SIMD
+								if (mode)
+									p96_expand16_sse2 (p, bits, &e);
+								else
+#endif
+									p96_expand16_scalar (p, bits, &e);
+							}
+						}
+						break;
+					}
+				}
+				t = uae_time_us () - t;
+				double us = (double)t / loops;
+				if (mode == 0)
+					base = us;
+				console_out_f (_T("%2d-bit %-8s %-6s %8.1f us/screen %5.2fx\n"),
+					Bpp * 8, names[test], mode ? _T("SSE2") : _T("scalar"), us, us > 0 ? base / us : 0.0);
+			}
+		}
+	}
+	p96b_simd = best;
+	xfree (a);
+}
+
 /*
 * BlitPattern:
 *
@@ -3835,6 +4432,11 @@ static uae_u32 REGPARAM2 picasso_BlitPattern (TrapContext *ctx)
 			bgpen = pattern.BgPen;
 			endianswap (&bgpen, Bpp);
 
+#ifdef P96_BLIT_SIMD
+			struct p96_expand ex;
+			bool simd = p96_expand_init (&ex, Bpp, pattern.DrawMode, fgpen, bgpen, Mask, 0xff & Mask);
+#endif
+
 			uae_u16 *tmplbuf = NULL;
 			if (indirect) {
 				tmplbuf = xcalloc(uae_u16, 1 << pattern.Size);
@@ -3864,6 +4466,14 @@ static uae_u32 REGPARAM2 picasso_BlitPattern (TrapContext *ctx)
 					if (max > 16)
 						max = 16;
 
+#ifdef P96_BLIT_SIMD
+					if (simd && max == 16) {
+						if (inversion && pattern.DrawMode != COMP)
+							data = ~data;
+						p96_expand16_sse2 (uae_mem2, data & 0xffff, &ex);
+						continue;
+					}
+#endif
 					switch (pattern.DrawMode)
 					{
 					case JAM1:
@@ -3930,6 +4540,7 @@ static uae_u32 REGPARAM2 picasso_BlitPattern (TrapContext *ctx)
 			}
 			result = 1;
 			xfree(tmplbuf);
+			p96_mark_dirty(&ri, X, Y, W, H, Bpp);
 		}
 	}
 
@@ -4018,6 +4629,11 @@ static uae_u32 REGPARAM2 picasso_BlitTemplate(TrapContext *ctx)
 			bgpen = tmp.BgPen;
 			endianswap (&bgpen, Bpp);
 
+#ifdef P96_BLIT_SIMD
+			struct p96_expand ex;
+			bool simd = p96_expand_init (&ex, Bpp, tmp.DrawMode, fgpen, bgpen, (uae_u8)Mask, 0xff);
+#endif
+
 			uae_u8 *tmpl_buffer = NULL;
 			if (indirect) {
 				int tmpl_size = H * tmp.BytesPerRow * Bpp;
@@ -4034,9 +4650,20 @@ static uae_u32 REGPARAM2 picasso_BlitTemplate(TrapContext *ctx)
 				uae_u8 *tmpl_mem = tmpl_base;
 				unsigned int data;
 				
+				cols = 0;
+#ifdef P96_BLIT_SIMD
+				if (simd) {
+					for (; cols + 16 <= W; cols += 16, uae_mem2 += Bpp * 16, tmpl_mem += 2) {
+						unsigned int bits = ((tmpl_mem[0] << 16) | (tmpl_mem[1] << 8) | tmpl_mem[2]) >> (8 - bitoffset);
+						if (inversion && tmp.DrawMode != COMP)
+							bits = ~bits;
+						p96_expand16_sse2 (uae_mem2, bits & 0xffff, &ex);
+					}
+				}
+#endif
 				data = *tmpl_mem;
 
-				for (cols = 0; cols < W; cols += 8, uae_mem2 += Bpp * 8) {
+				for (; cols < W; cols += 8, uae_mem2 += Bpp * 8) {
 					unsigned int byte;
 					long bits;
 					long max = W - cols;
@@ -4116,6 +4743,7 @@ static uae_u32 REGPARAM2 picasso_BlitTemplate(TrapContext *ctx)
 			}
 			result = 1;
 			xfree(tmpl_buffer);
+			p96_mark_dirty(&ri, X, Y, W, H, Bpp);
 		}
 	}
 
@@ -4324,6 +4952,7 @@ static uae_u32 REGPARAM2 picasso_BlitPlanar2Chunky (TrapContext *ctx)
 			srcx, srcy, dstx, dsty, width, height, minterm, mask, local_bm.Depth));
 		P96TRACE((_T("P2C - BitMap has %d BPR, %d rows\n"), local_bm.BytesPerRow, local_bm.Rows));
 		PlanarToChunky (ctx, &local_ri, &local_bm, srcx, srcy, dstx, dsty, width, height, mask);
+		p96_mark_dirty(&local_ri, dstx, dsty, width, height, GetBytesPerPixel(local_ri.RGBFormat));
 		result = 1;
 	}
 	return result;
@@ -4528,6 +5157,7 @@ static uae_u32 REGPARAM2 picasso_BlitPlanar2Direct (TrapContext *ctx)
 		P96TRACE((_T("BlitPlanar2Direct(%d, %d, %d, %d, %d, %d) Minterm 0x%x, Mask 0x%x, Depth %d\n"),
 			srcx, srcy, dstx, dsty, width, height, minterm, Mask, local_bm.Depth));
 		PlanarToDirect(ctx, &local_ri, &local_bm, srcx, srcy, dstx, dsty, width, height, Mask, cim);
+		p96_mark_dirty(&local_ri, dstx, dsty, width, height, GetBytesPerPixel(local_ri.RGBFormat));
 		result = 1;
 	}
 	return result;
@@ -4559,6 +5189,117 @@ void picasso_statusline(int monid, uae_u8 *dst)
 	}
 }
 
+/* SIMD versions of the copyrow() conversions to 32-bit. The byte shuffles
+* give exactly the same pixels as the scalar loops, the 15/16-bit one
+* computes what alloc_colors_picasso() put in p96_rgbx16 and is only used
+* after checking it against the whole table. They convert whole blocks
+* and return the number of pixels done, copyrow() does the rest.  */
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define P96_CONVERT_SIMD 1
+#include <immintrin.h>
+#endif
+
+enum { p96c_none, p96c_shuffle32, p96c_shuffle24, p96c_rgb16 };
+
+struct p96_rgb16_layout {
+	bool swap;
+	int shift[3], bits[3];
+};
+
+// convert mode the SIMD conversion is enabled for, -1 if none
+static int p96c_mode = -1;
+static int p96c_type;
+static uae_u8 p96c_shuffle[16];
+static struct p96_rgb16_layout p96c_layout;
+
+#ifdef P96_CONVERT_SIMD
+
+__attribute__((target("ssse3")))
+static int p96_shuffle32_ssse3 (const uae_u8 *src, uae_u32 *dst, int width)
+{
+	__m128i mask = _mm_loadu_si128 ((const __m128i*)p96c_shuffle);
+	int i;
+
+	for (i = 0; i + 4 <= width; i += 4) {
+		__m128i v = _mm_loadu_si128 ((const __m128i*)(src + i * 4));
+		_mm_storeu_si128 ((__m128i*)(dst + i), _mm_shuffle_epi8 (v, mask));
+	}
+	return i;
+}
+
+// 16 bytes are loaded for 4 pixels, stop before reading past the row
+__attribute__((target("ssse3")))
+static int p96_shuffle24_ssse3 (const uae_u8 *src, uae_u32 *dst, int width)
+{
+	__m128i mask = _mm_loadu_si128 ((const __m128i*)p96c_shuffle);
+	int i;
+
+	for (i = 0; i + 6 <= width; i += 4) {
+		__m128i v = _mm_loadu_si128 ((const __m128i*)(src + i * 3));
+		_mm_storeu_si128 ((__m128i*)(dst + i), _mm_shuffle_epi8 (v, mask));
+	}
+	return i;
+}
+
+struct p96_rgb16_consts {
+	__m128i shift[3], mask[3], up[3], lowmask[3], pos[3];
+};
+
+// one colour component to 8 bits like alloc_colors_picasso(): the value on top, its low bits below
+__attribute__((target("sse2")))
+static inline __m128i p96_rgb16_expand_sse2 (__m128i v, const struct p96_rgb16_consts *c)
+{
+	__m128i out = _mm_setzero_si128 ();
+	for (int i = 0; i < 3; i++) {
+		__m128i f = _mm_and_si128 (_mm_srl_epi32 (v, c->shift[i]), c->mask[i]);
+		f = _mm_or_si128 (_mm_sll_epi32 (f, c->up[i]), _mm_and_si128 (f, c->lowmask[i]));
+		out = _mm_or_si128 (out, _mm_sll_epi32 (f, c->pos[i]));
+	}
+	return out;
+}
+
+__attribute__((target("sse2")))
+static int p96_rgb16_sse2 (const uae_u8 *src, uae_u32 *dst, int width)
+{
+	const struct p96_rgb16_layout *l = &p96c_layout;
+	struct p96_rgb16_consts c;
+	__m128i zero = _mm_setzero_si128 ();
+	int i;
+
+	for (i = 0; i < 3; i++) {
+		int up = 8 - l->bits[i];
+		c.shift[i] = _mm_cvtsi32_si128 (l->shift[i]);
+		c.mask[i] = _mm_set1_epi32 ((1 << l->bits[i]) - 1);
+		c.up[i] = _mm_cvtsi32_si128 (up);
+		c.lowmask[i] = _mm_set1_epi32 ((1 << up) - 1);
+		c.pos[i] = _mm_cvtsi32_si128 (16 - i * 8);
+	}
+	for (i = 0; i + 8 <= width; i += 8) {
+		__m128i v = _mm_loadu_si128 ((const __m128i*)(src + i * 2));
+		if (l->swap)
+			v = _mm_or_si128 (_mm_slli_epi16 (v, 8), _mm_srli_epi16 (v, 8));
+		_mm_storeu_si128 ((__m128i*)(dst + i), p96_rgb16_expand_sse2 (_mm_unpacklo_epi16 (v, zero), &c));
+		_mm_storeu_si128 ((__m128i*)(dst + i + 4), p96_rgb16_expand_sse2 (_mm_unpackhi_epi16 (v, zero), &c));
+	}
+	return i;
+}
+
+static int p96_convert_simd (const uae_u8 *src, uae_u32 *dst, int width)
+{
+	switch (p96c_type)
+	{
+	case p96c_shuffle32:
+		return p96_shuffle32_ssse3 (src, dst, width);
+	case p96c_shuffle24:
+		return p96_shuffle24_ssse3 (src, dst, width);
+	case p96c_rgb16:
+		return p96_rgb16_sse2 (src, dst, width);
+	}
+	return 0;
+}
+
+#endif /* P96_CONVERT_SIMD */
+
 static void copyrow (int monid, uae_u8 *src, uae_u8 *dst, int x, int y, int width, int srcbytesperrow, int srcpixbytes, int dx, int dy, int dstbytesperrow, int dstpixbytes, bool direct, int convert_mode, uae_u32 *p96_rgbx16p)
 {
 	struct picasso_vidbuf_description *vidinfo = &picasso_vidinfo[monid];
@@ -4601,6 +5342,14 @@ static void copyrow (int monid, uae_u8 *src, uae_u8 *dst, int x, int y, int widt
 		}
 	}
 
+#ifdef P96_CONVERT_SIMD
+	if (convert_mode == p96c_mode && (p96c_type != p96c_rgb16 || p96_rgbx16p == p96_rgbx16)) {
+		int done = p96_convert_simd (src2 + x * srcpix, (uae_u32*)dst2 + dx, width);
+		x += done;
+		dx += done;
+	}
+#endif
+
 	endx4 = endx & ~3;
 
 	switch (convert_mode)
@@ -4836,6 +5585,158 @@ static void copyrow (int monid, uae_u8 *src, uae_u8 *dst, int x, int y, int widt
 	}
 }
 
+#ifdef P96_CONVERT_SIMD
+
+// compare against the scalar code, odd lengths included
+static bool p96_convert_check_shuffle (int mode, int srcpixbytes)
+{
+	static const int widths[] = { 1, 3, 4, 5, 6, 7, 9, 10, 17, 64, -1 };
+	uae_u8 *src = xmalloc (uae_u8, 64 * 4 + 4);
+	uae_u32 *out1 = xmalloc (uae_u32, 64);
+	uae_u32 *out2 = xmalloc (uae_u32, 64);
+	uae_u32 seed = 0x12345678;
+	bool ok = true;
+
+	for (int i = 0; i < 64 * 4 + 4; i++) {
+		seed = seed * 1103515245 + 12345;
+		src[i] = seed >> 16;
+	}
+	for (int i = 0; widths[i] >= 0 && ok; i++) {
+		int w = widths[i];
+		p96c_mode = -1;
+		copyrow (0, src, (uae_u8*)out1, 0, 0, w, 0, srcpixbytes, 0, 0, 0, 4, false, mode, p96_rgbx16);
+		p96c_mode = mode;
+		copyrow (0, src, (uae_u8*)out2, 0, 0, w, 0, srcpixbytes, 0, 0, 0, 4, false, mode, p96_rgbx16);
+		ok = !memcmp (out1, out2, w * sizeof (uae_u32));
+	}
+	p96c_mode = -1;
+	xfree (out2);
+	xfree (out1);
+	xfree (src);
+	return ok;
+}
+
+// every possible pixel against the table
+static bool p96_convert_check_rgb16 (void)
+{
+	uae_u16 *src = xmalloc (uae_u16, 65536);
+	uae_u32 *out = xmalloc (uae_u32, 65536);
+	bool ok;
+
+	for (int i = 0; i < 65536; i++)
+		src[i] = i;
+	ok = p96_rgb16_sse2 ((uae_u8*)src, out, 65536) == 65536 && !memcmp (out, p96_rgbx16, 65536 * sizeof (uae_u32));
+	xfree (out);
+	xfree (src);
+	return ok;
+}
+
+#endif /* P96_CONVERT_SIMD */
+
+/* Enable the SIMD conversion for convert_mode if there is one and it
+* gives the same result. The 15/16-bit check is repeated whenever
+* p96_rgbx16 has been rebuilt, the single bit entries identify it.  */
+static void p96_convert_select (int convert_mode)
+{
+#ifdef P96_CONVERT_SIMD
+	static int checked_mode = -1;
+	static uae_u32 checked_table[16];
+	static int cpu = -1;
+	uae_u32 table[16];
+	const uae_u8 *order = NULL;
+	struct p96_rgb16_layout *l = &p96c_layout;
+	int type = p96c_none, srcpixbytes = 4;
+	bool ok;
+
+	for (int i = 0; i < 16; i++)
+		table[i] = p96_rgbx16[1 << i];
+	if (convert_mode == checked_mode && !memcmp (table, checked_table, sizeof table))
+		return;
+	checked_mode = convert_mode;
+	memcpy (checked_table, table, sizeof table);
+	if (cpu < 0) {
+		__builtin_cpu_init ();
+		cpu = __builtin_cpu_supports ("ssse3") ? 2 : (__builtin_cpu_supports ("sse2") ? 1 : 0);
+	}
+	p96c_mode = -1;
+
+	// source byte offsets of blue, green and red
+	static const uae_u8 order_rgb[] = { 2, 1, 0 };
+	static const uae_u8 order_bgr[] = { 0, 1, 2 };
+	static const uae_u8 order_argb[] = { 3, 2, 1 };
+	static const uae_u8 order_abgr[] = { 1, 2, 3 };
+	memset (l, 0, sizeof (struct p96_rgb16_layout));
+	switch (convert_mode)
+	{
+	case RGBFB_R8G8B8A8_32:
+		type = p96c_shuffle32;
+		order = order_rgb;
+		break;
+	case RGBFB_A8R8G8B8_32:
+		type = p96c_shuffle32;
+		order = order_argb;
+		break;
+	case RGBFB_A8B8G8R8_32:
+		type = p96c_shuffle32;
+		order = order_abgr;
+		break;
+	case RGBFB_R8G8B8_32:
+		type = p96c_shuffle24;
+		order = order_rgb;
+		srcpixbytes = 3;
+		break;
+	case RGBFB_B8G8R8_32:
+		type = p96c_shuffle24;
+		order = order_bgr;
+		srcpixbytes = 3;
+		break;
+	case RGBFB_R5G6B5_32:
+		l->swap = true;
+		/* fall through */
+	case RGBFB_R5G6B5PC_32:
+		l->shift[0] = 11; l->shift[1] = 5; l->shift[2] = 0;
+		l->bits[0] = 5; l->bits[1] = 6; l->bits[2] = 5;
+		type = p96c_rgb16;
+		break;
+	case RGBFB_R5G5B5_32:
+		l->swap = true;
+		/* fall through */
+	case RGBFB_R5G5B5PC_32:
+		l->shift[0] = 10; l->shift[1] = 5; l->shift[2] = 0;
+		l->bits[0] = 5; l->bits[1] = 5; l->bits[2] = 5;
+		type = p96c_rgb16;
+		break;
+	case RGBFB_B5G6R5PC_32:
+		l->shift[0] = 0; l->shift[1] = 5; l->shift[2] = 11;
+		l->bits[0] = 5; l->bits[1] = 6; l->bits[2] = 5;
+		type = p96c_rgb16;
+		break;
+	case RGBFB_B5G5R5PC_32:
+		l->shift[0] = 0; l->shift[1] = 5; l->shift[2] = 10;
+		l->bits[0] = 5; l->bits[1] = 5; l->bits[2] = 5;
+		type = p96c_rgb16;
+		break;
+	}
+	if (type == p96c_none)
+		return;
+	if (order) {
+		for (int i = 0; i < 4; i++) {
+			for (int j = 0; j < 3; j++)
+				p96c_shuffle[i * 4 + j] = i * srcpixbytes + order[j];
+			p96c_shuffle[i * 4 + 3] = 0x80;
+		}
+	}
+	p96c_type = type;
+	if (type == p96c_rgb16)
+		ok = cpu >= 1 && p96_convert_check_rgb16 ();
+	else
+		ok = cpu >= 2 && p96_convert_check_shuffle (convert_mode, srcpixbytes);
+	if (ok)
+		p96c_mode = convert_mode;
+	write_log (_T("P96: %s pixel conversion for mode %d\n"), ok ? (type == p96c_rgb16 ? _T("SSE2") : _T("SSSE3")) : _T("scalar"), convert_mode);
+#endif
+}
+
 static uae_u16 yuvtorgb(uae_u8 yx, uae_u8 ux, uae_u8 vx)
 {
 	int y = yx - 16;
@@ -5473,6 +6374,7 @@ uae_u8 *getrtgbuffer(int monid, int *widthp, int *heightp, int *pitch, int *dept
 	hmode = pixbytes == 1 ? RGBFB_CLUT : RGBFB_B8G8R8A8;
 	convert = getconvert (state->RGBFormat, pixbytes);
 	alloc_colors_picasso(8, 8, 8, 16, 8, 0, state->RGBFormat, p96_rgbx16);
+	p96_convert_select(convert);
 
 	if (pixbytes > 1 && hmode != convert) {
 		copyall (monid, src + off, dst, width, height, state->BytesPerRow, state->BytesPerPixel, width * pixbytes, pixbytes, false, convert);
@@ -5507,6 +6409,232 @@ void freertgbuffer(int monid, uae_u8 *dst)
 	xfree (dst);
 }
 
+/* Changed parts of the screen, from the write watch pages. Each page is
+* turned into a span of pixels on every row it touches, rows with the
+* same span are merged into rectangles, sorted by y.  */
+struct rtg_dirty_rect {
+	int x, y, w, h;
+};
+
+struct rtg_dirty_state {
+	int rows;
+	int *x0, *x1;
+	struct rtg_dirty_rect *rects;
+};
+static struct rtg_dirty_state rtg_dirty_states[MAX_AMIGAMONITORS];
+
+static int rtg_dirty_rects(int monid, void **pages, int count, uae_u8 *src, int pagesize, int bytesperrow, int pixbytes, int pwidth, int pheight)
+{
+	struct rtg_dirty_state *ds = &rtg_dirty_states[monid];
+	int n = 0;
+
+	if (bytesperrow <= 0 || pixbytes <= 0)
+		return 0;
+	if (ds->rows < pheight) {
+		xfree(ds->x0);
+		xfree(ds->x1);
+		xfree(ds->rects);
+		ds->x0 = xmalloc(int, pheight);
+		ds->x1 = xmalloc(int, pheight);
+		ds->rects = xmalloc(struct rtg_dirty_rect, pheight);
+		ds->rows = pheight;
+	}
+	for (int y = 0; y < pheight; y++) {
+		ds->x0[y] = pwidth;
+		ds->x1[y] = 0;
+	}
+	for (int i = 0; i < count; i++) {
+		long start = (uae_u8*)pages[i] - src;
+		long end = start + pagesize;
+		if (end <= 0)
+			continue;
+		if (start < 0)
+			start = 0;
+		int y = start / bytesperrow;
+		int yend = (end - 1) / bytesperrow;
+		if (yend >= pheight)
+			yend = pheight - 1;
+		for (; y <= yend; y++) {
+			long rowstart = (long)y * bytesperrow;
+			long b0 = start > rowstart ? start - rowstart : 0;
+			long b1 = end < rowstart + bytesperrow ? end - rowstart : bytesperrow;
+			// pixels crossing the page boundary are included
+			int px0 = b0 / pixbytes;
+			int px1 = (b1 + pixbytes - 1) / pixbytes;
+			if (px1 > pwidth)
+				px1 = pwidth;
+			if (px0 >= px1)
+				continue;
+			if (px0 < ds->x0[y])
+				ds->x0[y] = px0;
+			if (px1 > ds->x1[y])
+				ds->x1[y] = px1;
+		}
+	}
+	for (int y = 0; y < pheight; y++) {
+		int x = ds->x0[y], w = ds->x1[y] - ds->x0[y];
+		if (w <= 0)
+			continue;
+		if (n > 0) {
+			struct rtg_dirty_rect *r = &ds->rects[n - 1];
+			if (r->y + r->h == y && r->x == x && r->w == w) {
+				r->h++;
+				continue;
+			}
+		}
+		ds->rects[n].x = x;
+		ds->rects[n].y = y;
+		ds->rects[n].w = w;
+		ds->rects[n].h = 1;
+		n++;
+	}
+	return n;
+}
+
+struct rtg_convert_job {
+	int monid;
+	struct rtg_dirty_rect *rects;
+	int numrects;
+	uae_u8 *src, *dst;
+	int srcbytesperrow, srcpixbytes;
+	int dstbytesperrow, dstpixbytes;
+	bool direct;
+	int convert_mode;
+};
+
+// convert the parts of the rectangles that are on rows first..last-1
+static void rtg_convert_rows(struct rtg_convert_job *job, int first, int last)
+{
+	for (int i = 0; i < job->numrects; i++) {
+		struct rtg_dirty_rect *r = &job->rects[i];
+		int y = r->y > first ? r->y : first;
+		int yend = r->y + r->h < last ? r->y + r->h : last;
+		for (; y < yend; y++) {
+			copyrow(job->monid, job->src, job->dst, r->x, y, r->w,
+				job->srcbytesperrow, job->srcpixbytes,
+				r->x, y, job->dstbytesperrow, job->dstpixbytes,
+				job->direct, job->convert_mode, p96_rgbx16);
+		}
+	}
+}
+
+/* Optional conversion threads (gfxcard_convert_threads). Large updates
+* are split into bands of rows with about the same number of changed
+* pixels, the calling thread converting the first band itself.  */
+#define MAX_CONVERT_THREADS 8
+#define CONVERT_THREAD_MIN_PIXELS (256 * 256)
+
+struct rtg_convert_thread {
+	uae_sem_t start;
+	struct rtg_convert_job *job;
+	int first, last;
+	volatile bool quit;
+};
+
+static struct rtg_convert_thread convert_threads[MAX_CONVERT_THREADS];
+static int convert_threads_num;
+static uae_sem_t convert_threads_done;
+
+static void *rtg_convert_thread_func(void *v)
+{
+	struct rtg_convert_thread *ct = (struct rtg_convert_thread*)v;
+
+	for (;;) {
+		uae_sem_wait(&ct->start);
+		if (ct->quit)
+			break;
+		rtg_convert_rows(ct->job, ct->first, ct->last);
+		uae_sem_post(&convert_threads_done);
+	}
+	uae_sem_post(&convert_threads_done);
+	return NULL;
+}
+
+static void rtg_convert_threads_free(void)
+{
+	for (int i = 0; i < convert_threads_num; i++) {
+		struct rtg_convert_thread *ct = &convert_threads[i];
+		ct->quit = true;
+		uae_sem_post(&ct->start);
+		uae_sem_wait(&convert_threads_done);
+		uae_sem_destroy(&ct->start);
+	}
+	if (convert_threads_num)
+		uae_sem_destroy(&convert_threads_done);
+	convert_threads_num = 0;
+}
+
+static int rtg_convert_threads_init(void)
+{
+	int num = currprefs.rtg_convert_threads;
+
+	if (num < 0)
+		num = 0;
+	if (num > MAX_CONVERT_THREADS)
+		num = MAX_CONVERT_THREADS;
+	if (num == convert_threads_num)
+		return num;
+	rtg_convert_threads_free();
+	if (!num)
+		return 0;
+	uae_sem_init(&convert_threads_done, 0, 0);
+	for (int i = 0; i < num; i++) {
+		struct rtg_convert_thread *ct = &convert_threads[i];
+		memset(ct, 0, sizeof(struct rtg_convert_thread));
+		uae_sem_init(&ct->start, 0, 0);
+		uae_start_thread(_T("rtgconvert"), rtg_convert_thread_func, ct, NULL);
+	}
+	convert_threads_num = num;
+	write_log(_T("%d RTG conversion threads started\n"), num);
+	return num;
+}
+
+static void rtg_convert(struct rtg_convert_job *job)
+{
+	int bounds[MAX_CONVERT_THREADS + 2];
+	int chunks = rtg_convert_threads_init() + 1;
+	long total = 0, done = 0;
+	int n, k, i;
+
+	p96_convert_select(job->convert_mode);
+	for (i = 0; i < job->numrects; i++)
+		total += (long)job->rects[i].w * job->rects[i].h;
+	if (total < chunks * CONVERT_THREAD_MIN_PIXELS)
+		chunks = total / CONVERT_THREAD_MIN_PIXELS;
+	if (chunks <= 1) {
+		rtg_convert_rows(job, 0, INT_MAX);
+		return;
+	}
+
+	// band boundaries at every total / chunks changed pixels
+	n = 0;
+	bounds[n++] = 0;
+	k = 1;
+	for (i = 0; i < job->numrects && k < chunks; i++) {
+		struct rtg_dirty_rect *r = &job->rects[i];
+		long area = (long)r->w * r->h;
+		while (k < chunks && done + area >= total * k / chunks) {
+			int b = r->y + (int)((total * k / chunks - done + r->w - 1) / r->w);
+			if (b > bounds[n - 1])
+				bounds[n++] = b;
+			k++;
+		}
+		done += area;
+	}
+	bounds[n] = INT_MAX;
+
+	for (i = 1; i < n; i++) {
+		struct rtg_convert_thread *ct = &convert_threads[i - 1];
+		ct->job = job;
+		ct->first = bounds[i];
+		ct->last = bounds[i + 1];
+		uae_sem_post(&ct->start);
+	}
+	rtg_convert_rows(job, bounds[0], bounds[1]);
+	for (i = 1; i < n; i++)
+		uae_sem_wait(&convert_threads_done);
+}
+
 void picasso_invalidate(int monid, int x, int y, int w, int h)
 {
 #ifdef FSUAE
@@ -5593,6 +6721,7 @@ void picasso_flushpixels(int index, uae_u8 *src, int off, bool render)
 			ULONG ps;
 			gwwcnt = gwwbufsize[index];
 #ifdef FSUAE
+			gwwcnt = rtg_getwritewatch(index, src, src_start, src_end, gwwbuf[index], gwwcnt);
 #else
 			if (mman_GetWriteWatch(src_start, src_end - src_start, gwwbuf[index], &gwwcnt, &ps))
 				break;
@@ -5620,17 +6749,29 @@ void picasso_flushpixels(int index, uae_u8 *src, int off, bool render)
 			break;
 		}
 
+		struct rtg_convert_job job;
+		job.monid = monid;
+		job.src = src + off;
+		job.dst = dst;
+		job.srcbytesperrow = state->BytesPerRow;
+		job.srcpixbytes = state->BytesPerPixel;
+		job.dstbytesperrow = vidinfo->rowbytes;
+		job.dstpixbytes = vidinfo->pixbytes;
+		job.direct = state->RGBFormat == vidinfo->host_mode;
+		job.convert_mode = vidinfo->picasso_convert;
+
 		if (dofull) {
-			if (flashscreen != 0)
+			if (flashscreen != 0) {
 				copyallinvert(monid, src + off, dst, pwidth, pheight,
 					state->BytesPerRow, state->BytesPerPixel,
 					vidinfo->rowbytes, vidinfo->pixbytes,
 					state->RGBFormat == vidinfo->host_mode, vidinfo->picasso_convert);
-			else
-				copyall(monid, src + off, dst, pwidth, pheight,
-					state->BytesPerRow, state->BytesPerPixel,
-					vidinfo->rowbytes, vidinfo->pixbytes,
-					state->RGBFormat == vidinfo->host_mode, vidinfo->picasso_convert);
+			} else {
+				struct rtg_dirty_rect full = { 0, 0, pwidth, pheight };
+				job.rects = &full;
+				job.numrects = 1;
+				rtg_convert(&job);
+			}
 
 			miny = 0;
 			maxy = pheight;
@@ -5638,49 +6779,18 @@ void picasso_flushpixels(int index, uae_u8 *src, int off, bool render)
 			break;
 		}
 
-		for (int i = 0; i < gwwcnt; i++) {
-			uae_u8 *p = (uae_u8*)gwwbuf[index][i];
-
-			if (p >= src_start && p < src_end) {
-				int y, x, realoffset;
-
-				if (p >= src + off) {
-					realoffset = p - (src + off);
-				} else {
-					realoffset = 0;
-				}
-
-				y = realoffset / state->BytesPerRow;
-				if (y < pheight) {
-					int w = gwwpagesize[index] / state->BytesPerPixel;
-					x = (realoffset % state->BytesPerRow) / state->BytesPerPixel;
-					if (x < pwidth) {
-						copyrow(monid, src + off, dst, x, y, pwidth - x,
-							state->BytesPerRow, state->BytesPerPixel,
-							x, y, vidinfo->rowbytes, vidinfo->pixbytes,
-							state->RGBFormat == vidinfo->host_mode, vidinfo->picasso_convert, p96_rgbx16);
-						flushlines++;
-					}
-					w = (gwwpagesize[index] - (state->BytesPerRow - x * state->BytesPerPixel)) / state->BytesPerPixel;
-					if (y < miny)
-						miny = y;
-					y++;
-					while (y < pheight && w > 0) {
-						int maxw = w > pwidth ? pwidth : w;
-						copyrow(monid, src + off, dst, 0, y, maxw,
-							state->BytesPerRow, state->BytesPerPixel,
-							0, y, vidinfo->rowbytes, vidinfo->pixbytes,
-							state->RGBFormat == vidinfo->host_mode, vidinfo->picasso_convert, p96_rgbx16);
-						w -= maxw;
-						y++;
-						flushlines++;
-					}
-					if (y > maxy)
-						maxy = y;
-				}
-
-			}
-
+		job.numrects = rtg_dirty_rects(monid, gwwbuf[index], gwwcnt, src + off, gwwpagesize[index],
+			state->BytesPerRow, state->BytesPerPixel, pwidth, pheight);
+		job.rects = rtg_dirty_states[monid].rects;
+		if (job.numrects > 0) {
+			struct rtg_dirty_rect *last = &job.rects[job.numrects - 1];
+			rtg_convert(&job);
+			for (int i = 0; i < job.numrects; i++)
+				flushlines += job.rects[i].h;
+			if (job.rects[0].y < miny)
+				miny = job.rects[0].y;
+			if (last->y + last->h > maxy)
+				maxy = last->y + last->h;
 		}
 		break;
 	}
@@ -5751,8 +6861,52 @@ static void *render_thread(void *v)
 	return 0;
 }
 
+#ifdef FSUAE
+/* Like MEMORY_FUNCTIONS() but the writes mark the software write watch
+* pages, and xlate'd pointers force a full refresh.  */
+#define RTG_MEMORY_FUNCTIONS(name, index) \
+MEMORY_LGET(name); \
+MEMORY_WGET(name); \
+MEMORY_BGET(name); \
+MEMORY_CHECK(name); \
+static void REGPARAM3 name ## _lput (uaecptr, uae_u32) REGPARAM; \
+static void REGPARAM2 name ## _lput (uaecptr addr, uae_u32 l) \
+{ \
+	addr -= name ## _bank.startaccessmask; \
+	addr &= name ## _bank.mask; \
+	do_put_mem_long ((uae_u32 *)(name ## _bank.baseaddr + addr), l); \
+	rtg_dirty_put (index, addr, 4); \
+} \
+static void REGPARAM3 name ## _wput (uaecptr, uae_u32) REGPARAM; \
+static void REGPARAM2 name ## _wput (uaecptr addr, uae_u32 w) \
+{ \
+	addr -= name ## _bank.startaccessmask; \
+	addr &= name ## _bank.mask; \
+	do_put_mem_word ((uae_u16 *)(name ## _bank.baseaddr + addr), w); \
+	rtg_dirty_put (index, addr, 2); \
+} \
+static void REGPARAM3 name ## _bput (uaecptr, uae_u32) REGPARAM; \
+static void REGPARAM2 name ## _bput (uaecptr addr, uae_u32 b) \
+{ \
+	addr -= name ## _bank.startaccessmask; \
+	addr &= name ## _bank.mask; \
+	name ## _bank.baseaddr[addr] = b; \
+	rtg_dirty_put (index, addr, 1); \
+} \
+static uae_u8 *REGPARAM3 name ## _xlate (uaecptr addr) REGPARAM; \
+static uae_u8 *REGPARAM2 name ## _xlate (uaecptr addr) \
+{ \
+	rtg_dirty_xlate (index); \
+	addr -= name ## _bank.startaccessmask; \
+	addr &= name ## _bank.mask; \
+	return name ## _bank.baseaddr + addr; \
+}
+#else
+#define RTG_MEMORY_FUNCTIONS(name, index) MEMORY_FUNCTIONS(name)
+#endif
+
 extern addrbank gfxmem_bank;
-MEMORY_FUNCTIONS(gfxmem);
+RTG_MEMORY_FUNCTIONS(gfxmem, 0);
 addrbank gfxmem_bank = {
 	gfxmem_lget, gfxmem_wget, gfxmem_bget,
 	gfxmem_lput, gfxmem_wput, gfxmem_bput,
@@ -5761,7 +6915,7 @@ addrbank gfxmem_bank = {
 	ABFLAG_RAM | ABFLAG_RTG | ABFLAG_DIRECTACCESS, 0, 0
 };
 extern addrbank gfxmem2_bank;
-MEMORY_FUNCTIONS(gfxmem2);
+RTG_MEMORY_FUNCTIONS(gfxmem2, 1);
 addrbank gfxmem2_bank = {
 	gfxmem2_lget, gfxmem2_wget, gfxmem2_bget,
 	gfxmem2_lput, gfxmem2_wput, gfxmem2_bput,
@@ -5770,7 +6924,7 @@ addrbank gfxmem2_bank = {
 	ABFLAG_RAM | ABFLAG_RTG | ABFLAG_DIRECTACCESS, 0, 0
 };
 extern addrbank gfxmem3_bank;
-MEMORY_FUNCTIONS(gfxmem3);
+RTG_MEMORY_FUNCTIONS(gfxmem3, 2);
 addrbank gfxmem3_bank = {
 	gfxmem3_lget, gfxmem3_wget, gfxmem3_bget,
 	gfxmem3_lput, gfxmem3_wput, gfxmem3_bput,
@@ -5779,7 +6933,7 @@ addrbank gfxmem3_bank = {
 	ABFLAG_RAM | ABFLAG_RTG | ABFLAG_DIRECTACCESS, 0, 0
 };
 extern addrbank gfxmem4_bank;
-MEMORY_FUNCTIONS(gfxmem4);
+RTG_MEMORY_FUNCTIONS(gfxmem4, 3);
 addrbank gfxmem4_bank = {
 	gfxmem4_lget, gfxmem4_wget, gfxmem4_bget,
 	gfxmem4_lput, gfxmem4_wput, gfxmem4_bput,
@@ -6791,6 +7945,7 @@ void picasso_free(void)
 		}
 		render_thread_state = 0;
 	}
+	rtg_convert_threads_free();
 }
 
 static uae_u32 p96_restored_flags;
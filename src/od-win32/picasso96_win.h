@@ -649,6 +649,7 @@ extern bool picasso_is_vram_dirty (int index, uaecptr addr, int size);
 extern void picasso_statusline (int monid, uae_u8 *dst);
 extern void picasso_invalidate(int monid, int x, int y, int w, int h);
 extern void picasso_free(void);
+extern void picasso96_benchmark(void);
 
 /* This structure describes the UAE-side framebuffer for the Picasso
  * screen.  */
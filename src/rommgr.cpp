@@ -1493,6 +1493,11 @@ struct romdata *getromdatabydata (uae_u8 *rom, int size)
 	return ret;
 }
 
+struct romdata *getromdatabysha1 (const uae_u8 *sha1, int size)
+{
+	return checkromdata (sha1, size, -1);
+}
+
 struct romdata *getromdatabyzfile (struct zfile *f)
 {
 	int pos, size;
@@ -197,7 +197,9 @@ struct staterecord
 {
 	int len;
 	int inuse;
+	int keyframe;
 	uae_u8 *cpu;
+	uae_u8 *ram;
 	uae_u8 *data;
 	uae_u8 *end;
 	int inprecoffset;
@@ -205,6 +207,21 @@ struct staterecord
 
 static struct staterecord **staterecords;
 
+/* Replay RAM is stored page by page. Keyframes contain all pages, other
+ * records only the pages that changed since the previous record, found by
+ * comparing RAM against a shadow copy taken at the previous capture.
+ */
+#define STATERECORD_PAGE_SIZE 4096
+#define STATERECORD_RAM_REGIONS 4
+static uae_u8 *staterecord_shadow[STATERECORD_RAM_REGIONS];
+static int staterecord_shadow_size[STATERECORD_RAM_REGIONS];
+static uae_u8 *staterecord_dirty[STATERECORD_RAM_REGIONS];
+static int staterecord_shadow_pos = -1;
+static int staterecord_deltas;
+static int statefile_need;
+/* with keyframes, records are captured here and copied out at their real size */
+static struct staterecord *staterecord_scratch;
+
 static void state_incompatible_warn (void)
 {
 	static int warned;
@@ -992,6 +1009,7 @@ void savestate_restore_finish (void)
 	savestate_state = 0;
 	init_hz_normal();
 	audio_activate();
+	inprec_restore_finish ();
 #ifdef FSUAE
     uae_callback(uae_on_restore_state_finished, savestate_fname);
 #endif
@@ -1427,6 +1445,7 @@ bool savestate_check (void)
 		if (hsync_counter == 0 && input_play == INPREC_PLAY_NORMAL)
 			savestate_memorysave ();
 		savestate_capture (0);
+		inprec_vsync ();
 	}
 	if (savestate_state == STATE_DORESTORE) {
 		savestate_state = STATE_RESTORE;
@@ -1440,6 +1459,42 @@ bool savestate_check (void)
 
 static int rewindmode;
 
+static uae_u8 *staterecord_ram_region (int region, int *len)
+{
+	*len = 0;
+	switch (region)
+	{
+	case 0:
+		return save_cram (len);
+	case 1:
+		return save_bram (len);
+#ifdef AUTOCONFIG
+	case 2:
+		return save_fram (len, 0);
+	case 3:
+		return save_zram (len, 0);
+#endif
+	}
+	return NULL;
+}
+
+/* nearest keyframe at or before pos, -1 if the delta chain is broken */
+static int staterecord_keyframe (int pos)
+{
+	int i = pos;
+	for (;;) {
+		struct staterecord *st = staterecords[i];
+		if (st == NULL || st->inuse == 0)
+			return -1;
+		if (st->keyframe)
+			return i;
+		if (i == staterecords_first)
+			return -1;
+		i--;
+		if (i < 0)
+			i += staterecords_max;
+	}
+}
 
 static struct staterecord *canrewind (int pos)
 {
@@ -1453,9 +1508,146 @@ static struct staterecord *canrewind (int pos)
 		return NULL;
 	if ((pos + 1) % staterecords_max  == staterecords_first)
 		return NULL;
+	if (staterecord_keyframe (pos) < 0)
+		return NULL;
 	return staterecords[pos];
 }
 
+static uae_u8 *staterecord_restore_pages (uae_u8 *p)
+{
+	for (int i = 0; i < STATERECORD_RAM_REGIONS; i++) {
+		int len;
+		uae_u8 *dst = staterecord_ram_region (i, &len);
+		int size = restore_u32_func (&p);
+		int pages = restore_u32_func (&p);
+		if (!dst || len > size)
+			len = dst ? size : 0;
+		while (pages-- > 0) {
+			int offset = restore_u32_func (&p) * STATERECORD_PAGE_SIZE;
+			int plen = size - offset > STATERECORD_PAGE_SIZE ? STATERECORD_PAGE_SIZE : size - offset;
+			if (offset < len)
+				memcpy (dst + offset, p, len - offset > plen ? plen : len - offset);
+			p += plen;
+		}
+	}
+	return p;
+}
+
+/* Rebuild RAM of record pos: keyframe followed by all deltas up to pos */
+static uae_u8 *staterecord_restore_ram (int pos, uae_u8 *p)
+{
+	int key = staterecord_keyframe (pos);
+	int deltas = 0;
+
+	for (int i = key; i != pos; i = (i + 1) % staterecords_max) {
+		staterecord_restore_pages (staterecords[i]->ram);
+		deltas++;
+	}
+	p = staterecord_restore_pages (p);
+	if (currprefs.statecapturekeyframes > 0) {
+		for (int i = 0; i < STATERECORD_RAM_REGIONS; i++) {
+			int len;
+			uae_u8 *src = staterecord_ram_region (i, &len);
+			if (src && staterecord_shadow[i] && staterecord_shadow_size[i] == len)
+				memcpy (staterecord_shadow[i], src, len);
+		}
+		staterecord_shadow_pos = pos;
+		staterecord_deltas = deltas;
+	}
+	return p;
+}
+
+static bool staterecord_need_keyframe (void)
+{
+	int prev = replaycounter - 1;
+
+	if (currprefs.statecapturekeyframes <= 0)
+		return true;
+	if (prev < 0)
+		prev += staterecords_max;
+	if (staterecord_shadow_pos != prev || !canrewind (prev))
+		return true;
+	if (staterecord_deltas + 1 >= currprefs.statecapturekeyframes)
+		return true;
+	for (int i = 0; i < STATERECORD_RAM_REGIONS; i++) {
+		int len;
+		staterecord_ram_region (i, &len);
+		if (staterecord_shadow_size[i] != len)
+			return true;
+	}
+	return false;
+}
+
+/* Mark changed pages, return space needed to store them */
+static int staterecord_scan_pages (bool keyframe)
+{
+	int total = 0;
+	for (int i = 0; i < STATERECORD_RAM_REGIONS; i++) {
+		int len;
+		uae_u8 *src = staterecord_ram_region (i, &len);
+		int pages = (len + STATERECORD_PAGE_SIZE - 1) / STATERECORD_PAGE_SIZE;
+		total += 4 + 4;
+		if (!src)
+			continue;
+		if (keyframe) {
+			total += pages * 4 + len;
+			continue;
+		}
+		// Not write tracking: every delta capture still compares all of
+		// replay RAM with the shadow, a full read of chip, slow, fast and
+		// Z3 fast RAM per record. Only storing pages and updating the
+		// shadow are limited to the pages that changed.
+		for (int j = 0; j < pages; j++) {
+			int offset = j * STATERECORD_PAGE_SIZE;
+			int plen = len - offset > STATERECORD_PAGE_SIZE ? STATERECORD_PAGE_SIZE : len - offset;
+			staterecord_dirty[i][j] = memcmp (src + offset, staterecord_shadow[i] + offset, plen) != 0;
+			if (staterecord_dirty[i][j])
+				total += 4 + plen;
+		}
+	}
+	return total;
+}
+
+static uae_u8 *staterecord_save_pages (uae_u8 *p, bool keyframe)
+{
+	bool shadow = currprefs.statecapturekeyframes > 0;
+	for (int i = 0; i < STATERECORD_RAM_REGIONS; i++) {
+		int len, cnt = 0;
+		uae_u8 *src = staterecord_ram_region (i, &len);
+		int pages = (len + STATERECORD_PAGE_SIZE - 1) / STATERECORD_PAGE_SIZE;
+		uae_u8 *p2;
+		if (!src)
+			len = pages = 0;
+		if (shadow && keyframe && staterecord_shadow_size[i] != len) {
+			xfree (staterecord_shadow[i]);
+			xfree (staterecord_dirty[i]);
+			staterecord_shadow[i] = len ? xmalloc (uae_u8, len) : NULL;
+			staterecord_dirty[i] = len ? xcalloc (uae_u8, pages) : NULL;
+			staterecord_shadow_size[i] = len;
+		}
+		save_u32_func (&p, len);
+		p2 = p;
+		save_u32_func (&p, 0);
+		for (int j = 0; j < pages; j++) {
+			int offset = j * STATERECORD_PAGE_SIZE;
+			int plen = len - offset > STATERECORD_PAGE_SIZE ? STATERECORD_PAGE_SIZE : len - offset;
+			if (!keyframe && !staterecord_dirty[i][j])
+				continue;
+			save_u32_func (&p, j);
+			memcpy (p, src + offset, plen);
+			p += plen;
+			cnt++;
+			// unchanged pages already match the shadow
+			if (shadow && staterecord_shadow[i] && !keyframe)
+				memcpy (staterecord_shadow[i] + offset, src + offset, plen);
+		}
+		save_u32_func (&p2, cnt);
+		if (shadow && staterecord_shadow[i] && keyframe)
+			memcpy (staterecord_shadow[i], src, len);
+	}
+	return p;
+}
+
 int savestate_dorewind (int pos)
 {
 	rewindmode = pos;
@@ -1495,7 +1687,7 @@ void savestate_listrewind (void)
 
 void savestate_rewind (void)
 {
-	int len, i, dummy;
+	int i;
 	uae_u8 *p, *p2;
 	struct staterecord *st;
 	int pos;
@@ -1558,20 +1750,7 @@ void savestate_rewind (void)
 	if (restore_u32_func (&p))
 		p = restore_p96 (p);
 #endif
-	len = restore_u32_func (&p);
-	memcpy (chipmem_bank.baseaddr, p, currprefs.chipmem_size > len ? len : currprefs.chipmem_size);
-	p += len;
-	len = restore_u32_func (&p);
-	memcpy (save_bram (&dummy), p, currprefs.bogomem_size > len ? len : currprefs.bogomem_size);
-	p += len;
-#ifdef AUTOCONFIG
-	len = restore_u32_func (&p);
-	memcpy (save_fram (&dummy, 0), p, currprefs.fastmem[0].size > len ? len : currprefs.fastmem[0].size);
-	p += len;
-	len = restore_u32_func (&p);
-	memcpy (save_zram (&dummy, 0), p, currprefs.z3fastmem[0].size > len ? len : currprefs.z3fastmem[0].size);
-	p += len;
-#endif
+	p = staterecord_restore_ram (pos, p);
 #ifdef ACTION_REPLAY
 	if (restore_u32_func (&p))
 		p = restore_action_replay (p);
@@ -1637,12 +1816,27 @@ void savestate_memorysave (void)
 		save_state_internal (staterecord_statefile, _T("rerecording"), 1, false);
 }
 
+/* complete statefile in memory, used as input recording keyframe.
+ * Does not flush pending events like save_state () does, that
+ * would change timing compared to playback.
+ */
+int savestate_memorysave (struct zfile *f, const TCHAR *description)
+{
+#ifdef FILESYS
+	if (nr_units ())
+		return 0;
+#endif
+	return save_state_internal (f, description, 1, true);
+}
+
 void savestate_capture (int force)
 {
-	uae_u8 *p, *p2, *p3, *dst;
+	uae_u8 *p, *p2, *p3;
 	int i, len, tlen, retrycnt;
 	struct staterecord *st;
 	bool firstcapture = false;
+	bool keyframe, forcekeyframe = false;
+	bool scratch = currprefs.statecapturekeyframes > 0;
 
 #ifdef FILESYS
 	if (nr_units ())
@@ -1669,21 +1863,32 @@ void savestate_capture (int force)
 	savestate_first_capture = false;
 
 	retrycnt = 0;
+	// the old record in this slot is overwritten
+	if (scratch && staterecords[replaycounter])
+		staterecords[replaycounter]->inuse = 0;
 retry2:
-	st = staterecords[replaycounter];
+	st = scratch ? staterecord_scratch : staterecords[replaycounter];
 	if (st == NULL) {
 		st = (struct staterecord*)xmalloc (uae_u8, statefile_alloc);
 		st->len = statefile_alloc;
 	} else if (retrycnt > 0) {
-		write_log (_T("realloc %d -> %d\n"), st->len, st->len + STATEFILE_ALLOC_SIZE);
-		st->len += STATEFILE_ALLOC_SIZE;
+		write_log (_T("realloc %d -> %d\n"), st->len, st->len + STATEFILE_ALLOC_SIZE + statefile_need);
+		st->len += STATEFILE_ALLOC_SIZE + statefile_need;
+		st = (struct staterecord*)xrealloc (uae_u8, st, st->len);
+	} else if (st->len < statefile_alloc) {
+		// record captured with keyframes enabled
+		st->len = statefile_alloc;
 		st = (struct staterecord*)xrealloc (uae_u8, st, st->len);
 	}
+	statefile_need = 0;
 	if (st->len > statefile_alloc)
 		statefile_alloc = st->len;
 	st->inuse = 0;
 	st->data = (uae_u8*)(st + 1);
-	staterecords[replaycounter] = st;
+	if (scratch)
+		staterecord_scratch = st;
+	else
+		staterecords[replaycounter] = st;
 	retrycnt++;
 	p = p2 = st->data;
 	tlen = 0;
@@ -1850,36 +2055,18 @@ retry2:
 	}
 #endif
 
-	dst = save_cram (&len);
-	if (bufcheck (st, p, len))
-		goto retry;
-	save_u32_func (&p, len);
-	memcpy (p, dst, len);
-	tlen += len + 4;
-	p += len;
-	dst = save_bram (&len);
-	if (bufcheck (st, p, len))
-		goto retry;
-	save_u32_func (&p, len);
-	memcpy (p, dst, len);
-	tlen += len + 4;
-	p += len;
-#ifdef AUTOCONFIG
-	dst = save_fram (&len, 0);
-	if (bufcheck (st, p, len))
-		goto retry;
-	save_u32_func (&p, len);
-	memcpy (p, dst, len);
-	tlen += len + 4;
-	p += len;
-	dst = save_zram (&len, 0);
-	if (bufcheck (st, p, len))
+	keyframe = forcekeyframe || staterecord_need_keyframe ();
+	len = staterecord_scan_pages (keyframe);
+	if (bufcheck (st, p, len)) {
+		statefile_need = len;
 		goto retry;
-	save_u32_func (&p, len);
-	memcpy (p, dst, len);
-	tlen += len + 4;
-	p += len;
-#endif
+	}
+	// shadow copy is updated from now on, retry must start a new keyframe
+	forcekeyframe = true;
+	st->ram = p;
+	st->keyframe = keyframe;
+	p = staterecord_save_pages (p, keyframe);
+	tlen += len;
 #ifdef ACTION_REPLAY
 	if (bufcheck (st, p, 0))
 		goto retry;
@@ -1985,6 +2172,28 @@ retry2:
 	st->inuse = 1;
 	st->inprecoffset = inprec_getposition ();
 
+	if (scratch) {
+		// copy to the slot, reusing its buffer if the size is close enough
+		int used = (int)(st->end - (uae_u8*)st);
+		struct staterecord *rec = staterecords[replaycounter];
+		if (!rec || rec->len < used || rec->len - used > used / 4 + BS) {
+			xfree (rec);
+			rec = (struct staterecord*)xmalloc (uae_u8, used);
+			rec->len = used;
+		}
+		int reclen = rec->len;
+		memcpy (rec, st, used);
+		rec->len = reclen;
+		rec->data = (uae_u8*)(rec + 1);
+		rec->cpu = rec->data + (st->cpu - st->data);
+		rec->ram = rec->data + (st->ram - st->data);
+		rec->end = rec->data + (st->end - st->data);
+		staterecords[replaycounter] = rec;
+		st = rec;
+		staterecord_shadow_pos = replaycounter;
+		staterecord_deltas = keyframe ? 0 : staterecord_deltas + 1;
+	}
+
 	replaycounter++;
 	if (replaycounter >= staterecords_max)
 		replaycounter -= staterecords_max;
@@ -1994,26 +2203,20 @@ retry2:
 			staterecords_first -= staterecords_max;
 	}
 
-	write_log (_T("state capture %d (%010ld/%03ld,%ld/%d) (%ld bytes, alloc %d)\n"),
+	write_log (_T("state capture %d (%010ld/%03ld,%ld/%d) (%ld bytes, alloc %d, %s)\n"),
 		replaycounter, hsync_counter, vsync_counter,
 		hsync_counter % current_maxvpos (), current_maxvpos (),
-		st->end - st->data, statefile_alloc);
+		st->end - st->data, statefile_alloc, keyframe ? _T("keyframe") : _T("delta"));
 
 	if (firstcapture) {
 		savestate_memorysave ();
-#ifdef FSUAE
-#else
 		input_record++;
-#endif
 		for (i = 0; i < 4; i++) {
 			bool wp = true;
 			DISK_validate_filename (&currprefs, currprefs.floppyslots[i].df, NULL, false, &wp, NULL, NULL);
 			inprec_recorddiskchange (i, currprefs.floppyslots[i].df, wp);
 		}
-#ifdef FSUAE
-#else
 		input_record--;
-#endif
 	}
 
 
@@ -2029,6 +2232,17 @@ void savestate_free (void)
 {
 	xfree (staterecords);
 	staterecords = NULL;
+	xfree (staterecord_scratch);
+	staterecord_scratch = NULL;
+	for (int i = 0; i < STATERECORD_RAM_REGIONS; i++) {
+		xfree (staterecord_shadow[i]);
+		xfree (staterecord_dirty[i]);
+		staterecord_shadow[i] = NULL;
+		staterecord_dirty[i] = NULL;
+		staterecord_shadow_size[i] = 0;
+	}
+	staterecord_shadow_pos = -1;
+	staterecord_deltas = 0;
 }
 
 void savestate_capture_request (void)
@@ -27,6 +27,8 @@
 #include "devices.h"
 #include "flashrom.h"
 #include "gui.h"
+#include "uae.h"
+#include "threaddep/thread.h"
 
 #define SCSI_EMU_DEBUG 0
 #define RAW_SCSI_DEBUG 0
@@ -325,6 +327,7 @@ static void scsi_emulate_reset_device(struct scsi_data *sd)
 {
 	if (!sd)
 		return;
+	scsi_emulate_cmd_wait(sd);
 	if (sd->device_type == UAEDEV_HDF && sd->nativescsiunit < 0) {
 		scsi_clear_sense(sd);
 		//  SCSI bus reset occurred
@@ -510,6 +513,82 @@ void scsi_emulate_cmd(struct scsi_data *sd)
 	sd->offset = 0;
 }
 
+/* HDF reads issued from the emulation thread are completed by a worker
+ * thread so that a slow host read does not stall the guest. The caller
+ * polls scsi_emulate_cmd_busy() and must not touch sd until it is done.
+ * Each command posts async_done once, the emulation thread takes it back
+ * when it sees the command finished. */
+static smp_comm_pipe scsi_async_requests;
+static uae_thread_id scsi_async_tid;
+static bool scsi_async_started;
+
+static void *scsi_async_thread(void *v)
+{
+	for (;;) {
+		struct scsi_data *sd = (struct scsi_data*)read_comm_pipe_pvoid_blocking(&scsi_async_requests);
+		if (!sd)
+			break;
+		scsi_emulate_cmd(sd);
+		uae_sem_post(&sd->async_done);
+		sd->async_busy.store(false, std::memory_order_release);
+	}
+	return 0;
+}
+
+bool scsi_emulate_cmd_async(struct scsi_data *sd)
+{
+	if (sd->device_type != UAEDEV_HDF || sd->nativescsiunit >= 0 || sd->direction >= 0)
+		return false;
+	if (sd->cmd[0] != 0x08 && sd->cmd[0] != 0x28 && sd->cmd[0] != 0xa8)
+		return false;
+	if (!scsi_async_started) {
+		init_comm_pipe(&scsi_async_requests, 100, 1);
+		if (!uae_start_thread(_T("scsi hd"), scsi_async_thread, NULL, &scsi_async_tid)) {
+			write_log(_T("SCSI: failed to start HD thread\n"));
+			destroy_comm_pipe(&scsi_async_requests);
+			return false;
+		}
+		scsi_async_started = true;
+	}
+	if (!sd->async_done)
+		uae_sem_init(&sd->async_done, 0, 0);
+	sd->async_pending = true;
+	sd->async_busy.store(true, std::memory_order_relaxed);
+	write_comm_pipe_pvoid(&scsi_async_requests, sd, 1);
+	return true;
+}
+
+bool scsi_emulate_cmd_busy(struct scsi_data *sd)
+{
+	if (!sd || !sd->async_pending)
+		return false;
+	if (sd->async_busy.load(std::memory_order_acquire))
+		return true;
+	uae_sem_wait(&sd->async_done);
+	sd->async_pending = false;
+	return false;
+}
+
+void scsi_emulate_cmd_wait(struct scsi_data *sd)
+{
+	if (!sd || !sd->async_pending)
+		return;
+	uae_sem_wait(&sd->async_done);
+	sd->async_pending = false;
+}
+
+void scsi_async_free(void)
+{
+	if (scsi_async_started) {
+		/* queued commands are completed before the thread sees NULL */
+		write_comm_pipe_pvoid(&scsi_async_requests, NULL, 1);
+		uae_wait_thread(scsi_async_tid);
+		uae_end_thread(&scsi_async_tid);
+		destroy_comm_pipe(&scsi_async_requests);
+		scsi_async_started = false;
+	}
+}
+
 static void allocscsibuf(struct scsi_data *sd)
 {
 	sd->buffer_size = SCSI_DEFAULT_DATA_BUFFER_SIZE;
@@ -608,6 +687,9 @@ void scsi_free(struct scsi_data *sd)
 {
 	if (!sd)
 		return;
+	scsi_emulate_cmd_wait(sd);
+	if (sd->async_done)
+		uae_sem_destroy(&sd->async_done);
 	if (sd->nativescsiunit >= 0) {
 		sys_command_close (sd->nativescsiunit);
 		sd->nativescsiunit = -1;
@@ -808,6 +890,7 @@ struct raw_scsi
 	struct scsi_data *device[MAX_TOTAL_SCSI_DEVICES];
 	struct scsi_data *target;
 	int msglun;
+	bool cmd_pending;
 };
 
 struct soft_scsi
@@ -962,6 +1045,10 @@ static struct soft_scsi *getscsiboard(uaecptr addr)
 
 static void raw_scsi_reset(struct raw_scsi *rs)
 {
+	if (rs->cmd_pending) {
+		scsi_emulate_cmd_wait(rs->target);
+		rs->cmd_pending = false;
+	}
 	rs->target = NULL;
 	rs->io = 0;
 	rs->bus_phase = SCSI_SIGNAL_PHASE_FREE;
@@ -1078,6 +1165,43 @@ static void raw_scsi_set_databus(struct raw_scsi *rs, bool databusoutput)
 	rs->databusoutput = databusoutput;
 }
 
+static void raw_scsi_cmd_done(struct raw_scsi *rs)
+{
+	struct scsi_data *sd = rs->target;
+
+	scsi_start_transfer(sd);
+#if RAW_SCSI_DEBUG
+	if (sd->status) {
+		write_log(_T("raw_scsi: status = %d len = %d\n"), sd->status, sd->data_len);
+	}
+#endif
+	if (!sd->status && sd->data_len > 0) {
+#if RAW_SCSI_DEBUG
+		write_log(_T("raw_scsi: data in %d bytes waiting\n"), sd->data_len);
+#endif
+		rs->bus_phase = SCSI_SIGNAL_PHASE_DATA_IN;
+	} else {
+#if RAW_SCSI_DEBUG
+		write_log(_T("raw_scsi: no data, status = %d\n"), sd->status);
+#endif
+		rs->bus_phase = SCSI_SIGNAL_PHASE_STATUS;
+	}
+}
+
+// REQ stays inactive while the target reads the data. Drivers that poll
+// REQ see the data phase when it is ready, anything else waits for it.
+static void raw_scsi_check_cmd(struct raw_scsi *rs, bool wait)
+{
+	if (!rs->cmd_pending)
+		return;
+	if (!wait && scsi_emulate_cmd_busy(rs->target))
+		return;
+	scsi_emulate_cmd_wait(rs->target);
+	rs->cmd_pending = false;
+	rs->io |= SCSI_IO_REQ;
+	raw_scsi_cmd_done(rs);
+}
+
 static void raw_scsi_set_signal_phase(struct raw_scsi *rs, bool busy, bool select, bool atn)
 {
 	switch (rs->bus_phase)
@@ -1166,6 +1290,7 @@ static void raw_scsi_set_signal_phase(struct raw_scsi *rs, bool busy, bool selec
 
 static uae_u8 raw_scsi_get_signal_phase(struct raw_scsi *rs)
 {
+	raw_scsi_check_cmd(rs, false);
 	uae_u8 v = rs->io;
 	if (rs->bus_phase >= 0)
 		v |= rs->bus_phase;
@@ -1179,6 +1304,8 @@ static uae_u8 raw_scsi_get_data_2(struct raw_scsi *rs, bool next, bool nodebug)
 	struct scsi_data *sd = rs->target;
 	uae_u8 v = 0;
 
+	raw_scsi_check_cmd(rs, true);
+
 	switch (rs->bus_phase)
 	{
 		case SCSI_SIGNAL_PHASE_FREE:
@@ -1258,6 +1385,8 @@ static void raw_scsi_write_data(struct raw_scsi *rs, uae_u8 data)
 	struct scsi_data *sd = rs->target;
 	int len;
 
+	raw_scsi_check_cmd(rs, true);
+
 	switch (rs->bus_phase)
 	{
 		case SCSI_SIGNAL_PHASE_SELECT_1:
@@ -1281,25 +1410,12 @@ static void raw_scsi_write_data(struct raw_scsi *rs, uae_u8 data)
 #endif
 				scsi_start_transfer(sd);
 				rs->bus_phase = SCSI_SIGNAL_PHASE_DATA_OUT;
-			} else if (sd->direction <= 0) {
+			} else if (scsi_emulate_cmd_async(sd)) {
+				rs->cmd_pending = true;
+				rs->io &= ~SCSI_IO_REQ;
+			} else {
 				scsi_emulate_cmd(sd);
-				scsi_start_transfer(sd);
-#if RAW_SCSI_DEBUG
-				if (sd->status) {
-					write_log(_T("raw_scsi: status = %d len = %d\n"), sd->status, sd->data_len);
-				}
-#endif
-				if (!sd->status && sd->data_len > 0) {
-#if RAW_SCSI_DEBUG
-					write_log(_T("raw_scsi: data in %d bytes waiting\n"), sd->data_len);
-#endif
-					rs->bus_phase = SCSI_SIGNAL_PHASE_DATA_IN;
-				} else {
-#if RAW_SCSI_DEBUG
-					write_log(_T("raw_scsi: no data, status = %d\n"), sd->status);
-#endif
-					rs->bus_phase = SCSI_SIGNAL_PHASE_STATUS;
-				}
+				raw_scsi_cmd_done(rs);
 			}
 		}
 		break;
@@ -1519,6 +1635,9 @@ static void dma_check(struct soft_scsi *ncr)
 
 		m68k_cancel_idle();
 
+		// DMA loops test the bus phase directly, finish a pending command first
+		raw_scsi_check_cmd(&ncr->rscsi, true);
+
 		if (ncr->type == NCR5380_SUPRA && ncr->subtype == 4) {
 			if (ncr->dmac_direction != ncr->dma_direction)  {
 				write_log(_T("SUPRADMA: mismatched direction\n"));
@@ -1566,6 +1685,7 @@ static void aic_int(struct soft_scsi *scsi, uae_u8 mask)
 static bool aic_phase_match(struct soft_scsi *scsi)
 {
 	struct raw_scsi *r = &scsi->rscsi;
+	raw_scsi_check_cmd(r, true);
 	uae_u8 phase = r->bus_phase;
 	bool cd = (phase & SCSI_IO_COMMAND) != 0;
 	bool io = (phase & SCSI_IO_DIRECTION) != 0;
@@ -185,6 +185,11 @@ static struct zfile *zfile_create (struct zfile *prev, const TCHAR *originalname
 
 static void zfile_free (struct zfile *f)
 {
+	// zfile_exit() frees without zfile_fclose()
+	if (f->zfileclose) {
+		f->zfileclose (f);
+		f->zfileclose = NULL;
+	}
 	if (f->f)
 		fclose (f->f);
 	if (f->deleteafterclose) {
@@ -230,6 +235,11 @@ void zfile_fclose (struct zfile *f)
 		zfile_fclose (f->archiveparent);
 		f->archiveparent = NULL;
 	}
+	// before the list walk, it may close other files
+	if (f->zfileclose) {
+		f->zfileclose (f);
+		f->zfileclose = NULL;
+	}
 	struct zfile *pl = NULL;
 	struct zfile *nxt;
 	struct zfile *l  = zlist;
@@ -1989,6 +1999,8 @@ struct zfile *zfile_dup (struct zfile *zf)
 		return NULL;
 	if (zf->archiveparent)
 		checkarchiveparent (zf);
+	if (zf->zfiledup)
+		return zf->zfiledup (zf);
 	if (zf->userdata)
 		return NULL;
 	if (!zf->data && zf->dataseek) {
@@ -2046,7 +2058,8 @@ int zfile_exists (const TCHAR *name)
 
 int zfile_iscompressed (struct zfile *z)
 {
-	return z->data ? 1 : 0;
+	// zfiledup is only set for files streamed from archives
+	return z->data || z->zfiledup ? 1 : 0;
 }
 
 struct zfile *zfile_fopen_empty (struct zfile *prev, const TCHAR *name, uae_u64 size)
@@ -2101,6 +2114,19 @@ struct zfile *zfile_fopen_parent (struct zfile *z, const TCHAR *name, uae_u64 of
 	return l;
 }
 
+/* read-only file without data or handle, caller sets zfileread */
+struct zfile *zfile_fopen_virtual (struct zfile *prev, const TCHAR *name, uae_u64 size)
+{
+	struct zfile *l;
+
+	l = zfile_create (prev, NULL);
+	l->name = my_strdup (name ? name : _T(""));
+	l->size = size;
+	l->datasize = size;
+	l->dataseek = 1;
+	return l;
+}
+
 struct zfile *zfile_fopen_load_zfile (struct zfile *f)
 {
 	struct zfile *l = zfile_fopen_empty (f, f->name, f->size);
@@ -2306,6 +2332,8 @@ size_t zfile_fwrite (const void *b, size_t l1, size_t l2, struct zfile *z)
 			z->datasize = z->size;
 		return l2;
 	}
+	if (!z->f)
+		return 0;
 	return fwrite (b, l1, l2, z->f);
 }
 
@@ -2394,7 +2422,11 @@ int zfile_getc (struct zfile *z)
 {
 	checkarchiveparent (z);
 	int out = -1;
-	if (z->data) {
+	if (z->zfileread) {
+		uae_u8 b;
+		if (zfile_fread (&b, 1, 1, z) == 1)
+			out = b;
+	} else if (z->data) {
 		if (z->seek < z->size) {
 			out = z->data[z->seek++];
 		}
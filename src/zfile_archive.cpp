@@ -24,6 +24,7 @@
 #include "crc32.h"
 #include "zarchive.h"
 #include "disk.h"
+#include "threaddep/thread.h"
 
 #ifdef FSUAE // NL
 #undef _WIN32
@@ -413,6 +414,327 @@ struct zvolume *archive_directory_zip (struct zfile *z)
 	return zv;
 }
 
+/* Large deflated files are not unpacked to memory. They are inflated
+* on demand in 64k chunks, the most recently used chunks are cached and
+* the inflate state is saved about every megabyte (at deflate block
+* boundaries), so that a seek never needs to inflate more than that.
+* Stored files are read directly from the archive.
+* Each stream reads the archive through its own host file handle, CD
+* audio and data can be in different members and are read from
+* different threads.  */
+
+#define ZIP_STREAM_MIN (16 * 1024 * 1024)
+#define ZIP_STREAM_SPAN (1024 * 1024)
+#define ZIP_STREAM_CHUNK 65536
+#define ZIP_STREAM_CACHE 32
+#define ZIP_STREAM_WINDOW 32768
+
+struct zipstream_point
+{
+	uae_s64 out;
+	uae_s64 in;
+	int bits;
+	int windowsize;
+	uae_u8 *window;
+};
+
+struct zipstream_chunk
+{
+	uae_s64 offset;
+	uae_u32 used;
+	uae_u8 *data;
+};
+
+struct zipstream
+{
+	uae_sem_t sem;
+	int refcnt;
+	struct zfile *archive;
+	uae_s64 start, csize, size;
+	z_stream zs;
+	bool zsinit;
+	uae_s64 in, out;
+	struct zipstream_point *points;
+	int numpoints, maxpoints;
+	struct zipstream_chunk cache[ZIP_STREAM_CACHE];
+	uae_u32 usecnt;
+	uae_u8 inbuf[16384];
+	uae_u8 skip[ZIP_STREAM_CHUNK];
+};
+
+static bool zipstream_input (struct zipstream *s)
+{
+	uae_s64 len = s->csize - s->in;
+	if (len > sizeof s->inbuf)
+		len = sizeof s->inbuf;
+	if (len <= 0)
+		return false;
+	zfile_fseek (s->archive, s->start + s->in, SEEK_SET);
+	if (zfile_fread (s->inbuf, 1, len, s->archive) != len)
+		return false;
+	s->in += len;
+	s->zs.next_in = s->inbuf;
+	s->zs.avail_in = len;
+	return true;
+}
+
+static bool zipstream_restart (struct zipstream *s, struct zipstream_point *p)
+{
+	if (s->zsinit) {
+		inflateReset (&s->zs);
+	} else {
+		memset (&s->zs, 0, sizeof s->zs);
+		if (inflateInit2 (&s->zs, -MAX_WBITS) != Z_OK)
+			return false;
+		s->zsinit = true;
+	}
+	s->zs.avail_in = 0;
+	s->in = 0;
+	s->out = 0;
+	if (!p)
+		return true;
+	s->in = p->in;
+	if (p->bits) {
+		uae_u8 b;
+		zfile_fseek (s->archive, s->start + p->in - 1, SEEK_SET);
+		if (zfile_fread (&b, 1, 1, s->archive) != 1)
+			return false;
+		inflatePrime (&s->zs, p->bits, b >> (8 - p->bits));
+	}
+	inflateSetDictionary (&s->zs, p->window, p->windowsize);
+	s->out = p->out;
+	return true;
+}
+
+static void zipstream_addpoint (struct zipstream *s)
+{
+	uae_s64 last = s->numpoints ? s->points[s->numpoints - 1].out : 0;
+	if (s->out < last + ZIP_STREAM_SPAN || s->out >= s->size)
+		return;
+	if (s->numpoints >= s->maxpoints) {
+		s->maxpoints = s->maxpoints ? s->maxpoints * 2 : 64;
+		s->points = xrealloc (struct zipstream_point, s->points, s->maxpoints);
+	}
+	struct zipstream_point *p = &s->points[s->numpoints];
+	uInt windowsize = ZIP_STREAM_WINDOW;
+	p->window = xmalloc (uae_u8, ZIP_STREAM_WINDOW);
+	if (inflateGetDictionary (&s->zs, p->window, &windowsize) != Z_OK) {
+		xfree (p->window);
+		return;
+	}
+	p->windowsize = windowsize;
+	p->out = s->out;
+	p->in = s->in - s->zs.avail_in;
+	p->bits = s->zs.data_type & 7;
+	s->numpoints++;
+}
+
+// last checkpoint at or before offset
+static struct zipstream_point *zipstream_findpoint (struct zipstream *s, uae_s64 offset)
+{
+	int lo = 0, hi = s->numpoints;
+	while (lo < hi) {
+		int mid = (lo + hi) / 2;
+		if (s->points[mid].out <= offset)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo > 0 ? &s->points[lo - 1] : NULL;
+}
+
+static bool zipstream_inflate (struct zipstream *s, uae_s64 offset, uae_u8 *dst)
+{
+	uae_s64 end = offset + ZIP_STREAM_CHUNK;
+	if (end > s->size)
+		end = s->size;
+	struct zipstream_point *p = zipstream_findpoint (s, offset);
+	if (!s->zsinit || s->out > offset || (p && p->out > s->out)) {
+		if (!zipstream_restart (s, p))
+			return false;
+	}
+	while (s->out < end) {
+		// data before the wanted chunk is inflated to the skip buffer
+		if (s->out < offset) {
+			s->zs.next_out = s->skip;
+			s->zs.avail_out = offset - s->out > ZIP_STREAM_CHUNK ? ZIP_STREAM_CHUNK : offset - s->out;
+		} else {
+			s->zs.next_out = dst + (s->out - offset);
+			s->zs.avail_out = end - s->out;
+		}
+		while (s->zs.avail_out) {
+			if (!s->zs.avail_in && !zipstream_input (s))
+				goto error;
+			uInt avail = s->zs.avail_out;
+			int err = inflate (&s->zs, Z_BLOCK);
+			s->out += avail - s->zs.avail_out;
+			if (err == Z_STREAM_END && s->zs.avail_out)
+				goto error;
+			if (err != Z_OK && err != Z_STREAM_END)
+				goto error;
+			if ((s->zs.data_type & 128) && !(s->zs.data_type & 64))
+				zipstream_addpoint (s);
+		}
+	}
+	return true;
+error:
+	write_log (_T("ZIP: inflate error at %lld (%s)\n"), s->out, s->zs.msg ? s->zs.msg : "");
+	inflateEnd (&s->zs);
+	s->zsinit = false;
+	return false;
+}
+
+static struct zipstream_chunk *zipstream_getchunk (struct zipstream *s, uae_s64 offset)
+{
+	struct zipstream_chunk *c = NULL;
+
+	s->usecnt++;
+	for (int i = 0; i < ZIP_STREAM_CACHE; i++) {
+		struct zipstream_chunk *cc = &s->cache[i];
+		if (cc->data && cc->offset == offset) {
+			cc->used = s->usecnt;
+			return cc;
+		}
+		if (!c || !cc->data || (c->data && cc->used < c->used))
+			c = cc;
+	}
+	if (!c->data)
+		c->data = xmalloc (uae_u8, ZIP_STREAM_CHUNK);
+	c->offset = -1;
+	if (!zipstream_inflate (s, offset, c->data))
+		return NULL;
+	c->offset = offset;
+	c->used = s->usecnt;
+	return c;
+}
+
+static uae_s64 zipstream_fread (void *data, uae_u64 l1, uae_u64 l2, struct zfile *zf)
+{
+	struct zipstream *s = (struct zipstream*)zf->userdata;
+	uae_u8 *b = (uae_u8*)data;
+	uae_s64 size, done = 0;
+
+	if (!l1 || !l2 || zf->seek >= zf->size)
+		return 0;
+	size = l1 * l2;
+	if (zf->seek + size > zf->size)
+		size = (zf->size - zf->seek) / l1 * l1;
+	uae_sem_wait (&s->sem);
+	while (done < size) {
+		uae_s64 pos = zf->seek + done;
+		struct zipstream_chunk *c = zipstream_getchunk (s, pos & ~(uae_s64)(ZIP_STREAM_CHUNK - 1));
+		if (!c)
+			break;
+		int offset = pos - c->offset;
+		uae_s64 len = ZIP_STREAM_CHUNK - offset;
+		if (len > size - done)
+			len = size - done;
+		memcpy (b + done, c->data + offset, len);
+		done += len;
+	}
+	uae_sem_post (&s->sem);
+	zf->seek += done;
+	return done / l1;
+}
+
+static struct zfile *zipstream_dup (struct zfile *zf);
+
+static void zipstream_close (struct zfile *zf)
+{
+	struct zipstream *s = (struct zipstream*)zf->userdata;
+	zf->userdata = NULL;
+	uae_sem_wait (&s->sem);
+	int refcnt = --s->refcnt;
+	uae_sem_post (&s->sem);
+	if (refcnt > 0)
+		return;
+	if (s->zsinit)
+		inflateEnd (&s->zs);
+	for (int i = 0; i < s->numpoints; i++)
+		xfree (s->points[i].window);
+	xfree (s->points);
+	for (int i = 0; i < ZIP_STREAM_CACHE; i++)
+		xfree (s->cache[i].data);
+	zfile_fclose (s->archive);
+	uae_sem_destroy (&s->sem);
+	xfree (s);
+}
+
+static struct zfile *zipstream_open (struct zfile *prev, struct zipstream *s, const TCHAR *name)
+{
+	struct zfile *zf = zfile_fopen_virtual (prev, name, s->size);
+	uae_sem_wait (&s->sem);
+	s->refcnt++;
+	uae_sem_post (&s->sem);
+	zf->userdata = s;
+	zf->zfileread = zipstream_fread;
+	zf->zfiledup = zipstream_dup;
+	zf->zfileclose = zipstream_close;
+	return zf;
+}
+
+static struct zfile *zipstream_dup (struct zfile *zf)
+{
+	struct zfile *nzf = zipstream_open (zf, (struct zipstream*)zf->userdata, zf->name);
+	nzf->seek = zf->seek;
+	return nzf;
+}
+
+static struct zfile *zipstream_stored_dup (struct zfile *zf);
+
+// stored member, read through a new handle of the archive
+static struct zfile *zipstream_stored (struct zfile *archive, const TCHAR *name, uae_s64 start, uae_s64 size)
+{
+	struct zfile *h = zfile_dup (archive);
+	if (!h)
+		return NULL;
+	struct zfile *zf = zfile_fopen_parent (h, name, start, size);
+	zfile_fclose (h);
+	zf->zfiledup = zipstream_stored_dup;
+	return zf;
+}
+
+static struct zfile *zipstream_stored_dup (struct zfile *zf)
+{
+	struct zfile *nzf = zipstream_stored (zf->parent, zf->name, zf->offset, zf->size);
+	if (nzf)
+		nzf->seek = zf->seek;
+	return nzf;
+}
+
+static struct zfile *zipstream_create (struct znode *zn, unzFile uz)
+{
+	struct zfile *archive = zn->volume->archive;
+	unz_file_info file_info;
+	uLong start;
+
+	// zfile_dup() must open a new host file, not copy or share the archive
+	if (!archive->f || archive->data || archive->parent)
+		return NULL;
+	if (unzGetCurrentFileInfo (uz, &file_info, NULL, 0, NULL, 0, NULL, 0) != UNZ_OK)
+		return NULL;
+	start = unzGetCurrentFileZStreamPos (uz);
+	if (!start || file_info.uncompressed_size != zn->size)
+		return NULL;
+	if (file_info.compression_method == 0) {
+		write_log (_T("ZIP: '%s' is stored, reading directly\n"), zn->fullname);
+		return zipstream_stored (archive, zn->fullname, start, zn->size);
+	}
+	if (file_info.compression_method != Z_DEFLATED)
+		return NULL;
+	struct zipstream *s = xcalloc (struct zipstream, 1);
+	s->archive = zfile_dup (archive);
+	if (!s->archive) {
+		xfree (s);
+		return NULL;
+	}
+	uae_sem_init (&s->sem, 0, 1);
+	s->start = start;
+	s->csize = file_info.compressed_size;
+	s->size = zn->size;
+	write_log (_T("ZIP: streaming '%s' (%lld bytes)\n"), zn->fullname, s->size);
+	return zipstream_open (NULL, s, zn->fullname);
+}
 
 static struct zfile *archive_do_zip (struct znode *zn, struct zfile *z, int flags)
 {
@@ -456,6 +778,14 @@ static struct zfile *archive_do_zip (struct znode *zn, struct zfile *z, int flag
 	s = NULL;
 	if (unzOpenCurrentFile (uz) != UNZ_OK)
 		goto error;
+	if (!z && zn->size >= ZIP_STREAM_MIN) {
+		z = zipstream_create (zn, uz);
+		if (z) {
+			unzCloseCurrentFile (uz);
+			unzClose (uz);
+			return z;
+		}
+	}
 	if (!z)
 		z = zfile_fopen_empty (NULL, zn->fullname, zn->size);
 	if (z) {
@@ -0,0 +1,412 @@
+/*
+ * Input recording round trip: a recording is started through the
+ * frontend request, events are recorded over a few hundred frames with
+ * keyframes, the file is played back through the play request, and a
+ * seek restores the nearest keyframe and plays forward from there.
+ *
+ * inputrecord.cpp is built into the test so that its keyframe list can
+ * be inspected. Files live in memory, savestates are short strings that
+ * name the frame they were taken at.
+ */
+
+#include "../src/inputrecord.cpp"
+
+#include <zlib.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+/* ------------------------------------------------------------------------ */
+
+static int failures;
+
+#define CHECK(x) do { \
+	if (!(x)) { \
+		fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #x); \
+		failures++; \
+	} \
+} while (0)
+
+/* ------------------------------------------------------------------------ */
+
+static std::map<std::string, std::vector<uae_u8> > files;
+
+struct zfile
+{
+	std::vector<uae_u8> *data;
+	std::vector<uae_u8> mem;
+	uae_s64 pos;
+	TCHAR *name;
+};
+
+struct zfile *zfile_fopen(const TCHAR *name, const TCHAR *mode, int mask)
+{
+	if (mode[0] == 'r' && !files.count(name))
+		return NULL;
+	struct zfile *z = new zfile();
+	z->data = &files[name];
+	if (mode[0] == 'w')
+		z->data->clear();
+	z->name = _tcsdup(name);
+	return z;
+}
+
+struct zfile *zfile_fopen(const TCHAR *name, const TCHAR *mode)
+{
+	return zfile_fopen(name, mode, 0);
+}
+
+struct zfile *zfile_fopen_empty(struct zfile *prev, const TCHAR *name)
+{
+	struct zfile *z = new zfile();
+	z->data = &z->mem;
+	z->name = _tcsdup(name);
+	return z;
+}
+
+void zfile_fclose(struct zfile *z)
+{
+	if (!z)
+		return;
+	xfree(z->name);
+	delete z;
+}
+
+int zfile_exists(const TCHAR *name)
+{
+	return files.count(name) != 0;
+}
+
+uae_s64 zfile_fseek(struct zfile *z, uae_s64 offset, int mode)
+{
+	if (mode == SEEK_CUR)
+		offset += z->pos;
+	else if (mode == SEEK_END)
+		offset += z->data->size();
+	if (offset < 0 || offset > (uae_s64) z->data->size())
+		return -1;
+	z->pos = offset;
+	return 0;
+}
+
+uae_s64 zfile_ftell(struct zfile *z)
+{
+	return z->pos;
+}
+
+uae_s64 zfile_size(struct zfile *z)
+{
+	return z->data->size();
+}
+
+size_t zfile_fread(void *b, size_t l1, size_t l2, struct zfile *z)
+{
+	size_t len = l1 * l2;
+	size_t left = z->data->size() - z->pos;
+	if (len > left)
+		len = left / l1 * l1;
+	memcpy(b, z->data->data() + z->pos, len);
+	z->pos += len;
+	return len / l1;
+}
+
+size_t zfile_fwrite(const void *b, size_t l1, size_t l2, struct zfile *z)
+{
+	size_t len = l1 * l2;
+	if (z->pos + len > z->data->size())
+		z->data->resize(z->pos + len);
+	memcpy(z->data->data() + z->pos, b, len);
+	z->pos += len;
+	return l2;
+}
+
+int zfile_truncate(struct zfile *z, uae_s64 size)
+{
+	z->data->resize(size);
+	if (z->pos > size)
+		z->pos = size;
+	return 1;
+}
+
+uae_u8 *zfile_getdata(struct zfile *z, uae_s64 offset, int len, int *outlen)
+{
+	if (offset + len > (uae_s64) z->data->size())
+		return NULL;
+	uae_u8 *b = xmalloc(uae_u8, len + 1);
+	memcpy(b, z->data->data() + offset, len);
+	if (outlen)
+		*outlen = len;
+	return b;
+}
+
+TCHAR *zfile_getname(struct zfile *z)
+{
+	return z ? z->name : NULL;
+}
+
+int zfile_zcompress(struct zfile *dst, void *src, int size)
+{
+	uLongf len = compressBound(size);
+	std::vector<uae_u8> out(len);
+	if (compress(out.data(), &len, (const Bytef *) src, size) != Z_OK)
+		return 0;
+	zfile_fwrite(out.data(), len, 1, dst);
+	return len;
+}
+
+int zfile_zuncompress(void *dst, int dstsize, struct zfile *src, int srcsize)
+{
+	std::vector<uae_u8> in(srcsize);
+	uLongf len = dstsize;
+	if (zfile_fread(in.data(), srcsize, 1, src) != 1)
+		return 0;
+	if (uncompress((Bytef *) dst, &len, in.data(), srcsize) != Z_OK)
+		return 0;
+	return len;
+}
+
+/* ------------------------------------------------------------------------ */
+
+#define LINES 313
+#define STATEPATH "states/"
+
+struct uae_prefs currprefs, changed_prefs;
+unsigned long currcycle;
+struct ev eventtab[ev_max];
+struct regstruct regs;
+unsigned long int hsync_counter, vsync_counter;
+float vblank_hz = 50;
+TCHAR savestate_fname[MAX_DPATH];
+int savestate_state;
+int disk_debug_logging;
+
+static int resets, gui_messages, warp;
+
+void write_log(const TCHAR *format, ...)
+{
+}
+
+void gui_message(const TCHAR *format, ...)
+{
+	gui_messages++;
+}
+
+void uae_reset(int hardreset, int keyboardreset)
+{
+	resets++;
+}
+
+void warpmode(int mode)
+{
+	warp = mode;
+}
+
+int savestate_memorysave(struct zfile *f, const TCHAR *description)
+{
+	char tmp[64];
+	sprintf(tmp, "vsync %lu hsync %lu", vsync_counter, hsync_counter);
+	zfile_fwrite(tmp, strlen(tmp), 1, f);
+	return 1;
+}
+
+int current_maxvpos(void)
+{
+	return LINES;
+}
+
+void fetch_statefilepath(TCHAR *out, int size)
+{
+	_tcscpy(out, _T(STATEPATH));
+}
+
+void fetch_inputfilepath(TCHAR *out, int size)
+{
+	out[0] = 0;
+}
+
+void getpathpart(TCHAR *outpath, int size, const TCHAR *inpath)
+{
+	outpath[0] = 0;
+}
+
+void getfilepart(TCHAR *out, int size, const TCHAR *path)
+{
+	_tcscpy(out, path);
+}
+
+char *uutf8(const TCHAR *s)
+{
+	return strdup(s);
+}
+
+TCHAR *utf8u(const char *s)
+{
+	return strdup(s);
+}
+
+uae_u32 uaesrand(uae_u32 seed) { return seed; }
+uae_u32 uaerandgetseed(void) { return 0; }
+void refreshtitle(void) { }
+void clear_inputstate(void) { }
+void disk_eject(int num) { }
+void disk_insert_force(int num, const TCHAR *name, bool forcedwriteprotect) { }
+void savestate_initsave(const TCHAR *filename, int docompress, int nodialogs, bool save) { }
+int save_state(const TCHAR *filename, const TCHAR *description) { return 0; }
+void savestate_capture_request(void) { }
+uae_u8 *save_log(int bootlog, int *len) { return NULL; }
+bool my_stat(const TCHAR *name, struct mystat *ms) { return false; }
+bool my_chmod(const TCHAR *name, uae_u32 mode) { return false; }
+void uae_quit(void) { }
+
+/* ------------------------------------------------------------------------ */
+
+struct event
+{
+	uae_u32 hsync;
+	int nr, state;
+};
+
+static bool operator==(const event &a, const event &b)
+{
+	return a.hsync == b.hsync && a.nr == b.nr && a.state == b.state;
+}
+
+static void set_hsync(uae_u32 hsync)
+{
+	hsync_counter = hsync;
+	currcycle = hsync * 227 * CYCLE_UNIT;
+	eventtab[ev_hsync].oldcycles = currcycle;
+}
+
+static void end_frame(int frame)
+{
+	vsync_counter = frame + 1;
+	set_hsync((frame + 1) * LINES);
+	inprec_vsync();
+}
+
+// play frames first to last - 1, returns the events seen
+static std::vector<event> play(int first, int last)
+{
+	std::vector<event> played;
+	for (int frame = first; frame < last; frame++) {
+		for (int line = 0; line < LINES; line++) {
+			int nr, state, max, autofire;
+			set_hsync(frame * LINES + line);
+			while (inprec_playevent(&nr, &state, &max, &autofire)) {
+				event e = { (uae_u32) hsync_counter, nr, state };
+				played.push_back(e);
+			}
+		}
+		end_frame(frame);
+	}
+	return played;
+}
+
+static std::vector<event> after(const std::vector<event> &events, uae_u32 from, uae_u32 to)
+{
+	std::vector<event> v;
+	for (size_t i = 0; i < events.size(); i++) {
+		if (events[i].hsync >= from && events[i].hsync < to)
+			v.push_back(events[i]);
+	}
+	return v;
+}
+
+int main(int argc, char *argv[])
+{
+	const int frames = 600;
+	std::vector<event> recorded;
+	std::vector<event> played;
+
+	currprefs.inprec_keyframe_interval = changed_prefs.inprec_keyframe_interval = 2;
+
+	/* record, started from the frontend */
+
+	CHECK(inprec_request_record(_T("test.inp")));
+	CHECK(!inprec_request_play(_T("other.inp")));
+	inprec_vsync();
+	CHECK(input_record == INPREC_RECORD_START);
+	CHECK(resets == 1);
+	CHECK(!_tcscmp(changed_prefs.inprecfile, _T("test.inp")));
+
+	// what the reset in m68k_go does
+	set_hsync(0);
+	vsync_counter = 0;
+	input_record = INPREC_RECORD_NORMAL;
+	inprec_prepare_record(NULL);
+	CHECK(input_record == INPREC_RECORD_NORMAL);
+
+	for (int frame = 0; frame < frames; frame++) {
+		if (frame % 7 == 3) {
+			set_hsync(frame * LINES + 10 + frame % 50);
+			inprec_recordevent(frame, frame & 1, 1, 0);
+			event e = { (uae_u32) hsync_counter, frame, frame & 1 };
+			recorded.push_back(e);
+		}
+		end_frame(frame);
+	}
+	// one keyframe every 100 frames, the first at the end of frame 0
+	CHECK(keyframes_num == 6);
+	inprec_close(true);
+	CHECK(files.count(_T("test.inp")) == 1);
+	const std::vector<uae_u8> &file = files[_T("test.inp")];
+	CHECK(file.size() > 8 && getu32(file.data() + file.size() - 4) == 'UAEI');
+
+	/* play back, started from the frontend */
+
+	CHECK(inprec_request_play(_T("test.inp")));
+	inprec_vsync();
+	CHECK(input_play == INPREC_PLAY_NORMAL);
+	CHECK(resets == 2);
+	CHECK(!_tcscmp(currprefs.inprecfile, _T("test.inp")));
+
+	CHECK(inprec_open(currprefs.inprecfile, NULL));
+	CHECK(keyframes_num == 6);
+	set_hsync(0);
+	vsync_counter = 0;
+
+	played = play(0, 300);
+	CHECK(played == after(recorded, 0, 300 * LINES));
+	CHECK(!played.empty());
+
+	/* seek forward past two keyframes */
+
+	uae_u32 target = 430 * LINES;
+	CHECK(inprec_seek(target));
+	CHECK(!inprec_seek(target + 1));
+	inprec_vsync();
+	CHECK(savestate_state == STATE_DORESTORE);
+	CHECK(!_tcscmp(savestate_fname, _T(STATEPATH "inprec_keyframe.uss")));
+	const std::vector<uae_u8> &state = files[savestate_fname];
+	std::string s(state.begin(), state.end());
+	CHECK(s == "vsync 401 hsync " + std::to_string(401 * LINES));
+
+	// what restore_state does
+	savestate_state = 0;
+	inprec_restore_finish();
+	CHECK(hsync_counter == 401 * LINES);
+	CHECK(vsync_counter == 401);
+	CHECK(warp == 1);
+
+	played = play(401, frames);
+	CHECK(played == after(recorded, 401 * LINES, frames * LINES));
+	CHECK(!played.empty());
+	CHECK(warp == 0);
+
+	// the end record closes playback
+	int nr, st, max, autofire;
+	CHECK(!inprec_playevent(&nr, &st, &max, &autofire));
+	CHECK(input_play == 0);
+
+	CHECK(gui_messages == 0);
+
+	if (failures) {
+		fprintf(stderr, "%d checks failed\n", failures);
+		return 1;
+	}
+	return 0;
+}
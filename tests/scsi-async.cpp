@@ -0,0 +1,378 @@
+/*
+ * Checks that HDF reads completed by the SCSI worker thread reach the
+ * guest through the raw SCSI bus: REQ stays low while the read is in
+ * progress, polling sees the data phase when it is done, and code that
+ * reads the bus directly waits for the command instead of seeing the
+ * command phase.
+ *
+ * scsi.cpp is built into the test so that its static raw SCSI helpers
+ * can be driven directly. Everything else it links against is stubbed.
+ */
+
+#include "../src/scsi.cpp"
+
+#include <pthread.h>
+#include <semaphore.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+/* ------------------------------------------------------------------------ */
+
+static int failures;
+
+#define CHECK(x) do { \
+	if (!(x)) { \
+		fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #x); \
+		failures++; \
+	} \
+} while (0)
+
+/* ------------------------------------------------------------------------ */
+
+struct fsemu_semaphore_t {
+	sem_t semaphore;
+};
+
+extern "C" {
+
+fsemu_semaphore_t *fsemu_semaphore_create(int value)
+{
+	fsemu_semaphore_t *semaphore = xcalloc(fsemu_semaphore_t, 1);
+	sem_init(&semaphore->semaphore, 0, value);
+	return semaphore;
+}
+
+void fsemu_semaphore_destroy(fsemu_semaphore_t *semaphore)
+{
+	sem_destroy(&semaphore->semaphore);
+	xfree(semaphore);
+}
+
+int fsemu_semaphore_post(fsemu_semaphore_t *semaphore)
+{
+	return sem_post(&semaphore->semaphore);
+}
+
+int fsemu_semaphore_wait(fsemu_semaphore_t *semaphore)
+{
+	return sem_wait(&semaphore->semaphore);
+}
+
+int fsemu_semaphore_try_wait(fsemu_semaphore_t *semaphore)
+{
+	return sem_trywait(&semaphore->semaphore);
+}
+
+int fsemu_semaphore_wait_timeout_ms(fsemu_semaphore_t *semaphore, int timeout_ms)
+{
+	return sem_wait(&semaphore->semaphore);
+}
+
+}
+
+int uae_start_thread(const char *name, uae_thread_function fn, void *arg, uae_thread_id *tid)
+{
+	pthread_t *thread = xmalloc(pthread_t, 1);
+	if (pthread_create(thread, NULL, fn, arg)) {
+		xfree(thread);
+		return 0;
+	}
+	if (tid)
+		*tid = (uae_thread_id) thread;
+	else
+		pthread_detach(*thread);
+	return 1;
+}
+
+static int threads_joined;
+
+int uae_wait_thread(uae_thread_id tid)
+{
+	pthread_join(*(pthread_t *) tid, NULL);
+	threads_joined++;
+	return 0;
+}
+
+void uae_end_thread(uae_thread_id *tid)
+{
+	xfree(*tid);
+	*tid = NULL;
+}
+
+/* ------------------------------------------------------------------------ */
+
+/* The fake disk returns (lba * 512 + offset) * 7 for every byte and does
+ * not finish a read until the test posts read_gate. */
+
+#define BLOCKSIZE 512
+
+static sem_t read_gate;
+static pthread_t read_thread;
+static int reads_done;
+
+static uae_u8 pattern(int lba, int offset)
+{
+	return (uae_u8) ((lba * BLOCKSIZE + offset) * 7);
+}
+
+int scsi_hd_emulate(struct hardfiledata *hfd, struct hd_hardfiledata *hdhfd, uae_u8 *cmdbuf, int scsi_cmd_len,
+	uae_u8 *scsi_data, int *data_len, uae_u8 *r, int *reply_len, uae_u8 *s, int *sense_len)
+{
+	int lba, count;
+
+	if (!cmdbuf)
+		return 0;
+	if (cmdbuf[0] == 0x08) {
+		lba = ((cmdbuf[1] & 0x1f) << 16) | (cmdbuf[2] << 8) | cmdbuf[3];
+		count = cmdbuf[4] ? cmdbuf[4] : 256;
+	} else {
+		lba = (cmdbuf[2] << 24) | (cmdbuf[3] << 16) | (cmdbuf[4] << 8) | cmdbuf[5];
+		count = (cmdbuf[7] << 8) | cmdbuf[8];
+	}
+	for (int i = 0; i < count * BLOCKSIZE; i++)
+		scsi_data[i] = pattern(lba, i);
+	*data_len = count * BLOCKSIZE;
+	*reply_len = 0;
+	*sense_len = 0;
+	read_thread = pthread_self();
+	sem_wait(&read_gate);
+	reads_done++;
+	return 0;
+}
+
+/* ------------------------------------------------------------------------ */
+
+struct uae_prefs currprefs;
+addrbank fastmem_bank[MAX_RAM_BOARDS];
+uaecptr expamem_board_pointer;
+int log_scsiemu;
+uae_u32 (*x_get_byte)(uaecptr addr);
+void (*x_put_byte)(uaecptr addr, uae_u32 v);
+void (*x_do_cycles)(unsigned long);
+
+void write_log(const TCHAR *format, ...)
+{
+}
+
+struct scsi_data_tape *tape_alloc(int unitnum, const TCHAR *tape_directory, bool readonly) { return NULL; }
+void tape_free(struct scsi_data_tape *tape) { }
+int scsi_tape_emulate(struct scsi_data_tape *sd, uae_u8 *cmdbuf, int scsi_cmd_len,
+	uae_u8 *scsi_data, int *data_len, uae_u8 *r, int *reply_len, uae_u8 *s, int *sense_len) { return 0; }
+int scsi_cd_emulate(int unitnum, uae_u8 *cmdbuf, int scsi_cmd_len,
+	uae_u8 *scsi_data, int *data_len, uae_u8 *r, int *reply_len, uae_u8 *s, int *sense_len, bool atapi) { return 0; }
+int hdf_hd_open(struct hd_hardfiledata *hfd) { return 0; }
+void hdf_hd_close(struct hd_hardfiledata *hfd) { }
+int sys_command_open(int unitnum) { return 0; }
+void sys_command_close(int unitnum) { }
+struct device_info *sys_command_info(int unitnum, struct device_info *di, int quick) { return NULL; }
+int sys_command_scsi_direct_native(int unitnum, int type, struct amigascsi *as) { return 0; }
+int device_func_init(int flags) { return 0; }
+void devices_rethink_all(void func(void)) { }
+bool load_rom_rc(struct romconfig *rc, uae_u32 romtype, int maxfilesize, int fileoffset, uae_u8 *rom, int maxromsize, int flags) { return false; }
+struct zfile *read_device_from_romconfig(struct romconfig *rc, uae_u32 romtype) { return NULL; }
+const struct expansionromtype *get_device_expansion_rom(int romtype) { return NULL; }
+void zfile_fclose(struct zfile *z) { }
+void expamem_next(addrbank *mapped, addrbank *next) { }
+void expamem_shutup(addrbank *mapped) { }
+void map_banks(addrbank *bank, int first, int count, int realsize) { }
+void map_banks_z2(addrbank *bank, int first, int count) { }
+void *eeprom93xx_new(const uae_u8 *memory, int nwords, struct zfile *zf) { return NULL; }
+uae_u16 eeprom93xx_read(void *eepromp) { return 0; }
+void eeprom93xx_write(void *eepromp, int eecs, int eesk, int eedi) { }
+void eeprom93xx_free(void *eepromp) { }
+void x86_rt1000_bios(struct zfile *z, struct romconfig *rc) { }
+void apollo_add_ide_unit(int ch, struct uaedev_config_info *ci, struct romconfig *rc) { }
+void gayle_dataflyer_enable(bool enable) { }
+void cia_parallelack(void) { }
+void gui_flicker_led(int led, int unitnum, int status) { }
+void safe_interrupt_set(int num, int id, bool i6) { }
+void m68k_cancel_idle(void) { }
+void cpu_fallback(int mode) { }
+void cpu_halt(int id) { }
+
+/* ------------------------------------------------------------------------ */
+
+static void *release_read(void *v)
+{
+	usleep(20 * 1000);
+	sem_post(&read_gate);
+	return NULL;
+}
+
+static void select_target(struct raw_scsi *rs, int id)
+{
+	raw_scsi_put_data(rs, 0x80, false);
+	raw_scsi_set_signal_phase(rs, true, false, false);
+	raw_scsi_put_data(rs, 0x80 | (1 << id), false);
+	raw_scsi_set_signal_phase(rs, true, true, false);
+	raw_scsi_set_signal_phase(rs, false, true, false);
+	raw_scsi_set_signal_phase(rs, false, false, false);
+}
+
+static void send_read6(struct raw_scsi *rs, int lba, int count)
+{
+	uae_u8 cmd[6] = { 0x08, (uae_u8) (lba >> 16), (uae_u8) (lba >> 8), (uae_u8) lba, (uae_u8) count, 0 };
+	for (int i = 0; i < 6; i++)
+		raw_scsi_put_data(rs, cmd[i], true);
+}
+
+static void send_read10(struct raw_scsi *rs, int lba, int count)
+{
+	uae_u8 cmd[10] = { 0x28, 0, (uae_u8) (lba >> 24), (uae_u8) (lba >> 16), (uae_u8) (lba >> 8), (uae_u8) lba,
+		0, (uae_u8) (count >> 8), (uae_u8) count, 0 };
+	for (int i = 0; i < 10; i++)
+		raw_scsi_put_data(rs, cmd[i], true);
+}
+
+static void check_data(struct raw_scsi *rs, int lba, int count)
+{
+	int bad = 0;
+	for (int i = 0; i < count * BLOCKSIZE; i++) {
+		if (raw_scsi_get_data(rs, true) != pattern(lba, i))
+			bad++;
+	}
+	CHECK(bad == 0);
+	CHECK(rs->bus_phase == SCSI_SIGNAL_PHASE_STATUS);
+	CHECK(raw_scsi_get_data(rs, true) == 0);
+	CHECK(rs->bus_phase == SCSI_SIGNAL_PHASE_MESSAGE_IN);
+	raw_scsi_get_data(rs, true);
+	CHECK(rs->bus_phase == SCSI_SIGNAL_PHASE_FREE);
+}
+
+static bool completion_consumed(struct scsi_data *sd)
+{
+	return !sd->async_pending && !sd->async_busy.load() &&
+		fsemu_semaphore_try_wait(sd->async_done) != 0;
+}
+
+/* The guest driver polls the bus: no REQ while the host read is running,
+ * then the data phase. */
+static void test_poll(struct raw_scsi *rs, struct scsi_data *sd)
+{
+	select_target(rs, 0);
+	CHECK(rs->bus_phase == SCSI_SIGNAL_PHASE_COMMAND);
+	send_read6(rs, 3, 2);
+
+	CHECK(rs->cmd_pending);
+	uae_u8 v = raw_scsi_get_signal_phase(rs);
+	CHECK(!(v & SCSI_IO_REQ));
+	CHECK((v & SCSI_IO_BUSY) != 0);
+	CHECK(scsi_emulate_cmd_busy(sd));
+
+	sem_post(&read_gate);
+	for (int i = 0; i < 5000; i++) {
+		v = raw_scsi_get_signal_phase(rs);
+		if (v & SCSI_IO_REQ)
+			break;
+		usleep(1000);
+	}
+	CHECK((v & SCSI_IO_REQ) != 0);
+	CHECK(rs->bus_phase == SCSI_SIGNAL_PHASE_DATA_IN);
+	CHECK(!pthread_equal(read_thread, pthread_self()));
+	CHECK(completion_consumed(sd));
+	check_data(rs, 3, 2);
+}
+
+/* Reading the data register without polling first waits for the read. */
+static void test_get_data_waits(struct raw_scsi *rs, struct scsi_data *sd)
+{
+	pthread_t releaser;
+
+	select_target(rs, 0);
+	send_read10(rs, 100, 1);
+	CHECK(rs->cmd_pending);
+	pthread_create(&releaser, NULL, release_read, NULL);
+	check_data(rs, 100, 1);
+	pthread_join(releaser, NULL);
+	CHECK(completion_consumed(sd));
+}
+
+/* Controllers that test the bus phase directly (AIC phase match, the soft
+ * SCSI DMA loops) must see the data phase, not the command phase. */
+static void test_phase_match_waits(struct scsi_data *sd)
+{
+	struct soft_scsi scsi;
+	pthread_t releaser;
+
+	memset(&scsi, 0, sizeof scsi);
+	scsi.rscsi.device[0] = sd;
+	raw_scsi_reset(&scsi.rscsi);
+	select_target(&scsi.rscsi, 0);
+	send_read10(&scsi.rscsi, 7, 4);
+	CHECK(scsi.rscsi.cmd_pending);
+	pthread_create(&releaser, NULL, release_read, NULL);
+	// DATA IN: I/O set, C/D and MSG clear
+	scsi.regs[9] = 1 << 6;
+	CHECK(aic_phase_match(&scsi));
+	pthread_join(releaser, NULL);
+	CHECK(!scsi.rscsi.cmd_pending);
+	CHECK(completion_consumed(sd));
+	check_data(&scsi.rscsi, 7, 4);
+}
+
+/* Each command posts its completion once and it is taken back once, the
+ * semaphore does not accumulate counts. */
+static void test_many(struct raw_scsi *rs, struct scsi_data *sd)
+{
+	int bad = 0;
+	for (int n = 0; n < 200; n++) {
+		select_target(rs, 0);
+		send_read6(rs, n, 1);
+		sem_post(&read_gate);
+		while (!(raw_scsi_get_signal_phase(rs) & SCSI_IO_REQ))
+			usleep(100);
+		for (int i = 0; i < BLOCKSIZE; i++) {
+			if (raw_scsi_get_data(rs, true) != pattern(n, i))
+				bad++;
+		}
+		raw_scsi_get_data(rs, true);
+		raw_scsi_get_data(rs, true);
+	}
+	CHECK(bad == 0);
+	CHECK(completion_consumed(sd));
+}
+
+/* Freeing a unit with a read in flight waits for it, and the worker is
+ * joined on shutdown. */
+static void test_free(struct raw_scsi *rs, struct scsi_data *sd)
+{
+	pthread_t releaser;
+	int reads = reads_done;
+
+	select_target(rs, 0);
+	send_read6(rs, 0, 1);
+	pthread_create(&releaser, NULL, release_read, NULL);
+	scsi_free(sd);
+	CHECK(reads_done == reads + 1);
+	pthread_join(releaser, NULL);
+	scsi_async_free();
+	CHECK(threads_joined == 1);
+}
+
+int main(int argc, char *argv[])
+{
+	struct hd_hardfiledata hfd;
+	struct raw_scsi rs;
+
+	sem_init(&read_gate, 0, 0);
+	memset(&hfd, 0, sizeof hfd);
+	hfd.hfd.ci.blocksize = BLOCKSIZE;
+	struct scsi_data *sd = scsi_alloc_hd(0, &hfd, 0);
+
+	memset(&rs, 0, sizeof rs);
+	rs.device[0] = sd;
+	raw_scsi_reset(&rs);
+
+	test_poll(&rs, sd);
+	test_get_data_waits(&rs, sd);
+	test_phase_match_waits(sd);
+	test_many(&rs, sd);
+	test_free(&rs, sd);
+
+	if (failures) {
+		fprintf(stderr, "%d checks failed\n", failures);
+		return 1;
+	}
+	return 0;
+}